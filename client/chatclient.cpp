@@ -1,53 +1,186 @@
 #include "chatclient.h"
 
+#include "localsocket.h"
 #include "protocol.h"
 
 #include <QAbstractSocket>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
-#include <QTcpSocket>
+#include <QLocale>
+#include <QRandomGenerator>
+#include <QSslCertificate>
+#include <QSslCipher>
+#include <QSslSocket>
+#include <QTimer>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+constexpr int kReconnectBaseDelayMs = 500;
+constexpr int kReconnectMaxDelayMs = 30 * 1000;
+constexpr int kMaxReconnectAttempts = 8;
+// Out-of-order sequence numbers remembered before giving up on the missing one.
+constexpr int kMaxSeqAhead = 1024;
+// Same pacing as the server's download side: wait for at least this much
+// rate budget instead of sending tiny frames.
+constexpr qint64 kMinRateChunk = 4096;
+
+} // namespace
 
 ChatClient::ChatClient(QObject *parent)
     : QObject(parent)
-    , m_socket(new QTcpSocket(this))
+    , m_socket(new QSslSocket(this))
+    , m_reconnectTimer(new QTimer(this))
+    , m_uploadTimer(new QTimer(this))
+    , m_sslConfig(QSslConfiguration::defaultConfiguration())
 {
-    connect(m_socket, &QTcpSocket::connected, this, &ChatClient::onConnected);
-    connect(m_socket, &QTcpSocket::readyRead, this, &ChatClient::onReadyRead);
-    connect(m_socket, &QTcpSocket::disconnected, this, &ChatClient::onDisconnected);
+    m_sslConfig.setProtocol(QSsl::TlsV1_2OrLater);
+
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &ChatClient::onReconnectTimer);
+    m_uploadTimer->setSingleShot(true);
+    connect(m_uploadTimer, &QTimer::timeout, this, &ChatClient::pumpUploads);
+
+    connect(m_socket, &QSslSocket::connected, this, &ChatClient::onConnected);
+    connect(m_socket, &QSslSocket::encrypted, this, &ChatClient::onEncrypted);
+    connect(m_socket, &QSslSocket::sslErrors, this, &ChatClient::onSslErrors);
+    connect(m_socket, &QSslSocket::readyRead, this, &ChatClient::onReadyRead);
+    connect(m_socket, &QSslSocket::disconnected, this, &ChatClient::onDisconnected);
+    connect(m_socket, &QSslSocket::bytesWritten, this, &ChatClient::pumpUploads, Qt::QueuedConnection);
     connect(m_socket,
-        QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::errorOccurred),
+        QOverload<QAbstractSocket::SocketError>::of(&QSslSocket::errorOccurred),
         this,
         &ChatClient::onError);
 }
 
 void ChatClient::connectToServer(const QString &host, quint16 port, const QString &userName)
 {
+    m_localPath.clear();
+    beginConnection(host, port, userName);
+}
+
+void ChatClient::connectToLocalServer(const QString &path, const QString &userName)
+{
+    m_localPath = path;
+    m_tls = false;
+    beginConnection(path, 0, userName);
+}
+
+void ChatClient::beginConnection(const QString &host, quint16 port, const QString &userName)
+{
+    m_reconnectTimer->stop();
+    m_disconnectedNotified = true;
     if (m_socket->state() != QAbstractSocket::UnconnectedState) {
         m_socket->abort();
     }
 
+    m_host = host;
+    m_port = port;
     m_disconnectedNotified = false;
+    m_userDisconnect = false;
     m_pendingUserName = Protocol::normalizeName(userName);
     m_userName.clear();
     m_buffer.clear();
+    m_resumeToken.clear();
+    m_lastSeq = 0;
+    m_seqAhead.clear();
+    m_reconnectAttempt = 0;
+    abortTransfers("reconnected");
+    openHistory();
+
+    if (!m_localPath.isEmpty()) {
+        emit log(QString("connecting to local socket %1...").arg(host));
+    } else {
+        emit log(QString("connecting to %1:%2%3...").arg(host).arg(port).arg(m_tls ? QStringLiteral(" (tls)") : QString()));
+    }
+    openConnection();
+}
 
-    emit log(QString("connecting to %1:%2...").arg(host).arg(port));
-    m_socket->connectToHost(host, port);
+void ChatClient::setConnector(Connector connector)
+{
+    m_connector = std::move(connector);
 }
 
 void ChatClient::disconnectFromServer()
 {
+    m_userDisconnect = true;
+    m_resumeToken.clear();
+
+    if (m_reconnectTimer->isActive()) {
+        m_reconnectTimer->stop();
+        m_disconnectedNotified = true;
+        m_userName.clear();
+        m_history.close();
+    }
+
     if (m_socket->state() == QAbstractSocket::UnconnectedState) {
         return;
     }
-    sendJson(QJsonObject{{"type", "logout"}});
+    if (m_socket->state() == QAbstractSocket::ConnectedState) {
+        sendJson(QJsonObject{{"type", "logout"}});
+    }
     m_socket->disconnectFromHost();
 }
 
+bool ChatClient::tlsSupported()
+{
+    return QSslSocket::supportsSsl();
+}
+
+void ChatClient::setTlsEnabled(bool enabled)
+{
+    m_tls = enabled && tlsSupported();
+}
+
+bool ChatClient::tlsEnabled() const
+{
+    return m_tls;
+}
+
+bool ChatClient::setCaCertificates(const QString &path)
+{
+    const QList<QSslCertificate> certs = QSslCertificate::fromPath(path, QSsl::Pem);
+    if (certs.isEmpty()) {
+        return false;
+    }
+    m_sslConfig.addCaCertificates(certs);
+    return true;
+}
+
+void ChatClient::openConnection()
+{
+    const bool local = !m_localPath.isEmpty();
+    if (local || (m_connector && !m_tls)) {
+        // Already connected: there is no connected() to wait for.
+        QString error = QStringLiteral("no local connection");
+        const qintptr descriptor = local ? LocalSocket::connectTo(m_localPath, &error) : m_connector();
+        if (descriptor < 0 || !m_socket->setSocketDescriptor(descriptor)) {
+            emit log(QString("connection failed: %1").arg(descriptor < 0 ? error : m_socket->errorString()));
+            QMetaObject::invokeMethod(this, &ChatClient::handleConnectionLost, Qt::QueuedConnection);
+            return;
+        }
+        QMetaObject::invokeMethod(this, &ChatClient::onConnected, Qt::QueuedConnection);
+        return;
+    }
+    if (!m_tls) {
+        m_socket->connectToHost(m_host, m_port);
+        return;
+    }
+
+    m_socket->setSslConfiguration(m_sslConfig);
+    m_handshakeTimer.start();
+    m_socket->connectToHostEncrypted(m_host, m_port);
+}
+
 bool ChatClient::isConnected() const
 {
-    return m_socket->state() == QAbstractSocket::ConnectedState;
+    return m_socket->state() == QAbstractSocket::ConnectedState && (!m_tls || m_socket->isEncrypted());
 }
 
 QString ChatClient::userName() const
@@ -61,7 +194,9 @@ void ChatClient::sendChat(const QString &text)
     if (!isConnected() || !Protocol::isValidMessage(normalized)) {
         return;
     }
-    sendJson(QJsonObject{{"type", "chat"}, {"text", normalized}});
+    QJsonObject request{{"type", "chat"}, {"text", normalized}};
+    addTrace(&request);
+    sendJson(request);
 }
 
 void ChatClient::sendPrivate(const QString &to, const QString &text)
@@ -71,21 +206,323 @@ void ChatClient::sendPrivate(const QString &to, const QString &text)
     if (!isConnected() || !Protocol::isValidName(normalizedTo) || !Protocol::isValidMessage(normalizedText)) {
         return;
     }
-    sendJson(QJsonObject{{"type", "private"}, {"to", normalizedTo}, {"text", normalizedText}});
+    QJsonObject request{{"type", "private"}, {"to", normalizedTo}, {"text", normalizedText}};
+    addTrace(&request);
+    sendJson(request);
+}
+
+void ChatClient::sendPrivateGroup(const QStringList &to, const QString &text)
+{
+    const QString normalizedText = Protocol::normalizeText(text);
+    QJsonArray names;
+    for (const auto &name : to) {
+        const QString normalized = Protocol::normalizeName(name);
+        if (Protocol::isValidName(normalized)) {
+            names.append(normalized);
+        }
+    }
+    if (!isConnected() || names.isEmpty() || names.size() > Protocol::kMaxPrivateRecipients || !Protocol::isValidMessage(normalizedText)) {
+        return;
+    }
+    QJsonObject request{{"type", "private"}, {"to", names}, {"text", normalizedText}};
+    addTrace(&request);
+    sendJson(request);
+}
+
+void ChatClient::setTracing(bool enabled)
+{
+    m_tracing = enabled;
+    if (enabled && !m_traceClock.isValid()) {
+        m_traceClock.start();
+    }
+}
+
+bool ChatClient::tracing() const
+{
+    return m_tracing;
+}
+
+QString ChatClient::traceReport() const
+{
+    return QStringList{
+        m_traceEndToEnd.report(tr("端到端")),
+        m_traceNetwork.report(tr("网络往返")),
+        m_traceServer.report(tr("服务器内")),
+        m_traceIngress.report(tr("接收→路由")),
+        m_traceDelivery.report(tr("路由→写出")),
+    }
+        .join('\n');
+}
+
+void ChatClient::resetTrace()
+{
+    m_traceEndToEnd.clear();
+    m_traceNetwork.clear();
+    m_traceServer.clear();
+    m_traceIngress.clear();
+    m_traceDelivery.clear();
+}
+
+void ChatClient::addTrace(QJsonObject *request) const
+{
+    if (m_tracing) {
+        request->insert("trace", QJsonObject{{"t", m_traceClock.nsecsElapsed() / 1000}});
+    }
+}
+
+void ChatClient::recordTrace(const QJsonObject &msg)
+{
+    const QJsonObject trace = msg.value("trace").toObject();
+    const qint64 receivedNs = trace.value("rx").toInteger();
+    const qint64 routedNs = trace.value("rt").toInteger();
+    const qint64 writtenNs = trace.value("w").toInteger();
+    // No write time: replayed from the offline mailbox, not sent live.
+    if (receivedNs <= 0 || routedNs < receivedNs || writtenNs < routedNs) {
+        return;
+    }
+    if (m_traceServer.count() >= kMaxTraceSamples) {
+        resetTrace();
+    }
+
+    const qint64 serverNs = writtenNs - receivedNs;
+    m_traceServer.add(serverNs);
+    m_traceIngress.add(routedNs - receivedNs);
+    m_traceDelivery.add(writtenNs - routedNs);
+
+    // Only our own messages carry a send time from this clock.
+    if (msg.value("from").toString() == m_userName && trace.contains("t")) {
+        const qint64 endToEndNs = m_traceClock.nsecsElapsed() - trace.value("t").toInteger() * 1000;
+        if (endToEndNs >= 0) {
+            m_traceEndToEnd.add(endToEndNs);
+            m_traceNetwork.add(qMax<qint64>(0, endToEndNs - serverNs));
+        }
+    }
+}
+
+bool ChatClient::search(const QString &term, const QString &from, int limit)
+{
+    const QString normalizedTerm = Protocol::normalizeText(term);
+    if (!isConnected() || normalizedTerm.isEmpty()) {
+        return false;
+    }
+    QJsonObject request{
+        {"type", "search"},
+        {"id", m_nextSearchId++},
+        {"term", normalizedTerm},
+        {"limit", limit},
+    };
+    const QString normalizedFrom = Protocol::normalizeName(from);
+    if (!normalizedFrom.isEmpty()) {
+        request.insert("from", normalizedFrom);
+    }
+    sendJson(request);
+    return true;
+}
+
+void ChatClient::setHistoryEnabled(bool enabled)
+{
+    m_historyEnabled = enabled;
+    if (!enabled) {
+        m_history.close();
+    }
+}
+
+QList<HistoryCache::Entry> ChatClient::cachedHistory(int count)
+{
+    return m_history.recent(count);
+}
+
+QString ChatClient::historyReport() const
+{
+    if (!m_history.isOpen()) {
+        return tr("本地记录：未开启");
+    }
+    const HistoryCache::Stats s = m_history.stats();
+    QString report = tr("本地记录：%1  打开 %2 ms  载入 %3 条 %4 ms  本次写入 %5 条")
+                         .arg(QLocale().formattedDataSize(s.fileBytes))
+                         .arg(static_cast<double>(s.openNs) / 1e6, 0, 'f', 2)
+                         .arg(s.loaded)
+                         .arg(static_cast<double>(s.loadNs) / 1e6, 0, 'f', 2)
+                         .arg(s.appended);
+    if (m_catchUpMs >= 0) {
+        report += '\n';
+        report += tr("补取：%1 条（重复 %2 条）  %3  %4 ms")
+                      .arg(m_catchUpMessages)
+                      .arg(s.duplicates)
+                      .arg(QLocale().formattedDataSize(m_catchUpBytes))
+                      .arg(m_catchUpMs);
+    }
+    return report;
+}
+
+void ChatClient::openHistory()
+{
+    m_catchUpClock.invalidate();
+    m_catchUpMs = -1;
+    if (!m_historyEnabled) {
+        return;
+    }
+    const QString server = m_localPath.isEmpty() ? QString("%1:%2").arg(m_host).arg(m_port) : m_localPath;
+    QString error;
+    if (!m_history.open(HistoryCache::pathFor(server, m_pendingUserName), &error)) {
+        emit log(QString("history cache off: %1").arg(error));
+    }
+}
+
+void ChatClient::requestHistory(qint64 sinceMs)
+{
+    sendJson(QJsonObject{
+        {"type", "history"},
+        {"id", m_nextSearchId++},
+        {"since", QDateTime::fromMSecsSinceEpoch(sinceMs).toString(Qt::ISODate)},
+    });
+}
+
+void ChatClient::requestHistoryAfter(double cursor)
+{
+    sendJson(QJsonObject{
+        {"type", "history"},
+        {"id", m_nextSearchId++},
+        {"after", cursor},
+    });
+}
+
+void ChatClient::handleHistoryResult(const QJsonObject &obj)
+{
+    if (!m_catchUpClock.isValid()) {
+        return;
+    }
+    m_catchUpBytes += m_lineBytes;
+    const QString error = obj.value("error").toString();
+    if (!error.isEmpty()) {
+        emit log(QString("history catch-up unavailable: %1").arg(error));
+        finishCatchUp();
+        return;
+    }
+
+    for (const auto &v : obj.value("messages").toArray()) {
+        const QJsonObject msg = v.toObject();
+        if (HistoryCache::entryFrom(msg).timeMs <= 0 || m_history.isDuplicate(msg)) {
+            continue;
+        }
+        ++m_catchUpMessages;
+        handleJson(msg);
+    }
+    const double next = obj.value("next").toDouble();
+    if (obj.value("more").toBool() && next > 0) {
+        requestHistoryAfter(next);
+        return;
+    }
+    finishCatchUp();
+}
+
+void ChatClient::finishCatchUp()
+{
+    m_catchUpMs = m_catchUpClock.elapsed();
+    m_catchUpClock.invalidate();
+    emit log(QString("history caught up: %1 messages, %2 bytes in %3 ms").arg(m_catchUpMessages).arg(m_catchUpBytes).arg(m_catchUpMs));
+    emit historyCaughtUp(m_catchUpMessages, m_catchUpBytes, m_catchUpMs);
+}
+
+bool ChatClient::sendFile(const QString &path, const QString &to)
+{
+    const QFileInfo info(path);
+    auto *file = new QFile(path, this);
+    if (!isConnected() || info.size() <= 0 || !file->open(QIODevice::ReadOnly)) {
+        delete file;
+        return false;
+    }
+
+    Upload upload;
+    upload.ref = m_nextUploadRef++;
+    upload.file = file;
+    upload.name = info.fileName();
+    upload.to = Protocol::normalizeName(to);
+    upload.size = info.size();
+    m_uploads.push_back(upload);
+    requestUpload(m_uploads.last());
+    emit log(QString("uploading %1 (%2 bytes)").arg(upload.name).arg(upload.size));
+    return true;
+}
+
+bool ChatClient::downloadFile(const QString &id, const QString &savePath)
+{
+    const QByteArray fileId = id.toLatin1();
+    if (!isConnected() || fileId.isEmpty() || findDownload(fileId) >= 0) {
+        return false;
+    }
+
+    auto *file = new QFile(savePath + QStringLiteral(".part"), this);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Append)) {
+        delete file;
+        return false;
+    }
+
+    Download download;
+    download.id = fileId;
+    download.file = file;
+    download.name = QFileInfo(savePath).fileName();
+    download.savePath = savePath;
+    download.offset = file->size();
+    m_downloads.push_back(download);
+    requestDownload(m_downloads.last());
+    return true;
 }
 
 void ChatClient::onConnected()
 {
-    emit log("tcp connected, sending login...");
+    if (m_tls) {
+        emit log("tcp connected, tls handshake...");
+        return;
+    }
+    startSession();
+}
+
+void ChatClient::onEncrypted()
+{
+    emit log(QString("tls handshake done in %1 ms (%2)")
+                 .arg(static_cast<double>(m_handshakeTimer.nsecsElapsed()) / 1e6, 0, 'f', 2)
+                 .arg(m_socket->sessionCipher().name()));
+    startSession();
+}
+
+void ChatClient::onSslErrors(const QList<QSslError> &errors)
+{
+    for (const auto &e : errors) {
+        emit log(QString("tls error: %1").arg(e.errorString()));
+    }
+}
+
+void ChatClient::startSession()
+{
     emit connected();
-    sendJson(QJsonObject{{"type", "login"}, {"name", m_pendingUserName}});
+
+    if (!m_resumeToken.isEmpty()) {
+        emit log(QString("connected, resuming session after seq %1...").arg(m_lastSeq));
+        sendJson(QJsonObject{
+            {"type", "resume"},
+            {"token", QString::fromLatin1(m_resumeToken)},
+            {"last_seq", static_cast<qint64>(m_lastSeq)},
+        });
+        return;
+    }
+
+    emit log("connected, sending login...");
+    sendLogin(m_pendingUserName);
 }
 
 void ChatClient::onReadyRead()
 {
     m_buffer.append(m_socket->readAll());
 
-    while (true) {
+    while (!m_buffer.isEmpty()) {
+        if (m_frameRemaining > 0) {
+            const qint64 n = qMin<qint64>(m_frameRemaining, m_buffer.size());
+            consumeFrame(m_buffer.left(n));
+            m_buffer.remove(0, n);
+            continue;
+        }
+
         const int newlineIndex = m_buffer.indexOf('\n');
         if (newlineIndex < 0) {
             break;
@@ -93,11 +530,22 @@ void ChatClient::onReadyRead()
 
         QByteArray line = m_buffer.left(newlineIndex);
         m_buffer.remove(0, newlineIndex + 1);
+        m_lineBytes = newlineIndex + 1;
         line = line.trimmed();
         if (line.isEmpty()) {
             continue;
         }
 
+        if (line.startsWith('@')) {
+            if (!beginFrame(line)) {
+                emit log("invalid data frame from server");
+                m_buffer.clear();
+                m_socket->abort();
+                return;
+            }
+            continue;
+        }
+
         QJsonParseError err;
         const QJsonDocument doc = QJsonDocument::fromJson(line, &err);
         if (err.error != QJsonParseError::NoError || !doc.isObject()) {
@@ -111,24 +559,68 @@ void ChatClient::onReadyRead()
 
 void ChatClient::onDisconnected()
 {
-    if (m_disconnectedNotified) {
+    handleConnectionLost();
+}
+
+void ChatClient::onError(int)
+{
+    emit log(QString("socket error: %1").arg(m_socket->errorString()));
+    if (m_socket->state() == QAbstractSocket::UnconnectedState) {
+        handleConnectionLost();
+    }
+}
+
+void ChatClient::onReconnectTimer()
+{
+    m_buffer.clear();
+    m_frameId.clear();
+    m_frameRemaining = 0;
+    const QString target = m_localPath.isEmpty() ? QString("%1:%2").arg(m_host).arg(m_port) : m_localPath;
+    emit log(QString("reconnecting to %1 (attempt %2)...").arg(target).arg(m_reconnectAttempt));
+    openConnection();
+}
+
+void ChatClient::handleConnectionLost()
+{
+    if (m_disconnectedNotified || m_reconnectTimer->isActive()) {
+        return;
+    }
+
+    m_buffer.clear();
+    m_frameId.clear();
+    m_frameRemaining = 0;
+    m_uploadTimer->stop();
+    for (auto &upload : m_uploads) {
+        upload.streaming = false;
+    }
+    if (!m_userDisconnect && !m_resumeToken.isEmpty() && m_reconnectAttempt < kMaxReconnectAttempts) {
+        scheduleReconnect();
         return;
     }
 
     m_disconnectedNotified = true;
+    m_resumeToken.clear();
+    abortTransfers("disconnected");
     emit log("disconnected");
     m_userName.clear();
+    m_catchUpClock.invalidate();
+    m_history.close();
     emit disconnected();
 }
 
-void ChatClient::onError(int)
+void ChatClient::scheduleReconnect()
 {
-    emit log(QString("socket error: %1").arg(m_socket->errorString()));
-    if (!m_disconnectedNotified && m_socket->state() == QAbstractSocket::UnconnectedState) {
-        m_disconnectedNotified = true;
-        m_userName.clear();
-        emit disconnected();
-    }
+    ++m_reconnectAttempt;
+
+    // Exponential backoff with +-25% jitter so a server restart is not followed
+    // by every client reconnecting in the same instant.
+    const int shift = qMin(m_reconnectAttempt - 1, 16);
+    const int base = qMin(kReconnectMaxDelayMs, kReconnectBaseDelayMs << shift);
+    const int delay = base * 3 / 4 + static_cast<int>(QRandomGenerator::global()->bounded(base / 2 + 1));
+
+    emit log(QString("connection lost, reconnecting in %1 ms...").arg(delay));
+    emit reconnecting(m_reconnectAttempt, delay);
+    m_reconnectTimer->start(delay);
 }
 
 void ChatClient::sendJson(const QJsonObject &obj)
@@ -136,13 +628,83 @@ void ChatClient::sendJson(const QJsonObject &obj)
     m_socket->write(Protocol::toLine(obj));
 }
 
+void ChatClient::sendLogin(const QString &name)
+{
+    m_lastSeq = 0;
+    m_seqAhead.clear();
+    sendJson(QJsonObject{{"type", "login"}, {"name", name}});
+}
+
+bool ChatClient::acceptSeq(quint64 seq)
+{
+    if (seq <= m_lastSeq || m_seqAhead.contains(seq)) {
+        return false; // already seen, e.g. before the reconnect
+    }
+    if (seq != m_lastSeq + 1) {
+        m_seqAhead.insert(seq);
+        if (m_seqAhead.size() > kMaxSeqAhead) {
+            skipSeqTo(*std::min_element(m_seqAhead.cbegin(), m_seqAhead.cend()) - 1);
+        }
+        return true;
+    }
+    skipSeqTo(seq);
+    return true;
+}
+
+void ChatClient::skipSeqTo(quint64 seq)
+{
+    // Everything up to `seq` is done with; pull in what was already seen past it.
+    m_lastSeq = qMax(m_lastSeq, seq);
+    m_seqAhead.removeIf([this](quint64 s) { return s <= m_lastSeq; });
+    while (m_seqAhead.remove(m_lastSeq + 1)) {
+        ++m_lastSeq;
+    }
+}
+
 void ChatClient::handleJson(const QJsonObject &obj)
 {
+    if (obj.contains("seq") && !acceptSeq(static_cast<quint64>(obj.value("seq").toInteger()))) {
+        return;
+    }
+
     const QString type = obj.value("type").toString();
     if (type == "login_ok") {
         m_userName = obj.value("name").toString();
+        m_resumeToken = obj.value("token").toString().toLatin1();
+        m_reconnectAttempt = 0;
         emit log(QString("login ok: %1").arg(m_userName));
         emit loginOk(m_userName);
+        resumeTransfers();
+        if (m_history.highWaterMs() > 0) {
+            m_catchUpClock.start();
+            m_catchUpMessages = 0;
+            m_catchUpBytes = 0;
+            requestHistory(m_history.highWaterMs());
+        }
+        return;
+    }
+
+    if (type == "resume_ok") {
+        const bool gap = obj.value("gap").toBool();
+        // Lines older than the replay are gone for good; stop waiting for them.
+        const qint64 replayFrom = obj.value("replay_from").toInteger();
+        if (replayFrom > 0) {
+            skipSeqTo(static_cast<quint64>(replayFrom) - 1);
+        }
+        m_reconnectAttempt = 0;
+        emit log(QString("session resumed: %1").arg(m_userName));
+        emit resumed(gap);
+        resumeTransfers();
+        return;
+    }
+
+    if (type == "resume_error") {
+        // The server no longer knows the session (expired or restarted): fall
+        // back to a fresh login under the same name on this connection.
+        emit log(QString("resume failed: %1, logging in again").arg(obj.value("reason").toString()));
+        m_resumeToken.clear();
+        m_pendingUserName = m_userName;
+        sendLogin(m_pendingUserName);
         return;
     }
 
@@ -169,11 +731,57 @@ void ChatClient::handleJson(const QJsonObject &obj)
         const QString from = obj.value("from").toString();
         const QString text = obj.value("text").toString();
         const bool isPrivate = obj.value("scope").toString() == "private";
-        const QString to = obj.value("to").toString();
+        // A message to several recipients lists all of them.
+        QString to = obj.value("to").toString();
+        if (obj.value("to").isArray()) {
+            QStringList names;
+            for (const auto &v : obj.value("to").toArray()) {
+                names.push_back(v.toString());
+            }
+            to = names.join(", ");
+        }
+        if (m_tracing && obj.contains("trace")) {
+            recordTrace(obj);
+        }
+        const QJsonObject file = obj.value("file").toObject();
+        if (!file.isEmpty()) {
+            emit fileReceived(from, file.value("id").toString(), file.value("name").toString(), file.value("size").toInteger(), isPrivate, to);
+            return;
+        }
+        m_history.append(obj);
         emit chatReceived(from, text, isPrivate, to);
         return;
     }
 
+    if (type.startsWith("file_") && handleFileJson(type, obj)) {
+        return;
+    }
+
+    if (type == "offline") {
+        const QJsonArray messages = obj.value("messages").toArray();
+        emit offlineReceived(static_cast<int>(messages.size()));
+        for (const auto &v : messages) {
+            handleJson(v.toObject());
+        }
+        return;
+    }
+
+    if (type == "private_result") {
+        emit privateResultReceived(obj.value("results").toObject());
+        return;
+    }
+
+    if (type == "history_result") {
+        handleHistoryResult(obj);
+        return;
+    }
+
+    if (type == "search_result") {
+        emit searchResultReceived(obj.value("term").toString(), obj.value("messages").toArray(), obj.value("truncated").toBool(),
+            obj.value("error").toString());
+        return;
+    }
+
     if (type == "system") {
         emit systemReceived(obj.value("text").toString());
         return;
@@ -184,3 +792,258 @@ void ChatClient::handleJson(const QJsonObject &obj)
         return;
     }
 }
+
+bool ChatClient::handleFileJson(const QString &type, const QJsonObject &obj)
+{
+    const QByteArray id = obj.value("id").toString().toLatin1();
+
+    if (type == "file_put_ok") {
+        const int index = findUpload(id, obj.value("ref").toInt());
+        if (index < 0) {
+            return true;
+        }
+        Upload &upload = m_uploads[index];
+        upload.id = id;
+        upload.offset = qBound<qint64>(0, obj.value("offset").toInteger(), upload.size);
+        upload.rate = obj.value("rate").toInteger();
+        upload.sentSinceStart = 0;
+        upload.clock.start();
+        upload.streaming = true;
+        pumpUploads();
+        return true;
+    }
+
+    if (type == "file_put_done") {
+        const int index = findUpload(id);
+        if (index >= 0) {
+            const Upload upload = m_uploads.takeAt(index);
+            const QString path = upload.file->fileName();
+            delete upload.file;
+            emit transferFinished(upload.name, true, path);
+        }
+        return true;
+    }
+
+    if (type == "file_get_ok") {
+        const int index = findDownload(id);
+        if (index >= 0) {
+            m_downloads[index].size = obj.value("size").toInteger();
+        }
+        return true;
+    }
+
+    if (type == "file_get_done") {
+        const int index = findDownload(id);
+        if (index < 0) {
+            return true;
+        }
+        const Download download = m_downloads.takeAt(index);
+        download.file->close();
+        const bool complete = download.offset == download.size;
+        if (complete) {
+            QFile::remove(download.savePath);
+        }
+        if (complete && download.file->rename(download.savePath)) {
+            emit transferFinished(download.name, false, download.savePath);
+        } else {
+            emit transferFailed(download.name, complete ? QStringLiteral("rename_failed") : QStringLiteral("incomplete"));
+        }
+        delete download.file;
+        return true;
+    }
+
+    if (type == "file_error") {
+        const QString reason = obj.value("reason").toString();
+        const int upIndex = findUpload(id, obj.value("ref").toInt());
+        if (upIndex >= 0) {
+            Upload &upload = m_uploads[upIndex];
+            // Chunks the server could not place (usually sent before a
+            // reconnect): ask once where it actually is and carry on from there.
+            if (reason == "unexpected_chunk") {
+                if (upload.streaming) {
+                    requestUpload(upload);
+                }
+                return true;
+            }
+            const Upload failed = m_uploads.takeAt(upIndex);
+            delete failed.file;
+            emit transferFailed(failed.name, reason);
+            return true;
+        }
+        const int downIndex = findDownload(id);
+        if (downIndex >= 0) {
+            // The .part file stays, a later download continues it.
+            const Download failed = m_downloads.takeAt(downIndex);
+            delete failed.file;
+            emit transferFailed(failed.name, reason);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void ChatClient::requestUpload(Upload &upload)
+{
+    upload.streaming = false;
+    QJsonObject obj{{"type", "file_put"}, {"ref", upload.ref}, {"name", upload.name}, {"size", upload.size}};
+    if (!upload.to.isEmpty()) {
+        obj.insert("to", upload.to);
+    }
+    if (!upload.id.isEmpty()) {
+        obj.insert("id", QString::fromLatin1(upload.id));
+    }
+    sendJson(obj);
+}
+
+void ChatClient::requestDownload(Download &download)
+{
+    download.offset = download.file->size();
+    sendJson(QJsonObject{{"type", "file_get"}, {"id", QString::fromLatin1(download.id)}, {"offset", download.offset}});
+}
+
+void ChatClient::resumeTransfers()
+{
+    for (auto &upload : m_uploads) {
+        requestUpload(upload);
+    }
+    for (auto &download : m_downloads) {
+        requestDownload(download);
+    }
+}
+
+void ChatClient::abortTransfers(const QString &reason)
+{
+    m_uploadTimer->stop();
+    for (const auto &upload : std::as_const(m_uploads)) {
+        delete upload.file;
+        emit transferFailed(upload.name, reason);
+    }
+    m_uploads.clear();
+    for (const auto &download : std::as_const(m_downloads)) {
+        delete download.file;
+        emit transferFailed(download.name, reason);
+    }
+    m_downloads.clear();
+    m_frameId.clear();
+    m_frameRemaining = 0;
+}
+
+void ChatClient::pumpUploads()
+{
+    // One chunk per pass, and only while less than a chunk is still queued in
+    // the socket, so a chat line typed meanwhile waits behind one chunk at most.
+    if (!isConnected() || m_socket->bytesToWrite() >= Protocol::kFileChunkSize) {
+        return;
+    }
+
+    qint64 waitMs = -1;
+    for (int i = 0; i < m_uploads.size(); ++i) {
+        Upload &upload = m_uploads[i];
+        if (!upload.streaming) {
+            continue;
+        }
+        qint64 length = qMin<qint64>(Protocol::kFileChunkSize, upload.size - upload.offset);
+        if (upload.rate > 0) {
+            // The server advertises its per-transfer rate; pace to it.
+            const qint64 budget = upload.rate * upload.clock.elapsed() / 1000
+                + qMin<qint64>(upload.rate, Protocol::kFileChunkSize) - upload.sentSinceStart;
+            const qint64 wanted = qMin(length, kMinRateChunk);
+            if (budget < wanted) {
+                const qint64 ms = (wanted - budget) * 1000 / upload.rate + 1;
+                waitMs = waitMs < 0 ? ms : qMin(waitMs, ms);
+                continue;
+            }
+            length = qMin(length, budget);
+        }
+
+        QByteArray data;
+        if (upload.file->seek(upload.offset)) {
+            data = upload.file->read(length);
+        }
+        if (data.size() != length) {
+            const Upload failed = m_uploads.takeAt(i);
+            delete failed.file;
+            emit transferFailed(failed.name, "read_failed");
+            return;
+        }
+
+        m_socket->write(Protocol::dataFrameHeader(upload.id, upload.offset, length));
+        m_socket->write(data);
+        upload.offset += length;
+        upload.sentSinceStart += length;
+        emit transferProgress(upload.name, upload.offset, upload.size, true);
+        if (upload.offset >= upload.size) {
+            upload.streaming = false; // file_put_done follows
+        }
+
+        // Round robin between uploads.
+        m_uploads.move(i, m_uploads.size() - 1);
+        m_uploadTimer->start(0);
+        return;
+    }
+
+    if (waitMs >= 0) {
+        m_uploadTimer->start(static_cast<int>(qMin<qint64>(waitMs, 1000)));
+    }
+}
+
+bool ChatClient::beginFrame(const QByteArray &header)
+{
+    qint64 offset = 0;
+    qint64 length = 0;
+    if (!Protocol::parseDataFrameHeader(header, &m_frameId, &offset, &length)) {
+        m_frameId.clear();
+        return false;
+    }
+
+    m_frameRemaining = length;
+    const int index = findDownload(m_frameId);
+    if (index < 0 || m_downloads.at(index).offset != offset) {
+        m_frameId.clear();
+    }
+    return true;
+}
+
+void ChatClient::consumeFrame(const QByteArray &data)
+{
+    m_frameRemaining -= data.size();
+
+    const int index = m_frameId.isEmpty() ? -1 : findDownload(m_frameId);
+    if (index < 0) {
+        return;
+    }
+    Download &download = m_downloads[index];
+    if (download.file->write(data) != data.size()) {
+        const Download failed = m_downloads.takeAt(index);
+        delete failed.file;
+        m_frameId.clear();
+        emit transferFailed(failed.name, "write_failed");
+        return;
+    }
+    download.offset += data.size();
+    if (m_frameRemaining == 0) {
+        emit transferProgress(download.name, download.offset, download.size, false);
+    }
+}
+
+int ChatClient::findUpload(const QByteArray &id, int ref) const
+{
+    for (int i = 0; i < m_uploads.size(); ++i) {
+        const Upload &upload = m_uploads.at(i);
+        if ((ref > 0 && upload.ref == ref) || (!id.isEmpty() && upload.id == id)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ChatClient::findDownload(const QByteArray &id) const
+{
+    for (int i = 0; i < m_downloads.size(); ++i) {
+        if (m_downloads.at(i).id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
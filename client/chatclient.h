@@ -1,11 +1,24 @@
 #pragma once
 
+#include "historycache.h"
+#include "latencystats.h"
+
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
 #include <QObject>
+#include <QSslConfiguration>
+#include <QSet>
+#include <QSslError>
 #include <QString>
 #include <QStringList>
 
-class QTcpSocket;
+#include <functional>
+
+class QFile;
+class QSslSocket;
+class QTimer;
+class QJsonArray;
 class QJsonObject;
 
 class ChatClient : public QObject
@@ -16,13 +29,62 @@ public:
     explicit ChatClient(QObject *parent = nullptr);
 
     void connectToServer(const QString &host, quint16 port, const QString &userName);
+    // Same-host server listening on a Unix socket (server --local-socket);
+    // reconnects there too. Switches TLS off.
+    void connectToLocalServer(const QString &path, const QString &userName);
+    // Connects (and reconnects) through a descriptor from `connector` instead
+    // of host and port, which then only name the server in the log; for
+    // in-process servers (see ChatServer::openLocalConnection). An empty
+    // connector goes back to TCP. Not with TLS.
+    using Connector = std::function<qintptr()>;
+    void setConnector(Connector connector);
     void disconnectFromServer();
     bool isConnected() const;
     QString userName() const;
 
+    // TLS: the CA file is only needed for self-signed test certificates.
+    // Every connection, reconnects included, is a full handshake.
+    static bool tlsSupported();
+    void setTlsEnabled(bool enabled);
+    bool tlsEnabled() const;
+    bool setCaCertificates(const QString &path);
+
+    // File transfers run on the chat connection in chunks (see
+    // Protocol::kFileChunkSize) interleaved with chat lines. Both kinds survive
+    // a reconnect: an upload asks the server where it got to, a download
+    // continues from the size of its "<savePath>.part" file. An empty `to`
+    // shares the file with everyone.
+    bool sendFile(const QString &path, const QString &to = QString());
+    bool downloadFile(const QString &id, const QString &savePath);
+
+    // Latency tracing: chat and private messages ask the server for its
+    // timestamps (see Protocol::withTrace). Own messages give the end-to-end
+    // time and, minus the server's share, the network round trip; every traced
+    // message gives the server hops. Off by default; costs nothing then.
+    void setTracing(bool enabled);
+    bool tracing() const;
+    QString traceReport() const;
+    void resetTrace();
+
+    // Full-text search over the server's recent history; `from` narrows it to
+    // one sender. The answer arrives as searchResultReceived.
+    bool search(const QString &term, const QString &from = QString(), int limit = 20);
+
+    // Local history (see HistoryCache), on unless switched off before
+    // connecting. Chat messages are cached as they arrive; after login the
+    // server is only asked for the ones newer than the newest cached, which
+    // then arrive as chatReceived like any other. cachedHistory() gives the
+    // newest `count` cached ones of this server and user, oldest first.
+    void setHistoryEnabled(bool enabled);
+    QList<HistoryCache::Entry> cachedHistory(int count);
+    QString historyReport() const;
+
 public slots:
     void sendChat(const QString &text);
     void sendPrivate(const QString &to, const QString &text);
+    // One request for up to Protocol::kMaxPrivateRecipients names; how it
+    // went for each arrives as privateResultReceived.
+    void sendPrivateGroup(const QStringList &to, const QString &text);
 
 signals:
     void log(QString message);
@@ -33,20 +95,135 @@ signals:
     void userListReceived(QStringList users);
     void chatReceived(QString from, QString text, bool isPrivate, QString to);
     void systemReceived(QString text);
+    void offlineReceived(int count);
+    void reconnecting(int attempt, int delayMs);
+    void resumed(bool gap);
+    void fileReceived(QString from, QString id, QString name, qint64 size, bool isPrivate, QString to);
+    void transferProgress(QString name, qint64 done, qint64 total, bool upload);
+    void transferFinished(QString name, bool upload, QString path);
+    void transferFailed(QString name, QString reason);
+    void searchResultReceived(QString term, QJsonArray messages, bool truncated, QString error);
+    // Recipient -> "delivered", "queued", "full", "not_found" or "invalid".
+    void privateResultReceived(QJsonObject results);
+    // The catch-up after login is done: messages new to the cache, bytes of
+    // the server's answers, and how long it took.
+    void historyCaughtUp(int messages, qint64 bytes, qint64 elapsedMs);
 
 private slots:
     void onConnected();
+    void onEncrypted();
+    void onSslErrors(const QList<QSslError> &errors);
     void onReadyRead();
     void onDisconnected();
     void onError(int socketError);
+    void onReconnectTimer();
+    void pumpUploads();
 
 private:
+    struct Upload {
+        int ref = 0;
+        QByteArray id; // empty until the server accepted it
+        QFile *file = nullptr;
+        QString name;
+        QString to;
+        qint64 size = 0;
+        qint64 offset = 0;
+        qint64 rate = 0;
+        qint64 sentSinceStart = 0;
+        QElapsedTimer clock;
+        bool streaming = false;
+    };
+
+    struct Download {
+        QByteArray id;
+        QFile *file = nullptr;
+        QString name;
+        QString savePath;
+        qint64 size = -1;
+        qint64 offset = 0;
+    };
+
+    void beginConnection(const QString &host, quint16 port, const QString &userName);
+    void openConnection();
+    void startSession();
     void sendJson(const QJsonObject &obj);
+    void sendLogin(const QString &name);
     void handleJson(const QJsonObject &obj);
+    void handleConnectionLost();
+    void scheduleReconnect();
+    bool acceptSeq(quint64 seq);
+    void skipSeqTo(quint64 seq);
 
-    QTcpSocket *m_socket = nullptr;
+    void openHistory();
+    void requestHistory(qint64 sinceMs);
+    void requestHistoryAfter(double cursor);
+    void handleHistoryResult(const QJsonObject &obj);
+    void finishCatchUp();
+
+    void addTrace(QJsonObject *request) const;
+    void recordTrace(const QJsonObject &msg);
+
+    bool handleFileJson(const QString &type, const QJsonObject &obj);
+    void requestUpload(Upload &upload);
+    void requestDownload(Download &download);
+    void resumeTransfers();
+    void abortTransfers(const QString &reason);
+    bool beginFrame(const QByteArray &header);
+    void consumeFrame(const QByteArray &data);
+    int findUpload(const QByteArray &id, int ref = 0) const;
+    int findDownload(const QByteArray &id) const;
+
+    QSslSocket *m_socket = nullptr;
+    QTimer *m_reconnectTimer = nullptr;
+    Connector m_connector;
+    QString m_localPath;
     QByteArray m_buffer;
+    QString m_host;
+    quint16 m_port = 0;
     QString m_pendingUserName;
     QString m_userName;
     bool m_disconnectedNotified = true;
+    bool m_userDisconnect = false;
+
+    // Resume state: the token from login_ok, the sequence number up to which
+    // everything has arrived, and the ones seen beyond it. The server sends
+    // urgent classes (private messages, replies) ahead of queued broadcasts,
+    // so sequence numbers can arrive out of order.
+    QByteArray m_resumeToken;
+    quint64 m_lastSeq = 0;
+    QSet<quint64> m_seqAhead;
+    int m_reconnectAttempt = 0;
+
+    bool m_tls = false;
+    QSslConfiguration m_sslConfig;
+    QElapsedTimer m_handshakeTimer;
+
+    QList<Upload> m_uploads;
+    QList<Download> m_downloads;
+    QTimer *m_uploadTimer = nullptr;
+    int m_nextUploadRef = 1;
+    int m_nextSearchId = 1;
+
+    bool m_historyEnabled = true;
+    HistoryCache m_history;
+    // Size of the line being handled, for the catch-up's byte count.
+    qint64 m_lineBytes = 0;
+    // Catch-up in progress while the clock runs; the last one's totals stay.
+    QElapsedTimer m_catchUpClock;
+    int m_catchUpMessages = 0;
+    qint64 m_catchUpBytes = 0;
+    qint64 m_catchUpMs = -1;
+
+    // Samples are kept until kMaxTraceSamples, then the statistics start over.
+    static constexpr int kMaxTraceSamples = 10000;
+    bool m_tracing = false;
+    QElapsedTimer m_traceClock;
+    LatencyStats m_traceEndToEnd;
+    LatencyStats m_traceNetwork;
+    LatencyStats m_traceServer;
+    LatencyStats m_traceIngress;
+    LatencyStats m_traceDelivery;
+    // Download frame being read (empty id: discard) and its bytes still to come.
+    QByteArray m_frameId;
+    qint64 m_frameRemaining = 0;
 };
@@ -5,11 +5,16 @@ CONFIG += c++17
 SOURCES += \
     chatclient.cpp \
     clientwindow.cpp \
-    main.cpp
+    historycache.cpp \
+    main.cpp \
+    userlistmodel.cpp
 
 HEADERS += \
     chatclient.h \
-    clientwindow.h
+    clientconfig.h \
+    clientwindow.h \
+    historycache.h \
+    userlistmodel.h
 
 FORMS += \
     clientwindow.ui
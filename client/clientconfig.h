@@ -0,0 +1,14 @@
+#pragma once
+
+#include <QString>
+
+// Startup options for the client window; filled from the command line in main.cpp.
+struct ClientConfig {
+    bool tls = false;
+    // Extra CA certificate (PEM) to trust, e.g. a self-signed test certificate.
+    QString caCertFile;
+    // Start with latency tracing and the diagnostics panel on.
+    bool trace = false;
+    // Keep received messages in a local cache and show them at login.
+    bool history = true;
+};
@@ -3,37 +3,102 @@
 
 #include "chatclient.h"
 #include "protocol.h"
+#include "userlistmodel.h"
 
-#include <QListWidgetItem>
 #include <QCloseEvent>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileDialog>
+#include <QFontDatabase>
+#include <QJsonObject>
+#include <QLocale>
 #include <QMessageBox>
+#include <QTimer>
 
-ClientWindow::ClientWindow(QWidget *parent)
+namespace {
+
+// Cached messages put on the chat page at login.
+constexpr int kCachedLines = 200;
+
+QString chatLine(const QString &from, const QString &text, bool isPrivate, const QString &to)
+{
+    if (isPrivate && !to.isEmpty()) {
+        return QString("%1 -> %2 : %3").arg(from, to, text);
+    }
+    return QString("%1 : %2").arg(from, text);
+}
+
+} // namespace
+
+ClientWindow::ClientWindow(const ClientConfig &config, QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::ClientWindow)
     , m_client(new ChatClient(this))
+    , m_userModel(new UserListModel(this))
+    , m_userFilter(new UserFilterModel(this))
+    , m_diagnosticsTimer(new QTimer(this))
 {
     ui->setupUi(this);
 
+    m_userFilter->setSourceModel(m_userModel);
+    ui->listViewUsers->setModel(m_userFilter);
+
     connect(ui->pushButtonLogin, &QPushButton::clicked, this, &ClientWindow::onLoginClicked);
     connect(ui->pushButtonSend, &QPushButton::clicked, this, &ClientWindow::onSendClicked);
+    connect(ui->pushButtonFile, &QPushButton::clicked, this, &ClientWindow::onFileClicked);
     connect(ui->pushButtonExit, &QPushButton::clicked, this, &ClientWindow::onExitClicked);
+    connect(ui->pushButtonDiagnostics, &QPushButton::toggled, this, &ClientWindow::onDiagnosticsToggled);
+    connect(ui->pushButtonResetTrace, &QPushButton::clicked, this, [this]() {
+        m_client->resetTrace();
+        refreshDiagnostics();
+    });
     connect(ui->lineEditMessage, &QLineEdit::returnPressed, this, &ClientWindow::onSendClicked);
     connect(ui->lineEditHost, &QLineEdit::returnPressed, this, &ClientWindow::onLoginClicked);
     connect(ui->lineEditName, &QLineEdit::returnPressed, this, &ClientWindow::onLoginClicked);
+    connect(ui->lineEditUserFilter, &QLineEdit::textChanged, this, &ClientWindow::onUserFilterChanged);
+    connect(ui->lineEditUserFilter, &QLineEdit::returnPressed, this, [this]() {
+        if (m_userFilter->rowCount() > 0) {
+            onUserActivated(m_userFilter->index(0, 0));
+        }
+    });
+    connect(ui->listViewUsers, &QListView::activated, this, &ClientWindow::onUserActivated);
 
     connect(m_client, &ChatClient::log, this, &ClientWindow::onClientLog);
     connect(m_client, &ChatClient::loginOk, this, &ClientWindow::onLoginOk);
     connect(m_client, &ChatClient::loginError, this, &ClientWindow::onLoginError);
     connect(m_client, &ChatClient::disconnected, this, &ClientWindow::onDisconnected);
+    connect(m_client, &ChatClient::reconnecting, this, &ClientWindow::onReconnecting);
+    connect(m_client, &ChatClient::resumed, this, &ClientWindow::onResumed);
     connect(m_client, &ChatClient::userListReceived, this, &ClientWindow::onUserListReceived);
     connect(m_client, &ChatClient::chatReceived, this, &ClientWindow::onChatReceived);
     connect(m_client, &ChatClient::systemReceived, this, &ClientWindow::onSystemReceived);
+    connect(m_client, &ChatClient::offlineReceived, this, &ClientWindow::onOfflineReceived);
+    connect(m_client, &ChatClient::fileReceived, this, &ClientWindow::onFileReceived);
+    connect(m_client, &ChatClient::transferProgress, this, &ClientWindow::onTransferProgress);
+    connect(m_client, &ChatClient::transferFinished, this, &ClientWindow::onTransferFinished);
+    connect(m_client, &ChatClient::transferFailed, this, &ClientWindow::onTransferFailed);
+    connect(m_client, &ChatClient::searchResultReceived, this, &ClientWindow::onSearchResult);
+    connect(m_client, &ChatClient::privateResultReceived, this, &ClientWindow::onPrivateResult);
+    connect(m_client, &ChatClient::historyCaughtUp, this, &ClientWindow::onHistoryCaughtUp);
 
     ui->splitterChat->setStretchFactor(0, 4);
     ui->splitterChat->setStretchFactor(1, 1);
     ui->splitterChat->setSizes({720, 180});
 
+    if (!config.caCertFile.isEmpty() && !m_client->setCaCertificates(config.caCertFile)) {
+        statusBar()->showMessage(tr("无法读取 CA 证书：%1").arg(config.caCertFile), 5000);
+    }
+    ui->checkBoxTls->setEnabled(ChatClient::tlsSupported());
+    ui->checkBoxTls->setChecked(config.tls && ChatClient::tlsSupported());
+    m_client->setHistoryEnabled(config.history);
+
+    m_diagnosticsTimer->setInterval(1000);
+    connect(m_diagnosticsTimer, &QTimer::timeout, this, &ClientWindow::refreshDiagnostics);
+    ui->plainTextEditDiagnostics->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    ui->groupBoxDiagnostics->hide();
+    ui->pushButtonDiagnostics->setChecked(config.trace);
+
     showLoginPage();
 }
 
@@ -60,7 +125,20 @@ void ClientWindow::onLoginClicked()
         return;
     }
 
+    // A path is the server's local socket on this machine.
+#ifndef Q_OS_LINUX
+    if (host.startsWith('/')) {
+        QMessageBox::warning(this, tr("输入错误"), tr("本机套接字仅在 Linux 上可用"));
+        return;
+    }
+#endif
     setLoginEnabled(false);
+    if (host.startsWith('/')) {
+        statusBar()->showMessage(tr("正在连接本机套接字 %1 ...").arg(host), 5000);
+        m_client->connectToLocalServer(host, name);
+        return;
+    }
+    m_client->setTlsEnabled(ui->checkBoxTls->isChecked());
     statusBar()->showMessage(tr("正在连接 %1:%2 ...").arg(host).arg(Protocol::kDefaultPort), 5000);
     m_client->connectToServer(host, Protocol::kDefaultPort, name);
 }
@@ -72,6 +150,28 @@ void ClientWindow::onSendClicked()
         return;
     }
 
+    if (text.startsWith("/get ")) {
+        downloadFile(text.section(' ', 1, 1).toInt());
+        ui->lineEditMessage->clear();
+        return;
+    }
+
+    if (text.startsWith("/search ")) {
+        // "/search [@name] words"
+        QString term = text.section(' ', 1).trimmed();
+        QString from;
+        if (term.startsWith('@')) {
+            from = term.section(' ', 0, 0).mid(1);
+            term = term.section(' ', 1).trimmed();
+        }
+        if (!m_client->search(term, from)) {
+            statusBar()->showMessage(tr("请输入要搜索的内容"), 5000);
+            return;
+        }
+        ui->lineEditMessage->clear();
+        return;
+    }
+
     QString to;
     QString message;
 
@@ -89,7 +189,10 @@ void ClientWindow::onSendClicked()
         }
     }
 
-    if (!to.isEmpty() && !message.isEmpty()) {
+    // "@a,b,c" (or "/w a,b,c") sends one private message to all of them.
+    if (!to.isEmpty() && !message.isEmpty() && to.contains(',')) {
+        m_client->sendPrivateGroup(to.split(',', Qt::SkipEmptyParts), message);
+    } else if (!to.isEmpty() && !message.isEmpty()) {
         m_client->sendPrivate(to, message);
     } else {
         m_client->sendChat(text);
@@ -98,6 +201,26 @@ void ClientWindow::onSendClicked()
     ui->lineEditMessage->clear();
 }
 
+void ClientWindow::onFileClicked()
+{
+    // "@name" (or "/w name") in the message box sends the file privately.
+    const QString text = ui->lineEditMessage->text().trimmed();
+    QString to;
+    if (text.startsWith('@')) {
+        to = text.mid(1).section(' ', 0, 0);
+    } else if (text.startsWith("/w ") || text.startsWith("/msg ")) {
+        to = text.section(' ', 1, 1, QString::SectionSkipEmpty);
+    }
+
+    const QString path = QFileDialog::getOpenFileName(this, to.isEmpty() ? tr("发送文件给所有人") : tr("发送文件给 %1").arg(to));
+    if (path.isEmpty()) {
+        return;
+    }
+    if (!m_client->sendFile(path, to)) {
+        QMessageBox::warning(this, tr("发送文件"), tr("无法发送文件：%1").arg(QDir::toNativeSeparators(path)));
+    }
+}
+
 void ClientWindow::onExitClicked()
 {
     const auto choice = QMessageBox::question(this,
@@ -144,6 +267,7 @@ void ClientWindow::onClientLog(const QString &message)
 void ClientWindow::onLoginOk(const QString &userName)
 {
     ui->labelTitle->setText(tr("%1 的聊天室（实验4）").arg(userName));
+    m_userModel->setSelfName(userName);
     statusBar()->showMessage(tr("登录成功：%1").arg(userName), 5000);
     showChatPage();
 }
@@ -160,35 +284,181 @@ void ClientWindow::onDisconnected()
     showLoginPage();
 }
 
+void ClientWindow::onReconnecting(int attempt, int delayMs)
+{
+    statusBar()->showMessage(tr("连接已断开，%1 秒后进行第 %2 次重连...").arg((delayMs + 999) / 1000).arg(attempt));
+}
+
+void ClientWindow::onResumed(bool gap)
+{
+    statusBar()->showMessage(tr("已重新连接"), 5000);
+    if (gap) {
+        appendChatLine(tr("系统 : 断线期间的部分消息已丢失"));
+    }
+}
+
 void ClientWindow::onUserListReceived(const QStringList &users)
 {
-    ui->listWidgetUsers->clear();
-    const QString self = m_client->userName();
+    m_userModel->setUsers(users);
+}
+
+void ClientWindow::onChatReceived(const QString &from, const QString &text, bool isPrivate, const QString &to)
+{
+    appendChatLine(chatLine(from, text, isPrivate, to));
+}
+
+void ClientWindow::onSystemReceived(const QString &text)
+{
+    appendChatLine(tr("系统 : %1").arg(text));
+}
 
-    for (const auto &u : users) {
-        auto *item = new QListWidgetItem(u, ui->listWidgetUsers);
-        item->setData(Qt::UserRole, u);
+void ClientWindow::onOfflineReceived(int count)
+{
+    appendChatLine(tr("系统 : 你有 %1 条离线消息").arg(count));
+}
+
+void ClientWindow::onFileReceived(const QString &from, const QString &id, const QString &name, qint64 size, bool isPrivate, const QString &to)
+{
+    m_files.push_back(qMakePair(id, name));
+    const QString file = tr("[文件 #%1] %2（%3），输入 /get %1 下载").arg(m_files.size()).arg(name, QLocale().formattedDataSize(size));
+    if (isPrivate && !to.isEmpty()) {
+        appendChatLine(QString("%1 -> %2 : %3").arg(from, to, file));
+        return;
+    }
+    appendChatLine(QString("%1 : %2").arg(from, file));
+}
 
-        if (!self.isEmpty() && u == self) {
-            QFont f = item->font();
-            f.setBold(true);
-            item->setFont(f);
+void ClientWindow::onTransferProgress(const QString &name, qint64 done, qint64 total, bool upload)
+{
+    const int percent = total > 0 ? static_cast<int>(done * 100 / total) : 0;
+    statusBar()->showMessage((upload ? tr("上传 %1：%2%") : tr("下载 %1：%2%")).arg(name).arg(percent), 2000);
+}
+
+void ClientWindow::onTransferFinished(const QString &name, bool upload, const QString &path)
+{
+    if (upload) {
+        statusBar()->showMessage(tr("文件已发送：%1").arg(name), 5000);
+        return;
+    }
+    appendChatLine(tr("系统 : 文件已保存到 %1").arg(QDir::toNativeSeparators(path)));
+}
+
+void ClientWindow::onTransferFailed(const QString &name, const QString &reason)
+{
+    appendChatLine(tr("系统 : 文件 %1 传输失败（%2）").arg(name, reason));
+}
+
+void ClientWindow::onSearchResult(const QString &term, const QJsonArray &messages, bool truncated, const QString &error)
+{
+    if (error == "disabled") {
+        appendChatLine(tr("系统 : 服务器未开启搜索"));
+        return;
+    }
+    if (!error.isEmpty()) {
+        appendChatLine(tr("系统 : 搜索“%1”无效，请换个词").arg(term));
+        return;
+    }
+
+    appendChatLine(truncated ? tr("系统 : 搜索“%1”找到 %2 条（更早的结果未列出）").arg(term).arg(messages.size())
+                             : tr("系统 : 搜索“%1”找到 %2 条").arg(term).arg(messages.size()));
+    for (const auto &v : messages) {
+        const QJsonObject msg = v.toObject();
+        const QString time = QDateTime::fromString(msg.value("time").toString(), Qt::ISODate).toString("MM-dd HH:mm");
+        // A message to several recipients lists all of them.
+        QStringList names;
+        for (const auto &name : msg.value("to").toArray()) {
+            names.push_back(name.toString());
         }
+        const QString to = msg.value("to").isArray() ? names.join(", ") : msg.value("to").toString();
+        const QString from = to.isEmpty() ? msg.value("from").toString() : QString("%1 -> %2").arg(msg.value("from").toString(), to);
+        appendChatLine(QString("  [%1] %2 : %3").arg(time, from, msg.value("text").toString()));
     }
 }
 
-void ClientWindow::onChatReceived(const QString &from, const QString &text, bool isPrivate, const QString &to)
+void ClientWindow::onPrivateResult(const QJsonObject &results)
 {
-    if (isPrivate && !to.isEmpty()) {
-        appendChatLine(QString("%1 -> %2 : %3").arg(from, to, text));
+    QStringList queued;
+    QStringList full;
+    QStringList notFound;
+    QStringList invalid;
+    for (auto it = results.constBegin(); it != results.constEnd(); ++it) {
+        const QString result = it.value().toString();
+        if (result == QLatin1String("queued")) {
+            queued << it.key();
+        } else if (result == QLatin1String("full")) {
+            full << it.key();
+        } else if (result == QLatin1String("not_found")) {
+            notFound << it.key();
+        } else if (result == QLatin1String("invalid")) {
+            invalid << it.key();
+        }
+    }
+    if (!queued.isEmpty()) {
+        appendChatLine(tr("系统 : %1 不在线，消息已留言").arg(queued.join(QStringLiteral("、"))));
+    }
+    if (!full.isEmpty()) {
+        appendChatLine(tr("系统 : %1 的离线信箱已满，消息未送达").arg(full.join(QStringLiteral("、"))));
+    }
+    if (!notFound.isEmpty()) {
+        appendChatLine(tr("系统 : 没有用户 %1，消息未送达").arg(notFound.join(QStringLiteral("、"))));
+    }
+    if (!invalid.isEmpty()) {
+        appendChatLine(tr("系统 : 无效的用户名：%1").arg(invalid.join(QStringLiteral("、"))));
+    }
+}
+
+void ClientWindow::onHistoryCaughtUp(int messages, qint64 bytes, qint64 elapsedMs)
+{
+    statusBar()->showMessage(tr("已补取 %1 条新消息（%2，%3 ms）").arg(messages).arg(QLocale().formattedDataSize(bytes)).arg(elapsedMs), 5000);
+}
+
+void ClientWindow::onDiagnosticsToggled(bool enabled)
+{
+    m_client->setTracing(enabled);
+    ui->groupBoxDiagnostics->setVisible(enabled);
+    if (enabled) {
+        refreshDiagnostics();
+        m_diagnosticsTimer->start();
+    } else {
+        m_diagnosticsTimer->stop();
+    }
+}
+
+void ClientWindow::refreshDiagnostics()
+{
+    ui->plainTextEditDiagnostics->setPlainText(m_client->traceReport() + '\n' + m_client->historyReport());
+}
+
+void ClientWindow::downloadFile(int number)
+{
+    if (number < 1 || number > m_files.size()) {
+        statusBar()->showMessage(tr("没有编号为 %1 的文件").arg(number), 5000);
+        return;
+    }
+
+    const auto &file = m_files.at(number - 1);
+    const QString path = QFileDialog::getSaveFileName(this, tr("保存文件"), QDir::home().filePath(file.second));
+    if (path.isEmpty()) {
         return;
     }
-    appendChatLine(QString("%1 : %2").arg(from, text));
+    if (!m_client->downloadFile(file.first, path)) {
+        QMessageBox::warning(this, tr("下载文件"), tr("无法下载到：%1").arg(QDir::toNativeSeparators(path)));
+    }
 }
 
-void ClientWindow::onSystemReceived(const QString &text)
+void ClientWindow::onUserFilterChanged(const QString &text)
 {
-    appendChatLine(tr("系统 : %1").arg(text));
+    m_userFilter->setFilterText(text);
+}
+
+void ClientWindow::onUserActivated(const QModelIndex &index)
+{
+    const QString name = index.data(Qt::UserRole).toString();
+    if (name.isEmpty() || name == m_client->userName()) {
+        return;
+    }
+    ui->lineEditMessage->setText(QString("@%1 ").arg(name));
+    ui->lineEditMessage->setFocus();
 }
 
 void ClientWindow::setLoginEnabled(bool enabled)
@@ -196,6 +466,7 @@ void ClientWindow::setLoginEnabled(bool enabled)
     ui->lineEditHost->setEnabled(enabled);
     ui->lineEditName->setEnabled(enabled);
     ui->pushButtonLogin->setEnabled(enabled);
+    ui->checkBoxTls->setEnabled(enabled && ChatClient::tlsSupported());
 }
 
 void ClientWindow::showLoginPage()
@@ -203,7 +474,10 @@ void ClientWindow::showLoginPage()
     ui->stackedWidget->setCurrentWidget(ui->pageLogin);
     setLoginEnabled(true);
     ui->plainTextEditChat->clear();
-    ui->listWidgetUsers->clear();
+    m_files.clear();
+    m_userModel->clear();
+    m_userModel->setSelfName({});
+    ui->lineEditUserFilter->clear();
     ui->lineEditMessage->clear();
     ui->lineEditName->setFocus();
 }
@@ -211,9 +485,32 @@ void ClientWindow::showLoginPage()
 void ClientWindow::showChatPage()
 {
     ui->stackedWidget->setCurrentWidget(ui->pageChat);
+    // A login after a failed resume keeps what the page already shows.
+    if (ui->plainTextEditChat->document()->isEmpty()) {
+        showCachedHistory();
+    }
     ui->lineEditMessage->setFocus();
 }
 
+void ClientWindow::showCachedHistory()
+{
+    QElapsedTimer timer;
+    timer.start();
+    const QList<HistoryCache::Entry> entries = m_client->cachedHistory(kCachedLines);
+    if (entries.isEmpty()) {
+        return;
+    }
+
+    QStringList lines;
+    lines.reserve(entries.size() + 1);
+    for (const auto &entry : entries) {
+        lines << chatLine(entry.from, entry.text, !entry.to.isEmpty(), entry.to.join(", "));
+    }
+    lines << tr("—— 以上为本地记录 ——");
+    appendChatLine(lines.join('\n'));
+    statusBar()->showMessage(tr("已载入本地记录 %1 条（%2 ms）").arg(entries.size()).arg(static_cast<double>(timer.nsecsElapsed()) / 1e6, 0, 'f', 1), 5000);
+}
+
 void ClientWindow::appendChatLine(const QString &line)
 {
     ui->plainTextEditChat->appendPlainText(line);
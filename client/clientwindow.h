@@ -1,9 +1,15 @@
 #pragma once
 
 #include <QCloseEvent>
+#include <QJsonArray>
 #include <QMainWindow>
+#include <QList>
+#include <QModelIndex>
+#include <QPair>
 #include <QStringList>
 
+#include "clientconfig.h"
+
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class ClientWindow;
@@ -11,13 +17,16 @@ class ClientWindow;
 QT_END_NAMESPACE
 
 class ChatClient;
+class QTimer;
+class UserFilterModel;
+class UserListModel;
 
 class ClientWindow : public QMainWindow
 {
     Q_OBJECT
 
 public:
-    explicit ClientWindow(QWidget *parent = nullptr);
+    explicit ClientWindow(const ClientConfig &config = ClientConfig(), QWidget *parent = nullptr);
     ~ClientWindow() override;
 
 protected:
@@ -26,21 +35,43 @@ protected:
 private slots:
     void onLoginClicked();
     void onSendClicked();
+    void onFileClicked();
     void onExitClicked();
     void onClientLog(const QString &message);
     void onLoginOk(const QString &userName);
     void onLoginError(const QString &reason);
     void onDisconnected();
+    void onReconnecting(int attempt, int delayMs);
+    void onResumed(bool gap);
     void onUserListReceived(const QStringList &users);
     void onChatReceived(const QString &from, const QString &text, bool isPrivate, const QString &to);
     void onSystemReceived(const QString &text);
+    void onOfflineReceived(int count);
+    void onFileReceived(const QString &from, const QString &id, const QString &name, qint64 size, bool isPrivate, const QString &to);
+    void onTransferProgress(const QString &name, qint64 done, qint64 total, bool upload);
+    void onTransferFinished(const QString &name, bool upload, const QString &path);
+    void onTransferFailed(const QString &name, const QString &reason);
+    void onSearchResult(const QString &term, const QJsonArray &messages, bool truncated, const QString &error);
+    void onPrivateResult(const QJsonObject &results);
+    void onHistoryCaughtUp(int messages, qint64 bytes, qint64 elapsedMs);
+    void onUserFilterChanged(const QString &text);
+    void onUserActivated(const QModelIndex &index);
+    void onDiagnosticsToggled(bool enabled);
+    void refreshDiagnostics();
 
 private:
     void setLoginEnabled(bool enabled);
     void showLoginPage();
     void showChatPage();
+    void showCachedHistory();
     void appendChatLine(const QString &line);
+    void downloadFile(int number);
 
     Ui::ClientWindow *ui = nullptr;
     ChatClient *m_client = nullptr;
+    UserListModel *m_userModel = nullptr;
+    UserFilterModel *m_userFilter = nullptr;
+    QTimer *m_diagnosticsTimer = nullptr;
+    // Files announced in the chat, numbered for "/get N": (id, name).
+    QList<QPair<QString, QString>> m_files;
 };
@@ -0,0 +1,253 @@
+#include "historycache.h"
+
+#include "protocol.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
+
+#include <algorithm>
+
+namespace {
+
+// Start of the line ending just before `end` (which is past its newline, or
+// the end of the data), and where that line's text ends.
+qint64 lineStart(const uchar *data, qint64 end, qint64 *textEnd)
+{
+    qint64 last = end;
+    if (last > 0 && data[last - 1] == '\n') {
+        --last;
+    }
+    *textEnd = last;
+    while (last > 0 && data[last - 1] != '\n') {
+        --last;
+    }
+    return last;
+}
+
+QJsonObject parseLine(const uchar *data, qint64 begin, qint64 end)
+{
+    const QByteArray line = QByteArray::fromRawData(reinterpret_cast<const char *>(data + begin), end - begin);
+    return QJsonDocument::fromJson(line).object();
+}
+
+} // namespace
+
+HistoryCache::~HistoryCache()
+{
+    close();
+}
+
+QString HistoryCache::pathFor(const QString &server, const QString &userName)
+{
+    // Host names, socket paths and user names all end up in one file name.
+    const QString name = QString::fromLatin1(QUrl::toPercentEncoding(server) + '_' + QUrl::toPercentEncoding(userName));
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath(QStringLiteral("history/%1.jsonl").arg(name));
+}
+
+bool HistoryCache::open(const QString &path, QString *error)
+{
+    close();
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) {
+        *error = QStringLiteral("cannot create %1").arg(QFileInfo(path).absolutePath());
+        return false;
+    }
+    m_file.setFileName(path);
+    compactIfLarge(m_file);
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        *error = m_file.errorString();
+        return false;
+    }
+    m_mapSize = m_file.size();
+    if (m_mapSize > 0) {
+        m_map = m_file.map(0, m_mapSize);
+        if (!m_map) {
+            *error = m_file.errorString();
+            m_file.close();
+            return false;
+        }
+        // A line cut short by a crash mid-append is skipped when read; the
+        // next one must not be glued to it.
+        if (m_map[m_mapSize - 1] != '\n') {
+            m_file.write("\n");
+        }
+    }
+
+    // The high-water mark is the last line; the few lines just before it are
+    // what a catch-up can repeat.
+    qint64 end = m_mapSize;
+    while (end > 0) {
+        qint64 textEnd = 0;
+        const qint64 begin = lineStart(m_map, end, &textEnd);
+        const Entry entry = entryFrom(parseLine(m_map, begin, textEnd));
+        end = begin;
+        if (entry.timeMs <= 0) {
+            continue; // cut short, see above
+        }
+        if (m_highWaterMs == 0) {
+            m_highWaterMs = entry.timeMs;
+        }
+        if (entry.timeMs < m_highWaterMs - kSameMessageMs) {
+            break;
+        }
+        m_newest.prepend(entry);
+    }
+
+    m_stats = Stats();
+    m_stats.fileBytes = m_mapSize;
+    m_stats.openNs = timer.nsecsElapsed();
+    return true;
+}
+
+void HistoryCache::close()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+    m_mapSize = 0;
+    m_file.close();
+    m_highWaterMs = 0;
+    m_newest.clear();
+}
+
+QList<HistoryCache::Entry> HistoryCache::recent(int count)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<Entry> entries;
+    qint64 end = m_mapSize;
+    while (end > 0 && entries.size() < count) {
+        qint64 textEnd = 0;
+        const qint64 begin = lineStart(m_map, end, &textEnd);
+        Entry entry = entryFrom(parseLine(m_map, begin, textEnd));
+        end = begin;
+        if (entry.timeMs > 0) {
+            entries.push_back(std::move(entry));
+        }
+    }
+    std::reverse(entries.begin(), entries.end());
+
+    m_stats.loaded = static_cast<int>(entries.size());
+    m_stats.loadNs = timer.nsecsElapsed();
+    return entries;
+}
+
+bool HistoryCache::append(const QJsonObject &msg)
+{
+    const Entry entry = entryFrom(msg);
+    if (!isOpen() || entry.timeMs <= 0) {
+        return false;
+    }
+
+    QJsonObject stored{
+        {"type", "chat"},
+        {"scope", entry.to.isEmpty() ? "broadcast" : "private"},
+        {"from", entry.from},
+        {"text", entry.text},
+        {"time", msg.value("time")},
+    };
+    if (!entry.to.isEmpty()) {
+        stored.insert("to", msg.value("to"));
+    }
+    const QByteArray line = Protocol::toLine(stored);
+    if (m_file.write(line) != line.size() || !m_file.flush()) {
+        return false;
+    }
+    m_stats.fileBytes += line.size();
+    ++m_stats.appended;
+    m_highWaterMs = qMax(m_highWaterMs, entry.timeMs);
+    remember(entry);
+    return true;
+}
+
+bool HistoryCache::isDuplicate(const QJsonObject &msg)
+{
+    const Entry entry = entryFrom(msg);
+    for (auto it = m_newest.begin(); it != m_newest.end(); ++it) {
+        if (it->from != entry.from || it->text != entry.text || qAbs(it->timeMs - entry.timeMs) > kSameMessageMs) {
+            continue;
+        }
+        // The history has a message to several people once per recipient.
+        if (entry.to.isEmpty() != it->to.isEmpty() || (!entry.to.isEmpty() && !it->to.contains(entry.to.constFirst()))) {
+            continue;
+        }
+        if (!entry.to.isEmpty()) {
+            it->to.removeOne(entry.to.constFirst());
+        }
+        if (it->to.isEmpty()) {
+            m_newest.erase(it);
+        }
+        ++m_stats.duplicates;
+        return true;
+    }
+    return false;
+}
+
+HistoryCache::Stats HistoryCache::stats() const
+{
+    return m_stats;
+}
+
+HistoryCache::Entry HistoryCache::entryFrom(const QJsonObject &msg)
+{
+    Entry entry;
+    if (msg.value("type").toString() != "chat" || msg.contains("file")) {
+        return entry;
+    }
+    const QDateTime time = QDateTime::fromString(msg.value("time").toString(), Qt::ISODate);
+    if (!time.isValid()) {
+        return entry;
+    }
+    entry.timeMs = time.toMSecsSinceEpoch();
+    entry.from = msg.value("from").toString();
+    entry.text = msg.value("text").toString();
+    if (msg.value("scope").toString() == "private") {
+        const QJsonValue to = msg.value("to");
+        if (to.isArray()) {
+            for (const auto &v : to.toArray()) {
+                entry.to.push_back(v.toString());
+            }
+        } else {
+            entry.to.push_back(to.toString());
+        }
+    }
+    return entry;
+}
+
+void HistoryCache::compactIfLarge(QFile &file)
+{
+    if (file.size() <= kMaxFileBytes || !file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    // Keeps whole lines from the middle on.
+    file.seek(file.size() / 2);
+    file.readLine();
+    const QByteArray tail = file.readAll();
+    file.close();
+
+    QSaveFile out(file.fileName());
+    if (out.open(QIODevice::WriteOnly)) {
+        out.write(tail);
+        out.commit();
+    }
+}
+
+void HistoryCache::remember(const Entry &entry)
+{
+    m_newest.push_back(entry);
+    if (m_newest.size() > kRememberedMessages) {
+        m_newest.removeFirst();
+    }
+}
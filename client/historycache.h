@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+class QJsonObject;
+
+// Chat messages one user received from one server, kept across runs so the
+// chat page shows the recent conversation before the server has said a word.
+//
+// The cache is an append-only file of JSON lines (the server's chat messages
+// without "seq" and "trace") under the application's local data directory.
+// open() maps the file and reads only its last line, for the high-water mark;
+// recent() parses the lines it asks for backwards from the end of the map, so
+// the cost of a launch follows what is shown, not how long the history is.
+// A file grown past kMaxFileBytes is cut to its newer half when opened.
+class HistoryCache
+{
+public:
+    struct Entry {
+        qint64 timeMs = 0;
+        QString from;
+        QStringList to; // empty for a broadcast
+        QString text;
+    };
+
+    struct Stats {
+        qint64 fileBytes = 0;
+        qint64 openNs = 0;   // open, map and high-water mark
+        int loaded = 0;      // lines parsed by the last recent()
+        qint64 loadNs = 0;   // the last recent()
+        quint64 appended = 0;
+        quint64 duplicates = 0; // caught-up messages the cache already had
+    };
+
+    static constexpr qint64 kMaxFileBytes = 8 * 1024 * 1024;
+    // A caught-up message is the same as a cached one if sender, recipient and
+    // text match and their times are this close: the server stamps its history
+    // a moment after the message itself.
+    static constexpr qint64 kSameMessageMs = 2000;
+    // Messages appended this run that a catch-up is checked against; more than
+    // one page of it (see SearchService::kMaxHistory on the server).
+    static constexpr int kRememberedMessages = 1024;
+
+    HistoryCache() = default;
+    ~HistoryCache();
+    HistoryCache(const HistoryCache &) = delete;
+    HistoryCache &operator=(const HistoryCache &) = delete;
+
+    // `server` is "host:port" or the local socket path.
+    static QString pathFor(const QString &server, const QString &userName);
+
+    bool open(const QString &path, QString *error);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    // The newest `count` cached messages, oldest first. Lines appended since
+    // open() are not included: they were shown as they arrived.
+    QList<Entry> recent(int count);
+    // Time of the newest cached message, 0 if there is none.
+    qint64 highWaterMs() const { return m_highWaterMs; }
+
+    // Appends a "chat" message from the server; false if it is not one.
+    bool append(const QJsonObject &msg);
+    // For a caught-up message: true (and counted) if it is already cached.
+    bool isDuplicate(const QJsonObject &msg);
+
+    Stats stats() const;
+
+    static Entry entryFrom(const QJsonObject &msg);
+
+private:
+    static void compactIfLarge(QFile &file);
+    void remember(const Entry &entry);
+
+    QFile m_file;
+    uchar *m_map = nullptr;
+    qint64 m_mapSize = 0;
+    qint64 m_highWaterMs = 0;
+    // The cached messages within kSameMessageMs of the newest when opened,
+    // then the last kRememberedMessages appended; a duplicate uses up its
+    // match (one recipient of it, for a message to several).
+    QList<Entry> m_newest;
+    Stats m_stats;
+};
@@ -1,12 +1,32 @@
+#include "clientconfig.h"
 #include "clientwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
-    ClientWindow window;
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    const QCommandLineOption tlsOption("tls", "Connect with TLS by default.");
+    parser.addOption(tlsOption);
+    const QCommandLineOption caCertOption("ca-cert", "Trust the PEM CA certificate in <file>.", "file");
+    parser.addOption(caCertOption);
+    const QCommandLineOption traceOption("trace", "Trace message latency and show the diagnostics panel.");
+    parser.addOption(traceOption);
+    const QCommandLineOption noHistoryOption("no-history", "Do not keep a local history of received messages.");
+    parser.addOption(noHistoryOption);
+    parser.process(app);
+
+    ClientConfig config;
+    config.tls = parser.isSet(tlsOption) || parser.isSet(caCertOption);
+    config.caCertFile = parser.value(caCertOption);
+    config.trace = parser.isSet(traceOption);
+    config.history = !parser.isSet(noHistoryOption);
+
+    ClientWindow window(config);
     window.show();
     return app.exec();
 }
-
@@ -0,0 +1,193 @@
+#include "userlistmodel.h"
+
+#include <QFont>
+
+#include <algorithm>
+
+UserListModel::UserListModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int UserListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : static_cast<int>(m_users.size());
+}
+
+QVariant UserListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() < 0 || index.row() >= m_users.size()) {
+        return {};
+    }
+
+    const QString &name = m_users.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::UserRole:
+        return name;
+    case Qt::FontRole:
+        if (!m_selfName.isEmpty() && name == m_selfName) {
+            QFont f;
+            f.setBold(true);
+            return f;
+        }
+        return {};
+    default:
+        return {};
+    }
+}
+
+bool UserListModel::lessThan(const QString &a, const QString &b)
+{
+    const int c = QString::compare(a, b, Qt::CaseInsensitive);
+    if (c != 0) {
+        return c < 0;
+    }
+    return QString::compare(a, b, Qt::CaseSensitive) < 0;
+}
+
+void UserListModel::setUsers(QStringList users)
+{
+    if (!std::is_sorted(users.cbegin(), users.cend(), &UserListModel::lessThan)) {
+        std::sort(users.begin(), users.end(), &UserListModel::lessThan);
+    }
+
+    if (m_users.isEmpty() || users.isEmpty()) {
+        if (m_users.isEmpty() && users.isEmpty()) {
+            return;
+        }
+        beginResetModel();
+        m_users = std::move(users);
+        endResetModel();
+        return;
+    }
+
+    // Both lists are sorted with the same ordering, so a single merge pass finds
+    // every contiguous run that has to be removed or inserted.
+    qsizetype row = 0;
+    qsizetype j = 0;
+    while (row < m_users.size() || j < users.size()) {
+        if (j == users.size()) {
+            beginRemoveRows({}, static_cast<int>(row), static_cast<int>(m_users.size() - 1));
+            m_users.remove(row, m_users.size() - row);
+            endRemoveRows();
+            break;
+        }
+
+        if (row == m_users.size()) {
+            const qsizetype count = users.size() - j;
+            beginInsertRows({}, static_cast<int>(row), static_cast<int>(row + count - 1));
+            m_users.append(users.mid(j));
+            endInsertRows();
+            break;
+        }
+
+        const QString &current = m_users.at(row);
+        const QString &wanted = users.at(j);
+        if (current == wanted) {
+            ++row;
+            ++j;
+            continue;
+        }
+
+        if (lessThan(current, wanted)) {
+            qsizetype last = row;
+            while (last + 1 < m_users.size() && lessThan(m_users.at(last + 1), wanted)) {
+                ++last;
+            }
+            beginRemoveRows({}, static_cast<int>(row), static_cast<int>(last));
+            m_users.remove(row, last - row + 1);
+            endRemoveRows();
+            continue;
+        }
+
+        qsizetype end = j + 1;
+        while (end < users.size() && lessThan(users.at(end), current)) {
+            ++end;
+        }
+        const qsizetype count = end - j;
+        beginInsertRows({}, static_cast<int>(row), static_cast<int>(row + count - 1));
+        m_users = m_users.mid(0, row) + users.mid(j, count) + m_users.mid(row);
+        endInsertRows();
+        row += count;
+        j = end;
+    }
+}
+
+void UserListModel::setSelfName(const QString &name)
+{
+    if (m_selfName == name) {
+        return;
+    }
+
+    const int oldRow = rowOf(m_selfName);
+    m_selfName = name;
+    const int newRow = rowOf(m_selfName);
+
+    if (oldRow >= 0) {
+        emit dataChanged(index(oldRow), index(oldRow), {Qt::FontRole});
+    }
+    if (newRow >= 0) {
+        emit dataChanged(index(newRow), index(newRow), {Qt::FontRole});
+    }
+}
+
+void UserListModel::clear()
+{
+    setUsers({});
+}
+
+const QStringList &UserListModel::users() const
+{
+    return m_users;
+}
+
+QString UserListModel::userAt(int row) const
+{
+    return (row >= 0 && row < m_users.size()) ? m_users.at(row) : QString();
+}
+
+int UserListModel::rowOf(const QString &name) const
+{
+    if (name.isEmpty()) {
+        return -1;
+    }
+    const auto it = std::lower_bound(m_users.cbegin(), m_users.cend(), name, &UserListModel::lessThan);
+    if (it == m_users.cend() || *it != name) {
+        return -1;
+    }
+    return static_cast<int>(it - m_users.cbegin());
+}
+
+UserFilterModel::UserFilterModel(QObject *parent)
+    : QSortFilterProxyModel(parent)
+{
+    setDynamicSortFilter(true);
+}
+
+void UserFilterModel::setFilterText(const QString &text)
+{
+    const QString filter = text.trimmed();
+    if (filter == m_filter) {
+        return;
+    }
+    m_filter = filter;
+    invalidateFilter();
+}
+
+QString UserFilterModel::filterText() const
+{
+    return m_filter;
+}
+
+bool UserFilterModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+{
+    if (m_filter.isEmpty() || sourceParent.isValid()) {
+        return true;
+    }
+    const auto *users = qobject_cast<const UserListModel *>(sourceModel());
+    if (!users) {
+        return QSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+    }
+    return users->userAt(sourceRow).contains(m_filter, Qt::CaseInsensitive);
+}
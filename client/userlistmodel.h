@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QSortFilterProxyModel>
+#include <QString>
+#include <QStringList>
+
+// Sorted list of online users. setUsers() diffs the new snapshot against the
+// current rows and only emits insert/remove signals for the ranges that changed,
+// so a single join/leave costs one row update instead of a full rebuild.
+class UserListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit UserListModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void setUsers(QStringList users);
+    void setSelfName(const QString &name);
+    void clear();
+
+    const QStringList &users() const;
+    QString userAt(int row) const;
+
+    static bool lessThan(const QString &a, const QString &b);
+
+private:
+    int rowOf(const QString &name) const;
+
+    QStringList m_users;
+    QString m_selfName;
+};
+
+// Case-insensitive substring filter on top of UserListModel. Matches directly
+// against the source string list instead of going through QVariant/regex.
+class UserFilterModel : public QSortFilterProxyModel
+{
+    Q_OBJECT
+
+public:
+    explicit UserFilterModel(QObject *parent = nullptr);
+
+    void setFilterText(const QString &text);
+    QString filterText() const;
+
+protected:
+    bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const override;
+
+private:
+    QString m_filter;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// Traffic capture: what the server received, in the order each connection
+// received it, for chatreplay to play back against a server.
+//
+// The file starts with kMagic and the capture's start as a little-endian
+// quint64 of milliseconds since the epoch, then holds records:
+//
+//   kind:u8  clientId:varint  timeNs:varint  [kind Line/Session: length:varint bytes]
+//
+// timeNs counts from the start of the capture. Workers write their records in
+// blocks, so records of different connections are only roughly in time order;
+// those of one connection are in order.
+namespace Capture {
+
+constexpr char kMagic[8] = {'C', 'H', 'A', 'T', 'C', 'A', 'P', '1'};
+constexpr int kHeaderSize = 16;
+
+enum class Kind : quint8 {
+    Open = 1,    // connection accepted
+    Line = 2,    // one received line, without its newline
+    Close = 3,   // connection gone
+    Session = 4, // logged in or resumed: the user name
+};
+
+struct Record {
+    Kind kind = Kind::Line;
+    quint64 clientId = 0;
+    qint64 timeNs = 0;
+    QByteArray data;
+};
+
+inline void appendVarint(QByteArray *out, quint64 value)
+{
+    while (value >= 0x80) {
+        out->append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->append(static_cast<char>(value));
+}
+
+inline bool readVarint(const char **p, const char *end, quint64 *value)
+{
+    quint64 result = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        const auto byte = static_cast<quint8>(*(*p)++);
+        result |= static_cast<quint64>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline QByteArray header(qint64 startMs)
+{
+    QByteArray out(kMagic, sizeof(kMagic));
+    for (int i = 0; i < 8; ++i) {
+        out.append(static_cast<char>((static_cast<quint64>(startMs) >> (8 * i)) & 0xff));
+    }
+    return out;
+}
+
+// Start time from a file header; false if `data` does not start with one.
+inline bool parseHeader(const QByteArray &data, qint64 *startMs)
+{
+    if (data.size() < kHeaderSize || !data.startsWith(QByteArray(kMagic, sizeof(kMagic)))) {
+        return false;
+    }
+    quint64 ms = 0;
+    for (int i = 0; i < 8; ++i) {
+        ms |= static_cast<quint64>(static_cast<quint8>(data.at(8 + i))) << (8 * i);
+    }
+    *startMs = static_cast<qint64>(ms);
+    return true;
+}
+
+inline void appendRecord(QByteArray *out, Kind kind, quint64 clientId, qint64 timeNs, const QByteArray &data = QByteArray())
+{
+    out->append(static_cast<char>(kind));
+    appendVarint(out, clientId);
+    appendVarint(out, static_cast<quint64>(qMax<qint64>(0, timeNs)));
+    if (kind == Kind::Line || kind == Kind::Session) {
+        appendVarint(out, static_cast<quint64>(data.size()));
+        out->append(data);
+    }
+}
+
+// Reads the record at *p and advances past it; false at the end of the data or
+// on a truncated record (the tail of a capture cut short by a crash).
+inline bool readRecord(const char **p, const char *end, Record *record)
+{
+    if (*p >= end) {
+        return false;
+    }
+    const auto kind = static_cast<Kind>(static_cast<quint8>(*(*p)++));
+    quint64 clientId = 0;
+    quint64 timeNs = 0;
+    if (!readVarint(p, end, &clientId) || !readVarint(p, end, &timeNs)) {
+        return false;
+    }
+    record->kind = kind;
+    record->clientId = clientId;
+    record->timeNs = static_cast<qint64>(timeNs);
+    record->data.clear();
+
+    switch (kind) {
+    case Kind::Open:
+    case Kind::Close:
+        return true;
+    case Kind::Line:
+    case Kind::Session: {
+        quint64 length = 0;
+        if (!readVarint(p, end, &length) || length > static_cast<quint64>(end - *p)) {
+            return false;
+        }
+        record->data = QByteArray(*p, static_cast<qsizetype>(length));
+        *p += length;
+        return true;
+    }
+    }
+    return false;
+}
+
+} // namespace Capture
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+#include <algorithm>
+
+// Latency samples in nanoseconds with percentile summaries. Shared by the
+// benchmark tools so every report uses the same format:
+//
+//   [title] n=1000 rate=5234.1/s
+//     latency ms: min=0.120 p50=0.340 p90=0.810 p99=2.100 max=5.300 avg=0.420
+class LatencyStats
+{
+public:
+    void add(qint64 ns)
+    {
+        m_samples.push_back(ns);
+        m_sum += ns;
+        m_sorted = false;
+    }
+
+    void merge(const LatencyStats &other)
+    {
+        m_samples.append(other.m_samples);
+        m_sum += other.m_sum;
+        m_sorted = m_samples.isEmpty();
+    }
+
+    void clear()
+    {
+        m_samples.clear();
+        m_sum = 0;
+        m_sorted = true;
+    }
+
+    qsizetype count() const { return m_samples.size(); }
+    bool isEmpty() const { return m_samples.isEmpty(); }
+
+    qint64 percentile(double p) const
+    {
+        if (m_samples.isEmpty()) {
+            return 0;
+        }
+        sort();
+        const auto last = m_samples.size() - 1;
+        const auto index = qBound<qsizetype>(0, static_cast<qsizetype>(p / 100.0 * static_cast<double>(last) + 0.5), last);
+        return m_samples.at(index);
+    }
+
+    qint64 min() const { return percentile(0); }
+    qint64 max() const { return percentile(100); }
+    double mean() const { return m_samples.isEmpty() ? 0.0 : static_cast<double>(m_sum) / static_cast<double>(m_samples.size()); }
+
+    QString report(const QString &title, double elapsedSec = 0.0) const
+    {
+        QString out = QString("[%1] n=%2").arg(title).arg(count());
+        if (elapsedSec > 0.0) {
+            out += QString(" rate=%1/s").arg(static_cast<double>(count()) / elapsedSec, 0, 'f', 1);
+        }
+        if (isEmpty()) {
+            return out;
+        }
+        out += QString("\n  latency ms: min=%1 p50=%2 p90=%3 p99=%4 max=%5 avg=%6")
+                   .arg(toMs(min()), 0, 'f', 3)
+                   .arg(toMs(percentile(50)), 0, 'f', 3)
+                   .arg(toMs(percentile(90)), 0, 'f', 3)
+                   .arg(toMs(percentile(99)), 0, 'f', 3)
+                   .arg(toMs(max()), 0, 'f', 3)
+                   .arg(mean() / 1e6, 0, 'f', 3);
+        return out;
+    }
+
+    static double toMs(qint64 ns) { return static_cast<double>(ns) / 1e6; }
+
+private:
+    void sort() const
+    {
+        if (!m_sorted) {
+            std::sort(m_samples.begin(), m_samples.end());
+            m_sorted = true;
+        }
+    }
+
+    mutable QList<qint64> m_samples;
+    mutable bool m_sorted = true;
+    qint64 m_sum = 0;
+};
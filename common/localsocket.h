@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Same-host connections to the server's Unix domain socket (server
+// --local-socket). The descriptor goes to a QTcpSocket/QSslSocket through
+// setSocketDescriptor(), which makes it non-blocking; the chat protocol on it
+// is the same as over TCP, without TLS. Linux only; elsewhere connectTo()
+// fails.
+namespace LocalSocket {
+
+// A connected stream socket, or -1 and *error.
+inline qintptr connectTo(const QString &path, QString *error)
+{
+#ifdef Q_OS_LINUX
+    sockaddr_un addr;
+    const QByteArray native = path.toLocal8Bit();
+    if (native.isEmpty() || native.size() >= static_cast<qsizetype>(sizeof(addr.sun_path))) {
+        *error = QStringLiteral("socket path too long");
+        return -1;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, native.constData(), static_cast<size_t>(native.size()));
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        *error = qt_error_string(errno);
+        return -1;
+    }
+    int rc = 0;
+    do {
+        rc = ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        *error = qt_error_string(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    Q_UNUSED(path);
+    *error = QStringLiteral("local sockets need Linux");
+    return -1;
+#endif
+}
+
+} // namespace LocalSocket
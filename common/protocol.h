@@ -3,6 +3,7 @@
 #include <QByteArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QList>
 #include <QString>
 
 namespace Protocol {
@@ -11,11 +12,100 @@ constexpr quint16 kDefaultPort = 45454;
 constexpr int kMaxNameLength = 20;
 constexpr int kMaxMessageLength = 500;
 
+// A private request may name up to this many recipients as a "to" array; it
+// is delivered once to each and answered with one "private_result" holding
+// every recipient's outcome.
+constexpr int kMaxPrivateRecipients = 50;
+
+// Session resume: the server keeps the last kResumeBufferSize sequenced lines of
+// every session and holds a dropped session (and its name) for kResumeGraceMs.
+constexpr int kResumeBufferSize = 256;
+constexpr int kResumeGraceMs = 60 * 1000;
+
+// File transfer lane. File bytes travel as data frames on the chat connection:
+// a header line "@<id> <offset> <length>" followed by exactly <length> raw
+// bytes. Lines starting with '@' are never JSON, so either side can tell a
+// frame from a message without parsing. Frames are at most kFileChunkSize so a
+// chat line never waits behind more than one chunk.
+constexpr int kFileChunkSize = 64 * 1024;
+constexpr int kMaxFileNameLength = 255;
+
 inline QByteArray toLine(const QJsonObject &obj)
 {
     return QJsonDocument(obj).toJson(QJsonDocument::Compact) + '\n';
 }
 
+// Latency tracing, only for requests that ask for it. A client adds
+// "trace":{"t":<its own clock in µs>} to a chat or private request; the
+// message then carries "trace":{"t":..,"rx":..,"rt":..,"w":..} with the server's
+// monotonic clock in ns when the line was received, routed, and written to each
+// recipient's socket. The router leaves "w" as 0 at the very end of the line,
+// so a worker recognizes a traced line by its tail alone.
+inline constexpr char kTraceWriteTail[] = "\"w\":0}}\n";
+
+// Appends the trace object to an encoded line ending in "}\n".
+inline QByteArray withTrace(const QByteArray &line, qint64 clientUs, qint64 receivedNs, qint64 routedNs)
+{
+    if (!line.endsWith("}\n")) {
+        return line;
+    }
+    QByteArray out = line.left(line.size() - 2);
+    out.append(",\"trace\":{\"t\":" + QByteArray::number(clientUs) + ",\"rx\":" + QByteArray::number(receivedNs) + ",\"rt\":"
+        + QByteArray::number(routedNs) + ',' + kTraceWriteTail);
+    return out;
+}
+
+// Fills in "w" of a line ending in kTraceWriteTail.
+inline void stampTraceWrite(QByteArray *line, qint64 writtenNs)
+{
+    line->chop(4); // "0}}\n"
+    line->append(QByteArray::number(writtenNs) + "}}\n");
+}
+
+// Splices a "seq" field into an already encoded compact JSON line, so one
+// encoded message can be stamped per recipient without re-serializing it.
+inline QByteArray withSeq(const QByteArray &line, quint64 seq)
+{
+    if (!line.startsWith('{')) {
+        return line;
+    }
+
+    const QByteArray field = "\"seq\":" + QByteArray::number(seq);
+    QByteArray out;
+    out.reserve(line.size() + field.size() + 1);
+    out.append('{');
+    out.append(field);
+    if (line.size() > 1 && line.at(1) != '}') {
+        out.append(',');
+    }
+    out.append(line.constData() + 1, line.size() - 1);
+    return out;
+}
+
+inline QByteArray dataFrameHeader(const QByteArray &id, qint64 offset, qint64 length)
+{
+    return '@' + id + ' ' + QByteArray::number(offset) + ' ' + QByteArray::number(length) + '\n';
+}
+
+// Parses a header line without its newline; false if it is not a frame header.
+inline bool parseDataFrameHeader(const QByteArray &line, QByteArray *id, qint64 *offset, qint64 *length)
+{
+    if (!line.startsWith('@')) {
+        return false;
+    }
+    const QList<QByteArray> parts = line.mid(1).split(' ');
+    if (parts.size() != 3 || parts.at(0).isEmpty()) {
+        return false;
+    }
+
+    bool offsetOk = false;
+    bool lengthOk = false;
+    *id = parts.at(0);
+    *offset = parts.at(1).toLongLong(&offsetOk);
+    *length = parts.at(2).toLongLong(&lengthOk);
+    return offsetOk && lengthOk && *offset >= 0 && *length >= 0 && *length <= kFileChunkSize;
+}
+
 inline QString normalizeName(QString name)
 {
     return name.trimmed();
@@ -2,9 +2,15 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     server \
-    client
+    client \
+    chatbench \
+    chatreplay \
+    chatsim
 
 # Work around MinGW make/cmd Unicode-path issues on Windows by ensuring the
 # sub-project .pro paths passed to qmake are relative (ASCII-only).
 server.file = server/server.pro
 client.file = client/client.pro
+chatbench.file = tools/chatbench/chatbench.pro
+chatreplay.file = tools/chatreplay/chatreplay.pro
+chatsim.file = tools/chatsim/chatsim.pro
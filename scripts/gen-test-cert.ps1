@@ -0,0 +1,41 @@
+#!/usr/bin/env pwsh
+
+# Generates a self-signed certificate for local TLS testing:
+#   server --tls-cert <out>/server.crt --tls-key <out>/server.key
+#   client --ca-cert <out>/server.crt
+#   chatbench --tls --ca-cert <out>/server.crt
+
+[CmdletBinding()]
+param(
+    [string]$OutDir,
+    [int]$Days = 365
+)
+
+$ErrorActionPreference = 'Stop'
+
+$root = Resolve-Path (Join-Path $PSScriptRoot '..')
+if (-not $OutDir) {
+    $OutDir = Join-Path $root 'build/certs'
+}
+New-Item -ItemType Directory -Force -Path $OutDir | Out-Null
+
+$openssl = Get-Command openssl -ErrorAction SilentlyContinue
+if (-not $openssl) {
+    Write-Host "ERROR: openssl not found in PATH." -ForegroundColor Yellow
+    exit 1
+}
+
+$key = Join-Path $OutDir 'server.key'
+$crt = Join-Path $OutDir 'server.crt'
+
+& $openssl.Source req -x509 -nodes `
+    -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 `
+    -keyout $key -out $crt -days $Days `
+    -subj '/CN=localhost' `
+    -addext 'subjectAltName=DNS:localhost,IP:127.0.0.1,IP:::1'
+if ($LASTEXITCODE -ne 0) {
+    exit $LASTEXITCODE
+}
+
+Write-Host "Certificate: $crt"
+Write-Host "Private key: $key"
@@ -0,0 +1,70 @@
+#include "capturewriter.h"
+
+#include "capturefile.h"
+#include "routerthread.h"
+
+#include <QDateTime>
+#include <QMutexLocker>
+
+bool CaptureWriter::open(const QString &path, QString *error)
+{
+    close();
+
+    QMutexLocker locker(&m_mutex);
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = m_file.errorString();
+        return false;
+    }
+    m_file.write(Capture::header(QDateTime::currentMSecsSinceEpoch()));
+    m_records.storeRelaxed(0);
+    m_bytes.storeRelaxed(Capture::kHeaderSize);
+    m_failedWrites.storeRelaxed(0);
+    m_startNs.storeRelaxed(RouterThread::nowNs());
+    m_enabled.storeRelease(true);
+    return true;
+}
+
+void CaptureWriter::close()
+{
+    m_enabled.storeRelease(false);
+
+    QMutexLocker locker(&m_mutex);
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+}
+
+qint64 CaptureWriter::nowNs() const
+{
+    return RouterThread::nowNs() - m_startNs.loadRelaxed();
+}
+
+void CaptureWriter::write(const QByteArray &block, int records)
+{
+    QMutexLocker locker(&m_mutex);
+    // A worker can still hold a block from before close().
+    if (!m_file.isOpen()) {
+        return;
+    }
+    if (m_file.write(block) != block.size()) {
+        m_failedWrites.fetchAndAddRelaxed(1);
+        return;
+    }
+    m_records.fetchAndAddRelaxed(static_cast<quint64>(records));
+    m_bytes.fetchAndAddRelaxed(static_cast<quint64>(block.size()));
+}
+
+CaptureWriter::Stats CaptureWriter::stats() const
+{
+    Stats s;
+    s.enabled = isEnabled();
+    {
+        QMutexLocker locker(&m_mutex);
+        s.path = m_file.fileName();
+    }
+    s.records = m_records.loadRelaxed();
+    s.bytes = m_bytes.loadRelaxed();
+    s.failedWrites = m_failedWrites.loadRelaxed();
+    return s;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+
+// Records what the server receives into a capture file (see capturefile.h),
+// shared by every ClientWorker. Workers encode records into a buffer of their
+// own and hand it over once per read, so the hot path costs a timestamp and a
+// memcpy; only the hand-over takes the lock.
+class CaptureWriter
+{
+public:
+    struct Stats {
+        bool enabled = false;
+        QString path;
+        quint64 records = 0;
+        quint64 bytes = 0;
+        quint64 failedWrites = 0;
+    };
+
+    bool open(const QString &path, QString *error);
+    void close();
+
+    // Any thread.
+    bool isEnabled() const { return m_enabled.loadAcquire(); }
+    qint64 nowNs() const;
+    void write(const QByteArray &block, int records);
+    Stats stats() const;
+
+private:
+    mutable QMutex m_mutex;
+    QFile m_file;
+    QAtomicInteger<bool> m_enabled;
+    QAtomicInteger<qint64> m_startNs;
+
+    QAtomicInteger<quint64> m_records;
+    QAtomicInteger<quint64> m_bytes;
+    QAtomicInteger<quint64> m_failedWrites;
+};
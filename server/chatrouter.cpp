@@ -0,0 +1,1561 @@
+#include "chatrouter.h"
+
+#include "clientworker.h"
+#include "envelope.h"
+#include "filespool.h"
+#include "protocol.h"
+#include "routerthread.h"
+#include "shardmap.h"
+#include "spanrecorder.h"
+#include "tracestats.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+#include <QSemaphore>
+#include <QThread>
+#include <QTimer>
+
+#include <utility>
+
+// While coalescing: at most one user list this often.
+static constexpr qint64 kCoalescedPresenceMs = 1000;
+
+static QString toCompactJson(const QJsonObject &obj)
+{
+    return QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+}
+
+static QString toPrettyJson(const QJsonObject &obj)
+{
+    return QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Indented)).trimmed();
+}
+
+static QByteArray newResumeToken()
+{
+    quint32 words[4];
+    QRandomGenerator::system()->fillRange(words);
+    return QByteArray(reinterpret_cast<const char *>(words), sizeof(words)).toHex();
+}
+
+static IngressEvent shardEvent(IngressEvent::Kind kind, const QByteArray &line, const QString &name = QString(), const QString &peer = QString())
+{
+    IngressEvent event;
+    event.kind = kind;
+    event.line = line;
+    event.name = name;
+    event.peer = peer;
+    return event;
+}
+
+static QString formatSize(qint64 bytes)
+{
+    if (bytes < 1024) {
+        return QString("%1 B").arg(bytes);
+    }
+    if (bytes < 1024 * 1024) {
+        return QString("%1 KiB").arg(static_cast<double>(bytes) / 1024, 0, 'f', 1);
+    }
+    return QString("%1 MiB").arg(static_cast<double>(bytes) / (1024 * 1024), 0, 'f', 1);
+}
+
+static OfflineMailbox::Limits mailboxLimits(int shardCount)
+{
+    // The caps are for the whole server; each shard gets its share.
+    OfflineMailbox::Limits limits;
+    limits.maxMemoryBytes /= qMax(1, shardCount);
+    limits.maxRecipients = qMax(1, limits.maxRecipients / qMax(1, shardCount));
+    limits.maxSpillBytes /= qMax(1, shardCount);
+    return limits;
+}
+
+ChatRouter::ChatRouter(const ServerConfig &config, int index, const ServerContext &context, QObject *parent)
+    : QObject(parent)
+    , m_config(config)
+    , m_index(index)
+    , m_shards(context.shards)
+    , m_connectionLimit(context.connectionLimit)
+    , m_spool(context.spool)
+    , m_trace(context.trace)
+    , m_filter(context.filter)
+    , m_overload(context.overload)
+    , m_spans(context.spans)
+    , m_sessionTimer(new QTimer(this))
+    , m_mailboxTimer(new QTimer(this))
+    , m_statsTimer(new QTimer(this))
+    , m_mailbox(mailboxLimits(context.shards->count()))
+{
+    m_sessionTimer->setInterval(1000);
+    connect(m_sessionTimer, &QTimer::timeout, this, &ChatRouter::expireSessions);
+
+    m_mailboxTimer->setInterval(60 * 1000);
+    connect(m_mailboxTimer, &QTimer::timeout, this, &ChatRouter::expireMailbox);
+
+    m_statsTimer->setInterval(500);
+    connect(m_statsTimer, &QTimer::timeout, this, &ChatRouter::publishStats);
+
+    m_mailbox.setSpillDirectory(m_config.mailboxDir, [this](const QString &recipient) { return m_shards->shardForName(recipient) == m_index; });
+    publishStats();
+}
+
+void ChatRouter::handleIngress(IngressEvent &event)
+{
+    switch (event.kind) {
+    case IngressEvent::Kind::Attach: {
+        const ClientRegistry::Handle client = attachClient(event.clientId, event.worker, event.thread);
+        if (!event.name.isEmpty()) {
+            // Taken over logged in: its imported session reaches it through
+            // the handle from now on.
+            m_clients.logIn(client, event.name);
+            Session *session = findSession(event.name);
+            if (session && session->clientId == event.clientId) {
+                session->client = client;
+            }
+        }
+        break;
+    }
+    case IngressEvent::Kind::Line:
+        if (!forwardIfMoved(event) && !m_stopping) {
+            onClientLine(event.clientId, event.line, event.enqueuedNs);
+        }
+        break;
+    case IngressEvent::Kind::Disconnected:
+        if (forwardIfMoved(event)) {
+            break;
+        }
+        if (m_handingOver) {
+            m_departed.push_back(event.clientId);
+        } else {
+            removeClient(event.clientId, !m_stopping);
+        }
+        break;
+    case IngressEvent::Kind::Handoff:
+        handOff(event);
+        break;
+    case IngressEvent::Kind::FileUploaded:
+        if (!m_stopping) {
+            fileUploaded(event.clientId, event.line);
+        }
+        break;
+    case IngressEvent::Kind::Adopt:
+        adoptClient(event);
+        break;
+    case IngressEvent::Kind::Publish:
+        if (!m_stopping) {
+            publish(event.line);
+        }
+        break;
+    case IngressEvent::Kind::Broadcast:
+        if (!m_stopping) {
+            deliverToAll(event.line);
+        }
+        break;
+    case IngressEvent::Kind::Join:
+    case IngressEvent::Kind::Leave:
+        if (!m_stopping) {
+            updatePresence(event.name, event.kind == IngressEvent::Kind::Join);
+        }
+        break;
+    case IngressEvent::Kind::UserList:
+        if (!m_stopping) {
+            sendUserList(event.line);
+        }
+        break;
+    case IngressEvent::Kind::Private:
+        if (!m_stopping) {
+            acceptPrivate(event.name, event.peer, event.line);
+        }
+        break;
+    case IngressEvent::Kind::PrivateResult:
+        if (!m_stopping) {
+            finishPrivate(event.name, event.peer, event.line, static_cast<PrivateOutcome>(event.code));
+        }
+        break;
+    case IngressEvent::Kind::PrivateGroup:
+        if (!m_stopping) {
+            acceptPrivateGroup(event.name, event.names, event.line, event.code);
+        }
+        break;
+    case IngressEvent::Kind::PrivateGroupResult:
+        if (!m_stopping) {
+            finishPrivateGroup(event.code, event.names, event.line);
+        }
+        break;
+    case IngressEvent::Kind::SearchResult:
+        if (!m_stopping) {
+            const ClientRegistry::Handle client = m_clients.find(event.clientId);
+            if (!client.isNull() && m_clients.isLoggedIn(client) && m_clients.name(client) == event.name) {
+                sendLine(m_clients.worker(client), event.line);
+            }
+        }
+        break;
+    case IngressEvent::Kind::Index:
+    case IngressEvent::Kind::IndexPrivate:
+    case IngressEvent::Kind::Search:
+        break;
+    }
+}
+
+void ChatRouter::onBatchDone()
+{
+    flushPresence();
+}
+
+QJsonObject ChatRouter::stats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_statsSnapshot;
+}
+
+void ChatRouter::start()
+{
+    if (!m_config.mailboxDir.isEmpty() && isCoordinator()) {
+        emit log(m_mailbox.spillDirectory().isEmpty()
+                ? QString("offline mailbox: cannot use spill directory %1").arg(m_config.mailboxDir)
+                : QString("offline mailbox: spilling to %1").arg(m_mailbox.spillDirectory()));
+    }
+    m_mailboxTimer->start();
+    m_statsTimer->start();
+}
+
+void ChatRouter::beginShutdown()
+{
+    m_stopping = true;
+
+    // The listener is already closed; anything still queued (including Attach
+    // events for connections accepted just before) is taken in now.
+    m_shards->thread(m_index)->drainPending();
+}
+
+void ChatRouter::finishShutdown()
+{
+    m_shards->thread(m_index)->drainPending();
+
+    const auto clientIds = m_clients.ids();
+    for (quint64 id : clientIds) {
+        removeClient(id, false);
+    }
+    m_sessions.clear();
+    m_sessionIndex.clear();
+    m_tokenToName.clear();
+    m_privateGroups.clear();
+    m_userListLine.clear();
+    m_presence.clear();
+    m_presenceDirty = false;
+    m_sessionTimer->stop();
+    m_mailboxTimer->stop();
+    m_statsTimer->stop();
+    publishStats();
+
+    m_stopping = false;
+    if (isCoordinator()) {
+        emit usersChanged({});
+        emit log("server stopped");
+    }
+}
+
+void ChatRouter::beginHandover()
+{
+    m_handingOver = true;
+    m_sessionTimer->stop();
+    m_mailboxTimer->stop();
+}
+
+int ChatRouter::drainHandover()
+{
+    return m_shards->thread(m_index)->drainPending();
+}
+
+QJsonObject ChatRouter::exportState()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    // Workers are frozen, so none of them is waiting on this router's queue
+    // and the blocking calls below cannot deadlock.
+    QJsonArray clients;
+    QSet<QString> moving;
+    QSet<QString> loggedOut;
+    m_clients.forEach([&](ClientRegistry::Handle client) {
+        const quint64 id = m_clients.clientId(client);
+        const QString name = m_clients.name(client);
+        if (m_clients.hasLoggedOut(client)) {
+            loggedOut.insert(name);
+            return;
+        }
+        ClientWorker *const clientWorker = m_clients.worker(client);
+        if (!clientWorker || m_departed.contains(id)) {
+            return;
+        }
+        QJsonObject worker;
+        QMetaObject::invokeMethod(clientWorker, "exportState", Qt::BlockingQueuedConnection, Q_RETURN_ARG(QJsonObject, worker));
+        if (worker.isEmpty()) {
+            return;
+        }
+        m_exportedFds.insert(id, worker.value("fd").toInt());
+        if (m_clients.isLoggedIn(client)) {
+            moving.insert(name);
+        }
+        clients.append(QJsonObject{
+            {"id", static_cast<qint64>(id)},
+            {"name", name},
+            {"worker", worker},
+        });
+    });
+
+    // Sessions whose connection stays behind are handed over detached; the
+    // client resumes them on the new server.
+    QJsonArray sessions;
+    for (const Session &session : std::as_const(m_sessions)) {
+        if (loggedOut.contains(session.name)) {
+            continue;
+        }
+        const bool attached = session.clientId != 0 && moving.contains(session.name);
+        QJsonArray replay;
+        for (const auto &entry : session.replay) {
+            replay.append(QJsonArray{static_cast<qint64>(entry.first), QString::fromUtf8(entry.second)});
+        }
+        sessions.append(QJsonObject{
+            {"name", session.name},
+            {"token", QString::fromLatin1(session.token)},
+            {"client_id", attached ? static_cast<qint64>(session.clientId) : 0},
+            {"last_seq", static_cast<qint64>(session.lastSeq)},
+            {"replay", replay},
+            {"detached_at_ms", attached ? 0 : (session.clientId != 0 ? now : session.detachedAtMs)},
+        });
+    }
+
+    QJsonObject state{
+        {"clients", clients},
+        {"sessions", sessions},
+        {"mailbox", m_mailbox.exportBoxes()},
+        {"known", m_mailbox.exportRecipients()},
+    };
+    if (isCoordinator()) {
+        state.insert("user_list", QString::fromUtf8(m_userListLine));
+    }
+    return state;
+}
+
+void ChatRouter::finishHandover()
+{
+    // The successor holds the connections now: workers go without a word to
+    // their peers, and spill files stay for the successor to read.
+    const auto clientIds = m_clients.ids();
+    for (quint64 id : clientIds) {
+        releaseClient(m_clients.take(m_clients.find(id)));
+    }
+    m_departed.clear();
+    m_exportedFds.clear();
+    m_sessions.clear();
+    m_sessionIndex.clear();
+    m_tokenToName.clear();
+    m_privateGroups.clear();
+    m_userListLine.clear();
+    m_presence.clear();
+    m_presenceDirty = false;
+    m_mailbox.clear();
+    m_statsTimer->stop();
+    m_handingOver = false;
+    publishStats();
+
+    if (isCoordinator()) {
+        emit usersChanged({});
+        emit log("handed over to the new server");
+    }
+}
+
+void ChatRouter::cancelHandover()
+{
+    m_handingOver = false;
+    m_clients.forEach([this](ClientRegistry::Handle client) {
+        if (ClientWorker *worker = m_clients.worker(client)) {
+            QMetaObject::invokeMethod(worker, "thaw", Qt::QueuedConnection, Q_ARG(qintptr, m_exportedFds.value(m_clients.clientId(client), -1)));
+        }
+    });
+    m_exportedFds.clear();
+
+    const QList<quint64> departed = std::move(m_departed);
+    m_departed.clear();
+    for (quint64 id : departed) {
+        removeClient(id, true);
+    }
+    m_sessionTimer->start();
+    m_mailboxTimer->start();
+}
+
+void ChatRouter::importState(const QJsonObject &state)
+{
+    bool detached = false;
+    for (const auto &value : state.value("sessions").toArray()) {
+        const QJsonObject obj = value.toObject();
+        Session session;
+        session.name = obj.value("name").toString();
+        session.token = obj.value("token").toString().toLatin1();
+        session.clientId = static_cast<quint64>(obj.value("client_id").toInteger());
+        // Null unless its connection was attached first; see Kind::Attach.
+        session.client = m_clients.find(session.clientId);
+        session.lastSeq = static_cast<quint64>(obj.value("last_seq").toInteger());
+        session.detachedAtMs = obj.value("detached_at_ms").toInteger();
+        for (const auto &entry : obj.value("replay").toArray()) {
+            const QJsonArray pair = entry.toArray();
+            session.replay.append(qMakePair(static_cast<quint64>(pair.at(0).toInteger()), pair.at(1).toString().toUtf8()));
+            session.replayBytes += session.replay.constLast().second.size();
+        }
+        detached = detached || session.clientId == 0;
+        m_tokenToName.insert(session.token, session.name);
+        addSession(session);
+    }
+    if (detached) {
+        m_sessionTimer->start();
+    }
+
+    m_mailbox.importBoxes(state.value("mailbox").toArray());
+    m_mailbox.importRecipients(state.value("known").toArray());
+    m_userListLine = state.value("user_list").toString().toUtf8();
+
+    // Presence is every session on every shard, connected or not; clients
+    // already have the list, so it is only shown here.
+    if (isCoordinator()) {
+        QStringList users;
+        for (const auto &name : state.value("presence").toArray()) {
+            m_presence.insert(name.toString());
+            users.push_back(name.toString());
+        }
+        users.sort(Qt::CaseInsensitive);
+        emit usersChanged(users);
+    }
+    publishStats();
+}
+
+void ChatRouter::publishStats()
+{
+    const OfflineMailbox::Stats mail = m_mailbox.stats();
+    QJsonObject snapshot{
+        {"connections", static_cast<int>(m_clients.size())},
+        {"sessions", static_cast<int>(m_sessions.size())},
+        {"mailbox",
+            QJsonObject{
+                {"recipients", mail.recipients},
+                {"pending", mail.pending},
+                {"queued", static_cast<qint64>(mail.queued)},
+                {"delivered", static_cast<qint64>(mail.delivered)},
+                {"bursts", static_cast<qint64>(mail.deliveryBursts)},
+                {"spilled", static_cast<qint64>(mail.spilled)},
+                {"dropped_full", static_cast<qint64>(mail.droppedFull)},
+                {"dropped_expired", static_cast<qint64>(mail.droppedExpired)},
+                {"unknown", static_cast<qint64>(mail.unknown)},
+                {"memory_bytes", mail.memoryBytes},
+                {"spill_bytes", mail.spillBytes},
+            }},
+    };
+
+    QMutexLocker locker(&m_statsMutex);
+    m_statsSnapshot = std::move(snapshot);
+    locker.unlock();
+
+    // A user list held back while coalescing.
+    flushPresence();
+}
+
+bool ChatRouter::isCoordinator() const
+{
+    return m_index == ShardMap::kCoordinator;
+}
+
+bool ChatRouter::forwardIfMoved(IngressEvent &event)
+{
+    // A worker that dropped mid-handoff sends its last input through the old
+    // router; it follows the Adopt event to the new one.
+    if (event.shard < 0 || event.shard == m_index || m_clients.contains(event.clientId)) {
+        return false;
+    }
+    const int shard = event.shard;
+    m_shards->forward(shard, std::move(event));
+    return true;
+}
+
+ClientRegistry::Handle ChatRouter::attachClient(quint64 clientId, ClientWorker *worker, QThread *thread)
+{
+    return m_clients.insert(clientId, worker, thread);
+}
+
+void ChatRouter::handOff(IngressEvent &event)
+{
+    const ClientRegistry::Handle client = m_clients.find(event.clientId);
+    if (client.isNull()) {
+        return;
+    }
+
+    // A logged-in connection never moves: its second login is answered here.
+    if (m_stopping || m_clients.isLoggedIn(client) || event.shard == m_index) {
+        if (ClientWorker *worker = m_clients.worker(client)) {
+            QMetaObject::invokeMethod(worker, "adopt", Qt::QueuedConnection, Q_ARG(int, m_index));
+        }
+        if (!m_stopping) {
+            onClientLine(event.clientId, event.line, event.enqueuedNs);
+        }
+        return;
+    }
+
+    const ClientRegistry::Entry entry = m_clients.take(client);
+
+    IngressEvent adopt = shardEvent(IngressEvent::Kind::Adopt, event.line);
+    adopt.clientId = event.clientId;
+    adopt.worker = entry.worker;
+    adopt.thread = entry.thread;
+    m_shards->forward(event.shard, std::move(adopt));
+}
+
+void ChatRouter::adoptClient(IngressEvent &event)
+{
+    attachClient(event.clientId, event.worker, event.thread);
+    if (event.worker) {
+        QMetaObject::invokeMethod(event.worker, "adopt", Qt::QueuedConnection, Q_ARG(int, m_index));
+    }
+    if (!m_stopping) {
+        onClientLine(event.clientId, event.line, event.enqueuedNs);
+    }
+}
+
+void ChatRouter::onClientLine(quint64 clientId, const QByteArray &line, qint64 receivedNs)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    if (client.isNull()) {
+        return;
+    }
+
+    QJsonParseError err;
+    QJsonDocument doc;
+    {
+        SpanRecorder::Scope span(m_spans, SpanRecorder::Parse, line.size());
+        doc = QJsonDocument::fromJson(line, &err);
+    }
+    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
+        emit log(QString("[%1] invalid json: %2").arg(clientId).arg(err.errorString()));
+        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid json"}});
+        return;
+    }
+
+    const QJsonObject obj = doc.object();
+    if (verbose()) {
+        const QString who = m_clients.isLoggedIn(client) ? m_clients.name(client) : QString("#%1").arg(clientId);
+        emit log(QString("[%1] JSON received from %2:\n%3").arg(clientId).arg(who, toPrettyJson(obj)));
+    }
+
+    const QString type = obj.value("type").toString();
+    if (type.isEmpty()) {
+        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "missing type"}});
+        return;
+    }
+
+    // Answered at once and outside the session sequence: it measures the
+    // round trip, and the worker sends it ahead of any queued chat.
+    if (type == "ping") {
+        sendLine(m_clients.worker(client), Protocol::toLine(QJsonObject{{"type", "pong"}, {"id", obj.value("id")}}));
+        return;
+    }
+
+    if (type == "login") {
+        handleLogin(clientId, obj);
+        return;
+    }
+
+    if (type == "resume") {
+        handleResume(clientId, obj);
+        return;
+    }
+
+    if (!m_clients.isLoggedIn(client)) {
+        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "not logged in"}});
+        return;
+    }
+    const QString from = m_clients.name(client);
+
+    if (type == "chat") {
+        QString text = Protocol::normalizeText(obj.value("text").toString());
+        if (!Protocol::isValidMessage(text)) {
+            sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid message"}});
+            return;
+        }
+        if (!filterText(clientId, from, &text)) {
+            return;
+        }
+
+        publish(traced(encodeWith([&] { return Envelope::chat(from, text); }), obj, receivedNs));
+        indexMessage(from, text);
+        if (verbose()) {
+            emit log(QString("[%1] %2: %3").arg(clientId).arg(from, text));
+        }
+        return;
+    }
+
+    if (type == "private") {
+        if (obj.value("to").isArray()) {
+            handlePrivateGroup(clientId, obj, receivedNs);
+            return;
+        }
+        const QString to = Protocol::normalizeName(obj.value("to").toString());
+        QString text = Protocol::normalizeText(obj.value("text").toString());
+        if (!Protocol::isValidName(to) || !Protocol::isValidMessage(text)) {
+            sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid private message"}});
+            return;
+        }
+        if (!filterText(clientId, from, &text)) {
+            return;
+        }
+
+        if (verbose()) {
+            emit log(QString("[%1] %2 -> %3: %4").arg(clientId).arg(from, to, text));
+        }
+        routePrivate(from, to, traced(encodeWith([&] { return Envelope::privateChat(from, to, text); }), obj, receivedNs));
+        return;
+    }
+
+    if (type == "search" || type == "history") {
+        const QString resultType = type + "_result";
+        if (degraded(OverloadController::Shed)) {
+            m_overload->count(OverloadController::RequestsShed);
+            sendJson(clientId, QJsonObject{{"type", resultType}, {"id", obj.value("id")}, {"error", "busy"}});
+            return;
+        }
+        if (!m_shards->hasSearch()) {
+            sendJson(clientId, QJsonObject{{"type", resultType}, {"id", obj.value("id")}, {"error", "disabled"}});
+            return;
+        }
+        // Answered from the search thread, which also keeps the history; the
+        // viewer decides which private messages can show up.
+        IngressEvent search = shardEvent(IngressEvent::Kind::Search, line, from);
+        search.clientId = clientId;
+        search.shard = m_index;
+        m_shards->toSearch(std::move(search));
+        return;
+    }
+
+    if (type == "file_put") {
+        handleFilePut(clientId, obj);
+        return;
+    }
+
+    if (type == "file_get") {
+        handleFileGet(clientId, obj);
+        return;
+    }
+
+    if (type == "logout") {
+        m_clients.setLoggedOut(client);
+        if (ClientWorker *worker = m_clients.worker(client)) {
+            QMetaObject::invokeMethod(worker, "disconnectFromHost", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "unknown type"}});
+}
+
+bool ChatRouter::filterText(quint64 clientId, const QString &from, QString *text)
+{
+    QStringList terms;
+    switch (m_filter.apply(text, &terms)) {
+    case ContentFilter::Outcome::Clean:
+        return true;
+    case ContentFilter::Outcome::Logged:
+        emit log(QString("[%1] filter: %2 wrote %3").arg(clientId).arg(from, terms.join(", ")));
+        return true;
+    case ContentFilter::Outcome::Masked:
+        emit log(QString("[%1] filter: masked %3 from %2").arg(clientId).arg(from, terms.join(", ")));
+        return true;
+    case ContentFilter::Outcome::Rejected:
+        emit log(QString("[%1] filter: rejected a message from %2 (%3)").arg(clientId).arg(from, terms.join(", ")));
+        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "message rejected by filter"}});
+        return false;
+    }
+    return true;
+}
+
+bool ChatRouter::verbose()
+{
+    if (degraded(OverloadController::Quiet)) {
+        m_overload->count(OverloadController::LogsSuppressed);
+        return false;
+    }
+    return true;
+}
+
+bool ChatRouter::degraded(OverloadController::Level level) const
+{
+    return m_overload && m_overload->atLeast(level);
+}
+
+void ChatRouter::handleLogin(quint64 clientId, const QJsonObject &obj)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    ClientWorker *const worker = m_clients.worker(client);
+    if (m_clients.isLoggedIn(client)) {
+        sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "already_logged_in"}});
+        return;
+    }
+    if (degraded(OverloadController::Closed)) {
+        m_overload->count(OverloadController::LoginsRejected);
+        sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "busy"}});
+        if (worker) {
+            QMetaObject::invokeMethod(worker, "disconnectFromHost", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    QString name = Protocol::normalizeName(obj.value("name").toString());
+    if (!Protocol::isValidName(name)) {
+        sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "invalid_name"}});
+        if (worker) {
+            QMetaObject::invokeMethod(worker, "disconnectFromHost", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    // The worker routed this login here because this shard owns the name, so
+    // the check and the insert below cannot race with another shard.
+    if (m_sessionIndex.contains(name)) {
+        sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "name_taken"}});
+        if (worker) {
+            QMetaObject::invokeMethod(worker, "disconnectFromHost", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    Session session;
+    session.name = name;
+    session.token = m_shards->makeToken(m_index, newResumeToken());
+    session.clientId = clientId;
+    session.client = client;
+    m_tokenToName.insert(session.token, name);
+    addSession(session);
+    m_mailbox.addRecipient(name);
+
+    m_clients.logIn(client, name);
+    if (worker) {
+        QMetaObject::invokeMethod(worker, "bind", Qt::QueuedConnection, Q_ARG(QString, name));
+    }
+
+    sendJson(clientId, QJsonObject{{"type", "login_ok"}, {"name", name}, {"token", QString::fromLatin1(session.token)}});
+    announcePresence(name, true);
+    emit log(QString("[%1] login ok: %2").arg(clientId).arg(name));
+
+    if (Session *added = findSession(name)) {
+        deliverOfflineMail(*added);
+    }
+}
+
+void ChatRouter::handleResume(quint64 clientId, const QJsonObject &obj)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    ClientWorker *const worker = m_clients.worker(client);
+    if (m_clients.isLoggedIn(client)) {
+        sendJson(clientId, QJsonObject{{"type", "resume_error"}, {"reason", "already_logged_in"}});
+        return;
+    }
+
+    const QByteArray token = obj.value("token").toString().toLatin1();
+    const auto nameIt = m_tokenToName.constFind(token);
+    Session *const found = (nameIt == m_tokenToName.constEnd()) ? nullptr : findSession(nameIt.value());
+    if (!found) {
+        sendJson(clientId, QJsonObject{{"type", "resume_error"}, {"reason", "unknown_session"}});
+        return;
+    }
+
+    Session &session = *found;
+
+    // The old socket may not have noticed the drop yet; the token proves
+    // ownership, so the new connection takes the session over.
+    if (session.clientId != 0 && session.clientId != clientId) {
+        const ClientRegistry::Handle old = m_clients.find(session.clientId);
+        if (!old.isNull()) {
+            m_clients.clearLogin(old);
+            if (ClientWorker *oldWorker = m_clients.worker(old)) {
+                QMetaObject::invokeMethod(oldWorker, "disconnectFromHost", Qt::QueuedConnection);
+            }
+        }
+        emit log(QString("[%1] session %2 taken over from #%3").arg(clientId).arg(session.name).arg(session.clientId));
+    }
+
+    const quint64 lastSeq = qMin<quint64>(static_cast<quint64>(qMax<qint64>(0, obj.value("last_seq").toInteger())), session.lastSeq);
+    const quint64 oldestSeq = session.replay.isEmpty() ? session.lastSeq + 1 : session.replay.constFirst().first;
+    const bool gap = lastSeq + 1 < oldestSeq;
+
+    QByteArray missed;
+    int missedCount = 0;
+    for (const auto &entry : std::as_const(session.replay)) {
+        if (entry.first > lastSeq) {
+            missed.append(entry.second);
+            ++missedCount;
+        }
+    }
+
+    session.clientId = clientId;
+    session.client = client;
+    session.detachedAtMs = 0;
+    m_clients.logIn(client, session.name);
+    chargeReplay(worker, session);
+    if (worker) {
+        QMetaObject::invokeMethod(worker, "bind", Qt::QueuedConnection, Q_ARG(QString, session.name));
+    }
+
+    sendLine(worker,
+        Protocol::toLine(QJsonObject{
+            {"type", "resume_ok"},
+            {"name", session.name},
+            {"last_seq", static_cast<qint64>(session.lastSeq)},
+            {"replay_from", static_cast<qint64>(qMax(lastSeq + 1, oldestSeq))},
+            {"gap", gap},
+        }));
+    if (!missed.isEmpty()) {
+        sendLine(worker, missed);
+    }
+    if (!m_userListLine.isEmpty()) {
+        sendLine(worker, m_userListLine);
+    }
+
+    emit log(QString("[%1] resumed %2 after seq %3, replayed %4 line(s)%5")
+                 .arg(clientId)
+                 .arg(session.name)
+                 .arg(lastSeq)
+                 .arg(missedCount)
+                 .arg(gap ? QStringLiteral(" (gap)") : QString()));
+}
+
+ChatRouter::Session *ChatRouter::findSession(const QString &name)
+{
+    const auto it = m_sessionIndex.constFind(name);
+    return it == m_sessionIndex.constEnd() ? nullptr : &m_sessions[it.value()];
+}
+
+ChatRouter::Session &ChatRouter::addSession(const Session &session)
+{
+    m_sessionIndex.insert(session.name, m_sessions.size());
+    m_sessions.append(session);
+    return m_sessions.last();
+}
+
+void ChatRouter::detachSession(const QString &name)
+{
+    Session *session = findSession(name);
+    if (!session) {
+        return;
+    }
+
+    session->clientId = 0;
+    session->client = ClientRegistry::Handle();
+    session->detachedAtMs = QDateTime::currentMSecsSinceEpoch();
+    emit log(QString("connection of %1 lost, holding session for %2 ms").arg(name).arg(Protocol::kResumeGraceMs));
+
+    if (!m_sessionTimer->isActive()) {
+        m_sessionTimer->start();
+    }
+}
+
+void ChatRouter::endSession(const QString &name)
+{
+    const auto it = m_sessionIndex.constFind(name);
+    if (it == m_sessionIndex.constEnd()) {
+        return;
+    }
+    const qsizetype index = it.value();
+    m_sessionIndex.erase(it);
+    m_tokenToName.remove(m_sessions.at(index).token);
+    if (index != m_sessions.size() - 1) {
+        m_sessions[index] = std::move(m_sessions.last());
+        m_sessionIndex[m_sessions.at(index).name] = index;
+    }
+    m_sessions.removeLast();
+}
+
+void ChatRouter::expireSessions()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QStringList expired;
+    bool detachedLeft = false;
+    for (const Session &session : std::as_const(m_sessions)) {
+        if (session.clientId != 0) {
+            continue;
+        }
+        if (now - session.detachedAtMs >= Protocol::kResumeGraceMs) {
+            expired.push_back(session.name);
+        } else {
+            detachedLeft = true;
+        }
+    }
+
+    if (!detachedLeft) {
+        m_sessionTimer->stop();
+    }
+    if (expired.isEmpty()) {
+        return;
+    }
+
+    for (const auto &name : expired) {
+        endSession(name);
+        emit log(QString("session expired: %1").arg(name));
+    }
+    for (const auto &name : expired) {
+        announcePresence(name, false);
+    }
+    flushPresence();
+}
+
+void ChatRouter::deliverOfflineMail(Session &session)
+{
+    const QList<QByteArray> lines = m_mailbox.take(session.name, QDateTime::currentMSecsSinceEpoch());
+    if (lines.isEmpty()) {
+        return;
+    }
+
+    // Stored lines are already encoded objects, so the burst envelope is built by
+    // joining them into a JSON array instead of parsing and re-encoding each one.
+    QByteArray envelope = R"({"type":"offline","messages":[)";
+    for (int i = 0; i < lines.size(); ++i) {
+        if (i > 0) {
+            envelope.append(',');
+        }
+        const QByteArray &line = lines.at(i);
+        envelope.append(line.constData(), line.endsWith('\n') ? line.size() - 1 : line.size());
+    }
+    envelope.append("]}\n");
+
+    deliver(session, envelope);
+    emit log(QString("[%1] delivered %2 offline message(s) to %3").arg(session.clientId).arg(lines.size()).arg(session.name));
+}
+
+void ChatRouter::expireMailbox()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    m_mailbox.expire(now);
+    if (isCoordinator() && m_spool) {
+        m_spool->expire(now);
+    }
+}
+
+void ChatRouter::handleFilePut(quint64 clientId, const QJsonObject &obj)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    ClientWorker *const worker = m_clients.worker(client);
+    const QString user = m_clients.name(client);
+    const int ref = obj.value("ref").toInt();
+    const auto fail = [&](const QString &reason) {
+        sendJson(clientId, QJsonObject{{"type", "file_error"}, {"ref", ref}, {"id", obj.value("id")}, {"reason", reason}});
+    };
+    if (!m_spool || !m_spool->isEnabled() || !worker) {
+        fail("disabled");
+        return;
+    }
+    if (degraded(OverloadController::Shed)) {
+        m_overload->count(OverloadController::RequestsShed);
+        fail("busy");
+        return;
+    }
+
+    FileSpool::File file;
+    const QByteArray id = obj.value("id").toString().toLatin1();
+    if (!id.isEmpty()) {
+        // Resuming an interrupted upload of the same user.
+        if (!m_spool->find(id, &file) || file.owner != user || file.complete) {
+            fail("unknown_file");
+            return;
+        }
+    } else {
+        QString name = obj.value("name").toString().trimmed();
+        name = QFileInfo(name.replace('\\', '/')).fileName();
+        const qint64 size = obj.value("size").toInteger();
+        const QString to = Protocol::normalizeName(obj.value("to").toString());
+        if (name.isEmpty() || name.size() > Protocol::kMaxFileNameLength || size <= 0 || (!to.isEmpty() && !Protocol::isValidName(to))) {
+            fail("invalid_request");
+            return;
+        }
+        if (size > m_config.maxFileSize) {
+            fail("too_large");
+            return;
+        }
+        if (!m_spool->create(user, to, name, size, &file)) {
+            fail("spool_error");
+            return;
+        }
+    }
+
+    const qint64 offset = m_spool->received(file.id);
+    if (offset == file.size) {
+        fileUploaded(clientId, file.id);
+        return;
+    }
+    if (offset < 0 || offset > file.size) {
+        fail("spool_error");
+        return;
+    }
+
+    // Queued ahead of the reply, so the worker expects the data before the
+    // client can send any.
+    QMetaObject::invokeMethod(worker,
+        "acceptUpload",
+        Qt::QueuedConnection,
+        Q_ARG(QByteArray, file.id),
+        Q_ARG(QString, m_spool->dataPath(file.id)),
+        Q_ARG(qint64, offset),
+        Q_ARG(qint64, file.size));
+    sendJson(clientId,
+        QJsonObject{
+            {"type", "file_put_ok"},
+            {"ref", ref},
+            {"id", QString::fromLatin1(file.id)},
+            {"offset", offset},
+            {"size", file.size},
+            {"chunk", Protocol::kFileChunkSize},
+            {"rate", m_config.transferRate},
+        });
+    emit log(QString("[%1] upload %2 (%3) from %4 at offset %5").arg(clientId).arg(QString::fromLatin1(file.id), file.name, user).arg(offset));
+}
+
+void ChatRouter::handleFileGet(quint64 clientId, const QJsonObject &obj)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    ClientWorker *const worker = m_clients.worker(client);
+    const QString user = m_clients.name(client);
+    const QByteArray id = obj.value("id").toString().toLatin1();
+    const qint64 offset = obj.value("offset").toInteger();
+    const auto fail = [&](const QString &reason) {
+        sendJson(clientId, QJsonObject{{"type", "file_error"}, {"id", QString::fromLatin1(id)}, {"reason", reason}});
+    };
+    if (!m_spool || !m_spool->isEnabled() || !worker) {
+        fail("disabled");
+        return;
+    }
+    if (degraded(OverloadController::Shed)) {
+        m_overload->count(OverloadController::RequestsShed);
+        fail("busy");
+        return;
+    }
+
+    // Files sent privately are only visible to the two ends.
+    FileSpool::File file;
+    if (!m_spool->find(id, &file) || !file.complete || !(file.to.isEmpty() || file.owner == user || file.to == user)) {
+        fail("unknown_file");
+        return;
+    }
+    if (offset < 0 || offset > file.size) {
+        fail("invalid_request");
+        return;
+    }
+
+    sendJson(clientId,
+        QJsonObject{
+            {"type", "file_get_ok"},
+            {"id", QString::fromLatin1(file.id)},
+            {"name", file.name},
+            {"size", file.size},
+            {"offset", offset},
+        });
+    QMetaObject::invokeMethod(worker,
+        "startDownload",
+        Qt::QueuedConnection,
+        Q_ARG(QByteArray, file.id),
+        Q_ARG(QString, m_spool->dataPath(file.id)),
+        Q_ARG(qint64, offset),
+        Q_ARG(qint64, file.size),
+        Q_ARG(qint64, m_config.transferRate));
+    emit log(QString("[%1] download %2 (%3) by %4 from offset %5").arg(clientId).arg(QString::fromLatin1(file.id), file.name, user).arg(offset));
+}
+
+void ChatRouter::fileUploaded(quint64 clientId, const QByteArray &id)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    if (client.isNull() || !m_clients.isLoggedIn(client) || !m_spool) {
+        return;
+    }
+    const QString from = m_clients.name(client);
+
+    FileSpool::File file;
+    if (!m_spool->find(id, &file) || file.owner != from || !m_spool->markComplete(id, &file)) {
+        return;
+    }
+    sendJson(clientId, QJsonObject{{"type", "file_put_done"}, {"id", QString::fromLatin1(id)}});
+
+    // Announced like a chat message so it is ordered, replayed and (for a
+    // private file) kept in the mailbox like one; older clients show the text.
+    QJsonObject msg{
+        {"type", "chat"},
+        {"scope", file.to.isEmpty() ? "broadcast" : "private"},
+        {"from", from},
+        {"text", QString("[file] %1 (%2)").arg(file.name, formatSize(file.size))},
+        {"file", QJsonObject{{"id", QString::fromLatin1(id)}, {"name", file.name}, {"size", file.size}}},
+        {"time", QString::fromLatin1(Envelope::isoNow())},
+    };
+    emit log(QString("[%1] %2 uploaded %3 (%4)").arg(clientId).arg(from, file.name, formatSize(file.size)));
+    if (file.to.isEmpty()) {
+        publish(encode(msg));
+        return;
+    }
+    msg.insert("to", file.to);
+    routePrivate(from, file.to, encode(msg));
+}
+
+void ChatRouter::removeClient(quint64 clientId, bool announce)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    if (client.isNull()) {
+        return;
+    }
+
+    const ClientRegistry::Entry entry = m_clients.take(client);
+
+    if (entry.loggedIn) {
+        if (announce && !entry.loggedOut) {
+            detachSession(entry.name);
+        } else {
+            endSession(entry.name);
+            if (announce) {
+                announcePresence(entry.name, false);
+            }
+        }
+    }
+
+    if (entry.worker) {
+        QMetaObject::invokeMethod(entry.worker, "disconnectFromHost", Qt::QueuedConnection);
+    }
+    releaseClient(entry);
+}
+
+void ChatRouter::releaseClient(const ClientRegistry::Entry &entry)
+{
+    if (entry.thread) {
+        entry.thread->quit();
+        if (!entry.thread->wait(2000)) {
+            emit log(QString("[%1] thread quit timeout, terminating").arg(entry.clientId));
+            entry.thread->terminate();
+            entry.thread->wait(1000);
+        }
+    }
+
+    if (entry.worker) {
+        entry.worker->moveToThread(QThread::currentThread());
+        delete entry.worker;
+    }
+    if (entry.thread) {
+        delete entry.thread;
+    }
+
+    m_connectionLimit->release(1);
+}
+
+void ChatRouter::routePrivate(const QString &from, const QString &to, const QByteArray &line)
+{
+    const int shard = m_shards->shardForName(to);
+    if (shard != m_index) {
+        m_shards->forward(shard, shardEvent(IngressEvent::Kind::Private, line, from, to));
+        return;
+    }
+    acceptPrivate(from, to, line);
+}
+
+void ChatRouter::acceptPrivate(const QString &from, const QString &to, const QByteArray &line)
+{
+    if (verbose() && m_sessionIndex.contains(to)) {
+        emit log(QString("Sending to %1 - %2").arg(to, QString::fromUtf8(line).trimmed()));
+    }
+    const PrivateOutcome outcome = storePrivate(from, to, line);
+
+    // The sender's echo depends on the outcome, so it is sent by the sender's
+    // shard once the recipient's shard has decided.
+    const int shard = m_shards->shardForName(from);
+    if (shard != m_index) {
+        IngressEvent result = shardEvent(IngressEvent::Kind::PrivateResult, line, from, to);
+        result.code = static_cast<int>(outcome);
+        m_shards->forward(shard, std::move(result));
+        return;
+    }
+    finishPrivate(from, to, line, outcome);
+}
+
+void ChatRouter::finishPrivate(const QString &from, const QString &to, const QByteArray &line, PrivateOutcome outcome)
+{
+    if (outcome == PrivateOutcome::Delivered || outcome == PrivateOutcome::Queued || outcome == PrivateOutcome::Spilled) {
+        indexPrivate(from, QStringList{to}, line);
+    }
+
+    Session *const self = findSession(from);
+    if (!self) {
+        return;
+    }
+
+    switch (outcome) {
+    case PrivateOutcome::Delivered:
+        if (to != from) {
+            deliver(*self, line);
+        }
+        break;
+    case PrivateOutcome::Queued:
+    case PrivateOutcome::Spilled:
+        deliver(*self, line);
+        deliver(*self, Envelope::notice(Envelope::Notice::Queued, to));
+        break;
+    case PrivateOutcome::Full:
+        deliver(*self, Envelope::notice(Envelope::Notice::MailboxFull, to));
+        break;
+    case PrivateOutcome::NotFound:
+        deliver(*self, Envelope::notice(Envelope::Notice::NotFound, to));
+        break;
+    }
+}
+
+ChatRouter::PrivateOutcome ChatRouter::storePrivate(const QString &from, const QString &to, const QByteArray &line)
+{
+    if (Session *dest = findSession(to)) {
+        deliver(*dest, line);
+        return PrivateOutcome::Delivered;
+    }
+    const auto result = m_mailbox.enqueue(to, line, QDateTime::currentMSecsSinceEpoch());
+    const PrivateOutcome outcome = result == OfflineMailbox::Result::Unknown ? PrivateOutcome::NotFound
+        : result == OfflineMailbox::Result::Full                            ? PrivateOutcome::Full
+        : result == OfflineMailbox::Result::Spilled                         ? PrivateOutcome::Spilled
+                                                                            : PrivateOutcome::Queued;
+    if ((outcome == PrivateOutcome::Queued || outcome == PrivateOutcome::Spilled) && verbose()) {
+        emit log(QString("%1 -> %2 (offline%3)").arg(from, to, outcome == PrivateOutcome::Spilled ? QStringLiteral(", spilled") : QString()));
+    }
+    return outcome;
+}
+
+void ChatRouter::handlePrivateGroup(quint64 clientId, const QJsonObject &obj, qint64 receivedNs)
+{
+    const QString from = m_clients.name(m_clients.find(clientId));
+    const QJsonArray to = obj.value("to").toArray();
+    QString text = Protocol::normalizeText(obj.value("text").toString());
+    if (to.isEmpty() || to.size() > Protocol::kMaxPrivateRecipients || !Protocol::isValidMessage(text)) {
+        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid private message"}});
+        return;
+    }
+    if (!filterText(clientId, from, &text)) {
+        return;
+    }
+
+    // One pass over the list: duplicates go, invalid names are answered
+    // without being sent anywhere, the rest is grouped by owning router.
+    PrivateGroup group;
+    group.from = from;
+    group.id = obj.value("id");
+    QStringList recipients;
+    QSet<QString> seen;
+    QList<QStringList> byShard(m_shards->count());
+    for (const auto &value : to) {
+        const QString name = Protocol::normalizeName(value.toString());
+        if (!Protocol::isValidName(name)) {
+            group.results.insert(value.toString(), QStringLiteral("invalid"));
+            continue;
+        }
+        if (seen.contains(name)) {
+            continue;
+        }
+        seen.insert(name);
+        recipients.push_back(name);
+        byShard[m_shards->shardForName(name)].push_back(name);
+    }
+    if (recipients.isEmpty()) {
+        sendJson(clientId, QJsonObject{{"type", "private_result"}, {"id", group.id}, {"results", group.results}});
+        return;
+    }
+
+    // Encoded once; every recipient and the sender's echo get the same line.
+    const QByteArray line = traced(encodeWith([&] { return Envelope::privateChat(from, recipients, text); }), obj, receivedNs);
+    if (verbose()) {
+        emit log(QString("[%1] %2 -> %3: %4").arg(clientId).arg(from, recipients.join(", "), text));
+    }
+    const int id = m_nextPrivateGroup;
+    m_nextPrivateGroup = (m_nextPrivateGroup + 1) & 0x7fffffff;
+    group.line = line;
+    group.recipients = recipients;
+    for (const auto &names : std::as_const(byShard)) {
+        group.pendingShards += names.isEmpty() ? 0 : 1;
+    }
+    m_privateGroups.insert(id, std::move(group));
+
+    for (int shard = 0; shard < byShard.size(); ++shard) {
+        if (shard == m_index || byShard.at(shard).isEmpty()) {
+            continue;
+        }
+        IngressEvent event = shardEvent(IngressEvent::Kind::PrivateGroup, line, from);
+        event.names = byShard.at(shard);
+        event.code = id;
+        m_shards->forward(shard, std::move(event));
+    }
+    // Last, since it can complete the group.
+    if (!byShard.at(m_index).isEmpty()) {
+        acceptPrivateGroup(from, byShard.at(m_index), line, id);
+    }
+}
+
+void ChatRouter::acceptPrivateGroup(const QString &from, const QStringList &names, const QByteArray &line, int group)
+{
+    QByteArray outcomes;
+    outcomes.reserve(names.size());
+    for (const auto &to : names) {
+        outcomes.append(static_cast<char>(storePrivate(from, to, line)));
+    }
+
+    const int shard = m_shards->shardForName(from);
+    if (shard != m_index) {
+        IngressEvent result = shardEvent(IngressEvent::Kind::PrivateGroupResult, outcomes, from);
+        result.names = names;
+        result.code = group;
+        m_shards->forward(shard, std::move(result));
+        return;
+    }
+    finishPrivateGroup(group, names, outcomes);
+}
+
+void ChatRouter::finishPrivateGroup(int group, const QStringList &names, const QByteArray &outcomes)
+{
+    const auto it = m_privateGroups.find(group);
+    if (it == m_privateGroups.end()) {
+        return;
+    }
+    PrivateGroup &pending = it.value();
+    for (qsizetype i = 0; i < names.size() && i < outcomes.size(); ++i) {
+        const auto outcome = static_cast<PrivateOutcome>(outcomes.at(i));
+        const QString &to = names.at(i);
+        switch (outcome) {
+        case PrivateOutcome::Delivered:
+            pending.results.insert(to, QStringLiteral("delivered"));
+            pending.stored = true;
+            pending.toSelf = pending.toSelf || to == pending.from;
+            break;
+        case PrivateOutcome::Queued:
+        case PrivateOutcome::Spilled:
+            pending.results.insert(to, QStringLiteral("queued"));
+            pending.stored = true;
+            break;
+        case PrivateOutcome::Full:
+            pending.results.insert(to, QStringLiteral("full"));
+            break;
+        case PrivateOutcome::NotFound:
+            pending.results.insert(to, QStringLiteral("not_found"));
+            break;
+        }
+    }
+    if (--pending.pendingShards > 0) {
+        return;
+    }
+
+    const PrivateGroup done = m_privateGroups.take(group);
+    if (done.stored) {
+        // One document for the message, visible to whoever has it.
+        QStringList stored;
+        for (const auto &name : done.recipients) {
+            const QString result = done.results.value(name).toString();
+            if (result == QLatin1String("delivered") || result == QLatin1String("queued")) {
+                stored.push_back(name);
+            }
+        }
+        indexPrivate(done.from, stored, done.line);
+    }
+
+    Session *const self = findSession(done.from);
+    if (!self) {
+        return;
+    }
+    if (done.stored && !done.toSelf) {
+        deliver(*self, done.line);
+    }
+    sendJson(*self, QJsonObject{{"type", "private_result"}, {"id", done.id}, {"results", done.results}});
+}
+
+void ChatRouter::indexMessage(const QString &from, const QString &text)
+{
+    if (m_shards->hasSearch()) {
+        m_shards->toSearch(shardEvent(IngressEvent::Kind::Index, text.toUtf8(), from));
+    }
+}
+
+void ChatRouter::indexPrivate(const QString &from, const QStringList &to, const QByteArray &line)
+{
+    // The text is taken out of the line on the search thread, not here.
+    if (m_shards->hasSearch()) {
+        IngressEvent event = shardEvent(IngressEvent::Kind::IndexPrivate, line, from);
+        event.names = to;
+        m_shards->toSearch(std::move(event));
+    }
+}
+
+QByteArray ChatRouter::traced(const QByteArray &line, const QJsonObject &request, qint64 receivedNs)
+{
+    const QJsonValue trace = request.value("trace");
+    if (!trace.isObject()) {
+        return line;
+    }
+    const qint64 routedNs = RouterThread::nowNs();
+    if (m_trace) {
+        m_trace->record(TraceStats::Ingress, routedNs - receivedNs);
+    }
+    return Protocol::withTrace(line, trace.toObject().value("t").toInteger(), receivedNs, routedNs);
+}
+
+void ChatRouter::publish(const QByteArray &line)
+{
+    // Every broadcast goes through the coordinator, so all shards deliver
+    // broadcasts in the same order.
+    if (!isCoordinator()) {
+        m_shards->forward(ShardMap::kCoordinator, shardEvent(IngressEvent::Kind::Publish, line));
+        return;
+    }
+    for (int shard = 0; shard < m_shards->count(); ++shard) {
+        if (shard != m_index) {
+            m_shards->forward(shard, shardEvent(IngressEvent::Kind::Broadcast, line));
+        }
+    }
+    deliverToAll(line);
+}
+
+void ChatRouter::deliverToAll(const QByteArray &line)
+{
+    SpanRecorder::Scope span(m_spans, SpanRecorder::FanOut, m_sessions.size());
+    // One log line per recipient is most of the log under load.
+    const bool logEach = verbose();
+    const QString compact = logEach ? QString::fromUtf8(line).trimmed() : QString();
+    for (Session &session : m_sessions) {
+        if (logEach) {
+            emit log(QString("Sending to %1 - %2").arg(session.name, compact));
+        }
+        deliver(session, line);
+    }
+}
+
+void ChatRouter::announcePresence(const QString &name, bool joined)
+{
+    if (!isCoordinator()) {
+        m_shards->forward(ShardMap::kCoordinator, shardEvent(joined ? IngressEvent::Kind::Join : IngressEvent::Kind::Leave, QByteArray(), name));
+        return;
+    }
+    updatePresence(name, joined);
+}
+
+void ChatRouter::updatePresence(const QString &name, bool joined)
+{
+    if (joined) {
+        m_presence.insert(name);
+    } else {
+        m_presence.remove(name);
+    }
+    m_presenceDirty = true;
+    if (degraded(OverloadController::Coalesce)) {
+        m_overload->count(OverloadController::NoticesDropped);
+        return;
+    }
+    publish(Envelope::notice(joined ? Envelope::Notice::Joined : Envelope::Notice::Left, name));
+}
+
+void ChatRouter::flushPresence()
+{
+    // One user_list per batch however many logins and logouts it held; when
+    // coalescing, one per kCoalescedPresenceMs, the rest is picked up by
+    // publishStats().
+    if (!isCoordinator() || !m_presenceDirty) {
+        return;
+    }
+    if (degraded(OverloadController::Coalesce) && m_presenceClock.isValid() && m_presenceClock.elapsed() < kCoalescedPresenceMs) {
+        return;
+    }
+    m_presenceDirty = false;
+    m_presenceClock.start();
+
+    QStringList users = m_presence.values();
+    users.sort(Qt::CaseInsensitive);
+    emit usersChanged(users);
+
+    const QByteArray line = encodeWith([&] { return Envelope::userList(users); });
+    for (int shard = 0; shard < m_shards->count(); ++shard) {
+        if (shard != m_index) {
+            m_shards->forward(shard, shardEvent(IngressEvent::Kind::UserList, line));
+        }
+    }
+    sendUserList(line);
+}
+
+void ChatRouter::sendUserList(const QByteArray &line)
+{
+    // Presence is a snapshot rather than a message: it is not sequenced or kept
+    // for replay, a resumed client gets a fresh one instead.
+    m_userListLine = line;
+    m_clients.forEachLoggedIn([&](ClientWorker *worker) { sendLine(worker, line); });
+}
+
+QByteArray ChatRouter::encode(const QJsonObject &obj)
+{
+    SpanRecorder::Scope span(m_spans, SpanRecorder::Encode);
+    QByteArray line = Protocol::toLine(obj);
+    span.setArg(line.size());
+    return line;
+}
+
+void ChatRouter::sendJson(quint64 clientId, const QJsonObject &obj)
+{
+    const ClientRegistry::Handle client = m_clients.find(clientId);
+    ClientWorker *const worker = m_clients.worker(client);
+    if (!worker) {
+        return;
+    }
+
+    if (m_clients.isLoggedIn(client)) {
+        if (Session *session = findSession(m_clients.name(client))) {
+            sendJson(*session, obj);
+            return;
+        }
+    }
+
+    if (verbose()) {
+        emit log(QString("Sending to #%1 - %2").arg(clientId).arg(toCompactJson(obj)));
+    }
+    sendLine(worker, encode(obj));
+}
+
+void ChatRouter::sendJson(Session &session, const QJsonObject &obj)
+{
+    if (verbose()) {
+        emit log(QString("Sending to %1 - %2").arg(session.name, toCompactJson(obj)));
+    }
+    deliver(session, encode(obj));
+}
+
+void ChatRouter::sendLine(ClientWorker *worker, const QByteArray &line)
+{
+    if (!worker) {
+        return;
+    }
+    // Taken back by the worker when the call reaches it.
+    if (auto *account = worker->memoryAccount()) {
+        account->add(MemoryBudget::Pending, line.size());
+    }
+    QMetaObject::invokeMethod(worker, "sendLine", Qt::QueuedConnection, Q_ARG(QByteArray, line));
+}
+
+void ChatRouter::deliver(Session &session, const QByteArray &line)
+{
+    const quint64 seq = ++session.lastSeq;
+    const QByteArray stamped = Protocol::withSeq(line, seq);
+
+    session.replay.append(qMakePair(seq, stamped));
+    session.replayBytes += stamped.size();
+    while (session.replay.size() > Protocol::kResumeBufferSize) {
+        session.replayBytes -= session.replay.constFirst().second.size();
+        session.replay.removeFirst();
+    }
+
+    // Straight to the slot: no lookup by id per recipient of a broadcast.
+    if (ClientWorker *worker = m_clients.worker(session.client)) {
+        chargeReplay(worker, session);
+        sendLine(worker, stamped);
+    }
+}
+
+void ChatRouter::chargeReplay(ClientWorker *worker, const Session &session)
+{
+    if (auto *account = worker ? worker->memoryAccount() : nullptr) {
+        account->set(MemoryBudget::Replay, session.replayBytes);
+    }
+}
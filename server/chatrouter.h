@@ -0,0 +1,222 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include "clientregistry.h"
+#include "contentfilter.h"
+#include "offlinemailbox.h"
+#include "overloadcontroller.h"
+#include "serverconfig.h"
+#include "servercontext.h"
+#include "spanrecorder.h"
+
+class ClientWorker;
+class FileSpool;
+class QSemaphore;
+class QThread;
+class QTimer;
+class ShardMap;
+class TraceStats;
+struct IngressEvent;
+
+// One shard of the server: owns the connections, sessions and offline mail of
+// the names that hash to it (see ShardMap) and routes their messages. Lives on
+// its RouterThread and is fed from its queues; nothing here is touched from
+// another thread except stats(), which returns a snapshot. Shard 0 is also the
+// coordinator that orders broadcasts and owns the global user list.
+class ChatRouter : public QObject
+{
+    Q_OBJECT
+
+public:
+    ChatRouter(const ServerConfig &config, int index, const ServerContext &context, QObject *parent = nullptr);
+
+    // Router thread: handlers installed on the RouterThread.
+    void handleIngress(IngressEvent &event);
+    void onBatchDone();
+
+    // Any thread: state as of the last publish (every 500 ms).
+    QJsonObject stats() const;
+
+public slots:
+    void start();
+    // Two phases across all shards: first every shard stops producing
+    // router-to-router traffic, then each drops its clients. Anything one shard
+    // handed to another during the first phase is picked up in the second.
+    void beginShutdown();
+    void finishShutdown();
+
+    // Server handover, driven by ChatServer. beginHandover() pauses the timers
+    // and keeps disconnected clients around (their workers must stay valid
+    // while the server freezes them); drainHandover() is repeated on every
+    // shard until none has anything left. exportState() collects the sessions,
+    // mail and each connection's worker state; then either finishHandover()
+    // lets go of everything without telling the clients, or cancelHandover()
+    // resumes as before.
+    void beginHandover();
+    int drainHandover();
+    QJsonObject exportState();
+    void finishHandover();
+    void cancelHandover();
+    // On the successor, before any connection is attached: this shard's part
+    // of the predecessor's state, as split up by ChatServer.
+    void importState(const QJsonObject &state);
+
+signals:
+    void log(QString message);
+    void usersChanged(QStringList users);
+
+private slots:
+    void expireSessions();
+    void expireMailbox();
+    void publishStats();
+
+private:
+    // Outlives its connection: a dropped client keeps its name and the tail of
+    // its sequenced output for Protocol::kResumeGraceMs so it can resume.
+    // What deliver() touches for every recipient of a broadcast comes first.
+    struct Session {
+        ClientRegistry::Handle client; // the connection's slot while attached
+        quint64 lastSeq = 0;
+        qint64 replayBytes = 0;
+        QList<QPair<quint64, QByteArray>> replay;
+        QString name;
+        QByteArray token;
+        quint64 clientId = 0; // 0 while detached
+        qint64 detachedAtMs = 0;
+    };
+
+    enum class PrivateOutcome {
+        Delivered,
+        Queued,
+        Spilled,
+        Full,
+        NotFound, // no session and never logged in: nothing is queued
+    };
+
+    // A private message to several recipients, held by the sender's router
+    // until every router with some of the recipients has reported back.
+    struct PrivateGroup {
+        QString from;
+        QByteArray line;
+        QStringList recipients; // as requested, for the index
+        QJsonValue id;
+        QJsonObject results;
+        int pendingShards = 0;
+        bool stored = false; // delivered or queued for anyone
+        bool toSelf = false; // the sender got it as a recipient
+    };
+
+    bool isCoordinator() const;
+    bool forwardIfMoved(IngressEvent &event);
+    ClientRegistry::Handle attachClient(quint64 clientId, ClientWorker *worker, QThread *thread);
+    void handOff(IngressEvent &event);
+    void adoptClient(IngressEvent &event);
+    void onClientLine(quint64 clientId, const QByteArray &line, qint64 receivedNs);
+    void removeClient(quint64 clientId, bool announce);
+    void releaseClient(const ClientRegistry::Entry &entry);
+    void handleLogin(quint64 clientId, const QJsonObject &obj);
+    void handleResume(quint64 clientId, const QJsonObject &obj);
+    // nullptr if `name` has no session here. Valid until a session is added
+    // or ended.
+    Session *findSession(const QString &name);
+    Session &addSession(const Session &session);
+    void detachSession(const QString &name);
+    void endSession(const QString &name);
+    void deliverOfflineMail(Session &session);
+
+    void handleFilePut(quint64 clientId, const QJsonObject &obj);
+    void handleFileGet(quint64 clientId, const QJsonObject &obj);
+    void fileUploaded(quint64 clientId, const QByteArray &id);
+
+    void routePrivate(const QString &from, const QString &to, const QByteArray &line);
+    void acceptPrivate(const QString &from, const QString &to, const QByteArray &line);
+    void finishPrivate(const QString &from, const QString &to, const QByteArray &line, PrivateOutcome outcome);
+    PrivateOutcome storePrivate(const QString &from, const QString &to, const QByteArray &line);
+    void handlePrivateGroup(quint64 clientId, const QJsonObject &obj, qint64 receivedNs);
+    void acceptPrivateGroup(const QString &from, const QStringList &names, const QByteArray &line, int group);
+    void finishPrivateGroup(int group, const QStringList &names, const QByteArray &outcomes);
+
+    void indexMessage(const QString &from, const QString &text);
+    // Only once it reached the recipient or their mailbox: a refused message
+    // must not turn up for whoever logs in under that name later.
+    void indexPrivate(const QString &from, const QStringList &to, const QByteArray &line);
+    QByteArray traced(const QByteArray &line, const QJsonObject &request, qint64 receivedNs);
+    void publish(const QByteArray &line);
+    void deliverToAll(const QByteArray &line);
+    void announcePresence(const QString &name, bool joined);
+    void updatePresence(const QString &name, bool joined);
+    void flushPresence();
+    void sendUserList(const QByteArray &line);
+
+    // Serialises under an Encode span: a QJsonObject, or with encodeWith()
+    // whatever builds the line (the Envelope functions for frequent ones).
+    QByteArray encode(const QJsonObject &obj);
+    template <typename Build>
+    QByteArray encodeWith(Build build)
+    {
+        SpanRecorder::Scope span(m_spans, SpanRecorder::Encode);
+        QByteArray line = build();
+        span.setArg(line.size());
+        return line;
+    }
+    void sendJson(quint64 clientId, const QJsonObject &obj);
+    void sendJson(Session &session, const QJsonObject &obj);
+    void sendLine(ClientWorker *worker, const QByteArray &line);
+    void deliver(Session &session, const QByteArray &line);
+    void chargeReplay(ClientWorker *worker, const Session &session);
+    bool filterText(quint64 clientId, const QString &from, QString *text);
+    // Overload measures: per-message log lines are written only when
+    // verbose() (which counts the ones left out), and degraded() tells whether
+    // the server is at `level` or worse.
+    bool verbose();
+    bool degraded(OverloadController::Level level) const;
+
+    const ServerConfig m_config;
+    const int m_index;
+    const ShardMap *const m_shards;
+    QSemaphore *const m_connectionLimit;
+    FileSpool *const m_spool;
+    TraceStats *const m_trace;
+    ContentFilter::Reader m_filter;
+    OverloadController *const m_overload;
+    SpanRecorder *const m_spans;
+    bool m_stopping = false;
+    bool m_handingOver = false;
+    QList<quint64> m_departed;
+    QHash<quint64, int> m_exportedFds;
+    QTimer *m_sessionTimer = nullptr;
+    QTimer *m_mailboxTimer = nullptr;
+    QTimer *m_statsTimer = nullptr;
+    OfflineMailbox m_mailbox;
+
+    ClientRegistry m_clients;
+    // Dense, so that deliverToAll() walks one array; ending a session moves
+    // the last one into its place. m_sessionIndex finds them by name.
+    QList<Session> m_sessions;
+    QHash<QString, qsizetype> m_sessionIndex;
+    QHash<QByteArray, QString> m_tokenToName;
+    QHash<int, PrivateGroup> m_privateGroups;
+    int m_nextPrivateGroup = 0;
+    // Latest user_list line from the coordinator, for resumed clients.
+    QByteArray m_userListLine;
+
+    // Coordinator only.
+    QSet<QString> m_presence;
+    bool m_presenceDirty = false;
+    // Last user list sent; coalesced ones wait for kCoalescedPresenceMs.
+    QElapsedTimer m_presenceClock;
+
+    mutable QMutex m_statsMutex;
+    QJsonObject m_statsSnapshot;
+};
@@ -1,14 +1,54 @@
 #include "chatserver.h"
 
+#include "chatrouter.h"
 #include "clientworker.h"
-#include "protocol.h"
+#include "handover.h"
+#include "searchservice.h"
 
-#include <QDateTime>
+#include <QCoreApplication>
+#include <QEvent>
+#include <QFile>
+#include <QFileSystemWatcher>
 #include <QJsonArray>
-#include <QJsonDocument>
+#include <QSocketNotifier>
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QThread>
+#include <QTimer>
+
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+
+#include <sys/socket.h>
+#endif
+
+namespace {
+
+// Bound on each blocking step of a handover: sending or receiving the package,
+// and the predecessor waiting for the successor's answer.
+constexpr int kHandoverTimeoutMs = 10000;
+
+// How often the memory budget is checked, and how many of the largest
+// connections the stats list.
+constexpr int kMemoryCheckMs = 1000;
+constexpr int kMemoryTopCount = 5;
+
+// Quiet time after the filter file changes before it is read: an editor
+// saving it may take more than one write.
+constexpr int kFilterReloadDelayMs = 200;
+
+// How often the load is sampled for the overload controller.
+constexpr int kOverloadCheckMs = 250;
+
+// How often the threads' spans are collected into the profile window.
+constexpr int kProfileCollectMs = 250;
+
+// Pending connections on the local socket; bots tend to reconnect together.
+constexpr int kLocalBacklog = 128;
+
+} // namespace
 
 class ThreadedTcpServer final : public QTcpServer
 {
@@ -29,339 +69,921 @@ private:
     ChatServer *m_owner = nullptr;
 };
 
-static QString toCompactJson(const QJsonObject &obj)
-{
-    return QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Compact));
-}
-
-static QString toPrettyJson(const QJsonObject &obj)
-{
-    return QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Indented)).trimmed();
-}
-
-static QJsonObject systemMessage(const QString &text)
-{
-    return QJsonObject{
-        {"type", "system"},
-        {"text", text},
-        {"time", QDateTime::currentDateTime().toString(Qt::ISODate)},
-    };
-}
-
-ChatServer::ChatServer(QObject *parent)
+ChatServer::ChatServer(const ServerConfig &config, QObject *parent)
     : QObject(parent)
+    , m_config(config)
     , m_server(new ThreadedTcpServer(this))
-    , m_connectionLimit(100)
+    , m_connectionLimit(qMax(1, config.maxClients))
 {
+    TransportContext::Backend backend = TransportContext::Backend::Qt;
+    TransportContext::parseBackend(m_config.transport, &backend);
+    m_transport.setBackend(backend);
+    m_memory.setBudget(m_config.memoryBudget);
+    m_memoryTimer = new QTimer(this);
+    m_memoryTimer->setInterval(kMemoryCheckMs);
+    connect(m_memoryTimer, &QTimer::timeout, this, &ChatServer::enforceMemoryBudget);
+    m_overload.setLagLimitMs(m_config.overloadLagMs);
+    m_overloadTimer = new QTimer(this);
+    m_overloadTimer->setInterval(kOverloadCheckMs);
+    connect(m_overloadTimer, &QTimer::timeout, this, &ChatServer::checkOverload);
+    m_profileTimer = new QTimer(this);
+    m_profileTimer->setInterval(kProfileCollectMs);
+    connect(m_profileTimer, &QTimer::timeout, this, &ChatServer::collectProfile);
+    if (!m_config.filterFile.isEmpty()) {
+        m_filterWatcher = new QFileSystemWatcher(this);
+        m_filterReload = new QTimer(this);
+        m_filterReload->setSingleShot(true);
+        m_filterReload->setInterval(kFilterReloadDelayMs);
+        connect(m_filterWatcher, &QFileSystemWatcher::fileChanged, m_filterReload, qOverload<>(&QTimer::start));
+        connect(m_filterReload, &QTimer::timeout, this, &ChatServer::loadFilter);
+    }
+    m_spool.setDirectory(m_config.spoolDir);
+
+    RouterPolicy policy;
+    policy.queueCapacity = m_config.routerQueueCapacity;
+    policy.batchSize = m_config.routerBatch;
+    policy.spinRounds = m_config.routerSpin;
+
+    const int shardCount = m_config.routerShards > 0 ? m_config.routerShards : qBound(1, QThread::idealThreadCount() / 2, 16);
+    for (int i = 0; i < shardCount; ++i) {
+        auto *thread = new RouterThread(policy, this);
+        thread->setObjectName(QStringLiteral("router-%1").arg(i));
+        m_routerThreads.push_back(thread);
+    }
+    if (m_config.searchHistory > 0) {
+        // Queries wait for nothing but the index, so this thread parks at once
+        // instead of spinning.
+        RouterPolicy searchPolicy = policy;
+        searchPolicy.spinRounds = 0;
+        m_searchThread = new RouterThread(searchPolicy, this);
+        m_searchThread->setObjectName(QStringLiteral("search"));
+    }
+    m_shards = ShardMap(m_routerThreads, m_searchThread);
+
+    m_context.shards = &m_shards;
+    m_context.connectionLimit = &m_connectionLimit;
+    m_context.tls = &m_tls;
+    m_context.spool = &m_spool;
+    m_context.outbound = &m_outbound;
+    m_context.capture = &m_capture;
+    m_context.trace = &m_trace;
+    m_context.transports = &m_transport;
+    m_context.memory = &m_memory;
+    m_context.overload = &m_overload;
+    m_context.spans = &m_spans;
+    m_context.filter = &m_filter;
+
+    if (m_searchThread) {
+        m_search = new SearchService(m_config.searchHistory, &m_shards);
+        m_search->moveToThread(m_searchThread);
+        m_searchThread->setHandler([search = m_search](IngressEvent &event) { search->handleEvent(event); });
+        connect(m_searchThread, &QThread::finished, m_search, &QObject::deleteLater);
+        m_searchThread->start();
+    }
+
+    for (int i = 0; i < shardCount; ++i) {
+        RouterThread *thread = m_routerThreads.at(i);
+        auto *router = new ChatRouter(m_config, i, m_context);
+        router->moveToThread(thread);
+        thread->setHandler([router](IngressEvent &event) { router->handleIngress(event); });
+        thread->setBatchDoneHandler([router]() { router->onBatchDone(); });
+        connect(thread, &QThread::finished, router, &QObject::deleteLater);
+        connect(router, &ChatRouter::log, this, &ChatServer::log);
+        connect(router, &ChatRouter::usersChanged, this, &ChatServer::usersChanged);
+        m_routers.push_back(router);
+    }
+    for (auto *thread : std::as_const(m_routerThreads)) {
+        thread->start();
+    }
 }
 
 ChatServer::~ChatServer()
 {
     stop();
+    for (auto *thread : std::as_const(m_routerThreads)) {
+        thread->shutdown();
+    }
+    if (m_searchThread) {
+        m_searchThread->shutdown();
+    }
 }
 
 bool ChatServer::start(const QHostAddress &address, quint16 port)
 {
     stop();
 
-    const bool ok = m_server->listen(address, port);
-    if (ok) {
-        emit log(QString("listening on %1:%2").arg(m_server->serverAddress().toString()).arg(m_server->serverPort()));
-        emit runningChanged(true);
-    } else {
+    m_tls.clear();
+    if (!m_config.tlsCertFile.isEmpty() || !m_config.tlsKeyFile.isEmpty()) {
+        QString error;
+        if (!m_tls.load(m_config.tlsCertFile, m_config.tlsKeyFile, &error)) {
+            emit log(QString("tls setup failed: %1").arg(error));
+            emit runningChanged(false);
+            return false;
+        }
+    }
+
+    if (!m_config.captureFile.isEmpty()) {
+        QString error;
+        if (!m_capture.open(m_config.captureFile, &error)) {
+            emit log(QString("capture setup failed: %1").arg(error));
+            emit runningChanged(false);
+            return false;
+        }
+    }
+
+    if (!m_server->listen(address, port)) {
+        m_capture.close();
         emit log(QString("listen failed: %1").arg(m_server->errorString()));
         emit runningChanged(false);
+        return false;
     }
-    return ok;
+    if (!m_config.localSocketPath.isEmpty() && !listenLocal()) {
+        m_server->close();
+        m_capture.close();
+        emit runningChanged(false);
+        return false;
+    }
+    emit log(QString("listening on %1:%2%3, %4 router shard(s), %5 transport")
+                 .arg(m_server->serverAddress().toString())
+                 .arg(m_server->serverPort())
+                 .arg(m_tls.isEnabled() ? QStringLiteral(" (tls)") : QString())
+                 .arg(m_routers.size())
+                 .arg(TransportContext::backendName(m_transport.backend())));
+    startRouters();
+    return true;
 }
 
-void ChatServer::stop()
+void ChatServer::startRouters()
 {
-    if (!isRunning() && m_clients.isEmpty()) {
-        return;
+    if (!m_config.spoolDir.isEmpty()) {
+        emit log(m_spool.isEnabled()
+                ? QString("file transfers: spool %1, max %2 MiB").arg(m_spool.directory()).arg(m_config.maxFileSize / (1024 * 1024))
+                : QString("file transfers: cannot use spool directory %1").arg(m_config.spoolDir));
     }
-
-    m_stopping = true;
-    m_server->close();
-
-    const auto clientIds = m_clients.keys();
-    for (quint64 id : clientIds) {
-        removeClient(id, false);
+    for (auto *router : std::as_const(m_routers)) {
+        QMetaObject::invokeMethod(router, &ChatRouter::start, Qt::QueuedConnection);
     }
-
-    m_stopping = false;
-    emit usersChanged({});
-    emit runningChanged(false);
-    emit log("server stopped");
+    if (m_capture.isEnabled()) {
+        emit log(QString("capturing received traffic to %1").arg(m_config.captureFile));
+    }
+    if (!m_config.profileFile.isEmpty()) {
+        m_spans.open(m_config.profileFile, m_config.profileWindowSeconds);
+        m_profileSaved.start();
+        m_profileTimer->start();
+        emit log(QString("profiling: last %1 s of the timeline go to %2").arg(m_config.profileWindowSeconds).arg(m_config.profileFile));
+    }
+    if (m_search) {
+        QMetaObject::invokeMethod(m_search, &SearchService::start, Qt::QueuedConnection);
+    }
+    if (m_filterWatcher && !m_filter.isEnabled()) {
+        loadFilter();
+    }
+    if (m_config.memoryBudget > 0) {
+        emit log(QString("memory budget: %1 MiB for all connections").arg(m_config.memoryBudget / (1024 * 1024)));
+        m_memoryTimer->start();
+    }
+    if (m_config.overloadLagMs > 0) {
+        m_overloadClock.start();
+        m_overloadDueNs = kOverloadCheckMs * 1000000LL;
+        m_overloadTimer->start();
+    }
+    listenForHandover();
+    m_started = true;
+    emit runningChanged(true);
 }
 
-bool ChatServer::isRunning() const
+bool ChatServer::takeOver()
 {
-    return m_server->isListening();
-}
+    if (m_config.handoverPath.isEmpty()) {
+        return false;
+    }
+    stop();
 
-void ChatServer::onIncomingConnection(qintptr socketDescriptor)
-{
-    if (!m_connectionLimit.tryAcquire(1)) {
-        emit log("connection rejected: too many clients");
-        auto *socket = new QTcpSocket(this);
-        if (socket->setSocketDescriptor(socketDescriptor)) {
-            socket->disconnectFromHost();
+    if (!m_config.tlsCertFile.isEmpty() || !m_config.tlsKeyFile.isEmpty()) {
+        // The predecessor refuses as well; TLS sessions live in its memory.
+        emit log("handover: not available with tls");
+        return false;
+    }
+
+    QString error;
+    const int fd = Handover::connectTo(m_config.handoverPath, &error);
+    if (fd < 0) {
+        if (!error.isEmpty()) {
+            emit log(QString("handover: cannot reach %1: %2").arg(m_config.handoverPath, error));
         }
-        socket->deleteLater();
-        return;
+        return false;
     }
 
-    const quint64 clientId = m_nextClientId++;
+    emit log(QString("handover: taking over from the server at %1").arg(m_config.handoverPath));
+    Handover::Package package;
+    const bool received = Handover::receive(fd, &package, kHandoverTimeoutMs, &error);
+    const QJsonObject state = package.state;
+    const int listener = package.fds.value(state.value("listener").toInt(), -1);
+    const auto closeAll = [&package]() {
+        for (int descriptor : std::as_const(package.fds)) {
+            Handover::closeFd(descriptor);
+        }
+    };
 
-    auto *thread = new QThread;
-    thread->setObjectName(QStringLiteral("client-%1").arg(clientId));
+    // The listener is taken before answering: once the predecessor has the
+    // answer it lets go of everything.
+    if (!received || listener < 0 || !m_server->setSocketDescriptor(listener)) {
+        emit log(QString("handover failed: %1").arg(!received ? error : listener < 0 ? QStringLiteral("no listener") : m_server->errorString()));
+        closeAll();
+        Handover::closeFd(fd);
+        return false;
+    }
+    if (!Handover::sendAck(fd)) {
+        emit log("handover failed: predecessor gone");
+        m_server->close();
+        package.fds.removeOne(listener);
+        closeAll();
+        Handover::closeFd(fd);
+        return false;
+    }
+    Handover::closeFd(fd);
 
-    auto *worker = new ClientWorker(clientId, socketDescriptor);
-    worker->moveToThread(thread);
+    // The local socket keeps its path and its waiting clients; without one to
+    // take, a new one is made.
+    const int localListener = state.contains("local_listener") ? package.fds.value(state.value("local_listener").toInt(), -1) : -1;
+    if (!m_config.localSocketPath.isEmpty()) {
+        listenLocal(localListener);
+    } else {
+        Handover::closeFd(localListener);
+    }
 
-    connect(thread, &QThread::started, worker, &ClientWorker::start);
-    connect(worker, &ClientWorker::lineReceived, this, &ChatServer::onClientLine);
-    connect(worker, &ClientWorker::disconnected, this, &ChatServer::onClientDisconnected);
-    connect(worker, &ClientWorker::disconnected, thread, &QThread::quit);
-    connect(worker, &ClientWorker::log, this, [this](quint64 id, const QString &msg) { emit log(QString("[%1] %2").arg(id).arg(msg)); });
+    if (!m_config.captureFile.isEmpty() && !m_capture.open(m_config.captureFile, &error)) {
+        emit log(QString("capture setup failed: %1").arg(error));
+    }
+    if (state.value("shards").toInt() != m_routers.size()) {
+        emit log(QString("handover: %1 router shard(s) here, %2 before; resume tokens of held sessions may no longer work")
+                     .arg(m_routers.size())
+                     .arg(state.value("shards").toInt()));
+    }
 
-    ClientEntry entry;
-    entry.worker = worker;
-    entry.thread = thread;
-    m_clients.insert(clientId, entry);
+    // Sessions and mail go to whichever shard owns the name here.
+    QList<QJsonArray> sessions(m_routers.size());
+    QList<QJsonArray> mailbox(m_routers.size());
+    QList<QJsonArray> known(m_routers.size());
+    QJsonArray presence;
+    QString userList;
+    QJsonArray clients;
+    for (const auto &value : state.value("routers").toArray()) {
+        const QJsonObject shard = value.toObject();
+        for (const auto &session : shard.value("sessions").toArray()) {
+            const QString name = session.toObject().value("name").toString();
+            sessions[m_shards.shardForName(name)].append(session);
+            presence.append(name);
+        }
+        for (const auto &box : shard.value("mailbox").toArray()) {
+            mailbox[m_shards.shardForName(box.toObject().value("recipient").toString())].append(box);
+        }
+        for (const auto &name : shard.value("known").toArray()) {
+            known[m_shards.shardForName(name.toString())].append(name);
+        }
+        if (shard.contains("user_list")) {
+            userList = shard.value("user_list").toString();
+        }
+        for (const auto &client : shard.value("clients").toArray()) {
+            clients.append(client);
+        }
+    }
+    for (int i = 0; i < m_routers.size(); ++i) {
+        QJsonObject part{{"sessions", sessions.at(i)}, {"mailbox", mailbox.at(i)}, {"known", known.at(i)}, {"user_list", userList}};
+        if (i == ShardMap::kCoordinator) {
+            part.insert("presence", presence);
+        }
+        ChatRouter *router = m_routers.at(i);
+        QMetaObject::invokeMethod(router, [router, part]() { router->importState(part); }, Qt::BlockingQueuedConnection);
+    }
 
-    emit log(QString("[%1] incoming connection").arg(clientId));
-    thread->start();
+    m_nextClientId = qMax<quint64>(m_nextClientId, static_cast<quint64>(state.value("next_client_id").toInteger()));
+    int restored = 0;
+    for (const auto &value : std::as_const(clients)) {
+        const QJsonObject client = value.toObject();
+        QJsonObject worker = client.value("worker").toObject();
+        const int socketFd = package.fds.value(worker.value("fd").toInt(), -1);
+        if (socketFd < 0) {
+            continue;
+        }
+        if (!m_connectionLimit.tryAcquire(1)) {
+            Handover::closeFd(socketFd);
+            continue;
+        }
+        worker.remove("fd");
+        startWorker(static_cast<quint64>(client.value("id").toInteger()), socketFd, worker, client.value("name").toString());
+        ++restored;
+    }
+
+    emit log(QString("handover: listening on %1:%2 with %3 connection(s) and %4 session(s), %5 router shard(s)")
+                 .arg(m_server->serverAddress().toString())
+                 .arg(m_server->serverPort())
+                 .arg(restored)
+                 .arg(presence.size())
+                 .arg(m_routers.size()));
+    startRouters();
+    return true;
 }
 
-void ChatServer::onClientLine(quint64 clientId, QByteArray line)
+void ChatServer::listenForHandover()
 {
-    const auto it = m_clients.find(clientId);
-    if (it == m_clients.end()) {
+    if (m_config.handoverPath.isEmpty() || m_handoverFd >= 0) {
         return;
     }
+    QString error;
+    m_handoverFd = Handover::listen(m_config.handoverPath, &error);
+    if (m_handoverFd < 0) {
+        emit log(QString("handover: cannot listen on %1: %2").arg(m_config.handoverPath, error));
+        return;
+    }
+    m_handoverNotifier = new QSocketNotifier(m_handoverFd, QSocketNotifier::Read, this);
+    connect(m_handoverNotifier, &QSocketNotifier::activated, this, &ChatServer::onHandoverRequest);
+    emit log(QString("handover: a new server can take over through %1").arg(m_config.handoverPath));
+}
 
-    QJsonParseError err;
-    const QJsonDocument doc = QJsonDocument::fromJson(line, &err);
-    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
-        emit log(QString("[%1] invalid json: %2").arg(clientId).arg(err.errorString()));
-        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid json"}});
+void ChatServer::closeHandover()
+{
+    // The path is left alone: after a handover it is the successor's.
+    delete m_handoverNotifier;
+    m_handoverNotifier = nullptr;
+    Handover::closeFd(m_handoverFd);
+    m_handoverFd = -1;
+}
+
+void ChatServer::onHandoverRequest()
+{
+    const int fd = Handover::accept(m_handoverFd);
+    if (fd < 0) {
         return;
     }
+    const bool done = handOver(fd);
+    Handover::closeFd(fd);
+    if (done) {
+        emit handedOver();
+    }
+}
 
-    const QJsonObject obj = doc.object();
-    {
-        const auto &client = m_clients[clientId];
-        const QString who = (client.loggedIn && !client.name.isEmpty()) ? client.name : QString("#%1").arg(clientId);
-        emit log(QString("[%1] JSON received from %2:\n%3").arg(clientId).arg(who, toPrettyJson(obj)));
+bool ChatServer::listenLocal(int fd)
+{
+    if (fd < 0) {
+        QString error;
+        // Who may connect is up to the directory, see the README.
+        fd = Handover::listen(m_config.localSocketPath, &error, kLocalBacklog, -1);
+        if (fd < 0) {
+            emit log(QString("local socket: cannot listen on %1: %2").arg(m_config.localSocketPath, error));
+            return false;
+        }
     }
+    m_localFd = fd;
+    m_localNotifier = new QSocketNotifier(m_localFd, QSocketNotifier::Read, this);
+    connect(m_localNotifier, &QSocketNotifier::activated, this, &ChatServer::onLocalConnection);
+    emit log(QString("local socket: accepting same-host clients on %1").arg(m_config.localSocketPath));
+    return true;
+}
 
-    const QString type = obj.value("type").toString();
-    if (type.isEmpty()) {
-        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "missing type"}});
+void ChatServer::closeLocal(bool removePath)
+{
+    if (m_localFd < 0) {
         return;
     }
+    delete m_localNotifier;
+    m_localNotifier = nullptr;
+    Handover::closeFd(m_localFd);
+    m_localFd = -1;
+    // After a handover the path is the successor's.
+    if (removePath) {
+        QFile::remove(m_config.localSocketPath);
+    }
+}
 
-    auto &client = m_clients[clientId];
+void ChatServer::onLocalConnection()
+{
+    // The notifier fires once for everything waiting.
+    int fd = -1;
+    while ((fd = Handover::accept(m_localFd)) >= 0) {
+        onIncomingConnection(fd, true);
+    }
+}
 
-    if (type == "login") {
-        if (client.loggedIn) {
-            sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "already_logged_in"}});
-            return;
-        }
+bool ChatServer::handOver(int fd)
+{
+    if (m_tls.isEnabled()) {
+        emit log("handover refused: tls connections cannot be handed over");
+        return false;
+    }
+    emit log("handover: successor connected, freezing connections");
+    m_server->pauseAccepting();
 
-        QString name = Protocol::normalizeName(obj.value("name").toString());
-        if (!Protocol::isValidName(name)) {
-            sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "invalid_name"}});
-            if (client.worker) {
-                QMetaObject::invokeMethod(client.worker, "disconnectFromHost", Qt::QueuedConnection);
-            }
-            return;
+    // From here on no router deletes a worker, and the queued removals of
+    // those deleted before are applied now, so m_workers is exact.
+    for (auto *router : std::as_const(m_routers)) {
+        QMetaObject::invokeMethod(router, &ChatRouter::beginHandover, Qt::BlockingQueuedConnection);
+    }
+    QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+
+    // The routers keep running meanwhile, so a worker waiting for room in a
+    // router's queue gets it.
+    for (auto *worker : std::as_const(m_workers)) {
+        QMetaObject::invokeMethod(worker, "freeze", Qt::BlockingQueuedConnection);
+    }
+    // A login moves its connection to another shard, which may send on to a
+    // third: repeat until no shard had anything left.
+    int drained = 0;
+    do {
+        drained = 0;
+        for (auto *router : std::as_const(m_routers)) {
+            int n = 0;
+            QMetaObject::invokeMethod(router, &ChatRouter::drainHandover, Qt::BlockingQueuedConnection, &n);
+            drained += n;
         }
+    } while (drained > 0);
+
+    // Descriptor 0 is the listener, then the local socket if there is one;
+    // each connection's "fd" becomes an index.
+    Handover::Package package;
+    package.fds.push_back(static_cast<int>(m_server->socketDescriptor()));
+    if (m_localFd >= 0) {
+        package.fds.push_back(m_localFd);
+    }
+    QList<int> duplicates;
+    QJsonArray routers;
+    int connections = 0;
+    for (auto *router : std::as_const(m_routers)) {
+        QJsonObject shard;
+        QMetaObject::invokeMethod(router, &ChatRouter::exportState, Qt::BlockingQueuedConnection, &shard);
+        QJsonArray clients;
+        for (const auto &value : shard.value("clients").toArray()) {
+            QJsonObject client = value.toObject();
+            QJsonObject worker = client.value("worker").toObject();
+            duplicates.push_back(worker.value("fd").toInt());
+            worker.insert("fd", static_cast<int>(package.fds.size()));
+            package.fds.push_back(duplicates.constLast());
+            client.insert("worker", worker);
+            clients.append(client);
+            ++connections;
+        }
+        shard.insert("clients", clients);
+        routers.append(shard);
+    }
+    package.state = QJsonObject{
+        {"version", 1},
+        {"next_client_id", static_cast<qint64>(m_nextClientId)},
+        {"shards", static_cast<int>(m_routers.size())},
+        {"listener", 0},
+        {"routers", routers},
+    };
+    if (m_localFd >= 0) {
+        package.state.insert("local_listener", 1);
+    }
 
-        if (m_nameToId.contains(name)) {
-            sendJson(clientId, QJsonObject{{"type", "login_error"}, {"reason", "name_taken"}});
-            if (client.worker) {
-                QMetaObject::invokeMethod(client.worker, "disconnectFromHost", Qt::QueuedConnection);
-            }
-            return;
+    QString error;
+    if (!Handover::send(fd, package, kHandoverTimeoutMs, &error) || !Handover::waitForAck(fd, kHandoverTimeoutMs)) {
+        // The duplicates go back to their workers.
+        emit log(QString("handover failed: %1, carrying on").arg(error.isEmpty() ? QStringLiteral("no answer") : error));
+        for (auto *router : std::as_const(m_routers)) {
+            QMetaObject::invokeMethod(router, &ChatRouter::cancelHandover, Qt::BlockingQueuedConnection);
         }
+        m_server->resumeAccepting();
+        return false;
+    }
 
-        client.name = name;
-        client.loggedIn = true;
-        m_nameToId.insert(name, clientId);
+    for (int duplicate : std::as_const(duplicates)) {
+        Handover::closeFd(duplicate);
+    }
+    for (auto it = m_routers.crbegin(); it != m_routers.crend(); ++it) {
+        QMetaObject::invokeMethod(*it, &ChatRouter::finishHandover, Qt::BlockingQueuedConnection);
+    }
+    closeHandover();
+    closeLocal(false);
+    m_server->close();
+    m_capture.close();
+    finishProfile();
+    m_started = false;
+    emit log(QString("handover: %1 connection(s) passed on, stopped").arg(connections));
+    emit runningChanged(false);
+    return true;
+}
 
-        sendJson(clientId, QJsonObject{{"type", "login_ok"}, {"name", name}});
-        broadcastJson(systemMessage(QString("%1 joined").arg(name)));
-        broadcastUsers();
-        emit log(QString("[%1] login ok: %2").arg(clientId).arg(name));
+void ChatServer::stop()
+{
+    if (!isRunning() && !m_started) {
         return;
     }
 
-    if (!client.loggedIn) {
-        sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "not logged in"}});
-        return;
+    closeHandover();
+    closeLocal(true);
+    m_memoryTimer->stop();
+    m_overloadTimer->stop();
+    m_overload.reset();
+    m_server->close();
+    m_started = false;
+
+    // Blocks until every shard has dropped its clients and joined their threads.
+    // The coordinator finishes last so its "stopped" state is what the window
+    // ends up showing.
+    for (auto *router : std::as_const(m_routers)) {
+        QMetaObject::invokeMethod(router, &ChatRouter::beginShutdown, Qt::BlockingQueuedConnection);
     }
+    for (auto it = m_routers.crbegin(); it != m_routers.crend(); ++it) {
+        QMetaObject::invokeMethod(*it, &ChatRouter::finishShutdown, Qt::BlockingQueuedConnection);
+    }
+    m_capture.close();
+    finishProfile();
 
-    if (type == "chat") {
-        const QString text = Protocol::normalizeText(obj.value("text").toString());
-        if (!Protocol::isValidMessage(text)) {
-            sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid message"}});
-            return;
-        }
+    emit runningChanged(false);
+}
 
-        const QJsonObject msg{
-            {"type", "chat"},
-            {"scope", "broadcast"},
-            {"from", client.name},
-            {"text", text},
-            {"time", QDateTime::currentDateTime().toString(Qt::ISODate)},
-        };
-        broadcastJson(msg);
-        emit log(QString("[%1] %2: %3").arg(clientId).arg(client.name, text));
+bool ChatServer::isRunning() const
+{
+    return m_server->isListening();
+}
+
+quint16 ChatServer::serverPort() const
+{
+    return m_server->serverPort();
+}
+
+void ChatServer::loadFilter()
+{
+    // Saving by rename replaces the file the watcher was on.
+    if (!m_filterWatcher->files().contains(m_config.filterFile)) {
+        m_filterWatcher->addPath(m_config.filterFile);
+    }
+
+    ContentFilter::Action action = ContentFilter::Action::Mask;
+    ContentFilter::parseAction(m_config.filterAction, &action);
+    const bool reload = m_filter.isEnabled();
+    QString error;
+    if (!m_filter.load(m_config.filterFile, action, &error)) {
+        emit log(reload ? QString("filter: cannot reload %1: %2, keeping the previous terms").arg(m_config.filterFile, error)
+                        : QString("filter: cannot load %1: %2, messages are not filtered").arg(m_config.filterFile, error));
         return;
     }
+    emit log(QString("filter: %1 %2 term(s) from %3")
+                 .arg(reload ? QStringLiteral("reloaded") : QStringLiteral("loaded"))
+                 .arg(m_filter.stats().patterns)
+                 .arg(m_config.filterFile));
+}
 
-    if (type == "private") {
-        const QString to = Protocol::normalizeName(obj.value("to").toString());
-        const QString text = Protocol::normalizeText(obj.value("text").toString());
-        if (!Protocol::isValidName(to) || !Protocol::isValidMessage(text)) {
-            sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "invalid private message"}});
-            return;
-        }
+void ChatServer::enforceMemoryBudget()
+{
+    for (const auto &usage : m_memory.enforce()) {
+        emit log(QString("[%1] memory budget exceeded, dropping %2 (%3 KiB)")
+                     .arg(usage.clientId)
+                     .arg(usage.name.isEmpty() ? QStringLiteral("connection") : usage.name)
+                     .arg(usage.total / 1024));
+    }
+}
 
-        const auto destIt = m_nameToId.find(to);
-        if (destIt == m_nameToId.end()) {
-            sendJson(clientId, systemMessage(QString("user not found: %1").arg(to)));
-            return;
+void ChatServer::checkOverload()
+{
+    // The timer firing late is the GUI thread's own lag.
+    const qint64 nowNs = m_overloadClock.nsecsElapsed();
+    OverloadController::Sample sample;
+    sample.nowNs = nowNs;
+    sample.lateNs = qMax<qint64>(0, nowNs - m_overloadDueNs);
+    m_overloadDueNs = nowNs + kOverloadCheckMs * 1000000LL;
+
+    const qint64 routerNowNs = RouterThread::nowNs();
+    for (const auto *thread : std::as_const(m_routerThreads)) {
+        const RouterThread::Stats ingress = thread->stats();
+        if (ingress.capacity > 0) {
+            sample.queueFill = qMax(sample.queueFill, static_cast<double>(ingress.depth) / static_cast<double>(ingress.capacity));
         }
+        sample.dequeued += ingress.dequeued;
+        sample.totalWaitNs += ingress.totalWaitNs;
+        if (ingress.oldestQueuedNs > 0) {
+            sample.oldestQueuedNs = qMax(sample.oldestQueuedNs, routerNowNs - ingress.oldestQueuedNs);
+        }
+    }
+    for (int c = 0; c < OutboundStats::ClassCount; ++c) {
+        sample.backlog += m_outbound.stats(static_cast<OutboundStats::Class>(c)).queued;
+    }
+    sample.connections = static_cast<int>(m_workers.size());
 
-        const QJsonObject msg{
-            {"type", "chat"},
-            {"scope", "private"},
-            {"from", client.name},
-            {"to", to},
-            {"text", text},
-            {"time", QDateTime::currentDateTime().toString(Qt::ISODate)},
-        };
-
-        sendJson(*destIt, msg);
-        sendJson(clientId, msg);
-        emit log(QString("[%1] %2 -> %3: %4").arg(clientId).arg(client.name, to, text));
-        return;
+    OverloadController::Transition transition;
+    if (m_overload.update(sample, &transition)) {
+        emit log(QString("overload: %1 -> %2 (%3)")
+                     .arg(OverloadController::levelName(transition.from), OverloadController::levelName(transition.to), transition.reason));
     }
+}
 
-    if (type == "logout") {
-        if (client.worker) {
-            QMetaObject::invokeMethod(client.worker, "disconnectFromHost", Qt::QueuedConnection);
+void ChatServer::collectProfile()
+{
+    m_spans.collect();
+    if (m_config.profileEverySeconds > 0 && m_profileSaved.elapsed() >= m_config.profileEverySeconds * 1000LL) {
+        QString error;
+        if (!saveProfile(&error)) {
+            emit log(QString("profile: %1").arg(error));
         }
-        return;
     }
-
-    sendJson(clientId, QJsonObject{{"type", "error"}, {"message", "unknown type"}});
 }
 
-void ChatServer::onClientDisconnected(quint64 clientId)
+bool ChatServer::saveProfile(QString *error)
 {
-    removeClient(clientId, !m_stopping);
+    if (!m_spans.isEnabled()) {
+        *error = QStringLiteral("profiling is off");
+        return false;
+    }
+    m_spans.collect();
+    m_profileSaved.start();
+    return m_spans.write(error);
 }
 
-void ChatServer::removeClient(quint64 clientId, bool announce)
+void ChatServer::finishProfile()
 {
-    const auto it = m_clients.find(clientId);
-    if (it == m_clients.end()) {
+    // Runs after the workers are gone, so their last spans are in.
+    if (!m_spans.isEnabled()) {
         return;
     }
+    m_profileTimer->stop();
+    QString error;
+    if (saveProfile(&error)) {
+        emit log(QString("profile: timeline saved to %1").arg(m_config.profileFile));
+    } else {
+        emit log(QString("profile: %1").arg(error));
+    }
+    m_spans.close();
+}
 
-    const ClientEntry entry = it.value();
-    m_clients.erase(it);
-
-    if (entry.loggedIn) {
-        m_nameToId.remove(entry.name);
-        if (announce) {
-            broadcastJson(systemMessage(QString("%1 left").arg(entry.name)));
-            broadcastUsers();
+QJsonObject ChatServer::stats() const
+{
+    int connections = 0;
+    int sessions = 0;
+    QJsonObject mailbox;
+    QJsonArray shards;
+
+    qint64 depth = 0;
+    qint64 maxDepth = 0;
+    qint64 capacity = 0;
+    quint64 dequeued = 0;
+    quint64 forwarded = 0;
+    quint64 batches = 0;
+    quint64 parks = 0;
+    quint64 wakeups = 0;
+    quint64 fullWaits = 0;
+    qint64 totalWaitNs = 0;
+    qint64 maxWaitNs = 0;
+
+    for (int i = 0; i < m_routers.size(); ++i) {
+        const QJsonObject shard = m_routers.at(i)->stats();
+        const RouterThread::Stats ingress = m_routerThreads.at(i)->stats();
+
+        connections += shard.value("connections").toInt();
+        sessions += shard.value("sessions").toInt();
+        const QJsonObject mail = shard.value("mailbox").toObject();
+        for (auto it = mail.constBegin(); it != mail.constEnd(); ++it) {
+            mailbox.insert(it.key(), mailbox.value(it.key()).toInteger() + it.value().toInteger());
         }
-    }
 
-    if (entry.worker) {
-        QMetaObject::invokeMethod(entry.worker, "disconnectFromHost", Qt::QueuedConnection);
+        depth += ingress.depth;
+        maxDepth = qMax(maxDepth, ingress.maxDepth);
+        capacity += ingress.capacity;
+        dequeued += ingress.dequeued;
+        forwarded += ingress.forwarded;
+        batches += ingress.batches;
+        parks += ingress.parks;
+        wakeups += ingress.wakeups;
+        fullWaits += ingress.fullWaits;
+        totalWaitNs += ingress.totalWaitNs;
+        maxWaitNs = qMax(maxWaitNs, ingress.maxWaitNs);
+
+        shards.append(QJsonObject{
+            {"connections", shard.value("connections")},
+            {"sessions", shard.value("sessions")},
+            {"depth", ingress.depth},
+            {"dequeued", static_cast<qint64>(ingress.dequeued)},
+            {"forwarded", static_cast<qint64>(ingress.forwarded)},
+        });
     }
 
-    if (entry.thread) {
-        entry.thread->quit();
-        if (!entry.thread->wait(2000)) {
-            emit log(QString("[%1] thread quit timeout, terminating").arg(clientId));
-            entry.thread->terminate();
-            entry.thread->wait(1000);
+    const TlsContext::Stats tls = m_tls.stats();
+    const FileSpool::Stats files = m_spool.stats();
+    const CaptureWriter::Stats capture = m_capture.stats();
+    const SpanRecorder::Stats profile = m_spans.stats();
+    const TransportContext::Stats transport = m_transport.stats();
+    const MemoryBudget::Stats memory = m_memory.stats(kMemoryTopCount);
+    const ContentFilter::Stats filter = m_filter.stats();
+    const OverloadController::Stats overload = m_overload.stats();
+
+    QJsonArray memoryTop;
+    for (const auto &usage : memory.top) {
+        QJsonObject entry{{"id", static_cast<qint64>(usage.clientId)}, {"name", usage.name}, {"total", usage.total}};
+        for (int k = 0; k < MemoryBudget::KindCount; ++k) {
+            entry.insert(MemoryBudget::kindName(static_cast<MemoryBudget::Kind>(k)), usage.bytes[k]);
         }
+        memoryTop.append(entry);
+    }
+    QJsonObject memoryObject{
+        {"budget", memory.budget},
+        {"connections", memory.connections},
+        {"total", memory.total},
+        {"evictions", static_cast<qint64>(memory.evictions)},
+        {"top", memoryTop},
+    };
+    for (int k = 0; k < MemoryBudget::KindCount; ++k) {
+        memoryObject.insert(MemoryBudget::kindName(static_cast<MemoryBudget::Kind>(k)), memory.bytes[k]);
     }
 
-    if (entry.worker) {
-        entry.worker->moveToThread(QThread::currentThread());
-        delete entry.worker;
+    QJsonObject overloadObject{
+        {"enabled", overload.enabled},
+        {"level", OverloadController::levelName(overload.level)},
+        {"level_index", static_cast<int>(overload.level)},
+        {"transitions", static_cast<qint64>(overload.transitions)},
+        {"queue_fill", overload.queueFill},
+        {"lag_ms", overload.lagMs},
+        {"backlog", overload.backlog},
+        {"sender_cap", overload.senderCap},
+    };
+    for (int m = 0; m < OverloadController::MeasureCount; ++m) {
+        overloadObject.insert(OverloadController::measureName(static_cast<OverloadController::Measure>(m)), static_cast<qint64>(overload.measures[m]));
     }
-    if (entry.thread) {
-        delete entry.thread;
+
+    QJsonObject trace;
+    for (int h = 0; h < TraceStats::HopCount; ++h) {
+        const auto hop = static_cast<TraceStats::Hop>(h);
+        const TraceStats::HopStats hopStats = m_trace.stats(hop);
+        trace.insert(TraceStats::hopName(hop),
+            QJsonObject{
+                {"count", static_cast<qint64>(hopStats.count)},
+                {"avg_us", hopStats.avgUs},
+                {"p50_us", hopStats.p50Us},
+                {"p99_us", hopStats.p99Us},
+                {"max_us", hopStats.maxUs},
+            });
     }
 
-    m_connectionLimit.release(1);
+    QJsonArray outbound;
+    for (int c = 0; c < OutboundStats::ClassCount; ++c) {
+        const auto cls = static_cast<OutboundStats::Class>(c);
+        const OutboundStats::ClassStats s = m_outbound.stats(cls);
+        outbound.append(QJsonObject{
+            {"class", OutboundStats::className(cls)},
+            {"queued", s.queued},
+            {"max_queued", s.maxQueued},
+            {"lines", static_cast<qint64>(s.lines)},
+            {"bytes", static_cast<qint64>(s.bytes)},
+            {"superseded", static_cast<qint64>(s.superseded)},
+            {"avg_wait_us", s.lines ? static_cast<double>(s.totalWaitNs) / static_cast<double>(s.lines) / 1e3 : 0.0},
+            {"max_wait_us", static_cast<double>(s.maxWaitNs) / 1e3},
+        });
+    }
+    return QJsonObject{
+        {"connections", connections},
+        {"sessions", sessions},
+        {"mailbox", mailbox},
+        {"shards", shards},
+        {"ingress",
+            QJsonObject{
+                {"depth", depth},
+                {"max_depth", maxDepth},
+                {"capacity", capacity},
+                {"dequeued", static_cast<qint64>(dequeued)},
+                {"forwarded", static_cast<qint64>(forwarded)},
+                {"batches", static_cast<qint64>(batches)},
+                {"avg_batch", batches ? static_cast<double>(dequeued) / static_cast<double>(batches) : 0.0},
+                {"parks", static_cast<qint64>(parks)},
+                {"wakeups", static_cast<qint64>(wakeups)},
+                {"full_waits", static_cast<qint64>(fullWaits)},
+                {"avg_wait_us", dequeued ? static_cast<double>(totalWaitNs) / static_cast<double>(dequeued) / 1e3 : 0.0},
+                {"max_wait_us", static_cast<double>(maxWaitNs) / 1e3},
+            }},
+        {"outbound", outbound},
+        {"memory", memoryObject},
+        {"filter",
+            QJsonObject{
+                {"enabled", filter.enabled},
+                {"path", filter.path},
+                {"terms", filter.patterns},
+                {"reloads", static_cast<qint64>(filter.reloads)},
+                {"scanned", static_cast<qint64>(filter.scanned)},
+                {"logged", static_cast<qint64>(filter.logged)},
+                {"masked", static_cast<qint64>(filter.masked)},
+                {"rejected", static_cast<qint64>(filter.rejected)},
+            }},
+        {"overload", overloadObject},
+        {"trace", trace},
+        {"search", m_search ? m_search->stats() : QJsonObject{{"enabled", false}}},
+        {"files",
+            QJsonObject{
+                {"enabled", m_spool.isEnabled()},
+                {"files", files.files},
+                {"partial", files.partial},
+                {"bytes", files.bytes},
+                {"uploads", static_cast<qint64>(files.uploads)},
+                {"downloads", static_cast<qint64>(files.downloads)},
+                {"received_bytes", static_cast<qint64>(files.receivedBytes)},
+                {"zero_copy_bytes", static_cast<qint64>(files.zeroCopyBytes)},
+                {"copied_bytes", static_cast<qint64>(files.copiedBytes)},
+            }},
+        {"capture",
+            QJsonObject{
+                {"enabled", capture.enabled},
+                {"path", capture.path},
+                {"records", static_cast<qint64>(capture.records)},
+                {"bytes", static_cast<qint64>(capture.bytes)},
+                {"failed_writes", static_cast<qint64>(capture.failedWrites)},
+            }},
+        {"profile",
+            QJsonObject{
+                {"enabled", profile.enabled},
+                {"path", profile.path},
+                {"spans", static_cast<qint64>(profile.spans)},
+                {"dropped", static_cast<qint64>(profile.dropped)},
+                {"threads", profile.threads},
+                {"window_spans", profile.windowSpans},
+                {"writes", static_cast<qint64>(profile.writes)},
+            }},
+        {"transport",
+            QJsonObject{
+                {"backend", TransportContext::backendName(m_transport.backend())},
+                {"reads", static_cast<qint64>(transport.reads)},
+                {"read_bytes", static_cast<qint64>(transport.readBytes)},
+                {"writes", static_cast<qint64>(transport.writes)},
+                {"write_buffers", static_cast<qint64>(transport.writeBuffers)},
+                {"written_bytes", static_cast<qint64>(transport.writtenBytes)},
+            }},
+        {"tls",
+            QJsonObject{
+                {"enabled", m_tls.isEnabled()},
+                {"handshakes", static_cast<qint64>(tls.handshakes)},
+                {"failures", static_cast<qint64>(tls.failures)},
+                {"avg_ms", tls.handshakes ? static_cast<double>(tls.totalNs) / static_cast<double>(tls.handshakes) / 1e6 : 0.0},
+                {"max_ms", static_cast<double>(tls.maxNs) / 1e6},
+            }},
+    };
 }
 
-void ChatServer::sendJson(quint64 clientId, const QJsonObject &obj)
+qintptr ChatServer::openLocalConnection()
 {
-    const auto it = m_clients.find(clientId);
-    if (it == m_clients.end() || !it.value().worker) {
-        return;
+#ifdef Q_OS_LINUX
+    if (!isRunning()) {
+        return -1;
     }
-
-    const QString to = (it.value().loggedIn && !it.value().name.isEmpty()) ? it.value().name : QString("#%1").arg(clientId);
-    emit log(QString("Sending to %1 - %2").arg(to, toCompactJson(obj)));
-
-    const QByteArray line = Protocol::toLine(obj);
-    QMetaObject::invokeMethod(it.value().worker, "sendLine", Qt::QueuedConnection, Q_ARG(QByteArray, line));
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        emit log(QString("local connection failed: %1").arg(qt_error_string(errno)));
+        return -1;
+    }
+    onIncomingConnection(fds[0], true);
+    return fds[1];
+#else
+    return -1;
+#endif
 }
 
-void ChatServer::broadcastJson(const QJsonObject &obj, quint64 exceptClientId)
+void ChatServer::onIncomingConnection(qintptr socketDescriptor, bool local)
 {
-    const QByteArray line = Protocol::toLine(obj);
-    const QString compact = toCompactJson(obj);
-    for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
-        const auto clientId = it.key();
-        const auto &client = it.value();
-        if (!client.loggedIn || !client.worker) {
-            continue;
+    if (!m_connectionLimit.tryAcquire(1)) {
+        emit log("connection rejected: too many clients");
+        if (local) {
+            Handover::closeFd(static_cast<int>(socketDescriptor));
+            return;
         }
-        if (exceptClientId != 0 && clientId == exceptClientId) {
-            continue;
+        auto *socket = new QTcpSocket(this);
+        if (socket->setSocketDescriptor(socketDescriptor)) {
+            socket->disconnectFromHost();
         }
-        emit log(QString("Sending to %1 - %2").arg(client.name, compact));
-        QMetaObject::invokeMethod(client.worker, "sendLine", Qt::QueuedConnection, Q_ARG(QByteArray, line));
+        socket->deleteLater();
+        return;
     }
+
+    SpanRecorder::Scope span(&m_spans, SpanRecorder::Accept);
+    const quint64 clientId = m_nextClientId++;
+    emit log(QString("[%1] incoming %2connection").arg(clientId).arg(local ? QStringLiteral("local ") : QString()));
+    startWorker(clientId, socketDescriptor, QJsonObject(), QString(), local);
 }
 
-void ChatServer::broadcastUsers()
+void ChatServer::startWorker(quint64 clientId, qintptr socketDescriptor, const QJsonObject &restored, const QString &name, bool local)
 {
-    const QStringList users = currentUsers();
-    emit usersChanged(users);
+    auto *thread = new QThread;
+    thread->setObjectName(QStringLiteral("client-%1").arg(clientId));
 
-    QJsonArray arr;
-    for (const auto &u : users) {
-        arr.append(u);
+    auto *worker = new ClientWorker(clientId, socketDescriptor, m_context, m_tls.isEnabled() && !local);
+    m_memory.setName(worker->memoryAccount(), name);
+    // A connection taken over logged in belongs on its name's shard at once.
+    const int shard = name.isEmpty() ? m_shards.homeShard(clientId) : m_shards.shardForName(name);
+    if (!restored.isEmpty()) {
+        worker->restoreState(restored, shard);
     }
-    broadcastJson(QJsonObject{{"type", "user_list"}, {"users", arr}});
-}
+    worker->moveToThread(thread);
 
-QStringList ChatServer::currentUsers() const
-{
-    QStringList users;
-    users.reserve(m_clients.size());
-    for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
-        if (it.value().loggedIn) {
-            users.push_back(it.value().name);
-        }
-    }
-    users.sort(Qt::CaseInsensitive);
-    return users;
+    connect(thread, &QThread::started, worker, &ClientWorker::start);
+    connect(worker, &ClientWorker::disconnected, thread, &QThread::quit);
+    connect(worker, &ClientWorker::log, this, [this](quint64 id, const QString &msg) { emit log(QString("[%1] %2").arg(id).arg(msg)); });
+    // Routers delete workers on their own threads; this runs queued here.
+    connect(worker, &QObject::destroyed, this, [this, clientId]() { m_workers.remove(clientId); });
+    m_workers.insert(clientId, worker);
+
+    // Queued on the shard ahead of anything the worker can push, since it
+    // only starts below.
+    IngressEvent attach;
+    attach.kind = IngressEvent::Kind::Attach;
+    attach.clientId = clientId;
+    attach.worker = worker;
+    attach.thread = thread;
+    attach.name = name;
+    m_shards.post(shard, std::move(attach));
+
+    thread->start();
 }
@@ -1,61 +1,136 @@
 #pragma once
 
-#include <QByteArray>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QHostAddress>
 #include <QJsonObject>
+#include <QList>
 #include <QObject>
 #include <QSemaphore>
 #include <QString>
 #include <QStringList>
 
+#include "capturewriter.h"
+#include "clienttransport.h"
+#include "contentfilter.h"
+#include "filespool.h"
+#include "memorybudget.h"
+#include "outboundqueue.h"
+#include "overloadcontroller.h"
+#include "serverconfig.h"
+#include "servercontext.h"
+#include "shardmap.h"
+#include "spanrecorder.h"
+#include "tlscontext.h"
+#include "tracestats.h"
+
+class ChatRouter;
 class ClientWorker;
-class QThread;
+class QFileSystemWatcher;
+class QSocketNotifier;
 class QTcpServer;
+class QTimer;
+class SearchService;
 class ThreadedTcpServer;
 
+// GUI-thread front of the server: accepts connections, starts a worker thread
+// per client and hands it to one of the ChatRouter shards, each running on its
+// own RouterThread.
+//
+// With ServerConfig::handoverPath set, a running server waits on that Unix
+// socket for a successor and hands it the listener, every connection and the
+// routers' state (see Handover); takeOver() is the successor's side.
 class ChatServer : public QObject
 {
     Q_OBJECT
     friend class ThreadedTcpServer;
 
 public:
-    explicit ChatServer(QObject *parent = nullptr);
+    explicit ChatServer(const ServerConfig &config = ServerConfig(), QObject *parent = nullptr);
     ~ChatServer() override;
 
     bool start(const QHostAddress &address, quint16 port);
+    // Starts with the sockets of the server waiting at handoverPath; false if
+    // there is none or the handover failed (nothing is running then).
+    bool takeOver();
     void stop();
     bool isRunning() const;
+    quint16 serverPort() const;
+
+    QJsonObject stats() const;
+
+    // With --profile: saves the recorded timeline now; false and *error if
+    // profiling is off or the file cannot be written.
+    bool saveProfile(QString *error);
+
+    // In-process connection for tests and simulations (Linux): one end of a
+    // Unix socket pair is served like an accepted client, the other is
+    // returned for the caller's client (see ChatClient::setConnector). -1 if
+    // the server is not running or the pair cannot be made; over the
+    // connection limit the server end is closed at once, like an accepted one.
+    qintptr openLocalConnection();
 
 signals:
     void log(QString message);
     void runningChanged(bool running);
     void usersChanged(QStringList users);
-
-private slots:
-    void onClientLine(quint64 clientId, QByteArray line);
-    void onClientDisconnected(quint64 clientId);
+    // Everything went to the successor; this server has stopped.
+    void handedOver();
 
 private:
-    struct ClientEntry {
-        QString name;
-        ClientWorker *worker = nullptr;
-        QThread *thread = nullptr;
-        bool loggedIn = false;
-    };
-
-    void onIncomingConnection(qintptr socketDescriptor);
-    void removeClient(quint64 clientId, bool announce);
-    void sendJson(quint64 clientId, const QJsonObject &obj);
-    void broadcastJson(const QJsonObject &obj, quint64 exceptClientId = 0);
-    void broadcastUsers();
-    QStringList currentUsers() const;
+    // `local`: from the Unix socket or openLocalConnection, served without TLS.
+    void onIncomingConnection(qintptr socketDescriptor, bool local = false);
+    void startWorker(quint64 clientId, qintptr socketDescriptor, const QJsonObject &restored = QJsonObject(), const QString &name = QString(), bool local = false);
+    void startRouters();
+    void listenForHandover();
+    void closeHandover();
+    // With `fd` the listener handed over by the predecessor, else a new one
+    // at localSocketPath.
+    bool listenLocal(int fd = -1);
+    void closeLocal(bool removePath);
+    void onLocalConnection();
+    void onHandoverRequest();
+    bool handOver(int fd);
+    void enforceMemoryBudget();
+    void checkOverload();
+    void collectProfile();
+    void finishProfile();
+    void loadFilter();
 
+    const ServerConfig m_config;
     QTcpServer *m_server = nullptr;
     quint64 m_nextClientId = 1;
-    bool m_stopping = false;
+    bool m_started = false;
     QSemaphore m_connectionLimit;
-
-    QHash<quint64, ClientEntry> m_clients;
-    QHash<QString, quint64> m_nameToId;
+    TlsContext m_tls;
+    FileSpool m_spool;
+    OutboundStats m_outbound;
+    CaptureWriter m_capture;
+    SpanRecorder m_spans;
+    QTimer *m_profileTimer = nullptr;
+    QElapsedTimer m_profileSaved;
+    TraceStats m_trace;
+    TransportContext m_transport;
+    MemoryBudget m_memory;
+    QTimer *m_memoryTimer = nullptr;
+    OverloadController m_overload;
+    QTimer *m_overloadTimer = nullptr;
+    QElapsedTimer m_overloadClock;
+    qint64 m_overloadDueNs = 0;
+    ContentFilter m_filter;
+    QFileSystemWatcher *m_filterWatcher = nullptr;
+    QTimer *m_filterReload = nullptr;
+    QList<RouterThread *> m_routerThreads;
+    QList<ChatRouter *> m_routers;
+    RouterThread *m_searchThread = nullptr;
+    SearchService *m_search = nullptr;
+    ShardMap m_shards;
+    // Pointers to the members above, for the routers and workers.
+    ServerContext m_context;
+    // Every live worker, for freezing them on a handover.
+    QHash<quint64, ClientWorker *> m_workers;
+    int m_localFd = -1;
+    QSocketNotifier *m_localNotifier = nullptr;
+    int m_handoverFd = -1;
+    QSocketNotifier *m_handoverNotifier = nullptr;
 };
@@ -0,0 +1,132 @@
+#include "clientregistry.h"
+
+ClientRegistry::Handle ClientRegistry::insert(quint64 clientId, ClientWorker *worker, QThread *thread)
+{
+    quint32 slot = 0;
+    if (!m_freeSlots.isEmpty()) {
+        slot = m_freeSlots.takeLast();
+    } else {
+        slot = static_cast<quint32>(m_hot.size());
+        m_hot.push_back(Hot());
+        m_cold.push_back(Cold());
+    }
+
+    Hot &hot = m_hot[slot];
+    hot.worker = worker;
+    hot.flags = InUse;
+    Cold &cold = m_cold[slot];
+    cold.clientId = clientId;
+    cold.thread = thread;
+    cold.name = 0;
+    m_slots.insert(clientId, slot);
+    return Handle{slot, hot.generation};
+}
+
+ClientRegistry::Entry ClientRegistry::take(Handle handle)
+{
+    Entry entry;
+    if (!isCurrent(handle)) {
+        return entry;
+    }
+
+    Hot &hot = m_hot[handle.slot];
+    Cold &cold = m_cold[handle.slot];
+    entry.clientId = cold.clientId;
+    entry.worker = hot.worker;
+    entry.thread = cold.thread;
+    entry.name = m_names.at(cold.name);
+    entry.loggedIn = hot.flags & LoggedIn;
+    entry.loggedOut = hot.flags & LoggedOut;
+
+    m_slots.remove(cold.clientId);
+    release(cold.name);
+    cold = Cold();
+    hot.worker = nullptr;
+    hot.flags = 0;
+    // Every handle to the slot so far is stale from here on.
+    if (++hot.generation == 0) {
+        hot.generation = 1;
+    }
+    m_freeSlots.push_back(handle.slot);
+    return entry;
+}
+
+ClientRegistry::Handle ClientRegistry::find(quint64 clientId) const
+{
+    const auto it = m_slots.constFind(clientId);
+    if (it == m_slots.constEnd()) {
+        return Handle();
+    }
+    return Handle{it.value(), m_hot.at(it.value()).generation};
+}
+
+bool ClientRegistry::isCurrent(Handle handle) const
+{
+    if (handle.isNull() || handle.slot >= static_cast<quint32>(m_hot.size())) {
+        return false;
+    }
+    const Hot &hot = m_hot.at(handle.slot);
+    return (hot.flags & InUse) && hot.generation == handle.generation;
+}
+
+ClientWorker *ClientRegistry::worker(Handle handle) const
+{
+    return isCurrent(handle) ? m_hot.at(handle.slot).worker : nullptr;
+}
+
+void ClientRegistry::logIn(Handle handle, const QString &name)
+{
+    Cold &cold = m_cold[handle.slot];
+    const quint32 previous = cold.name;
+    cold.name = intern(name);
+    release(previous);
+    m_hot[handle.slot].flags |= LoggedIn;
+}
+
+void ClientRegistry::clearLogin(Handle handle)
+{
+    Cold &cold = m_cold[handle.slot];
+    release(cold.name);
+    cold.name = 0;
+    m_hot[handle.slot].flags &= ~LoggedIn;
+}
+
+void ClientRegistry::setLoggedOut(Handle handle)
+{
+    m_hot[handle.slot].flags |= LoggedOut;
+}
+
+quint32 ClientRegistry::intern(const QString &name)
+{
+    if (name.isEmpty()) {
+        return 0;
+    }
+    const auto it = m_nameIds.constFind(name);
+    if (it != m_nameIds.constEnd()) {
+        ++m_nameRefs[it.value()];
+        return it.value();
+    }
+
+    quint32 id = 0;
+    if (!m_freeNames.isEmpty()) {
+        id = m_freeNames.takeLast();
+        m_names[id] = name;
+        m_nameRefs[id] = 1;
+    } else {
+        id = static_cast<quint32>(m_names.size());
+        m_names.push_back(name);
+        m_nameRefs.push_back(1);
+    }
+    m_nameIds.insert(name, id);
+    return id;
+}
+
+void ClientRegistry::release(quint32 name)
+{
+    if (name == 0 || --m_nameRefs[name] > 0) {
+        return;
+    }
+    m_nameIds.remove(m_names.at(name));
+    m_names[name].clear();
+    m_freeNames.push_back(name);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+class ClientWorker;
+class QThread;
+
+// The connections of one router in dense slots, for the scans that touch all
+// of them: every user list goes to each logged-in connection, and every
+// broadcast looks up the worker of each attached session.
+//
+// A slot's hot part (worker, flags, generation: 16 bytes) lives in one array
+// and its cold part (id, thread, name) in a parallel one, so a scan walks a
+// contiguous run of small records instead of hash nodes all over the heap.
+// Freed slots are reused. A Handle is a slot plus the generation it had when
+// handed out; the generation moves on whenever the slot is freed, so a handle
+// kept past its connection (by a Session, say) turns stale rather than naming
+// whoever gets the slot next. Names of logged-in connections are interned.
+//
+// Not thread-safe: lives on its router's thread.
+class ClientRegistry
+{
+public:
+    struct Handle {
+        quint32 slot = 0;
+        quint32 generation = 0; // 0: no connection
+
+        bool isNull() const { return generation == 0; }
+    };
+
+    // A connection taken out of the registry.
+    struct Entry {
+        quint64 clientId = 0;
+        ClientWorker *worker = nullptr;
+        QThread *thread = nullptr;
+        QString name;
+        bool loggedIn = false;
+        bool loggedOut = false;
+    };
+
+    Handle insert(quint64 clientId, ClientWorker *worker, QThread *thread);
+    Entry take(Handle handle);
+
+    // Null if there is no such connection.
+    Handle find(quint64 clientId) const;
+    bool contains(quint64 clientId) const { return m_slots.contains(clientId); }
+    // Whether `handle` still names the connection it was handed out for.
+    bool isCurrent(Handle handle) const;
+    qsizetype size() const { return m_slots.size(); }
+    QList<quint64> ids() const { return m_slots.keys(); }
+
+    // The worker for a current handle; nullptr for a null or stale one.
+    ClientWorker *worker(Handle handle) const;
+
+    // The rest need a current handle.
+    quint64 clientId(Handle handle) const { return m_cold.at(handle.slot).clientId; }
+    QThread *thread(Handle handle) const { return m_cold.at(handle.slot).thread; }
+    bool isLoggedIn(Handle handle) const { return m_hot.at(handle.slot).flags & LoggedIn; }
+    // Sent "logout": its session ends with the connection.
+    bool hasLoggedOut(Handle handle) const { return m_hot.at(handle.slot).flags & LoggedOut; }
+    // Empty unless logged in.
+    const QString &name(Handle handle) const { return m_names.at(m_cold.at(handle.slot).name); }
+
+    void logIn(Handle handle, const QString &name);
+    // Taken over by another connection: no longer logged in as anyone.
+    void clearLogin(Handle handle);
+    void setLoggedOut(Handle handle);
+
+    // f(ClientWorker *) for every logged-in connection with a worker.
+    template <typename F>
+    void forEachLoggedIn(F f) const
+    {
+        for (const Hot &hot : m_hot) {
+            if ((hot.flags & LoggedIn) && hot.worker) {
+                f(hot.worker);
+            }
+        }
+    }
+
+    // f(Handle) for every connection; `f` must not insert or take.
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (qsizetype slot = 0; slot < m_hot.size(); ++slot) {
+            if (m_hot.at(slot).flags & InUse) {
+                f(Handle{static_cast<quint32>(slot), m_hot.at(slot).generation});
+            }
+        }
+    }
+
+    // Slots in the arrays, used or free, and distinct names interned.
+    qsizetype capacity() const { return m_hot.size(); }
+    qsizetype internedNames() const { return m_nameIds.size(); }
+
+private:
+    enum Flag : quint8 {
+        InUse = 0x1,
+        LoggedIn = 0x2,
+        LoggedOut = 0x4,
+    };
+
+    struct Hot {
+        ClientWorker *worker = nullptr;
+        quint32 generation = 1;
+        quint8 flags = 0;
+    };
+
+    struct Cold {
+        quint64 clientId = 0;
+        QThread *thread = nullptr;
+        quint32 name = 0; // into m_names, 0 for none
+    };
+
+    quint32 intern(const QString &name);
+    void release(quint32 name);
+
+    QList<Hot> m_hot;
+    QList<Cold> m_cold;
+    QList<quint32> m_freeSlots;
+    QHash<quint64, quint32> m_slots;
+
+    // Interned names with their reference counts; id 0 is the empty name.
+    QList<QString> m_names{QString()};
+    QList<int> m_nameRefs{0};
+    QList<quint32> m_freeNames;
+    QHash<QString, quint32> m_nameIds;
+};
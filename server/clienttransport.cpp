@@ -0,0 +1,423 @@
+#include "clienttransport.h"
+
+#include <QDeadlineTimer>
+#include <QList>
+#include <QSocketNotifier>
+#include <QSslSocket>
+#include <QTcpSocket>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+class QtTransport final : public ClientTransport
+{
+public:
+    QtTransport(bool tls, QObject *parent)
+        : ClientTransport(parent)
+        , m_socket(tls ? new QSslSocket(this) : new QTcpSocket(this))
+    {
+        connect(m_socket, &QTcpSocket::readyRead, this, &ClientTransport::readyRead);
+        connect(m_socket, &QTcpSocket::bytesWritten, this, &ClientTransport::bytesWritten);
+        connect(m_socket, &QTcpSocket::disconnected, this, &ClientTransport::disconnected);
+        connect(m_socket, &QTcpSocket::errorOccurred, this, &ClientTransport::errorOccurred);
+    }
+
+    bool open(qintptr socketDescriptor) override { return m_socket->setSocketDescriptor(socketDescriptor); }
+    qintptr socketDescriptor() const override { return m_socket->socketDescriptor(); }
+    bool isConnected() const override { return m_socket->state() == QAbstractSocket::ConnectedState; }
+    QString errorString() const override { return m_socket->errorString(); }
+    QSslSocket *sslSocket() const override { return qobject_cast<QSslSocket *>(m_socket); }
+
+    void readAll(QByteArray *buffer) override { buffer->append(m_socket->readAll()); }
+    void write(const QByteArray &data) override { m_socket->write(data); }
+    qint64 bytesToWrite() const override { return m_socket->bytesToWrite(); }
+    void flush() override { m_socket->flush(); }
+    bool waitForBytesWritten(int msecs) override { return m_socket->waitForBytesWritten(msecs); }
+    void disconnectFromHost() override { m_socket->disconnectFromHost(); }
+    void abort() override { m_socket->abort(); }
+
+private:
+    QTcpSocket *const m_socket;
+};
+
+#ifdef Q_OS_LINUX
+
+// Room readv() is given in the caller's buffer at least, and the spill block
+// behind it that takes the rest of a burst in the same call.
+constexpr qsizetype kMinReadRoom = 16 * 1024;
+constexpr qsizetype kSpillBlock = 64 * 1024;
+// Queued lines per sendmsg().
+constexpr int kMaxIov = 64;
+
+class EpollTransport final : public ClientTransport
+{
+public:
+    EpollTransport(TransportContext *context, QObject *parent)
+        : ClientTransport(parent)
+        , m_context(context)
+    {
+    }
+
+    ~EpollTransport() override { closeDescriptor(); }
+
+    bool open(qintptr socketDescriptor) override
+    {
+        m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0) {
+            m_error = qt_error_string(errno);
+            return false;
+        }
+        m_fd = static_cast<int>(socketDescriptor);
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = m_fd;
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_fd, &event) < 0) {
+            m_error = qt_error_string(errno);
+            ::close(m_epoll);
+            m_epoll = -1;
+            m_fd = -1;
+            return false;
+        }
+        // Whatever is already waiting shows up as the first edge.
+        m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, [this]() { onEvents(); });
+        m_spill.resize(kSpillBlock);
+        return true;
+    }
+
+    qintptr socketDescriptor() const override { return m_fd; }
+    bool isConnected() const override { return m_fd >= 0 && !m_closing && !m_eof; }
+    QString errorString() const override { return m_error; }
+
+    void readAll(QByteArray *buffer) override
+    {
+        // Edge-triggered: read until the socket is empty. A short read means it
+        // is, which saves the call that would only return EAGAIN, unless the
+        // peer has hung up: data and FIN can share one edge, and only the read
+        // of 0 bytes after the data tells of the FIN.
+        while (m_fd >= 0 && !m_eof) {
+            const qsizetype old = buffer->size();
+            const qsizetype room = qMax(kMinReadRoom, buffer->capacity() - old);
+            buffer->resize(old + room);
+            iovec iov[2] = {{buffer->data() + old, static_cast<size_t>(room)}, {m_spill.data(), static_cast<size_t>(m_spill.size())}};
+
+            const ssize_t n = ::readv(m_fd, iov, 2);
+            if (n > 0) {
+                m_context->recordRead(n);
+                if (n <= room) {
+                    buffer->resize(old + n);
+                } else {
+                    buffer->append(m_spill.constData(), n - room);
+                }
+                if (n < room + m_spill.size() && !m_peerClosed) {
+                    return;
+                }
+                continue;
+            }
+            buffer->resize(old);
+            if (n == 0) {
+                m_eof = true;
+                finishLater();
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                fail(errno);
+            }
+            return;
+        }
+    }
+
+    void write(const QByteArray &data) override
+    {
+        if (m_fd < 0 || m_closing || data.isEmpty()) {
+            return;
+        }
+        m_queue.push_back(data);
+        m_queuedBytes += data.size();
+        // Everything written in this pass of the event loop leaves together.
+        if (!m_flushScheduled) {
+            m_flushScheduled = true;
+            QMetaObject::invokeMethod(
+                this,
+                [this]() {
+                    m_flushScheduled = false;
+                    flush();
+                },
+                Qt::QueuedConnection);
+        }
+    }
+
+    qint64 bytesToWrite() const override { return m_queuedBytes; }
+
+    void flush() override
+    {
+        bool wrote = false;
+        while (m_fd >= 0 && m_writable && !m_queue.isEmpty()) {
+            iovec iov[kMaxIov];
+            int count = 0;
+            for (qsizetype i = 0; i < m_queue.size() && count < kMaxIov; ++i, ++count) {
+                const QByteArray &data = m_queue.at(i);
+                const qsizetype skip = i == 0 ? m_queueOffset : 0;
+                iov[count].iov_base = const_cast<char *>(data.constData()) + skip;
+                iov[count].iov_len = static_cast<size_t>(data.size() - skip);
+            }
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = static_cast<size_t>(count);
+
+            const ssize_t n = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN) {
+                    // The next EPOLLOUT edge resumes.
+                    m_writable = false;
+                } else {
+                    fail(errno);
+                }
+                break;
+            }
+            m_context->recordWrite(count, n);
+            wrote = true;
+            consume(n);
+        }
+        if (wrote) {
+            emit bytesWritten();
+        }
+        if (m_closing && m_queue.isEmpty()) {
+            finishLater();
+        }
+    }
+
+    bool waitForBytesWritten(int msecs) override
+    {
+        const QDeadlineTimer deadline(msecs);
+        while (m_fd >= 0 && !m_queue.isEmpty()) {
+            const qint64 before = m_queuedBytes;
+            m_writable = true;
+            flush();
+            if (m_queuedBytes < before) {
+                return true;
+            }
+            pollfd p{m_fd, POLLOUT, 0};
+            if (deadline.hasExpired() || ::poll(&p, 1, static_cast<int>(deadline.remainingTime())) <= 0) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    void disconnectFromHost() override
+    {
+        if (m_fd < 0 || m_closing) {
+            return;
+        }
+        m_closing = true;
+        if (m_queue.isEmpty()) {
+            finishLater();
+        } else {
+            flush();
+        }
+    }
+
+    void abort() override { finish(); }
+
+private:
+    void onEvents()
+    {
+        epoll_event events[4];
+        const int n = ::epoll_wait(m_epoll, events, 4, 0);
+        quint32 mask = 0;
+        for (int i = 0; i < n; ++i) {
+            mask |= events[i].events;
+        }
+
+        if (mask & EPOLLOUT) {
+            m_writable = true;
+            if (!m_queue.isEmpty()) {
+                flush();
+            }
+        }
+        if (mask & EPOLLERR) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            ::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            fail(error ? error : ECONNRESET);
+            return;
+        }
+        // The peer closing shows up as a read of 0 bytes.
+        if (mask & (EPOLLRDHUP | EPOLLHUP)) {
+            m_peerClosed = true;
+        }
+        if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+            emit readyRead();
+        }
+    }
+
+    void consume(qint64 bytes)
+    {
+        m_queuedBytes -= bytes;
+        while (bytes > 0) {
+            const qint64 left = m_queue.constFirst().size() - m_queueOffset;
+            if (bytes < left) {
+                m_queueOffset += bytes;
+                return;
+            }
+            bytes -= left;
+            m_queue.removeFirst();
+            m_queueOffset = 0;
+        }
+    }
+
+    void fail(int error)
+    {
+        m_error = qt_error_string(error);
+        m_queue.clear();
+        m_queuedBytes = 0;
+        m_queueOffset = 0;
+        emit errorOccurred();
+        finishLater();
+    }
+
+    // The worker may be in the middle of its input when the socket turns out
+    // to be gone; it hears about it once it is done.
+    void finishLater()
+    {
+        QMetaObject::invokeMethod(this, [this]() { finish(); }, Qt::QueuedConnection);
+    }
+
+    void finish()
+    {
+        if (m_fd < 0) {
+            return;
+        }
+        closeDescriptor();
+        emit disconnected();
+    }
+
+    void closeDescriptor()
+    {
+        delete m_notifier;
+        m_notifier = nullptr;
+        if (m_epoll >= 0) {
+            ::close(m_epoll);
+            m_epoll = -1;
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_queue.clear();
+        m_queuedBytes = 0;
+        m_queueOffset = 0;
+    }
+
+    TransportContext *const m_context;
+    int m_fd = -1;
+    int m_epoll = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    // EPOLLRDHUP or EPOLLHUP seen: reads go on to the 0-byte one.
+    bool m_peerClosed = false;
+    QByteArray m_spill;
+    QList<QByteArray> m_queue;
+    qsizetype m_queueOffset = 0;
+    qint64 m_queuedBytes = 0;
+    QString m_error;
+    bool m_writable = true;
+    bool m_flushScheduled = false;
+    bool m_closing = false;
+    bool m_eof = false;
+};
+
+#endif
+
+} // namespace
+
+bool TransportContext::isAvailable(Backend backend)
+{
+#ifdef Q_OS_LINUX
+    Q_UNUSED(backend);
+    return true;
+#else
+    return backend == Backend::Qt;
+#endif
+}
+
+const char *TransportContext::backendName(Backend backend)
+{
+    switch (backend) {
+    case Backend::Qt:
+        return "qt";
+    case Backend::Epoll:
+        return "epoll";
+    }
+    return "";
+}
+
+bool TransportContext::parseBackend(const QString &name, Backend *backend)
+{
+    for (const auto candidate : {Backend::Qt, Backend::Epoll}) {
+        if (name == QLatin1String(backendName(candidate))) {
+            *backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TransportContext::setBackend(Backend backend)
+{
+    m_backend = isAvailable(backend) ? backend : Backend::Qt;
+}
+
+TransportContext::Backend TransportContext::backend() const
+{
+    return m_backend;
+}
+
+ClientTransport *TransportContext::create(bool tls, QObject *parent)
+{
+#ifdef Q_OS_LINUX
+    if (!tls && m_backend == Backend::Epoll) {
+        return new EpollTransport(this, parent);
+    }
+#endif
+    return new QtTransport(tls, parent);
+}
+
+void TransportContext::recordRead(qint64 bytes)
+{
+    m_reads.fetchAndAddRelaxed(1);
+    m_readBytes.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+}
+
+void TransportContext::recordWrite(int buffers, qint64 bytes)
+{
+    m_writes.fetchAndAddRelaxed(1);
+    m_writeBuffers.fetchAndAddRelaxed(static_cast<quint64>(buffers));
+    m_writtenBytes.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+}
+
+TransportContext::Stats TransportContext::stats() const
+{
+    Stats s;
+    s.reads = m_reads.loadRelaxed();
+    s.readBytes = m_readBytes.loadRelaxed();
+    s.writes = m_writes.loadRelaxed();
+    s.writeBuffers = m_writeBuffers.loadRelaxed();
+    s.writtenBytes = m_writtenBytes.loadRelaxed();
+    return s;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+
+class QSslSocket;
+
+// Byte stream of one client connection, as ClientWorker uses it. Created by a
+// TransportContext on the worker's thread and used only there.
+//
+// readAll() appends to the caller's buffer. write() queues without copying;
+// the queue goes to the kernel once control is back in the event loop (or on
+// flush()), so the lines written in one pass leave in as few calls as the
+// backend manages. disconnected() is emitted once, also after abort().
+class ClientTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+    virtual bool open(qintptr socketDescriptor) = 0;
+    virtual qintptr socketDescriptor() const = 0;
+    virtual bool isConnected() const = 0;
+    virtual QString errorString() const = 0;
+    // The TLS socket of a Qt transport set up for TLS; nullptr otherwise.
+    virtual QSslSocket *sslSocket() const { return nullptr; }
+
+    virtual void readAll(QByteArray *buffer) = 0;
+    virtual void write(const QByteArray &data) = 0;
+    virtual qint64 bytesToWrite() const = 0;
+    virtual void flush() = 0;
+    virtual bool waitForBytesWritten(int msecs) = 0;
+    // Closes once the queued output is out; abort() drops it.
+    virtual void disconnectFromHost() = 0;
+    virtual void abort() = 0;
+
+signals:
+    void readyRead();
+    void bytesWritten();
+    void disconnected();
+    void errorOccurred();
+};
+
+// Which ClientTransport the workers get, chosen at startup, and the counters
+// of the native backend.
+//
+// Qt wraps QTcpSocket (QSslSocket with TLS, whatever the backend). Epoll
+// (Linux) drives the non-blocking descriptor itself: each worker thread has
+// an edge-triggered epoll set that Qt's event dispatcher watches as a single
+// descriptor, reads drain the socket with readv() straight into the worker's
+// buffer plus a per-connection spill block allocated once, and writes go out
+// as one sendmsg() over every queued line.
+class TransportContext
+{
+public:
+    enum class Backend {
+        Qt,
+        Epoll,
+    };
+
+    struct Stats {
+        quint64 reads = 0;
+        quint64 readBytes = 0;
+        quint64 writes = 0;
+        quint64 writeBuffers = 0;
+        quint64 writtenBytes = 0;
+    };
+
+    static bool isAvailable(Backend backend);
+    static const char *backendName(Backend backend);
+    // "qt" or "epoll"; false for anything else.
+    static bool parseBackend(const QString &name, Backend *backend);
+
+    void setBackend(Backend backend);
+    Backend backend() const;
+
+    // Worker thread. TLS connections always get the Qt backend.
+    ClientTransport *create(bool tls, QObject *parent);
+
+    // Any thread; only the native backend records.
+    void recordRead(qint64 bytes);
+    void recordWrite(int buffers, qint64 bytes);
+    Stats stats() const;
+
+private:
+    Backend m_backend = Backend::Qt;
+
+    QAtomicInteger<quint64> m_reads;
+    QAtomicInteger<quint64> m_readBytes;
+    QAtomicInteger<quint64> m_writes;
+    QAtomicInteger<quint64> m_writeBuffers;
+    QAtomicInteger<quint64> m_writtenBytes;
+};
@@ -1,40 +1,193 @@
 #include "clientworker.h"
 
-#include <QTcpSocket>
+#include "capturewriter.h"
+#include "clienttransport.h"
+#include "filespool.h"
+#include "protocol.h"
+#include "shardmap.h"
+#include "spanrecorder.h"
+#include "tlscontext.h"
+#include "tracestats.h"
 
-ClientWorker::ClientWorker(quint64 clientId, qintptr socketDescriptor, QObject *parent)
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSslSocket>
+#include <QTimer>
+
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Bytes handed to the socket ahead of time. What the socket holds is sent in
+// order; what is still in the OutboundQueue can be overtaken by a more urgent
+// class, so this stays small.
+constexpr qint64 kSocketLowWater = 16 * 1024;
+
+// A rate-limited download waits until at least this much is allowed rather
+// than trickling out tiny frames.
+constexpr qint64 kMinRateChunk = 4096;
+
+// Capacity an empty input buffer may keep.
+constexpr qsizetype kInputBufferKeep = 64 * 1024;
+
+// How long a handover waits for Qt's write buffer of one connection to reach
+// the kernel before leaving that connection behind.
+constexpr int kHandoverFlushMs = 2000;
+
+QByteArray fileError(const QByteArray &id, const QString &reason)
+{
+    return Protocol::toLine(QJsonObject{{"type", "file_error"}, {"id", QString::fromLatin1(id)}, {"reason", reason}});
+}
+
+} // namespace
+
+ClientWorker::ClientWorker(quint64 clientId, qintptr socketDescriptor, const ServerContext &context, bool tls, QObject *parent)
     : QObject(parent)
     , m_clientId(clientId)
     , m_socketDescriptor(socketDescriptor)
+    , m_shards(context.shards)
+    , m_shard(context.shards->homeShard(clientId))
+    , m_tls(tls ? context.tls : nullptr)
+    , m_transports(context.transports)
+    , m_outbound(context.outbound)
+    , m_spool(context.spool)
+    , m_trace(context.trace)
+    , m_capture(context.capture)
+    , m_memory(context.memory)
+    , m_memoryAccount(context.memory ? context.memory->open(clientId, this) : nullptr)
+    , m_overload(context.overload)
+    , m_spans(context.spans)
+{
+}
+
+ClientWorker::~ClientWorker()
 {
+    closeTransfers();
+    if (m_memory) {
+        m_memory->close(m_memoryAccount);
+    }
+}
+
+void ClientWorker::restoreState(const QJsonObject &state, int shard)
+{
+    m_restored = state;
+    m_shard = shard;
+    m_bound = state.value("bound").toBool();
+    m_buffer = QByteArray::fromBase64(state.value("buffer").toString().toLatin1());
+    m_frameId = state.value("frame_id").toString().toLatin1();
+    m_frameRemaining = state.value("frame_remaining").toInteger();
+    for (const auto &line : state.value("held").toArray()) {
+        m_held.push_back(QByteArray::fromBase64(line.toString().toLatin1()));
+    }
 }
 
 void ClientWorker::start()
 {
-    if (m_socket) {
+    if (m_socket || !openSocket(m_socketDescriptor)) {
+        return;
+    }
+
+    if (m_capture && m_capture->isEnabled()) {
+        capture(Capture::Kind::Open, m_capture->nowNs());
+        flushCapture();
+    }
+
+    if (auto *ssl = m_socket->sslSocket()) {
+        ssl->setSslConfiguration(m_tls->configuration());
+        m_handshakeTimer.start();
+        ssl->startServerEncryption();
+        emit log(m_clientId, "client socket ready, tls handshake started");
         return;
     }
 
-    m_socket = new QTcpSocket(this);
-    if (!m_socket->setSocketDescriptor(m_socketDescriptor)) {
+    if (!m_restored.isEmpty()) {
+        applyRestoredState();
+        emit log(m_clientId, "client socket taken over");
+        return;
+    }
+    emit log(m_clientId, "client socket ready");
+}
+
+bool ClientWorker::openSocket(qintptr socketDescriptor)
+{
+    if (m_transports) {
+        m_socket = m_transports->create(m_tls, this);
+    } else {
+        TransportContext qtOnly;
+        m_socket = qtOnly.create(m_tls, this);
+    }
+    if (!m_socket->open(socketDescriptor)) {
         emit log(m_clientId, QString("setSocketDescriptor failed: %1").arg(m_socket->errorString()));
-        emit disconnected(m_clientId);
+        postDisconnected();
         m_socket->deleteLater();
         m_socket = nullptr;
-        return;
+        return false;
     }
 
-    connect(m_socket, &QTcpSocket::readyRead, this, &ClientWorker::onReadyRead);
-    connect(m_socket, &QTcpSocket::disconnected, this, &ClientWorker::onDisconnected);
-    connect(m_socket,
-        QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::errorOccurred),
-        this,
-        &ClientWorker::onError);
+    connect(m_socket, &ClientTransport::readyRead, this, &ClientWorker::onReadyRead);
+    // Queued: flush() inside sendChunk() can emit bytesWritten, and the next
+    // chunk must not start in the middle of the current one.
+    connect(m_socket, &ClientTransport::bytesWritten, this, &ClientWorker::flushOutbound, Qt::QueuedConnection);
+    connect(m_socket, &ClientTransport::disconnected, this, &ClientWorker::onDisconnected);
+    connect(m_socket, &ClientTransport::errorOccurred, this, &ClientWorker::onError);
 
-    emit log(m_clientId, "client socket ready");
+    if (auto *ssl = m_socket->sslSocket()) {
+        connect(ssl, &QSslSocket::encrypted, this, &ClientWorker::onEncrypted);
+        connect(ssl, &QSslSocket::sslErrors, this, &ClientWorker::onSslErrors);
+    }
+    return true;
+}
+
+void ClientWorker::applyRestoredState()
+{
+    const QJsonObject state = std::move(m_restored);
+    m_restored = QJsonObject();
+
+    const qint64 now = RouterThread::nowNs();
+    for (const auto &line : state.value("outbound").toArray()) {
+        m_outbound.push(line.toString().toUtf8(), now);
+    }
+
+    // Transfers go on from where the old server left them; the files are in
+    // the same spool.
+    if (m_spool) {
+        for (const auto &value : state.value("uploads").toArray()) {
+            const QJsonObject upload = value.toObject();
+            const QByteArray id = upload.value("id").toString().toLatin1();
+            acceptUpload(id, m_spool->dataPath(id), upload.value("offset").toInteger(), upload.value("size").toInteger());
+        }
+        for (const auto &value : state.value("downloads").toArray()) {
+            const QJsonObject download = value.toObject();
+            const QByteArray id = download.value("id").toString().toLatin1();
+            startDownload(id, m_spool->dataPath(id), download.value("offset").toInteger(), download.value("size").toInteger(), download.value("rate").toInteger());
+        }
+    }
+
+    const QList<QByteArray> held = std::move(m_held);
+    m_held.clear();
+    for (const auto &line : held) {
+        routeLine(line);
+    }
+    onReadyRead();
+    flushOutbound();
 }
 
 void ClientWorker::sendLine(QByteArray line)
+{
+    if (m_memoryAccount) {
+        m_memoryAccount->add(MemoryBudget::Pending, -line.size());
+    }
+    queueLine(std::move(line));
+}
+
+void ClientWorker::queueLine(QByteArray line)
 {
     if (!m_socket) {
         return;
@@ -42,6 +195,60 @@ void ClientWorker::sendLine(QByteArray line)
     if (!line.endsWith('\n')) {
         line.append('\n');
     }
+
+    // A resume replay comes as several lines in one call; each is queued in
+    // its own class.
+    const qint64 now = RouterThread::nowNs();
+    qsizetype start = 0;
+    qsizetype end = line.indexOf('\n');
+    if (end + 1 == line.size()) {
+        m_outbound.push(std::move(line), now);
+    } else {
+        while (end >= 0) {
+            m_outbound.push(line.mid(start, end + 1 - start), now);
+            start = end + 1;
+            end = line.indexOf('\n', start);
+        }
+    }
+    flushOutbound();
+}
+
+void ClientWorker::flushOutbound()
+{
+    if (!m_socket) {
+        return;
+    }
+
+    SpanRecorder::Scope span(m_spans, SpanRecorder::Write);
+    QByteArray line;
+    qint64 lines = 0;
+    while (m_socket->bytesToWrite() < kSocketLowWater && m_outbound.pop(&line, RouterThread::nowNs())) {
+        writeLine(line);
+        ++lines;
+    }
+    span.setArg(lines);
+    // File data is the lowest class of all.
+    if (m_outbound.isEmpty()) {
+        pumpDownloads();
+    }
+    updateMemory();
+}
+
+void ClientWorker::writeLine(QByteArray &line)
+{
+    if (line.endsWith(Protocol::kTraceWriteTail)) {
+        const qint64 now = RouterThread::nowNs();
+        if (m_trace) {
+            static const QByteArray key = "\"rt\":";
+            const auto at = line.lastIndexOf(key);
+            if (at >= 0) {
+                const auto from = at + key.size();
+                const qint64 routedNs = line.mid(from, line.indexOf(',', from) - from).toLongLong();
+                m_trace->record(TraceStats::Delivery, now - routedNs);
+            }
+        }
+        Protocol::stampTraceWrite(&line, now);
+    }
     m_socket->write(line);
 }
 
@@ -50,18 +257,68 @@ void ClientWorker::disconnectFromHost()
     if (!m_socket) {
         return;
     }
+
+    // Whatever is queued (a login_error, say) still goes out before the close.
+    QByteArray line;
+    while (m_outbound.pop(&line, RouterThread::nowNs())) {
+        writeLine(line);
+    }
     m_socket->disconnectFromHost();
 }
 
+void ClientWorker::adopt(int shard)
+{
+    m_shard = shard;
+    m_movingTo = -1;
+    // Frozen for a handover: the held lines move with the rest of the input.
+    if (m_frozen) {
+        return;
+    }
+
+    const QList<QByteArray> held = std::move(m_held);
+    m_held.clear();
+    for (const auto &line : held) {
+        routeLine(line);
+    }
+}
+
+void ClientWorker::bind(QString name)
+{
+    m_bound = true;
+    if (m_memory) {
+        m_memory->setName(m_memoryAccount, name);
+    }
+    if (m_capture && m_capture->isEnabled()) {
+        capture(Capture::Kind::Session, m_capture->nowNs(), name.toUtf8());
+        flushCapture();
+    }
+}
+
 void ClientWorker::onReadyRead()
 {
-    if (!m_socket) {
+    if (!m_socket || m_frozen || m_readPaused) {
         return;
     }
 
-    m_buffer.append(m_socket->readAll());
+    {
+        SpanRecorder::Scope span(m_spans, SpanRecorder::Read);
+        const qsizetype before = m_buffer.size();
+        m_socket->readAll(&m_buffer);
+        span.setArg(m_buffer.size() - before);
+    }
+    // Everything in one read arrived together and shares its timestamp.
+    const qint64 captureNs = (m_capture && m_capture->isEnabled()) ? m_capture->nowNs() : -1;
+
+    SpanRecorder::Scope frameSpan(m_spans, SpanRecorder::Frame);
+    qint64 lines = 0;
+    while (!m_buffer.isEmpty()) {
+        if (m_frameRemaining > 0) {
+            const qint64 n = qMin<qint64>(m_frameRemaining, m_buffer.size());
+            consumeFrame(m_buffer.left(n));
+            m_buffer.remove(0, n);
+            continue;
+        }
 
-    while (true) {
         const int newlineIndex = m_buffer.indexOf('\n');
         if (newlineIndex < 0) {
             break;
@@ -75,21 +332,550 @@ void ClientWorker::onReadyRead()
             continue;
         }
 
-        emit lineReceived(m_clientId, line);
+        if (line.startsWith('@')) {
+            if (!beginFrame(line)) {
+                emit log(m_clientId, "invalid data frame, closing connection");
+                m_buffer.clear();
+                m_socket->abort();
+                return;
+            }
+            continue;
+        }
+
+        if (captureNs >= 0) {
+            capture(Capture::Kind::Line, captureNs, line);
+        }
+        routeLine(std::move(line));
+        ++lines;
+        if (m_overload && overSenderCap()) {
+            pauseReading();
+            break;
+        }
+    }
+    frameSpan.setArg(lines);
+    flushCapture();
+    // A burst leaves a large buffer behind; it is given back once drained.
+    if (m_buffer.isEmpty() && m_buffer.capacity() > kInputBufferKeep) {
+        m_buffer.squeeze();
+    }
+    updateMemory();
+}
+
+bool ClientWorker::overSenderCap()
+{
+    if (!m_overload->atLeast(OverloadController::Throttle)) {
+        return false;
+    }
+    if (!m_window.isValid() || m_window.elapsed() >= OverloadController::kThrottleWindowMs) {
+        m_window.start();
+        m_windowLines = 0;
+    }
+    return ++m_windowLines > m_overload->senderCap();
+}
+
+void ClientWorker::pauseReading()
+{
+    // What is left in m_buffer is routed when reading resumes.
+    m_readPaused = true;
+    m_overload->count(OverloadController::ReadsPaused);
+    const qint64 remaining = qMax<qint64>(0, OverloadController::kThrottleWindowMs - m_window.elapsed());
+    QTimer::singleShot(static_cast<int>(remaining), this, [this] {
+        m_readPaused = false;
+        onReadyRead();
+    });
+}
+
+void ClientWorker::acceptUpload(QByteArray id, QString path, qint64 offset, qint64 size)
+{
+    // A second file_put for the same file restarts it from the spool's offset.
+    for (int i = 0; i < m_uploads.size(); ++i) {
+        if (m_uploads.at(i).id == id) {
+            delete m_uploads.takeAt(i).file;
+            break;
+        }
+    }
+
+    auto *file = new QFile(path, this);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered) || file->size() != offset) {
+        delete file;
+        queueLine(fileError(id, "spool_error"));
+        return;
+    }
+
+    Upload upload;
+    upload.id = std::move(id);
+    upload.file = file;
+    upload.offset = offset;
+    upload.size = size;
+    m_uploads.push_back(upload);
+    emit log(m_clientId, QString("upload %1 accepted at %2/%3").arg(QString::fromLatin1(upload.id)).arg(offset).arg(size));
+}
+
+void ClientWorker::startDownload(QByteArray id, QString path, qint64 offset, qint64 size, qint64 rate)
+{
+    for (int i = 0; i < m_downloads.size(); ++i) {
+        if (m_downloads.at(i).id == id) {
+            delete m_downloads.takeAt(i).file;
+            break;
+        }
+    }
+
+    auto *file = new QFile(path, this);
+    if (!file->open(QIODevice::ReadOnly | QIODevice::Unbuffered) || file->size() < size) {
+        delete file;
+        queueLine(fileError(id, "spool_error"));
+        return;
+    }
+
+    Download download;
+    download.id = std::move(id);
+    download.file = file;
+    download.offset = offset;
+    download.size = size;
+    download.rate = rate;
+    download.clock.start();
+    m_downloads.push_back(download);
+    if (m_spool) {
+        m_spool->recordDownload();
+    }
+    pumpDownloads();
+}
+
+void ClientWorker::freeze()
+{
+    m_frozen = true;
+    if (m_downloadTimer) {
+        m_downloadTimer->stop();
+    }
+}
+
+QJsonObject ClientWorker::exportState()
+{
+    if (!m_socket || m_tls || !m_socket->isConnected()) {
+        return QJsonObject();
+    }
+
+    // What Qt still holds goes to the kernel first: the successor shares the
+    // kernel's socket buffers but not this process's.
+    QElapsedTimer waited;
+    waited.start();
+    while (m_socket->bytesToWrite() > 0 && waited.elapsed() < kHandoverFlushMs) {
+        if (!m_socket->waitForBytesWritten(static_cast<int>(kHandoverFlushMs - waited.elapsed()))) {
+            break;
+        }
+    }
+    if (!m_socket->isConnected() || m_socket->bytesToWrite() > 0) {
+        emit log(m_clientId, "handover: output does not drain, connection stays behind");
+        return QJsonObject();
+    }
+
+    int fd = -1;
+#ifdef Q_OS_LINUX
+    fd = ::dup(static_cast<int>(m_socket->socketDescriptor()));
+#endif
+    if (fd < 0) {
+        return QJsonObject();
+    }
+    m_socket->readAll(&m_buffer);
+
+    QJsonArray held;
+    for (const auto &line : std::as_const(m_held)) {
+        held.append(QString::fromLatin1(line.toBase64()));
+    }
+    QJsonArray outbound;
+    for (const auto &line : m_outbound.lines()) {
+        outbound.append(QString::fromUtf8(line));
+    }
+    QJsonArray uploads;
+    for (const auto &upload : std::as_const(m_uploads)) {
+        uploads.append(QJsonObject{{"id", QString::fromLatin1(upload.id)}, {"offset", upload.offset}, {"size", upload.size}});
+    }
+    QJsonArray downloads;
+    for (const auto &download : std::as_const(m_downloads)) {
+        downloads.append(QJsonObject{{"id", QString::fromLatin1(download.id)}, {"offset", download.offset}, {"size", download.size}, {"rate", download.rate}});
+    }
+
+    // Closing this descriptor only drops a reference, so the peer sees
+    // nothing; the duplicate keeps the connection up.
+    m_socket->disconnect(this);
+    m_socket->abort();
+    delete m_socket;
+    m_socket = nullptr;
+
+    return QJsonObject{
+        {"fd", fd},
+        {"bound", m_bound},
+        {"held", held},
+        {"buffer", QString::fromLatin1(m_buffer.toBase64())},
+        {"outbound", outbound},
+        {"frame_id", QString::fromLatin1(m_frameId)},
+        {"frame_remaining", m_frameRemaining},
+        {"uploads", uploads},
+        {"downloads", downloads},
+    };
+}
+
+void ClientWorker::thaw(qintptr socketDescriptor)
+{
+    m_frozen = false;
+    if (!m_socket && (socketDescriptor < 0 || !openSocket(socketDescriptor))) {
+        return;
+    }
+
+    const QList<QByteArray> held = std::move(m_held);
+    m_held.clear();
+    for (const auto &line : held) {
+        routeLine(line);
+    }
+    onReadyRead();
+    flushOutbound();
+}
+
+void ClientWorker::evict()
+{
+    // A frozen connection belongs to the handover now.
+    if (!m_socket || m_frozen) {
+        return;
+    }
+    m_outbound.clear();
+    m_socket->abort();
+}
+
+bool ClientWorker::beginFrame(const QByteArray &header)
+{
+    QByteArray id;
+    qint64 offset = 0;
+    qint64 length = 0;
+    if (!Protocol::parseDataFrameHeader(header, &id, &offset, &length)) {
+        return false;
+    }
+
+    // A frame that does not continue an accepted upload is skipped; the
+    // client learns the offset to resume from with another file_put.
+    m_frameRemaining = length;
+    m_frameId = id;
+    const Upload *upload = findUpload(id);
+    if (!upload || offset != upload->offset || offset + length > upload->size) {
+        m_frameId.clear();
+        queueLine(fileError(id, "unexpected_chunk"));
+        return true;
+    }
+    if (length == 0) {
+        consumeFrame(QByteArray());
+    }
+    return true;
+}
+
+void ClientWorker::consumeFrame(const QByteArray &data)
+{
+    m_frameRemaining -= data.size();
+
+    Upload *upload = m_frameId.isEmpty() ? nullptr : findUpload(m_frameId);
+    if (!upload) {
+        return;
+    }
+    if (!data.isEmpty()) {
+        if (upload->file->write(data) != data.size()) {
+            queueLine(fileError(upload->id, "spool_error"));
+            for (int i = 0; i < m_uploads.size(); ++i) {
+                if (m_uploads.at(i).id == m_frameId) {
+                    delete m_uploads.takeAt(i).file;
+                    break;
+                }
+            }
+            m_frameId.clear();
+            return;
+        }
+        upload->offset += data.size();
+        if (m_spool) {
+            m_spool->recordReceived(data.size());
+        }
+    }
+
+    if (m_frameRemaining == 0) {
+        if (upload->offset == upload->size) {
+            finishUpload(m_frameId);
+        }
+        m_frameId.clear();
+    }
+}
+
+ClientWorker::Upload *ClientWorker::findUpload(const QByteArray &id)
+{
+    for (auto &upload : m_uploads) {
+        if (upload.id == id) {
+            return &upload;
+        }
+    }
+    return nullptr;
+}
+
+void ClientWorker::finishUpload(const QByteArray &id)
+{
+    for (int i = 0; i < m_uploads.size(); ++i) {
+        if (m_uploads.at(i).id == id) {
+            QFile *file = m_uploads.takeAt(i).file;
+            file->close();
+            delete file;
+            break;
+        }
+    }
+
+    // Only a logged-in (bound) connection gets uploads, so it stays on m_shard.
+    IngressEvent event;
+    event.kind = IngressEvent::Kind::FileUploaded;
+    event.clientId = m_clientId;
+    event.line = id;
+    m_shards->post(m_shard, std::move(event));
+}
+
+void ClientWorker::pumpDownloads()
+{
+    // One chunk per pass, and only once the previous one has left the socket
+    // buffer and no line is waiting: chat lines go out right behind it.
+    if (!m_socket || m_frozen || m_downloads.isEmpty() || !m_outbound.isEmpty() || m_socket->bytesToWrite() > 0) {
+        return;
+    }
+    if (!m_downloadTimer) {
+        m_downloadTimer = new QTimer(this);
+        m_downloadTimer->setSingleShot(true);
+        connect(m_downloadTimer, &QTimer::timeout, this, &ClientWorker::pumpDownloads);
+    }
+
+    qint64 waitMs = -1;
+    for (int i = 0; i < m_downloads.size(); ++i) {
+        Download &download = m_downloads[i];
+        qint64 length = qMin<qint64>(Protocol::kFileChunkSize, download.size - download.offset);
+        if (download.rate > 0) {
+            // Token bucket holding at most one chunk (or one second) of credit.
+            const qint64 budget = download.rate * download.clock.elapsed() / 1000
+                + qMin<qint64>(download.rate, Protocol::kFileChunkSize) - download.sentSinceStart;
+            const qint64 wanted = qMin(length, kMinRateChunk);
+            if (budget < wanted) {
+                const qint64 ms = (wanted - budget) * 1000 / download.rate + 1;
+                waitMs = waitMs < 0 ? ms : qMin(waitMs, ms);
+                continue;
+            }
+            length = qMin(length, budget);
+        }
+
+        // Round robin: the file just served goes to the back.
+        Download current = m_downloads.takeAt(i);
+        if (!sendChunk(current, length)) {
+            delete current.file;
+            emit log(m_clientId, QString("download %1 failed: spool file unreadable").arg(QString::fromLatin1(current.id)));
+            m_socket->abort();
+            return;
+        }
+        if (current.offset >= current.size) {
+            delete current.file;
+            queueLine(Protocol::toLine(QJsonObject{{"type", "file_get_done"}, {"id", QString::fromLatin1(current.id)}}));
+        } else {
+            m_downloads.push_back(current);
+        }
+        if (!m_downloads.isEmpty()) {
+            m_downloadTimer->start(0);
+        }
+        return;
+    }
+
+    if (waitMs >= 0) {
+        m_downloadTimer->start(static_cast<int>(qMin<qint64>(waitMs, 1000)));
+    }
+}
+
+bool ClientWorker::sendChunk(Download &download, qint64 length)
+{
+    m_socket->write(Protocol::dataFrameHeader(download.id, download.offset, length));
+
+    // With the socket buffer empty the chunk can go from the page cache to the
+    // socket without passing through user space. Anything sendfile() leaves
+    // (a full socket, TLS, other platforms) is read and queued as usual.
+    qint64 zeroCopy = 0;
+#ifdef Q_OS_LINUX
+    if (!m_tls) {
+        m_socket->flush();
+        if (m_socket->bytesToWrite() == 0) {
+            off_t pos = static_cast<off_t>(download.offset);
+            const ssize_t n = ::sendfile(static_cast<int>(m_socket->socketDescriptor()), download.file->handle(), &pos, static_cast<size_t>(length));
+            if (n > 0) {
+                zeroCopy = n;
+            }
+        }
+    }
+#endif
+
+    if (zeroCopy < length) {
+        // The header already promised `length` bytes, so a short read cannot
+        // be recovered on this connection.
+        if (!download.file->seek(download.offset + zeroCopy)) {
+            return false;
+        }
+        const QByteArray rest = download.file->read(length - zeroCopy);
+        if (rest.size() != length - zeroCopy) {
+            return false;
+        }
+        m_socket->write(rest);
+    }
+
+    download.offset += length;
+    download.sentSinceStart += length;
+    if (m_spool) {
+        m_spool->recordSent(zeroCopy, length - zeroCopy);
+    }
+    return true;
+}
+
+void ClientWorker::closeTransfers()
+{
+    for (auto &upload : m_uploads) {
+        delete upload.file;
+    }
+    m_uploads.clear();
+    for (auto &download : m_downloads) {
+        delete download.file;
+    }
+    m_downloads.clear();
+    m_frameId.clear();
+    m_frameRemaining = 0;
+}
+
+void ClientWorker::routeLine(QByteArray line)
+{
+    SpanRecorder::Scope span(m_spans, SpanRecorder::Route);
+    // While the connection moves between routers, input waits here so it
+    // cannot overtake the move.
+    if (m_movingTo >= 0) {
+        m_held.push_back(std::move(line));
+        return;
+    }
+
+    IngressEvent event;
+    event.kind = IngressEvent::Kind::Line;
+    event.clientId = m_clientId;
+
+    const int target = m_bound ? m_shard : targetShard(line);
+    if (target != m_shard) {
+        event.kind = IngressEvent::Kind::Handoff;
+        event.shard = target;
+        m_movingTo = target;
+    }
+    event.line = std::move(line);
+    m_shards->post(m_shard, std::move(event));
+}
+
+int ClientWorker::targetShard(const QByteArray &line) const
+{
+    const QJsonDocument doc = QJsonDocument::fromJson(line);
+    if (!doc.isObject()) {
+        return m_shard;
+    }
+
+    const QJsonObject obj = doc.object();
+    const QString type = obj.value("type").toString();
+    if (type == "login") {
+        return m_shards->shardForName(Protocol::normalizeName(obj.value("name").toString()));
     }
+    if (type == "resume") {
+        const int shard = m_shards->shardForToken(obj.value("token").toString().toLatin1());
+        return shard >= 0 ? shard : m_shard;
+    }
+    return m_shard;
 }
 
 void ClientWorker::onDisconnected()
 {
     emit log(m_clientId, "client disconnected");
+    if (m_capture && m_capture->isEnabled()) {
+        capture(Capture::Kind::Close, m_capture->nowNs());
+        flushCapture();
+    }
+    closeTransfers();
+    m_outbound.clear();
+    m_buffer.clear();
+    updateMemory();
+    postDisconnected();
+}
+
+void ClientWorker::postDisconnected()
+{
+    // Mid-move the new router may never get to call adopt(), so everything
+    // goes through the old one, which forwards it behind the connection.
+    for (auto &line : m_held) {
+        IngressEvent event;
+        event.kind = IngressEvent::Kind::Line;
+        event.clientId = m_clientId;
+        event.line = std::move(line);
+        event.shard = m_movingTo;
+        m_shards->post(m_shard, std::move(event));
+    }
+    m_held.clear();
+
+    IngressEvent event;
+    event.kind = IngressEvent::Kind::Disconnected;
+    event.clientId = m_clientId;
+    event.shard = m_movingTo;
+    m_shards->post(m_shard, std::move(event));
     emit disconnected(m_clientId);
 }
 
-void ClientWorker::onError(int)
+void ClientWorker::capture(Capture::Kind kind, qint64 timeNs, const QByteArray &data)
+{
+    Capture::appendRecord(&m_captureBlock, kind, m_clientId, timeNs, data);
+    ++m_captureRecords;
+}
+
+void ClientWorker::flushCapture()
+{
+    if (m_captureRecords == 0) {
+        return;
+    }
+    m_capture->write(m_captureBlock, m_captureRecords);
+    m_captureBlock.clear();
+    m_captureRecords = 0;
+}
+
+void ClientWorker::updateMemory()
+{
+    if (!m_memoryAccount) {
+        return;
+    }
+    m_memoryAccount->set(MemoryBudget::Input, m_buffer.capacity());
+    m_memoryAccount->set(MemoryBudget::Output, m_outbound.bytes() + (m_socket ? m_socket->bytesToWrite() : 0));
+}
+
+void ClientWorker::onError()
 {
     if (!m_socket) {
         return;
     }
+    if (m_tls && !m_encrypted && m_handshakeTimer.isValid()) {
+        m_tls->recordFailure();
+        m_handshakeTimer.invalidate();
+    }
     emit log(m_clientId, QString("socket error: %1").arg(m_socket->errorString()));
 }
 
+void ClientWorker::onEncrypted()
+{
+    m_encrypted = true;
+    const qint64 ns = m_handshakeTimer.nsecsElapsed();
+    m_handshakeTimer.invalidate();
+    if (m_tls) {
+        m_tls->recordHandshake(ns);
+    }
+
+    const auto *ssl = m_socket ? m_socket->sslSocket() : nullptr;
+    emit log(m_clientId,
+        QString("tls handshake done in %1 ms (%2)")
+            .arg(static_cast<double>(ns) / 1e6, 0, 'f', 2)
+            .arg(ssl ? ssl->sessionCipher().name() : QString()));
+}
+
+void ClientWorker::onSslErrors(const QList<QSslError> &errors)
+{
+    for (const auto &e : errors) {
+        emit log(m_clientId, QString("tls error: %1").arg(e.errorString()));
+    }
+}
+
@@ -1,19 +1,79 @@
 #pragma once
 
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QList>
 #include <QObject>
+#include <QSslError>
+#include <QString>
 
-class QTcpSocket;
+#include "capturefile.h"
+#include "memorybudget.h"
+#include "outboundqueue.h"
+#include "overloadcontroller.h"
+#include "servercontext.h"
+
+class CaptureWriter;
+class ClientTransport;
+class FileSpool;
+class QFile;
+class QTimer;
+class ShardMap;
+class SpanRecorder;
+class TlsContext;
+class TraceStats;
+class TransportContext;
 
 class ClientWorker : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit ClientWorker(quint64 clientId, qintptr socketDescriptor, QObject *parent = nullptr);
+    // Received lines and the disconnect go straight into the ingress queue of
+    // the router holding this connection: its home router until a login or
+    // resume moves it to the router owning the name (see ShardMap). With
+    // `tls` the socket is a QSslSocket set up from the context's TlsContext
+    // and the server handshake runs on this worker's thread before any line
+    // is read. The socket itself is a ClientTransport from the
+    // TransportContext (Qt's sockets without one).
+    //
+    // File data frames (see Protocol::kFileChunkSize) never reach the router:
+    // uploads are written to the spool here and downloads are sent from disk,
+    // one chunk at a time, so chat lines only ever wait behind one chunk.
+    //
+    // Outgoing lines wait in an OutboundQueue and are fed to the socket a
+    // little at a time, most urgent class first.
+    //
+    // While the CaptureWriter is enabled, received lines (not file data) are
+    // recorded with the time they were read. Traced lines (see
+    // Protocol::withTrace) get their write time here.
+    //
+    // For a server handover (see Handover) the worker is frozen, then exports
+    // its socket and the state around it; a worker on the new server restores
+    // that state before start().
+    //
+    // With a MemoryBudget the worker keeps its account up to date; routers
+    // charge it through memoryAccount().
+    //
+    // Under OverloadController::Throttle a connection that sends more than
+    // senderCap() lines in one window is not read until the window ends; the
+    // rest of its input waits in the socket (with the Qt backend, in Qt's
+    // read buffer).
+    //
+    // With a SpanRecorder enabled, reads, framing, routing and writes are
+    // recorded as spans on this worker's thread.
+    ClientWorker(quint64 clientId, qintptr socketDescriptor, const ServerContext &context, bool tls = false, QObject *parent = nullptr);
+    ~ClientWorker() override;
+
+    // Before start(): continue a connection exported by exportState() on the
+    // old server; `shard` is the router it is attached to.
+    void restoreState(const QJsonObject &state, int shard);
+
+    // Any thread, for as long as the worker exists; nullptr without a budget.
+    MemoryBudget::Account *memoryAccount() const { return m_memoryAccount; }
 
 signals:
-    void lineReceived(quint64 clientId, QByteArray line);
     void disconnected(quint64 clientId);
     void log(quint64 clientId, QString message);
 
@@ -22,15 +82,116 @@ public slots:
     void sendLine(QByteArray line);
     void disconnectFromHost();
 
+    // Called by the router that now holds the connection after a handoff (or
+    // that kept it); lines held during the move are routed again.
+    void adopt(int shard);
+    // Called once logged in: the connection stays where it is, lines are no
+    // longer inspected.
+    void bind(QString name);
+
+    // Called by the router once it has checked the request; `offset` is what
+    // the spool already holds.
+    void acceptUpload(QByteArray id, QString path, qint64 offset, qint64 size);
+    void startDownload(QByteArray id, QString path, qint64 offset, qint64 size, qint64 rate);
+
+    // Handover. freeze() stops reading and sending file data; exportState()
+    // flushes what Qt still buffers, hands back a duplicate of the socket
+    // ("fd") with the unread input, pending output and transfers, and lets go
+    // of the socket. An empty object means the connection cannot move (closed,
+    // TLS, or its output would not drain) and stays here. thaw() undoes both,
+    // taking the duplicate back if there is one.
+    void freeze();
+    QJsonObject exportState();
+    void thaw(qintptr socketDescriptor);
+
+    // The MemoryBudget picked this connection to drop: what is queued for it
+    // is discarded and the socket closed at once.
+    void evict();
+
 private slots:
     void onReadyRead();
     void onDisconnected();
-    void onError(int socketError);
+    void onError();
+    void onEncrypted();
+    void onSslErrors(const QList<QSslError> &errors);
+    void flushOutbound();
+    void pumpDownloads();
 
 private:
+    struct Upload {
+        QByteArray id;
+        QFile *file = nullptr;
+        qint64 offset = 0;
+        qint64 size = 0;
+    };
+
+    struct Download {
+        QByteArray id;
+        QFile *file = nullptr;
+        qint64 offset = 0;
+        qint64 size = 0;
+        qint64 rate = 0;
+        qint64 sentSinceStart = 0;
+        QElapsedTimer clock;
+    };
+
+    bool openSocket(qintptr socketDescriptor);
+    void applyRestoredState();
+    void routeLine(QByteArray line);
+    void queueLine(QByteArray line);
+    void writeLine(QByteArray &line);
+    bool beginFrame(const QByteArray &header);
+    void consumeFrame(const QByteArray &data);
+    Upload *findUpload(const QByteArray &id);
+    void finishUpload(const QByteArray &id);
+    bool sendChunk(Download &download, qint64 length);
+    void closeTransfers();
+    int targetShard(const QByteArray &line) const;
+    void postDisconnected();
+    void capture(Capture::Kind kind, qint64 timeNs, const QByteArray &data = QByteArray());
+    void flushCapture();
+    void updateMemory();
+    bool overSenderCap();
+    void pauseReading();
+
     const quint64 m_clientId;
     const qintptr m_socketDescriptor;
-    QTcpSocket *m_socket = nullptr;
+    const ShardMap *const m_shards;
+    int m_shard = 0;
+    int m_movingTo = -1;
+    bool m_bound = false;
+    bool m_frozen = false;
+    QList<QByteArray> m_held;
+    QJsonObject m_restored;
+    TlsContext *const m_tls;
+    TransportContext *const m_transports;
+    ClientTransport *m_socket = nullptr;
     QByteArray m_buffer;
-};
+    QElapsedTimer m_handshakeTimer;
+    bool m_encrypted = false;
+    OutboundQueue m_outbound;
+
+    FileSpool *const m_spool;
+    QList<Upload> m_uploads;
+    QList<Download> m_downloads;
+    QTimer *m_downloadTimer = nullptr;
+    // Upload frame being read: its upload (empty to discard the bytes) and
+    // how many bytes are still to come.
+    QByteArray m_frameId;
+    qint64 m_frameRemaining = 0;
 
+    TraceStats *const m_trace;
+    CaptureWriter *const m_capture;
+    QByteArray m_captureBlock;
+    int m_captureRecords = 0;
+
+    MemoryBudget *const m_memory;
+    MemoryBudget::Account *const m_memoryAccount;
+
+    OverloadController *const m_overload;
+    bool m_readPaused = false;
+    int m_windowLines = 0;
+    QElapsedTimer m_window;
+
+    SpanRecorder *const m_spans;
+};
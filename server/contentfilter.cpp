@@ -0,0 +1,272 @@
+#include "contentfilter.h"
+
+#include <QFile>
+#include <QMap>
+#include <QMutexLocker>
+#include <QPair>
+#include <QTextStream>
+
+#include <utility>
+
+namespace {
+
+char16_t fold(QChar c)
+{
+    return QChar::toCaseFolded(c.unicode());
+}
+
+} // namespace
+
+ContentFilter::Automaton::Automaton(const QList<QPair<QString, Action>> &patterns)
+{
+    // Built as a trie of maps, then flattened into sorted edge arrays.
+    struct Node {
+        QMap<char16_t, int> next;
+        int pattern = -1;
+    };
+    QList<Node> nodes(1);
+
+    for (const auto &[text, action] : patterns) {
+        if (text.isEmpty()) {
+            continue;
+        }
+        int state = 0;
+        for (const QChar c : text) {
+            const char16_t label = fold(c);
+            const auto it = nodes[state].next.constFind(label);
+            if (it != nodes[state].next.constEnd()) {
+                state = it.value();
+                continue;
+            }
+            nodes.push_back(Node());
+            const int created = static_cast<int>(nodes.size()) - 1;
+            nodes[state].next.insert(label, created);
+            state = created;
+        }
+        // The same term listed twice keeps the strongest action.
+        int &slot = nodes[state].pattern;
+        if (slot < 0) {
+            slot = static_cast<int>(m_patterns.size());
+            m_patterns.push_back(Pattern{static_cast<int>(text.size()), action});
+        } else if (action > m_patterns[slot].action) {
+            m_patterns[slot].action = action;
+        }
+    }
+
+    const auto count = nodes.size();
+    m_edgeStart.reserve(count + 1);
+    m_pattern.reserve(count);
+    for (const auto &node : std::as_const(nodes)) {
+        m_edgeStart.push_back(static_cast<int>(m_edgeLabel.size()));
+        for (auto it = node.next.constBegin(); it != node.next.constEnd(); ++it) {
+            m_edgeLabel.push_back(it.key());
+            m_edgeTarget.push_back(it.value());
+        }
+        m_pattern.push_back(node.pattern);
+    }
+    m_edgeStart.push_back(static_cast<int>(m_edgeLabel.size()));
+
+    // Fail and dictionary links, breadth first so a state's fail target is
+    // always done before it.
+    m_fail = QList<int>(count, 0);
+    m_dict = QList<int>(count, -1);
+    QList<int> queue;
+    queue.reserve(count);
+    for (int e = m_edgeStart[0]; e < m_edgeStart[1]; ++e) {
+        queue.push_back(m_edgeTarget[e]);
+    }
+    for (qsizetype head = 0; head < queue.size(); ++head) {
+        const int state = queue[head];
+        for (int e = m_edgeStart[state]; e < m_edgeStart[state + 1]; ++e) {
+            const int child = m_edgeTarget[e];
+            int fail = m_fail[state];
+            int target = step(fail, m_edgeLabel[e]);
+            while (target < 0 && fail != 0) {
+                fail = m_fail[fail];
+                target = step(fail, m_edgeLabel[e]);
+            }
+            m_fail[child] = target < 0 ? 0 : target;
+            m_dict[child] = m_pattern[m_fail[child]] >= 0 ? m_fail[child] : m_dict[m_fail[child]];
+            queue.push_back(child);
+        }
+    }
+}
+
+int ContentFilter::Automaton::step(int state, char16_t c) const
+{
+    int lo = m_edgeStart[state];
+    int hi = m_edgeStart[state + 1];
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (m_edgeLabel[mid] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < m_edgeStart[state + 1] && m_edgeLabel[lo] == c ? m_edgeTarget[lo] : -1;
+}
+
+QList<ContentFilter::Automaton::Match> ContentFilter::Automaton::find(const QString &text) const
+{
+    QList<Match> matches;
+    int state = 0;
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        const char16_t c = fold(text[i]);
+        int next = step(state, c);
+        while (next < 0 && state != 0) {
+            state = m_fail[state];
+            next = step(state, c);
+        }
+        state = next < 0 ? 0 : next;
+
+        for (int s = m_pattern[state] >= 0 ? state : m_dict[state]; s >= 0; s = m_dict[s]) {
+            const Pattern &p = m_patterns[m_pattern[s]];
+            matches.push_back(Match{static_cast<int>(i) + 1 - p.length, p.length, p.action});
+        }
+    }
+    return matches;
+}
+
+ContentFilter::Reader::Reader(ContentFilter *filter)
+    : m_filter(filter)
+{
+}
+
+ContentFilter::Outcome ContentFilter::Reader::apply(QString *text, QStringList *terms)
+{
+    if (!m_filter) {
+        return Outcome::Clean;
+    }
+    if (m_filter->m_generation.loadAcquire() != m_generation) {
+        m_automaton = m_filter->current(&m_generation);
+    }
+    if (!m_automaton) {
+        return Outcome::Clean;
+    }
+
+    m_filter->m_scanned.fetchAndAddRelaxed(1);
+    const QList<Automaton::Match> matches = m_automaton->find(*text);
+    if (matches.isEmpty()) {
+        return Outcome::Clean;
+    }
+
+    Action strongest = Action::Log;
+    for (const auto &match : matches) {
+        terms->push_back(text->mid(match.start, match.length));
+        strongest = qMax(strongest, match.action);
+    }
+    terms->removeDuplicates();
+    switch (strongest) {
+    case Action::Reject:
+        m_filter->m_rejected.fetchAndAddRelaxed(1);
+        return Outcome::Rejected;
+    case Action::Mask:
+        for (const auto &match : matches) {
+            if (match.action == Action::Mask) {
+                text->replace(match.start, match.length, QString(match.length, QLatin1Char('*')));
+            }
+        }
+        m_filter->m_masked.fetchAndAddRelaxed(1);
+        return Outcome::Masked;
+    case Action::Log:
+        break;
+    }
+    m_filter->m_logged.fetchAndAddRelaxed(1);
+    return Outcome::Logged;
+}
+
+bool ContentFilter::parseAction(const QString &name, Action *action)
+{
+    if (name == QLatin1String("mask")) {
+        *action = Action::Mask;
+    } else if (name == QLatin1String("reject")) {
+        *action = Action::Reject;
+    } else if (name == QLatin1String("log")) {
+        *action = Action::Log;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ContentFilter::load(const QString &path, Action defaultAction, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        *error = file.errorString();
+        return false;
+    }
+
+    QList<QPair<QString, Action>> patterns;
+    Action action = defaultAction;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        const QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        if (line.startsWith('[') && line.endsWith(']')) {
+            if (!parseAction(line.mid(1, line.size() - 2).trimmed(), &action)) {
+                *error = QString("unknown action %1").arg(line);
+                return false;
+            }
+            continue;
+        }
+        patterns.push_back(qMakePair(line, action));
+    }
+
+    auto automaton = std::make_shared<const Automaton>(patterns);
+    QMutexLocker locker(&m_mutex);
+    if (m_automaton) {
+        m_reloads.fetchAndAddRelaxed(1);
+    }
+    m_automaton = std::move(automaton);
+    m_path = path;
+    m_generation.fetchAndAddRelease(1);
+    return true;
+}
+
+void ContentFilter::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_automaton.reset();
+    m_path.clear();
+    m_generation.fetchAndAddRelease(1);
+}
+
+bool ContentFilter::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_automaton != nullptr;
+}
+
+QString ContentFilter::path() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_path;
+}
+
+ContentFilter::Stats ContentFilter::stats() const
+{
+    Stats s;
+    {
+        QMutexLocker locker(&m_mutex);
+        s.enabled = m_automaton != nullptr;
+        s.path = m_path;
+        s.patterns = m_automaton ? m_automaton->patternCount() : 0;
+    }
+    s.reloads = m_reloads.loadRelaxed();
+    s.scanned = m_scanned.loadRelaxed();
+    s.logged = m_logged.loadRelaxed();
+    s.masked = m_masked.loadRelaxed();
+    s.rejected = m_rejected.loadRelaxed();
+    return s;
+}
+
+std::shared_ptr<const ContentFilter::Automaton> ContentFilter::current(quint64 *generation) const
+{
+    QMutexLocker locker(&m_mutex);
+    *generation = m_generation.loadRelaxed();
+    return m_automaton;
+}
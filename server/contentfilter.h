@@ -0,0 +1,129 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+
+// Banned terms in chat and private text, checked by the routers before a
+// message fans out.
+//
+// The pattern file has one term per line; "#" starts a comment. A line
+// "[mask]", "[reject]" or "[log]" sets the action for the terms below it,
+// terms before any such line get the default action. Mask replaces the term
+// with '*', reject refuses the whole message, log only reports it. Matching
+// ignores case (simple case folding per UTF-16 unit, so offsets stay those of
+// the original text) and finds terms anywhere, also inside words.
+//
+// All terms are compiled into one Aho-Corasick automaton, so a message is
+// scanned once whatever the number of terms. load() builds a new automaton
+// off to the side and swaps it in; a Reader notices through one atomic load
+// and only then takes the lock to pick it up, so matching never waits.
+class ContentFilter
+{
+public:
+    enum class Action {
+        Log,
+        Mask,
+        Reject,
+    };
+
+    enum class Outcome {
+        Clean,
+        Logged,
+        Masked,
+        Rejected,
+    };
+
+    struct Stats {
+        bool enabled = false;
+        QString path;
+        int patterns = 0;
+        quint64 reloads = 0;
+        quint64 scanned = 0;
+        quint64 logged = 0;
+        quint64 masked = 0;
+        quint64 rejected = 0;
+    };
+
+    // Immutable once built.
+    class Automaton
+    {
+    public:
+        struct Match {
+            int start = 0;
+            int length = 0;
+            Action action = Action::Log;
+        };
+
+        explicit Automaton(const QList<QPair<QString, Action>> &patterns);
+
+        int patternCount() const { return static_cast<int>(m_patterns.size()); }
+        // Every occurrence, overlapping ones included, in order of their end.
+        QList<Match> find(const QString &text) const;
+
+    private:
+        struct Pattern {
+            int length = 0;
+            Action action = Action::Log;
+        };
+
+        int step(int state, char16_t c) const;
+
+        QList<Pattern> m_patterns;
+        // State s has the edges [m_edgeStart[s], m_edgeStart[s + 1]), sorted
+        // by label.
+        QList<int> m_edgeStart;
+        QList<char16_t> m_edgeLabel;
+        QList<int> m_edgeTarget;
+        QList<int> m_fail;
+        // Pattern ending exactly at a state (-1 if none), and the nearest
+        // state down its fail chain where one ends.
+        QList<int> m_pattern;
+        QList<int> m_dict;
+    };
+
+    // One per thread that filters; cheap to keep.
+    class Reader
+    {
+    public:
+        explicit Reader(ContentFilter *filter = nullptr);
+
+        // Rejected or masked text comes back through *text; the terms found go
+        // into *terms.
+        Outcome apply(QString *text, QStringList *terms);
+
+    private:
+        ContentFilter *m_filter;
+        quint64 m_generation = 0;
+        std::shared_ptr<const Automaton> m_automaton;
+    };
+
+    // "mask", "reject" or "log"; false for anything else.
+    static bool parseAction(const QString &name, Action *action);
+
+    // Any thread. Keeps the current patterns if the file cannot be read.
+    bool load(const QString &path, Action defaultAction, QString *error);
+    void clear();
+    bool isEnabled() const;
+    QString path() const;
+    Stats stats() const;
+
+private:
+    std::shared_ptr<const Automaton> current(quint64 *generation) const;
+
+    mutable QMutex m_mutex;
+    std::shared_ptr<const Automaton> m_automaton;
+    QString m_path;
+    QAtomicInteger<quint64> m_generation;
+
+    QAtomicInteger<quint64> m_reloads;
+    QAtomicInteger<quint64> m_scanned;
+    QAtomicInteger<quint64> m_logged;
+    QAtomicInteger<quint64> m_masked;
+    QAtomicInteger<quint64> m_rejected;
+};
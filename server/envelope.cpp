@@ -0,0 +1,238 @@
+#include "envelope.h"
+
+#include <QDateTime>
+
+namespace {
+
+// Room for the literal parts of any envelope, on top of the strings.
+constexpr qsizetype kFixedBytes = 96;
+
+// A UTF-16 unit takes at most 3 bytes of UTF-8 (a surrogate pair, two units,
+// takes 4); escaped control characters and lone surrogates are rare enough to
+// grow the buffer.
+qsizetype worstCase(const QString &text)
+{
+    return 2 + 3 * text.size();
+}
+
+void appendTime(QByteArray *out)
+{
+    out->append("\"time\":\"");
+    out->append(Envelope::isoNow());
+    out->append('"');
+}
+
+void appendUtf8(QByteArray *out, char32_t code)
+{
+    if (code < 0x80) {
+        out->append(static_cast<char>(code));
+    } else if (code < 0x800) {
+        out->append(static_cast<char>(0xc0 | (code >> 6)));
+        out->append(static_cast<char>(0x80 | (code & 0x3f)));
+    } else if (code < 0x10000) {
+        out->append(static_cast<char>(0xe0 | (code >> 12)));
+        out->append(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+        out->append(static_cast<char>(0x80 | (code & 0x3f)));
+    } else {
+        out->append(static_cast<char>(0xf0 | (code >> 18)));
+        out->append(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+        out->append(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+        out->append(static_cast<char>(0x80 | (code & 0x3f)));
+    }
+}
+
+// JSON string escaping without the quotes, as QJsonDocument does it: '"', '\\'
+// and control characters escaped, a lone surrogate (no UTF-8 form) as \uXXXX,
+// everything else as UTF-8.
+void appendEscaped(QByteArray *out, const QString &text)
+{
+    static const char hex[] = "0123456789abcdef";
+    const QChar *it = text.constData();
+    const QChar *const end = it + text.size();
+    for (; it != end; ++it) {
+        const char16_t unit = it->unicode();
+        if (unit >= 0x20 && unit < 0x80) {
+            if (unit == '"' || unit == '\\') {
+                out->append('\\');
+            }
+            out->append(static_cast<char>(unit));
+            continue;
+        }
+        if (unit < 0x20) {
+            switch (unit) {
+            case '\b':
+                out->append("\\b");
+                break;
+            case '\f':
+                out->append("\\f");
+                break;
+            case '\n':
+                out->append("\\n");
+                break;
+            case '\r':
+                out->append("\\r");
+                break;
+            case '\t':
+                out->append("\\t");
+                break;
+            default:
+                out->append("\\u00");
+                out->append(hex[unit >> 4]);
+                out->append(hex[unit & 0xf]);
+                break;
+            }
+            continue;
+        }
+        if (QChar::isHighSurrogate(unit) && it + 1 != end && (it + 1)->isLowSurrogate()) {
+            appendUtf8(out, QChar::surrogateToUcs4(unit, (it + 1)->unicode()));
+            ++it;
+            continue;
+        }
+        if (QChar::isSurrogate(unit)) {
+            out->append("\\u");
+            out->append(hex[unit >> 12]);
+            out->append(hex[(unit >> 8) & 0xf]);
+            out->append(hex[(unit >> 4) & 0xf]);
+            out->append(hex[unit & 0xf]);
+            continue;
+        }
+        appendUtf8(out, unit);
+    }
+}
+
+QByteArray privateLine(const QString &from, const QString &text, qsizetype toBytes)
+{
+    QByteArray out;
+    out.reserve(kFixedBytes + worstCase(from) + worstCase(text) + toBytes);
+    out.append("{\"from\":");
+    Envelope::appendString(&out, from);
+    out.append(",\"scope\":\"private\",\"text\":");
+    Envelope::appendString(&out, text);
+    out.append(',');
+    appendTime(&out);
+    out.append(",\"to\":");
+    return out;
+}
+
+} // namespace
+
+namespace Envelope {
+
+const QByteArray &isoNow()
+{
+    struct Cache {
+        qint64 second = -1;
+        QByteArray text;
+    };
+    static thread_local Cache cache;
+    const qint64 second = QDateTime::currentSecsSinceEpoch();
+    if (second != cache.second) {
+        cache.second = second;
+        cache.text = QDateTime::fromSecsSinceEpoch(second).toString(Qt::ISODate).toLatin1();
+    }
+    return cache.text;
+}
+
+void appendString(QByteArray *out, const QString &text)
+{
+    out->append('"');
+    appendEscaped(out, text);
+    out->append('"');
+}
+
+QByteArray chat(const QString &from, const QString &text)
+{
+    QByteArray out;
+    out.reserve(kFixedBytes + worstCase(from) + worstCase(text));
+    out.append("{\"from\":");
+    appendString(&out, from);
+    out.append(",\"scope\":\"broadcast\",\"text\":");
+    appendString(&out, text);
+    out.append(',');
+    appendTime(&out);
+    out.append(",\"type\":\"chat\"}\n");
+    return out;
+}
+
+QByteArray privateChat(const QString &from, const QString &to, const QString &text)
+{
+    QByteArray out = privateLine(from, text, worstCase(to));
+    appendString(&out, to);
+    out.append(",\"type\":\"chat\"}\n");
+    return out;
+}
+
+QByteArray privateChat(const QString &from, const QStringList &to, const QString &text)
+{
+    qsizetype toBytes = 2;
+    for (const auto &name : to) {
+        toBytes += worstCase(name) + 1;
+    }
+    QByteArray out = privateLine(from, text, toBytes);
+    out.append('[');
+    for (qsizetype i = 0; i < to.size(); ++i) {
+        if (i > 0) {
+            out.append(',');
+        }
+        appendString(&out, to.at(i));
+    }
+    out.append("],\"type\":\"chat\"}\n");
+    return out;
+}
+
+QByteArray notice(Notice notice, const QString &name)
+{
+    // The text around the name, already escaped (there is nothing to escape).
+    const char *before = "";
+    const char *after = "";
+    switch (notice) {
+    case Notice::Joined:
+        after = " joined";
+        break;
+    case Notice::Left:
+        after = " left";
+        break;
+    case Notice::Queued:
+        after = " is offline, message queued";
+        break;
+    case Notice::MailboxFull:
+        before = "mailbox of ";
+        after = " is full, message dropped";
+        break;
+    case Notice::NotFound:
+        before = "user not found: ";
+        break;
+    }
+
+    QByteArray out;
+    out.reserve(kFixedBytes + worstCase(name));
+    out.append("{\"text\":\"");
+    out.append(before);
+    appendEscaped(&out, name);
+    out.append(after);
+    out.append("\",");
+    appendTime(&out);
+    out.append(",\"type\":\"system\"}\n");
+    return out;
+}
+
+QByteArray userList(const QStringList &users)
+{
+    qsizetype bytes = kFixedBytes;
+    for (const auto &user : users) {
+        bytes += worstCase(user) + 1;
+    }
+    QByteArray out;
+    out.reserve(bytes);
+    out.append("{\"type\":\"user_list\",\"users\":[");
+    for (qsizetype i = 0; i < users.size(); ++i) {
+        if (i > 0) {
+            out.append(',');
+        }
+        appendString(&out, users.at(i));
+    }
+    out.append("]}\n");
+    return out;
+}
+
+} // namespace Envelope
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+// Encodes the server's frequent messages straight into their line, without a
+// QJsonObject in between. Everything but the variable fields is a literal,
+// the "time" value is formatted once per second on each thread, and the
+// variable strings are escaped into a buffer sized up front, so a message
+// costs one allocation: the line itself.
+//
+// The output is byte for byte what Protocol::toLine() makes of the same
+// object (compact, keys in QJsonObject's sorted order, non-ASCII as UTF-8),
+// so withSeq()/withTrace() and every client treat it the same.
+namespace Envelope {
+
+// Common system texts, with a user name spliced in.
+enum class Notice {
+    Joined,      // "<name> joined"
+    Left,        // "<name> left"
+    Queued,      // "<name> is offline, message queued"
+    MailboxFull, // "mailbox of <name> is full, message dropped"
+    NotFound,    // "user not found: <name>"
+};
+
+// QDateTime::currentDateTime().toString(Qt::ISODate), as the JSON text of the
+// "time" fields; the same object until the second changes.
+const QByteArray &isoNow();
+
+QByteArray chat(const QString &from, const QString &text);
+QByteArray privateChat(const QString &from, const QString &to, const QString &text);
+// One line for all recipients; "to" is the list.
+QByteArray privateChat(const QString &from, const QStringList &to, const QString &text);
+QByteArray notice(Notice notice, const QString &name);
+QByteArray userList(const QStringList &users);
+
+// Appends `text` as a JSON string, quotes included.
+void appendString(QByteArray *out, const QString &text);
+
+} // namespace Envelope
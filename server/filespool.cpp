@@ -0,0 +1,214 @@
+#include "filespool.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+
+static QByteArray newFileId()
+{
+    quint32 words[4];
+    QRandomGenerator::system()->fillRange(words);
+    return QByteArray(reinterpret_cast<const char *>(words), sizeof(words)).toHex();
+}
+
+bool FileSpool::setDirectory(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    m_dir.clear();
+    m_files.clear();
+    if (path.isEmpty()) {
+        return false;
+    }
+
+    QDir dir(path);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        return false;
+    }
+    m_dir = dir.absolutePath();
+
+    // Pick up files (and unfinished uploads) from a previous run.
+    const QStringList sidecars = dir.entryList({"*.json"}, QDir::Files);
+    for (const auto &name : sidecars) {
+        QFile f(dir.filePath(name));
+        if (!f.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        const QJsonObject obj = QJsonDocument::fromJson(f.readAll()).object();
+
+        File file;
+        file.id = QFileInfo(name).completeBaseName().toLatin1();
+        file.name = obj.value("name").toString();
+        file.owner = obj.value("owner").toString();
+        file.to = obj.value("to").toString();
+        file.size = obj.value("size").toInteger();
+        file.createdMs = obj.value("created").toInteger();
+        file.complete = obj.value("complete").toBool();
+        if (file.name.isEmpty() || file.owner.isEmpty() || file.size <= 0 || !QFile::exists(dataPath(file.id))) {
+            f.close();
+            remove(file.id);
+            continue;
+        }
+        m_files.insert(file.id, file);
+    }
+    return true;
+}
+
+QString FileSpool::directory() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_dir;
+}
+
+bool FileSpool::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return !m_dir.isEmpty();
+}
+
+bool FileSpool::create(const QString &owner, const QString &to, const QString &name, qint64 size, File *file)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_dir.isEmpty()) {
+        return false;
+    }
+
+    File created;
+    created.id = newFileId();
+    created.name = name;
+    created.owner = owner;
+    created.to = to;
+    created.size = size;
+    created.createdMs = QDateTime::currentMSecsSinceEpoch();
+
+    QFile data(dataPath(created.id));
+    if (!data.open(QIODevice::WriteOnly | QIODevice::Truncate) || !writeSidecar(created)) {
+        data.remove();
+        return false;
+    }
+    m_files.insert(created.id, created);
+    *file = created;
+    return true;
+}
+
+bool FileSpool::find(const QByteArray &id, File *file) const
+{
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_files.constFind(id);
+    if (it == m_files.constEnd()) {
+        return false;
+    }
+    *file = it.value();
+    return true;
+}
+
+bool FileSpool::markComplete(const QByteArray &id, File *file)
+{
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_files.find(id);
+    if (it == m_files.end() || it.value().complete || QFileInfo(dataPath(id)).size() != it.value().size) {
+        return false;
+    }
+    it.value().complete = true;
+    writeSidecar(it.value());
+    m_uploads.fetchAndAddRelaxed(1);
+    *file = it.value();
+    return true;
+}
+
+QString FileSpool::dataPath(const QByteArray &id) const
+{
+    return m_dir + '/' + QString::fromLatin1(id) + QStringLiteral(".dat");
+}
+
+qint64 FileSpool::received(const QByteArray &id) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_files.contains(id) ? QFileInfo(dataPath(id)).size() : -1;
+}
+
+void FileSpool::expire(qint64 nowMs)
+{
+    QMutexLocker locker(&m_mutex);
+    QList<QByteArray> expired;
+    for (auto it = m_files.constBegin(); it != m_files.constEnd(); ++it) {
+        if (nowMs - it.value().createdMs > kMaxAgeMs) {
+            expired.push_back(it.key());
+        }
+    }
+    for (const auto &id : expired) {
+        remove(id);
+    }
+}
+
+void FileSpool::recordReceived(qint64 bytes)
+{
+    m_receivedBytes.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+}
+
+void FileSpool::recordSent(qint64 zeroCopyBytes, qint64 copiedBytes)
+{
+    m_zeroCopyBytes.fetchAndAddRelaxed(static_cast<quint64>(zeroCopyBytes));
+    m_copiedBytes.fetchAndAddRelaxed(static_cast<quint64>(copiedBytes));
+}
+
+void FileSpool::recordDownload()
+{
+    m_downloads.fetchAndAddRelaxed(1);
+}
+
+FileSpool::Stats FileSpool::stats() const
+{
+    Stats s;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const auto &file : m_files) {
+            ++s.files;
+            if (file.complete) {
+                s.bytes += file.size;
+            } else {
+                ++s.partial;
+            }
+        }
+    }
+    s.uploads = m_uploads.loadRelaxed();
+    s.downloads = m_downloads.loadRelaxed();
+    s.receivedBytes = m_receivedBytes.loadRelaxed();
+    s.zeroCopyBytes = m_zeroCopyBytes.loadRelaxed();
+    s.copiedBytes = m_copiedBytes.loadRelaxed();
+    return s;
+}
+
+QString FileSpool::sidecarPath(const QByteArray &id) const
+{
+    return m_dir + '/' + QString::fromLatin1(id) + QStringLiteral(".json");
+}
+
+bool FileSpool::writeSidecar(const File &file) const
+{
+    const QJsonObject obj{
+        {"name", file.name},
+        {"owner", file.owner},
+        {"to", file.to},
+        {"size", file.size},
+        {"created", file.createdMs},
+        {"complete", file.complete},
+    };
+
+    QFile f(sidecarPath(file.id));
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    return f.write(QJsonDocument(obj).toJson(QJsonDocument::Compact)) > 0;
+}
+
+void FileSpool::remove(const QByteArray &id)
+{
+    m_files.remove(id);
+    QFile::remove(dataPath(id));
+    QFile::remove(sidecarPath(id));
+}
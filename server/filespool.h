@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+// Server-side store for file transfers, shared by the routers (which decide who
+// may upload or fetch what) and the workers (which move the bytes). Each file
+// is <id>.dat in the spool directory next to an <id>.json sidecar holding its
+// name, owner, recipient, size and whether the upload finished. The number of
+// bytes received so far is the length of the .dat file, so an interrupted
+// upload resumes from there, also across restarts.
+class FileSpool
+{
+public:
+    struct File {
+        QByteArray id;
+        QString name;
+        QString owner;
+        QString to; // empty for a file shared with everyone
+        qint64 size = 0;
+        qint64 createdMs = 0;
+        bool complete = false;
+    };
+
+    struct Stats {
+        int files = 0;
+        int partial = 0;
+        qint64 bytes = 0;
+        quint64 uploads = 0;
+        quint64 downloads = 0;
+        quint64 receivedBytes = 0;
+        quint64 zeroCopyBytes = 0;
+        quint64 copiedBytes = 0;
+    };
+
+    static constexpr qint64 kMaxAgeMs = 7LL * 24 * 60 * 60 * 1000;
+
+    bool setDirectory(const QString &path);
+    QString directory() const;
+    bool isEnabled() const;
+
+    bool create(const QString &owner, const QString &to, const QString &name, qint64 size, File *file);
+    bool find(const QByteArray &id, File *file) const;
+    bool markComplete(const QByteArray &id, File *file);
+    QString dataPath(const QByteArray &id) const;
+    qint64 received(const QByteArray &id) const;
+    void expire(qint64 nowMs);
+
+    // Any thread.
+    void recordReceived(qint64 bytes);
+    void recordSent(qint64 zeroCopyBytes, qint64 copiedBytes);
+    void recordDownload();
+    Stats stats() const;
+
+private:
+    QString sidecarPath(const QByteArray &id) const;
+    bool writeSidecar(const File &file) const;
+    void remove(const QByteArray &id);
+
+    mutable QMutex m_mutex;
+    QString m_dir;
+    QHash<QByteArray, File> m_files;
+
+    QAtomicInteger<quint64> m_uploads;
+    QAtomicInteger<quint64> m_downloads;
+    QAtomicInteger<quint64> m_receivedBytes;
+    QAtomicInteger<quint64> m_zeroCopyBytes;
+    QAtomicInteger<quint64> m_copiedBytes;
+};
@@ -0,0 +1,392 @@
+#include "handover.h"
+
+#include <QByteArray>
+#include <QDeadlineTimer>
+#include <QJsonDocument>
+
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace Handover {
+
+#ifdef Q_OS_LINUX
+
+namespace {
+
+constexpr char kMagic[8] = {'C', 'H', 'A', 'T', 'H', 'O', 'V', '1'};
+constexpr int kHeaderSize = 16;
+
+bool fillAddress(const QString &path, sockaddr_un *addr, QString *error)
+{
+    const QByteArray native = path.toLocal8Bit();
+    if (native.isEmpty() || native.size() >= static_cast<qsizetype>(sizeof(addr->sun_path))) {
+        *error = QStringLiteral("socket path too long");
+        return false;
+    }
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    std::memcpy(addr->sun_path, native.constData(), static_cast<size_t>(native.size()));
+    return true;
+}
+
+bool waitFor(int fd, short events, const QDeadlineTimer &deadline)
+{
+    pollfd p{fd, events, 0};
+    while (true) {
+        const int n = ::poll(&p, 1, static_cast<int>(qMin<qint64>(deadline.remainingTime(), 1000 * 1000)));
+        if (n > 0) {
+            return true;
+        }
+        if (n == 0 || errno != EINTR || deadline.hasExpired()) {
+            return false;
+        }
+    }
+}
+
+bool writeAll(int fd, const char *data, qsizetype size, const QDeadlineTimer &deadline, QString *error)
+{
+    while (size > 0) {
+        const ssize_t n = ::send(fd, data, static_cast<size_t>(size), MSG_NOSIGNAL);
+        if (n > 0) {
+            data += n;
+            size -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN && waitFor(fd, POLLOUT, deadline)) {
+            continue;
+        }
+        *error = n < 0 && errno != EAGAIN ? qt_error_string(errno) : QStringLiteral("timed out");
+        return false;
+    }
+    return true;
+}
+
+bool readAll(int fd, char *data, qsizetype size, const QDeadlineTimer &deadline, QString *error)
+{
+    while (size > 0) {
+        const ssize_t n = ::recv(fd, data, static_cast<size_t>(size), 0);
+        if (n > 0) {
+            data += n;
+            size -= n;
+            continue;
+        }
+        if (n == 0) {
+            *error = QStringLiteral("connection closed");
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN && waitFor(fd, POLLIN, deadline)) {
+            continue;
+        }
+        *error = errno != EAGAIN ? qt_error_string(errno) : QStringLiteral("timed out");
+        return false;
+    }
+    return true;
+}
+
+void putU32(QByteArray *out, quint32 value)
+{
+    for (int i = 0; i < 4; ++i) {
+        out->append(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+bool isSameUser(int fd, QString *error)
+{
+    ucred peer{};
+    socklen_t length = sizeof(peer);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) < 0) {
+        *error = qt_error_string(errno);
+        return false;
+    }
+    if (peer.uid != ::getuid()) {
+        *error = QString("peer runs as uid %1").arg(peer.uid);
+        return false;
+    }
+    return true;
+}
+
+quint32 getU32(const char *p)
+{
+    quint32 value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<quint32>(static_cast<quint8>(p[i])) << (8 * i);
+    }
+    return value;
+}
+
+} // namespace
+
+int listen(const QString &path, QString *error, int backlog, int mode)
+{
+    sockaddr_un addr;
+    if (!fillAddress(path, &addr, error)) {
+        return -1;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        *error = qt_error_string(errno);
+        return -1;
+    }
+    // Whoever held the path before (the predecessor, or a crashed run) has
+    // either handed over already or is gone.
+    ::unlink(addr.sun_path);
+    if (::bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0 || (mode >= 0 && ::chmod(addr.sun_path, static_cast<mode_t>(mode)) < 0)
+        || ::listen(fd, backlog) < 0) {
+        *error = qt_error_string(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int accept(int listenFd)
+{
+    int fd = -1;
+    do {
+        fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+bool send(int fd, const Package &package, int timeoutMs, QString *error)
+{
+    // The mode of the path keeps other users out; this is in case it was
+    // loosened, or the directory let someone else replace it.
+    if (!isSameUser(fd, error)) {
+        return false;
+    }
+    const QDeadlineTimer deadline(timeoutMs);
+    const QByteArray json = QJsonDocument(package.state).toJson(QJsonDocument::Compact);
+
+    QByteArray header(kMagic, sizeof(kMagic));
+    putU32(&header, static_cast<quint32>(json.size()));
+    putU32(&header, static_cast<quint32>(package.fds.size()));
+    if (!writeAll(fd, header.constData(), header.size(), deadline, error) || !writeAll(fd, json.constData(), json.size(), deadline, error)) {
+        return false;
+    }
+
+    for (qsizetype at = 0; at < package.fds.size(); at += kMaxFdsPerMessage) {
+        const int count = static_cast<int>(qMin<qsizetype>(kMaxFdsPerMessage, package.fds.size() - at));
+        char byte = 'F';
+        iovec iov{&byte, 1};
+        QByteArray control(static_cast<qsizetype>(CMSG_SPACE(sizeof(int) * static_cast<size_t>(count))), '\0');
+
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = static_cast<size_t>(control.size());
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * static_cast<size_t>(count));
+        std::memcpy(CMSG_DATA(cmsg), package.fds.constData() + at, sizeof(int) * static_cast<size_t>(count));
+
+        while (true) {
+            const ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (n == 1) {
+                break;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN && waitFor(fd, POLLOUT, deadline)) {
+                continue;
+            }
+            *error = n < 0 && errno != EAGAIN ? qt_error_string(errno) : QStringLiteral("timed out");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool waitForAck(int fd, int timeoutMs)
+{
+    char byte = 0;
+    QString error;
+    return readAll(fd, &byte, 1, QDeadlineTimer(timeoutMs), &error) && byte == 'A';
+}
+
+int connectTo(const QString &path, QString *error)
+{
+    sockaddr_un addr;
+    if (!fillAddress(path, &addr, error)) {
+        return -1;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        *error = qt_error_string(errno);
+        return -1;
+    }
+    int rc = -1;
+    do {
+        rc = ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            *error = qt_error_string(errno);
+        }
+        ::close(fd);
+        return -1;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+bool receive(int fd, Package *package, int timeoutMs, QString *error)
+{
+    const QDeadlineTimer deadline(timeoutMs);
+    char header[kHeaderSize];
+    if (!readAll(fd, header, kHeaderSize, deadline, error)) {
+        return false;
+    }
+    if (std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+        *error = QStringLiteral("not a handover");
+        return false;
+    }
+    const quint32 jsonSize = getU32(header + 8);
+    const quint32 fdCount = getU32(header + 12);
+
+    QByteArray json(static_cast<qsizetype>(jsonSize), '\0');
+    if (!readAll(fd, json.data(), json.size(), deadline, error)) {
+        return false;
+    }
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(json, &parseError);
+    if (!doc.isObject()) {
+        *error = parseError.errorString();
+        return false;
+    }
+    package->state = doc.object();
+
+    // The data bytes are read one at a time with their descriptors; a plain
+    // recv() over them would drop the descriptors.
+    QByteArray control(static_cast<qsizetype>(CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage)), '\0');
+    while (package->fds.size() < static_cast<qsizetype>(fdCount)) {
+        char byte = 0;
+        iovec iov{&byte, 1};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = static_cast<size_t>(control.size());
+
+        const ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN && waitFor(fd, POLLIN, deadline)) {
+            continue;
+        }
+        if (n <= 0) {
+            *error = n == 0 ? QStringLiteral("connection closed") : errno != EAGAIN ? qt_error_string(errno) : QStringLiteral("timed out");
+            break;
+        }
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            const auto count = static_cast<qsizetype>((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            const auto *fds = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+            for (qsizetype i = 0; i < count; ++i) {
+                package->fds.push_back(fds[i]);
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+            *error = QStringLiteral("descriptors truncated");
+            break;
+        }
+    }
+
+    if (package->fds.size() != static_cast<qsizetype>(fdCount)) {
+        for (int received : std::as_const(package->fds)) {
+            ::close(received);
+        }
+        package->fds.clear();
+        if (error->isEmpty()) {
+            *error = QStringLiteral("descriptor count mismatch");
+        }
+        return false;
+    }
+    return true;
+}
+
+bool sendAck(int fd)
+{
+    const char byte = 'A';
+    QString error;
+    return writeAll(fd, &byte, 1, QDeadlineTimer(5000), &error);
+}
+
+void closeFd(int fd)
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+#else
+
+int listen(const QString &, QString *error, int, int)
+{
+    *error = QStringLiteral("Unix sockets need Linux");
+    return -1;
+}
+
+int accept(int)
+{
+    return -1;
+}
+
+bool send(int, const Package &, int, QString *error)
+{
+    *error = QStringLiteral("handover needs Linux");
+    return false;
+}
+
+bool waitForAck(int, int)
+{
+    return false;
+}
+
+int connectTo(const QString &, QString *error)
+{
+    *error = QStringLiteral("handover needs Linux");
+    return -1;
+}
+
+bool receive(int, Package *, int, QString *error)
+{
+    *error = QStringLiteral("handover needs Linux");
+    return false;
+}
+
+bool sendAck(int)
+{
+    return false;
+}
+
+void closeFd(int)
+{
+}
+
+#endif
+
+} // namespace Handover
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+
+// Passes a running server's sockets to its successor on the same machine. The
+// old server listens on a Unix domain socket; the new one connects and gets one
+// package: the state as JSON, then every descriptor (the listener first, then
+// the client connections) as SCM_RIGHTS ancillary data, and answers with one
+// byte once it holds them. Only the old server closes its copies after that,
+// so the connections never see a FIN.
+//
+// Wire format: "CHATHOV1", u32 JSON length and u32 descriptor count (little
+// endian), the JSON, then the descriptors in messages of at most kMaxFdsPerMessage,
+// each with a one-byte payload. All calls block, bounded by their timeout.
+// Linux only; elsewhere every call fails.
+namespace Handover {
+
+constexpr int kMaxFdsPerMessage = 250;
+
+struct Package {
+    QJsonObject state;
+    QList<int> fds;
+};
+
+// Old server: a listening socket at `path` (an old one is replaced), given
+// `mode` before anyone can connect; -1 and *error on failure. accept()
+// returns -1 when no successor is waiting. The server's local client socket
+// is made the same way, with a longer backlog and mode -1, which leaves the
+// path as the umask made it. send() refuses a peer running as another user.
+int listen(const QString &path, QString *error, int backlog = 1, int mode = 0600);
+int accept(int listenFd);
+bool send(int fd, const Package &package, int timeoutMs, QString *error);
+bool waitForAck(int fd, int timeoutMs);
+
+// New server: -1 without *error when nobody listens at `path`.
+int connectTo(const QString &path, QString *error);
+bool receive(int fd, Package *package, int timeoutMs, QString *error);
+bool sendAck(int fd);
+
+void closeFd(int fd);
+
+} // namespace Handover
@@ -1,12 +1,102 @@
+#include "clienttransport.h"
+#include "contentfilter.h"
+#include "serverconfig.h"
 #include "serverwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
-    ServerWindow window;
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    const QCommandLineOption mailboxDirOption("mailbox-dir", "Spill offline private messages to <dir>.", "dir");
+    parser.addOption(mailboxDirOption);
+    const QCommandLineOption tlsCertOption("tls-cert", "Serve TLS with the PEM certificate chain in <file>.", "file");
+    parser.addOption(tlsCertOption);
+    const QCommandLineOption tlsKeyOption("tls-key", "PEM private key for --tls-cert.", "file");
+    parser.addOption(tlsKeyOption);
+    const QCommandLineOption maxClientsOption("max-clients", "Connections served at once.", "n", "100");
+    parser.addOption(maxClientsOption);
+    const QCommandLineOption localSocketOption("local-socket", "Also accept same-host clients on the Unix socket <path> (Linux, never TLS).", "path");
+    parser.addOption(localSocketOption);
+    const QCommandLineOption routerShardsOption("router-shards", "Router threads; user state is partitioned across them by name (0 = auto).", "n", "0");
+    parser.addOption(routerShardsOption);
+    const QCommandLineOption routerQueueOption("router-queue", "Capacity of each router's ingress queue.", "n", "16384");
+    parser.addOption(routerQueueOption);
+    const QCommandLineOption routerBatchOption("router-batch", "Ingress events the router handles per drain.", "n", "64");
+    parser.addOption(routerBatchOption);
+    const QCommandLineOption routerSpinOption("router-spin", "Empty polls before the router thread parks (0 parks at once).", "n", "2000");
+    parser.addOption(routerSpinOption);
+    const QCommandLineOption spoolDirOption("spool-dir", "Accept file transfers and keep the files in <dir>.", "dir");
+    parser.addOption(spoolDirOption);
+    const QCommandLineOption maxFileSizeOption("max-file-size", "Largest file accepted, in MiB.", "mib", "64");
+    parser.addOption(maxFileSizeOption);
+    const QCommandLineOption transferRateOption("transfer-rate", "Throughput limit per file transfer in KiB/s (0 = unlimited).", "kib", "0");
+    parser.addOption(transferRateOption);
+    const QCommandLineOption searchHistoryOption("search-history", "Messages kept searchable (0 disables search).", "n", "1000000");
+    parser.addOption(searchHistoryOption);
+    const QCommandLineOption captureOption("capture", "Record received traffic into <file> for chatreplay.", "file");
+    parser.addOption(captureOption);
+    const QCommandLineOption profileOption("profile", "Record a timeline of the server threads; save it to <file> as Chrome trace-event JSON.", "file");
+    parser.addOption(profileOption);
+    const QCommandLineOption profileWindowOption("profile-window", "Seconds of timeline kept for --profile.", "s", "10");
+    parser.addOption(profileWindowOption);
+    const QCommandLineOption profileEveryOption("profile-every", "Save the --profile file every <s> seconds (0 = only on demand and at stop).", "s", "0");
+    parser.addOption(profileEveryOption);
+    const QCommandLineOption handoverOption("handover", "Take over the sockets of the server listening at Unix socket <path>, and listen there for a successor.", "path");
+    parser.addOption(handoverOption);
+    const QCommandLineOption transportOption("transport", "Client socket backend: qt, or epoll (Linux; TLS connections stay on qt).", "backend", "qt");
+    parser.addOption(transportOption);
+    const QCommandLineOption memoryBudgetOption("memory-budget", "Drop the largest connections while all of them together hold more than <mib> MiB (0 = no limit).", "mib", "0");
+    parser.addOption(memoryBudgetOption);
+    const QCommandLineOption overloadLagOption("overload-lag", "Degrade step by step while router queue waits exceed <ms> (0 = never).", "ms", "100");
+    parser.addOption(overloadLagOption);
+    const QCommandLineOption filterOption("filter", "Filter chat and private text with the banned terms in <file> (reloaded when it changes).", "file");
+    parser.addOption(filterOption);
+    const QCommandLineOption filterActionOption("filter-action", "Action for terms outside a [mask]/[reject]/[log] section: mask, reject or log.", "action", "mask");
+    parser.addOption(filterActionOption);
+    parser.process(app);
+
+    TransportContext::Backend backend = TransportContext::Backend::Qt;
+    if (!TransportContext::parseBackend(parser.value(transportOption), &backend)) {
+        qCritical("unknown --transport %s (qt or epoll)", qPrintable(parser.value(transportOption)));
+        return 1;
+    }
+    ContentFilter::Action filterAction = ContentFilter::Action::Mask;
+    if (!ContentFilter::parseAction(parser.value(filterActionOption), &filterAction)) {
+        qCritical("unknown --filter-action %s (mask, reject or log)", qPrintable(parser.value(filterActionOption)));
+        return 1;
+    }
+
+    ServerConfig config;
+    config.mailboxDir = parser.value(mailboxDirOption);
+    config.tlsCertFile = parser.value(tlsCertOption);
+    config.tlsKeyFile = parser.value(tlsKeyOption);
+    config.maxClients = qMax(1, parser.value(maxClientsOption).toInt());
+    config.localSocketPath = parser.value(localSocketOption);
+    config.routerShards = qMax(0, parser.value(routerShardsOption).toInt());
+    config.routerQueueCapacity = qMax(2, parser.value(routerQueueOption).toInt());
+    config.routerBatch = qMax(1, parser.value(routerBatchOption).toInt());
+    config.routerSpin = qMax(0, parser.value(routerSpinOption).toInt());
+    config.spoolDir = parser.value(spoolDirOption);
+    config.maxFileSize = qMax<qint64>(1, parser.value(maxFileSizeOption).toLongLong()) * 1024 * 1024;
+    config.transferRate = qMax<qint64>(0, parser.value(transferRateOption).toLongLong()) * 1024;
+    config.searchHistory = qMax<qint64>(0, parser.value(searchHistoryOption).toLongLong());
+    config.captureFile = parser.value(captureOption);
+    config.profileFile = parser.value(profileOption);
+    config.profileWindowSeconds = qMax(1, parser.value(profileWindowOption).toInt());
+    config.profileEverySeconds = qMax(0, parser.value(profileEveryOption).toInt());
+    config.handoverPath = parser.value(handoverOption);
+    config.transport = parser.value(transportOption);
+    config.filterFile = parser.value(filterOption);
+    config.filterAction = parser.value(filterActionOption);
+    config.memoryBudget = qMax<qint64>(0, parser.value(memoryBudgetOption).toLongLong()) * 1024 * 1024;
+    config.overloadLagMs = qMax(0, parser.value(overloadLagOption).toInt());
+
+    ServerWindow window(config);
     window.show();
     return app.exec();
 }
-
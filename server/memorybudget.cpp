@@ -0,0 +1,157 @@
+#include "memorybudget.h"
+
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QObject>
+#include <QPair>
+
+#include <algorithm>
+#include <utility>
+
+qint64 MemoryBudget::Account::total() const
+{
+    qint64 sum = 0;
+    for (const auto &bytes : m_bytes) {
+        sum += bytes.loadRelaxed();
+    }
+    return sum;
+}
+
+const char *MemoryBudget::kindName(Kind kind)
+{
+    switch (kind) {
+    case Input:
+        return "input";
+    case Output:
+        return "output";
+    case Pending:
+        return "pending";
+    case Replay:
+        return "replay";
+    case KindCount:
+        break;
+    }
+    return "";
+}
+
+void MemoryBudget::setBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_budget = qMax<qint64>(0, bytes);
+}
+
+qint64 MemoryBudget::budget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+MemoryBudget::Account *MemoryBudget::open(quint64 clientId, QObject *worker)
+{
+    auto *account = new Account;
+    account->m_clientId = clientId;
+    account->m_worker = worker;
+    QMutexLocker locker(&m_mutex);
+    m_accounts.insert(clientId, account);
+    return account;
+}
+
+void MemoryBudget::close(Account *account)
+{
+    if (!account) {
+        return;
+    }
+    {
+        QMutexLocker locker(&m_mutex);
+        m_accounts.remove(account->m_clientId);
+    }
+    delete account;
+}
+
+void MemoryBudget::setName(Account *account, const QString &name)
+{
+    if (!account) {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    account->m_name = name;
+}
+
+QList<MemoryBudget::Usage> MemoryBudget::enforce()
+{
+    QList<Usage> evicted;
+    QMutexLocker locker(&m_mutex);
+    if (m_budget <= 0) {
+        return evicted;
+    }
+
+    // Connections already dropping still count until their worker is gone,
+    // but are not picked again. The counters keep moving, so candidates are
+    // ranked by one snapshot.
+    qint64 total = 0;
+    QList<QPair<Usage, Account *>> candidates;
+    candidates.reserve(m_accounts.size());
+    for (auto *account : std::as_const(m_accounts)) {
+        Usage usage = usageOf(*account);
+        total += usage.total;
+        if (!account->m_evicting) {
+            candidates.push_back(qMakePair(std::move(usage), account));
+        }
+    }
+    if (total <= m_budget) {
+        return evicted;
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.first.total > b.first.total; });
+    for (const auto &[usage, account] : std::as_const(candidates)) {
+        if (total <= m_budget) {
+            break;
+        }
+        total -= usage.total;
+        account->m_evicting = true;
+        // Posted under the lock: the worker cannot be destroyed before its
+        // account is closed, and Qt drops events posted to a deleted object.
+        QMetaObject::invokeMethod(account->m_worker, "evict", Qt::QueuedConnection);
+        m_evictions.fetchAndAddRelaxed(1);
+        evicted.push_back(usage);
+    }
+    return evicted;
+}
+
+MemoryBudget::Stats MemoryBudget::stats(int top) const
+{
+    Stats s;
+    s.evictions = m_evictions.loadRelaxed();
+
+    QMutexLocker locker(&m_mutex);
+    s.budget = m_budget;
+    s.connections = static_cast<int>(m_accounts.size());
+    QList<Usage> all;
+    all.reserve(m_accounts.size());
+    for (const auto *account : std::as_const(m_accounts)) {
+        Usage usage = usageOf(*account);
+        for (int k = 0; k < KindCount; ++k) {
+            s.bytes[k] += usage.bytes[k];
+        }
+        s.total += usage.total;
+        all.push_back(std::move(usage));
+    }
+    locker.unlock();
+
+    const auto n = qMin<qsizetype>(qMax(0, top), all.size());
+    std::partial_sort(all.begin(), all.begin() + n, all.end(), [](const Usage &a, const Usage &b) { return a.total > b.total; });
+    s.top = all.mid(0, n);
+    return s;
+}
+
+MemoryBudget::Usage MemoryBudget::usageOf(const Account &account)
+{
+    Usage usage;
+    usage.clientId = account.m_clientId;
+    usage.name = account.m_name;
+    for (int k = 0; k < KindCount; ++k) {
+        usage.bytes[k] = account.bytes(static_cast<Kind>(k));
+        usage.total += usage.bytes[k];
+    }
+    return usage;
+}
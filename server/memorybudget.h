@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+class QObject;
+
+// What each connection holds in memory, and an optional limit on the sum.
+//
+// Every worker has an Account. The worker charges its unparsed input and its
+// output (OutboundQueue plus what the transport has not written yet), the
+// routers charge the lines they posted that the worker has not taken yet and
+// the resume replay of the session attached to the connection. A line shared
+// by many recipients is charged to each of them.
+//
+// Over budget, enforce() asks the largest connections to drop (their worker's
+// evict() slot) until the rest fit.
+class MemoryBudget
+{
+public:
+    enum Kind : quint8 {
+        Input,   // received, not parsed yet
+        Output,  // queued for the socket, not written yet
+        Pending, // posted by a router, not taken by the worker yet
+        Replay,  // resume replay of the attached session
+        KindCount,
+    };
+
+    class Account
+    {
+    public:
+        // Any thread.
+        void set(Kind kind, qint64 bytes) { m_bytes[kind].storeRelaxed(bytes); }
+        void add(Kind kind, qint64 bytes) { m_bytes[kind].fetchAndAddRelaxed(bytes); }
+        qint64 bytes(Kind kind) const { return m_bytes[kind].loadRelaxed(); }
+        qint64 total() const;
+
+    private:
+        friend class MemoryBudget;
+
+        quint64 m_clientId = 0;
+        // Guarded by the budget's mutex.
+        QObject *m_worker = nullptr;
+        QString m_name;
+        bool m_evicting = false;
+
+        QAtomicInteger<qint64> m_bytes[KindCount];
+    };
+
+    struct Usage {
+        quint64 clientId = 0;
+        QString name;
+        qint64 bytes[KindCount] = {};
+        qint64 total = 0;
+    };
+
+    struct Stats {
+        qint64 budget = 0;
+        int connections = 0;
+        qint64 bytes[KindCount] = {};
+        qint64 total = 0;
+        quint64 evictions = 0;
+        // Largest connections first.
+        QList<Usage> top;
+    };
+
+    static const char *kindName(Kind kind);
+
+    // 0 = no limit.
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+    // A worker opens its account when it is created and closes it when it is
+    // destroyed; the account is valid in between.
+    Account *open(quint64 clientId, QObject *worker);
+    void close(Account *account);
+    void setName(Account *account, const QString &name);
+
+    // GUI thread, periodically. The connections asked to drop, largest first.
+    QList<Usage> enforce();
+    Stats stats(int top) const;
+
+private:
+    static Usage usageOf(const Account &account);
+
+    mutable QMutex m_mutex;
+    QHash<quint64, Account *> m_accounts;
+    qint64 m_budget = 0;
+    QAtomicInteger<quint64> m_evictions;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free multi-producer / single-consumer queue (Vyukov's bounded
+// queue with per-cell sequence numbers). Producers claim a slot with one CAS on
+// the enqueue position; the single consumer never contends with them. Capacity
+// is rounded up to a power of two.
+template <typename T>
+class MpscQueue
+{
+public:
+    explicit MpscQueue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (std::size_t i = 0; i < size; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Any thread. Returns false (and leaves `value` untouched) when full.
+    bool tryPush(T &value)
+    {
+        Cell *cell = nullptr;
+        std::size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only.
+    bool tryPop(T &out)
+    {
+        const std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        Cell *cell = &m_cells[pos & m_mask];
+        const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) < 0) {
+            return false;
+        }
+
+        out = std::move(cell->value);
+        cell->value = T();
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer thread only: what tryPop() would return next, nullptr if none.
+    const T *peek() const
+    {
+        const std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        const Cell *cell = &m_cells[pos & m_mask];
+        const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) < 0) {
+            return nullptr;
+        }
+        return &cell->value;
+    }
+
+    // Approximate when read concurrently with producers.
+    std::size_t sizeApprox() const
+    {
+        const std::size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+        const std::size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool isEmptyApprox() const { return sizeApprox() == 0; }
+    std::size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq{0};
+        T value{};
+    };
+
+    static constexpr std::size_t kCacheLine = 64;
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask = 0;
+    alignas(kCacheLine) std::atomic<std::size_t> m_enqueuePos{0};
+    alignas(kCacheLine) std::atomic<std::size_t> m_dequeuePos{0};
+};
+
+// Unbounded multi-producer / single-consumer queue (Vyukov's intrusive node
+// queue). Pushes never fail or block, at the cost of one allocation each; used
+// for router-to-router traffic, where a bounded queue could deadlock two
+// routers that are both waiting for room in the other's queue.
+template <typename T>
+class MpscList
+{
+public:
+    MpscList()
+        : m_tail(new Node)
+    {
+        m_head.store(m_tail, std::memory_order_relaxed);
+    }
+
+    ~MpscList()
+    {
+        T value;
+        while (tryPop(value)) {
+        }
+        delete m_tail;
+    }
+
+    MpscList(const MpscList &) = delete;
+    MpscList &operator=(const MpscList &) = delete;
+
+    // Any thread.
+    void push(T &value)
+    {
+        auto *node = new Node;
+        node->value = std::move(value);
+        Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Consumer thread only.
+    bool tryPop(T &out)
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        out = std::move(next->value);
+        next->value = T();
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+
+    // Consumer thread only: what tryPop() would return next, nullptr if none.
+    const T *peek() const
+    {
+        const Node *next = m_tail->next.load(std::memory_order_acquire);
+        return next ? &next->value : nullptr;
+    }
+
+    // Consumer thread only. A push that is half done reads as empty; the
+    // producer finishes it before it checks whether to wake the consumer.
+    bool isEmpty() const { return m_tail->next.load(std::memory_order_acquire) == nullptr; }
+
+private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value{};
+    };
+
+    alignas(64) std::atomic<Node *> m_head{nullptr};
+    alignas(64) Node *m_tail = nullptr;
+};
@@ -0,0 +1,376 @@
+#include "offlinemailbox.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonObject>
+
+namespace {
+
+constexpr quint32 kSpillMagic = 0x43484d42; // "CHMB"
+constexpr quint16 kSpillVersion = 1;
+
+QString fromHex(const QByteArray &hex)
+{
+    return QString::fromUtf8(QByteArray::fromHex(hex));
+}
+
+} // namespace
+
+OfflineMailbox::OfflineMailbox(const Limits &limits)
+    : m_limits(limits)
+{
+}
+
+void OfflineMailbox::setSpillDirectory(const QString &path, const std::function<bool(const QString &recipient)> &owns)
+{
+    m_spillDir = path;
+    if (m_spillDir.isEmpty()) {
+        return;
+    }
+
+    QDir dir(m_spillDir);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        m_spillDir.clear();
+        return;
+    }
+
+    // Pick up the names and the mail of a previous run.
+    QFile known(knownPath());
+    if (known.open(QIODevice::ReadOnly)) {
+        while (!known.atEnd()) {
+            const QString recipient = fromHex(known.readLine().trimmed());
+            if (!recipient.isEmpty() && (!owns || owns(recipient))) {
+                m_known.insert(recipient);
+            }
+        }
+    }
+    const QStringList files = dir.entryList({"*.mbox"}, QDir::Files);
+    for (const auto &file : files) {
+        const QString recipient = fromHex(QFileInfo(file).completeBaseName().toLatin1());
+        if (recipient.isEmpty() || (owns && !owns(recipient))) {
+            continue;
+        }
+        const int count = static_cast<int>(readSpill(recipient).size());
+        if (count == 0) {
+            removeSpill(recipient);
+            continue;
+        }
+        Box &box = m_boxes[recipient];
+        box.spilledCount = count;
+        box.spillBytes = QFileInfo(dir.filePath(file)).size();
+        m_stats.spillBytes += box.spillBytes;
+    }
+}
+
+QString OfflineMailbox::spillDirectory() const
+{
+    return m_spillDir;
+}
+
+void OfflineMailbox::addRecipient(const QString &recipient)
+{
+    if (m_known.contains(recipient)) {
+        return;
+    }
+    m_known.insert(recipient);
+    if (m_spillDir.isEmpty()) {
+        return;
+    }
+    // Shards sharing the directory append to the same file; one short write
+    // in append mode does not interleave with theirs.
+    QFile known(knownPath());
+    if (known.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        known.write(recipient.toUtf8().toHex() + '\n');
+    }
+}
+
+bool OfflineMailbox::isKnown(const QString &recipient) const
+{
+    return m_known.contains(recipient) || m_boxes.contains(recipient);
+}
+
+OfflineMailbox::Result OfflineMailbox::enqueue(const QString &recipient, const QByteArray &line, qint64 nowMs)
+{
+    auto it = m_boxes.find(recipient);
+    if (it == m_boxes.end()) {
+        if (!m_known.contains(recipient)) {
+            ++m_stats.unknown;
+            return Result::Unknown;
+        }
+        if (m_boxes.size() >= m_limits.maxRecipients) {
+            ++m_stats.droppedFull;
+            return Result::Full;
+        }
+        it = m_boxes.insert(recipient, Box());
+    }
+    Box &box = it.value();
+
+    while (!box.memory.isEmpty() && nowMs - box.memory.constFirst().timeMs > m_limits.maxAgeMs) {
+        m_stats.memoryBytes -= box.memory.constFirst().line.size();
+        box.memory.removeFirst();
+        ++m_stats.droppedExpired;
+    }
+
+    if (box.memory.size() + box.spilledCount >= m_limits.maxMessagesPerRecipient) {
+        ++m_stats.droppedFull;
+        return Result::Full;
+    }
+
+    const Entry entry{nowMs, line};
+
+    // Once a recipient has spilled, later mail follows it to disk so that
+    // delivery order stays "memory first, then spill file".
+    const bool overMemory = box.spilledCount > 0
+        || box.memory.size() >= kMemoryEntriesPerRecipient
+        || m_stats.memoryBytes + line.size() > m_limits.maxMemoryBytes;
+    if (overMemory) {
+        const bool spillRoom = m_stats.spillBytes + line.size() <= m_limits.maxSpillBytes;
+        const qint64 written = (!m_spillDir.isEmpty() && spillRoom) ? appendToSpill(recipient, entry) : 0;
+        if (written > 0) {
+            ++box.spilledCount;
+            box.spillBytes += written;
+            m_stats.spillBytes += written;
+            ++m_stats.queued;
+            ++m_stats.spilled;
+            return Result::Spilled;
+        }
+        if (box.spilledCount > 0 || m_stats.memoryBytes + line.size() > m_limits.maxMemoryBytes) {
+            if (box.memory.isEmpty() && box.spilledCount == 0) {
+                m_boxes.erase(it);
+            }
+            ++m_stats.droppedFull;
+            return Result::Full;
+        }
+    }
+
+    box.memory.append(entry);
+    m_stats.memoryBytes += line.size();
+    ++m_stats.queued;
+    return Result::Queued;
+}
+
+QList<QByteArray> OfflineMailbox::take(const QString &recipient, qint64 nowMs)
+{
+    const auto it = m_boxes.find(recipient);
+    if (it == m_boxes.end()) {
+        return {};
+    }
+
+    const Box box = it.value();
+    m_boxes.erase(it);
+
+    QList<Entry> entries = box.memory;
+    for (const auto &e : entries) {
+        m_stats.memoryBytes -= e.line.size();
+    }
+    if (box.spilledCount > 0) {
+        entries.append(readSpill(recipient));
+        removeSpill(recipient);
+        m_stats.spillBytes -= box.spillBytes;
+    }
+
+    QList<QByteArray> lines;
+    lines.reserve(entries.size());
+    for (const auto &e : entries) {
+        if (nowMs - e.timeMs > m_limits.maxAgeMs) {
+            ++m_stats.droppedExpired;
+            continue;
+        }
+        lines.push_back(e.line);
+    }
+
+    if (!lines.isEmpty()) {
+        m_stats.delivered += static_cast<quint64>(lines.size());
+        ++m_stats.deliveryBursts;
+    }
+    return lines;
+}
+
+bool OfflineMailbox::hasMail(const QString &recipient) const
+{
+    return m_boxes.contains(recipient);
+}
+
+void OfflineMailbox::expire(qint64 nowMs)
+{
+    for (auto it = m_boxes.begin(); it != m_boxes.end();) {
+        Box &box = it.value();
+        while (!box.memory.isEmpty() && nowMs - box.memory.constFirst().timeMs > m_limits.maxAgeMs) {
+            m_stats.memoryBytes -= box.memory.constFirst().line.size();
+            box.memory.removeFirst();
+            ++m_stats.droppedExpired;
+        }
+
+        // Spill files are append-only, so a file that has not been written to
+        // for longer than the age limit only holds expired mail.
+        if (box.spilledCount > 0) {
+            const QFileInfo info(spillPath(it.key()));
+            if (!info.exists() || nowMs - info.lastModified().toMSecsSinceEpoch() > m_limits.maxAgeMs) {
+                m_stats.droppedExpired += static_cast<quint64>(box.spilledCount);
+                removeSpill(it.key());
+                m_stats.spillBytes -= box.spillBytes;
+                box.spilledCount = 0;
+                box.spillBytes = 0;
+            }
+        }
+
+        if (box.memory.isEmpty() && box.spilledCount == 0) {
+            it = m_boxes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void OfflineMailbox::clear()
+{
+    m_boxes.clear();
+    m_known.clear();
+    m_stats.memoryBytes = 0;
+    m_stats.spillBytes = 0;
+}
+
+QJsonArray OfflineMailbox::exportBoxes() const
+{
+    QJsonArray boxes;
+    for (auto it = m_boxes.constBegin(); it != m_boxes.constEnd(); ++it) {
+        QJsonArray mail;
+        for (const auto &entry : it.value().memory) {
+            mail.append(QJsonObject{{"time", entry.timeMs}, {"line", QString::fromUtf8(entry.line)}});
+        }
+        boxes.append(QJsonObject{{"recipient", it.key()}, {"mail", mail}, {"spilled", it.value().spilledCount}});
+    }
+    return boxes;
+}
+
+void OfflineMailbox::importBoxes(const QJsonArray &boxes)
+{
+    for (const auto &value : boxes) {
+        const QJsonObject obj = value.toObject();
+        const QString recipient = obj.value("recipient").toString();
+        if (recipient.isEmpty()) {
+            continue;
+        }
+        Box &box = m_boxes[recipient];
+        for (const auto &mail : obj.value("mail").toArray()) {
+            const QJsonObject entry = mail.toObject();
+            box.memory.append(Entry{entry.value("time").toInteger(), entry.value("line").toString().toUtf8()});
+            m_stats.memoryBytes += box.memory.constLast().line.size();
+        }
+        // The spill file was already counted if it existed when the directory
+        // was scanned; the predecessor's count also covers later appends.
+        if (!m_spillDir.isEmpty()) {
+            box.spilledCount = obj.value("spilled").toInt();
+            m_stats.spillBytes -= box.spillBytes;
+            box.spillBytes = box.spilledCount > 0 ? QFileInfo(spillPath(recipient)).size() : 0;
+            m_stats.spillBytes += box.spillBytes;
+        }
+        if (box.memory.isEmpty() && box.spilledCount == 0) {
+            m_boxes.remove(recipient);
+        }
+    }
+}
+
+QJsonArray OfflineMailbox::exportRecipients() const
+{
+    QJsonArray recipients;
+    for (const auto &recipient : m_known) {
+        recipients.append(recipient);
+    }
+    return recipients;
+}
+
+void OfflineMailbox::importRecipients(const QJsonArray &recipients)
+{
+    // The predecessor has already written them to known.list.
+    for (const auto &value : recipients) {
+        const QString recipient = value.toString();
+        if (!recipient.isEmpty()) {
+            m_known.insert(recipient);
+        }
+    }
+}
+
+OfflineMailbox::Stats OfflineMailbox::stats() const
+{
+    Stats s = m_stats;
+    s.recipients = static_cast<int>(m_boxes.size());
+    s.pending = 0;
+    for (auto it = m_boxes.constBegin(); it != m_boxes.constEnd(); ++it) {
+        s.pending += static_cast<int>(it.value().memory.size()) + it.value().spilledCount;
+    }
+    return s;
+}
+
+QString OfflineMailbox::spillPath(const QString &recipient) const
+{
+    return QDir(m_spillDir).filePath(QString::fromLatin1(recipient.toUtf8().toHex()) + ".mbox");
+}
+
+QString OfflineMailbox::knownPath() const
+{
+    return QDir(m_spillDir).filePath("known.list");
+}
+
+qint64 OfflineMailbox::appendToSpill(const QString &recipient, const Entry &entry)
+{
+    QFile file(spillPath(recipient));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        return 0;
+    }
+    const qint64 before = file.size();
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    if (before == 0) {
+        out << kSpillMagic << kSpillVersion;
+    }
+    out << entry.timeMs << entry.line;
+    if (out.status() != QDataStream::Ok) {
+        return 0;
+    }
+    return file.size() - before;
+}
+
+QList<OfflineMailbox::Entry> OfflineMailbox::readSpill(const QString &recipient) const
+{
+    QList<Entry> entries;
+    if (m_spillDir.isEmpty()) {
+        return entries;
+    }
+
+    QFile file(spillPath(recipient));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return entries;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != kSpillMagic || version != kSpillVersion) {
+        return entries;
+    }
+
+    while (!in.atEnd()) {
+        Entry e;
+        in >> e.timeMs >> e.line;
+        if (in.status() != QDataStream::Ok) {
+            break; // truncated tail record from an interrupted append
+        }
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+void OfflineMailbox::removeSpill(const QString &recipient) const
+{
+    if (!m_spillDir.isEmpty()) {
+        QFile::remove(spillPath(recipient));
+    }
+}
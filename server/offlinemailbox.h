@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonArray>
+#include <QList>
+#include <QSet>
+#include <QString>
+
+#include <functional>
+
+// Per-recipient store-and-forward queue for private messages to users that are
+// not logged in. The oldest kMemoryEntriesPerRecipient messages of each
+// recipient stay in memory; later mail (or any past the global memory cap) is
+// appended to a per-recipient spill file when a spill directory is configured,
+// and once a recipient has spilled everything after follows it there, so that
+// delivery order stays "memory first, then spill file".
+//
+// Only names that have logged in (addRecipient()) get a mailbox: mail to any
+// other name is refused as Unknown, so neither a typo nor a made-up name costs
+// memory or a file. The number of mailboxes and the bytes in spill files are
+// capped for the whole mailbox; past either, mail is refused as Full. Known
+// names are also appended to known.list in the spill directory, one hex-encoded
+// UTF-8 name per line, so that users keep their mailbox across a restart.
+//
+// Spill file layout (QDataStream, big endian): a header of quint32 magic and
+// quint16 version, then one record per message: qint64 time (ms since epoch)
+// followed by the encoded line as a length-prefixed QByteArray. Records are only
+// ever appended; the file is removed once the recipient's mail is delivered.
+class OfflineMailbox
+{
+public:
+    struct Limits {
+        int maxMessagesPerRecipient = 200;
+        qint64 maxAgeMs = 7LL * 24 * 60 * 60 * 1000;
+        qint64 maxMemoryBytes = 16LL * 1024 * 1024;
+        int maxRecipients = 10000;
+        qint64 maxSpillBytes = 256LL * 1024 * 1024;
+    };
+
+    struct Stats {
+        quint64 queued = 0;
+        quint64 delivered = 0;
+        quint64 deliveryBursts = 0;
+        quint64 spilled = 0;
+        quint64 droppedFull = 0;
+        quint64 droppedExpired = 0;
+        quint64 unknown = 0; // refused: the name never logged in
+        int recipients = 0;
+        int pending = 0;
+        qint64 memoryBytes = 0;
+        qint64 spillBytes = 0;
+    };
+
+    enum class Result {
+        Queued,
+        Spilled,
+        Full,
+        Unknown,
+    };
+
+    explicit OfflineMailbox(const Limits &limits = Limits());
+
+    // `owns` limits which spill files left by a previous run are picked up,
+    // for when several mailboxes share one directory; empty takes all.
+    void setSpillDirectory(const QString &path, const std::function<bool(const QString &recipient)> &owns = {});
+    QString spillDirectory() const;
+
+    // A name that has logged in and can be sent mail from now on.
+    void addRecipient(const QString &recipient);
+    bool isKnown(const QString &recipient) const;
+
+    Result enqueue(const QString &recipient, const QByteArray &line, qint64 nowMs);
+    QList<QByteArray> take(const QString &recipient, qint64 nowMs);
+    bool hasMail(const QString &recipient) const;
+    void expire(qint64 nowMs);
+    void clear();
+
+    // Server handover: the mail held in memory plus how much each recipient
+    // has spilled, for a successor sharing the spill directory. import adds to
+    // what is already there.
+    QJsonArray exportBoxes() const;
+    void importBoxes(const QJsonArray &boxes);
+    QJsonArray exportRecipients() const;
+    void importRecipients(const QJsonArray &recipients);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        qint64 timeMs = 0;
+        QByteArray line;
+    };
+
+    struct Box {
+        QList<Entry> memory;
+        int spilledCount = 0;
+        qint64 spillBytes = 0;
+    };
+
+    static constexpr int kMemoryEntriesPerRecipient = 32;
+
+    QString spillPath(const QString &recipient) const;
+    QString knownPath() const;
+    // Bytes appended, 0 if it could not be written.
+    qint64 appendToSpill(const QString &recipient, const Entry &entry);
+    QList<Entry> readSpill(const QString &recipient) const;
+    void removeSpill(const QString &recipient) const;
+
+    Limits m_limits;
+    QString m_spillDir;
+    QHash<QString, Box> m_boxes;
+    QSet<QString> m_known;
+    Stats m_stats;
+};
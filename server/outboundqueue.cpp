@@ -0,0 +1,231 @@
+#include "outboundqueue.h"
+
+#include <utility>
+
+namespace {
+
+// Relative share of each class per round, in kQuantum units.
+constexpr qint64 kWeights[OutboundStats::ClassCount] = {8, 4, 2, 1};
+
+void raiseTo(QAtomicInteger<qint64> &max, qint64 value)
+{
+    qint64 seen = max.loadRelaxed();
+    while (value > seen && !max.testAndSetRelaxed(seen, value, seen)) {
+    }
+}
+
+// The "type" of the outermost object. Keys come sorted, so the nested
+// messages of a search_result or history_result come before it; only a key at
+// depth one counts. Strings are skipped whole, so quotes and brackets in a
+// chat text cannot throw the depth off.
+QByteArray typeOf(const QByteArray &line)
+{
+    static const QByteArray key = "\"type\":\"";
+    const char *const data = line.constData();
+    const qsizetype size = line.size();
+    int depth = 0;
+    for (qsizetype i = 0; i < size; ++i) {
+        switch (data[i]) {
+        case '"':
+            if (depth == 1 && QByteArrayView(data + i, size - i).startsWith(key)) {
+                const auto from = i + key.size();
+                const auto end = line.indexOf('"', from);
+                return end < 0 ? QByteArray() : line.mid(from, end - from);
+            }
+            for (++i; i < size && data[i] != '"'; ++i) {
+                if (data[i] == '\\') {
+                    ++i;
+                }
+            }
+            break;
+        case '{':
+        case '[':
+            ++depth;
+            break;
+        case '}':
+        case ']':
+            --depth;
+            break;
+        default:
+            break;
+        }
+    }
+    return QByteArray();
+}
+
+} // namespace
+
+const char *OutboundStats::className(Class c)
+{
+    switch (c) {
+    case Control:
+        return "control";
+    case Private:
+        return "private";
+    case Chat:
+        return "chat";
+    case Bulk:
+        return "bulk";
+    case ClassCount:
+        break;
+    }
+    return "";
+}
+
+void OutboundStats::recordQueued(Class c, qint64 connectionDepth)
+{
+    m_counters[c].queued.fetchAndAddRelaxed(1);
+    raiseTo(m_counters[c].maxQueued, connectionDepth);
+}
+
+void OutboundStats::recordSent(Class c, qint64 bytes, qint64 waitNs)
+{
+    Counters &counters = m_counters[c];
+    counters.queued.fetchAndSubRelaxed(1);
+    counters.lines.fetchAndAddRelaxed(1);
+    counters.bytes.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+    counters.totalWaitNs.fetchAndAddRelaxed(waitNs);
+    raiseTo(counters.maxWaitNs, waitNs);
+}
+
+void OutboundStats::recordDropped(Class c, qint64 count, bool superseded)
+{
+    m_counters[c].queued.fetchAndSubRelaxed(count);
+    if (superseded) {
+        m_counters[c].superseded.fetchAndAddRelaxed(static_cast<quint64>(count));
+    }
+}
+
+OutboundStats::ClassStats OutboundStats::stats(Class c) const
+{
+    const Counters &counters = m_counters[c];
+    ClassStats s;
+    s.queued = counters.queued.loadRelaxed();
+    s.maxQueued = counters.maxQueued.loadRelaxed();
+    s.lines = counters.lines.loadRelaxed();
+    s.bytes = counters.bytes.loadRelaxed();
+    s.superseded = counters.superseded.loadRelaxed();
+    s.totalWaitNs = counters.totalWaitNs.loadRelaxed();
+    s.maxWaitNs = counters.maxWaitNs.loadRelaxed();
+    return s;
+}
+
+OutboundQueue::OutboundQueue(OutboundStats *stats)
+    : m_stats(stats)
+{
+}
+
+OutboundQueue::~OutboundQueue()
+{
+    clear();
+}
+
+OutboundStats::Class OutboundQueue::classify(const QByteArray &line)
+{
+    const QByteArray type = typeOf(line);
+    if (type == "chat") {
+        return line.contains("\"scope\":\"private\"") ? OutboundStats::Private : OutboundStats::Chat;
+    }
+    if (type == "offline") {
+        return OutboundStats::Private;
+    }
+    if (type == "system") {
+        return OutboundStats::Chat;
+    }
+    if (type == "user_list" || type == "search_result" || type == "history_result") {
+        return OutboundStats::Bulk;
+    }
+    return OutboundStats::Control;
+}
+
+void OutboundQueue::push(QByteArray line, qint64 nowNs)
+{
+    const OutboundStats::Class c = classify(line);
+    QList<Entry> &queue = m_queues[c];
+
+    // Presence is a snapshot: only the newest one is worth sending.
+    if (c == OutboundStats::Bulk && !queue.isEmpty()) {
+        const auto before = queue.size();
+        queue.removeIf([this](const Entry &entry) {
+            if (typeOf(entry.line) != "user_list") {
+                return false;
+            }
+            m_bytes -= entry.line.size();
+            return true;
+        });
+        const auto removed = before - queue.size();
+        m_size -= removed;
+        if (m_stats && removed > 0) {
+            m_stats->recordDropped(c, removed, true);
+        }
+    }
+
+    m_bytes += line.size();
+    queue.push_back(Entry{std::move(line), nowNs});
+    ++m_size;
+    if (m_stats) {
+        m_stats->recordQueued(c, queue.size());
+    }
+}
+
+bool OutboundQueue::pop(QByteArray *line, qint64 nowNs)
+{
+    if (m_size == 0) {
+        return false;
+    }
+
+    while (true) {
+        QList<Entry> &queue = m_queues[m_current];
+        if (queue.isEmpty()) {
+            m_deficit[m_current] = 0;
+        } else {
+            if (!m_turnStarted) {
+                m_deficit[m_current] += kWeights[m_current] * kQuantum;
+                m_turnStarted = true;
+            }
+            const qint64 size = queue.constFirst().line.size();
+            if (size <= m_deficit[m_current]) {
+                Entry entry = queue.takeFirst();
+                --m_size;
+                m_bytes -= size;
+                m_deficit[m_current] = queue.isEmpty() ? 0 : m_deficit[m_current] - size;
+                if (m_stats) {
+                    m_stats->recordSent(static_cast<OutboundStats::Class>(m_current), size, nowNs - entry.enqueuedNs);
+                }
+                *line = std::move(entry.line);
+                return true;
+            }
+        }
+        // A line larger than one turn's credit carries the deficit into the
+        // next round, so it goes out after a few.
+        m_current = (m_current + 1) % OutboundStats::ClassCount;
+        m_turnStarted = false;
+    }
+}
+
+QList<QByteArray> OutboundQueue::lines() const
+{
+    QList<QByteArray> all;
+    all.reserve(m_size);
+    for (const auto &queue : m_queues) {
+        for (const auto &entry : queue) {
+            all.push_back(entry.line);
+        }
+    }
+    return all;
+}
+
+void OutboundQueue::clear()
+{
+    for (int c = 0; c < OutboundStats::ClassCount; ++c) {
+        if (m_stats && !m_queues[c].isEmpty()) {
+            m_stats->recordDropped(static_cast<OutboundStats::Class>(c), m_queues[c].size(), false);
+        }
+        m_queues[c].clear();
+        m_deficit[c] = 0;
+    }
+    m_size = 0;
+    m_bytes = 0;
+    m_current = 0;
+    m_turnStarted = false;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QList>
+
+// Counters of every connection's OutboundQueue, per class, as the window
+// shows them.
+class OutboundStats
+{
+public:
+    enum Class : quint8 {
+        Control, // replies to the client's own requests: login_ok, error, pong, file_*
+        Private, // private messages and offline mail
+        Chat,    // broadcasts and system notices
+        Bulk,    // presence snapshots, search results, history pages: large and can wait
+        ClassCount,
+    };
+
+    struct ClassStats {
+        qint64 queued = 0;
+        qint64 maxQueued = 0;
+        quint64 lines = 0;
+        quint64 bytes = 0;
+        quint64 superseded = 0;
+        qint64 totalWaitNs = 0;
+        qint64 maxWaitNs = 0;
+    };
+
+    static const char *className(Class c);
+
+    void recordQueued(Class c, qint64 connectionDepth);
+    void recordSent(Class c, qint64 bytes, qint64 waitNs);
+    void recordDropped(Class c, qint64 count, bool superseded);
+    ClassStats stats(Class c) const;
+
+private:
+    struct Counters {
+        QAtomicInteger<qint64> queued;
+        QAtomicInteger<qint64> maxQueued;
+        QAtomicInteger<quint64> lines;
+        QAtomicInteger<quint64> bytes;
+        QAtomicInteger<quint64> superseded;
+        QAtomicInteger<qint64> totalWaitNs;
+        QAtomicInteger<qint64> maxWaitNs;
+    };
+
+    Counters m_counters[ClassCount];
+};
+
+// Lines waiting to be written to one connection, in priority classes drained
+// by deficit round robin: each turn a class may send up to its weight times
+// kQuantum bytes, so replies and private messages overtake a backlog of
+// broadcasts and snapshots without starving them. A newer presence snapshot
+// replaces one that has not been sent yet. Owned by the connection's worker;
+// not thread-safe.
+class OutboundQueue
+{
+public:
+    static constexpr qint64 kQuantum = 4096;
+
+    explicit OutboundQueue(OutboundStats *stats = nullptr);
+    ~OutboundQueue();
+
+    // Class of an encoded server line, from its first "type" field (top-level
+    // in every line the server builds).
+    static OutboundStats::Class classify(const QByteArray &line);
+
+    void push(QByteArray line, qint64 nowNs);
+    bool pop(QByteArray *line, qint64 nowNs);
+    bool isEmpty() const { return m_size == 0; }
+    // Bytes of every queued line.
+    qint64 bytes() const { return m_bytes; }
+    void clear();
+    // Every queued line, most urgent class first, in order within a class.
+    QList<QByteArray> lines() const;
+
+private:
+    struct Entry {
+        QByteArray line;
+        qint64 enqueuedNs = 0;
+    };
+
+    OutboundStats *const m_stats;
+    QList<Entry> m_queues[OutboundStats::ClassCount];
+    qint64 m_deficit[OutboundStats::ClassCount] = {};
+    int m_current = 0;
+    bool m_turnStarted = false;
+    qsizetype m_size = 0;
+    qint64 m_bytes = 0;
+};
@@ -0,0 +1,166 @@
+#include "overloadcontroller.h"
+
+#include <cmath>
+
+namespace {
+
+// Limits besides the configured lag: the fullest ingress queue, and the
+// lines waiting in outbound queues (per connection, with a floor so a few
+// connections with a burst each do not count as overload).
+constexpr double kQueueFillLimit = 0.5;
+constexpr qint64 kBacklogPerConnection = 64;
+constexpr qint64 kBacklogFloor = 10000;
+
+// Under half of every limit for this long before each step down.
+constexpr qint64 kCoolDownMs = 2000;
+
+// Throttle: a connection may send this many times the average rate, and at
+// least kMinSenderCap lines per window.
+constexpr double kHeavyFactor = 4.0;
+constexpr int kMinSenderCap = 8;
+
+} // namespace
+
+const char *OverloadController::levelName(Level level)
+{
+    switch (level) {
+    case Normal:
+        return "normal";
+    case Quiet:
+        return "quiet";
+    case Coalesce:
+        return "coalesce";
+    case Shed:
+        return "shed";
+    case Throttle:
+        return "throttle";
+    case Closed:
+        return "closed";
+    case LevelCount:
+        break;
+    }
+    return "";
+}
+
+const char *OverloadController::measureName(Measure measure)
+{
+    switch (measure) {
+    case LogsSuppressed:
+        return "logs_suppressed";
+    case NoticesDropped:
+        return "notices_dropped";
+    case RequestsShed:
+        return "requests_shed";
+    case ReadsPaused:
+        return "reads_paused";
+    case LoginsRejected:
+        return "logins_rejected";
+    case MeasureCount:
+        break;
+    }
+    return "";
+}
+
+void OverloadController::setLagLimitMs(int ms)
+{
+    m_lagLimitMs = qMax(0, ms);
+    if (m_lagLimitMs == 0) {
+        m_level.storeRelaxed(Normal);
+    }
+}
+
+bool OverloadController::update(const Sample &sample, Transition *transition)
+{
+    if (m_lagLimitMs <= 0) {
+        return false;
+    }
+    // The first sample, or the first after the routers were restarted, only
+    // sets the baseline.
+    if (!m_primed || sample.dequeued < m_lastDequeued) {
+        m_primed = true;
+        m_lastNs = sample.nowNs;
+        m_lastDequeued = sample.dequeued;
+        m_lastWaitNs = sample.totalWaitNs;
+        return false;
+    }
+
+    const qint64 elapsedNs = qMax<qint64>(1, sample.nowNs - m_lastNs);
+    const quint64 events = sample.dequeued - m_lastDequeued;
+    const qint64 waitNs = sample.totalWaitNs - m_lastWaitNs;
+    m_lastNs = sample.nowNs;
+    m_lastDequeued = sample.dequeued;
+    m_lastWaitNs = sample.totalWaitNs;
+
+    const double queueWaitMs = events > 0 ? static_cast<double>(waitNs) / static_cast<double>(events) / 1e6 : 0.0;
+    m_lagMs = qMax(queueWaitMs, static_cast<double>(qMax(sample.oldestQueuedNs, sample.lateNs)) / 1e6);
+    m_queueFill = sample.queueFill;
+    m_backlog = sample.backlog;
+
+    const double windows = static_cast<double>(elapsedNs) / (kThrottleWindowMs * 1e6);
+    const double average = static_cast<double>(events) / windows / qMax(1, sample.connections);
+    m_senderCap.storeRelaxed(qMax(kMinSenderCap, static_cast<int>(std::ceil(kHeavyFactor * average))));
+
+    const qint64 backlogLimit = qMax(kBacklogFloor, kBacklogPerConnection * sample.connections);
+    const double fillPressure = m_queueFill / kQueueFillLimit;
+    const double lagPressure = m_lagMs / m_lagLimitMs;
+    const double backlogPressure = static_cast<double>(m_backlog) / static_cast<double>(backlogLimit);
+    const double pressure = qMax(fillPressure, qMax(lagPressure, backlogPressure));
+
+    const Level current = level();
+    Level next = current;
+    QString reason;
+    if (pressure >= 1.0) {
+        m_calmSinceNs = -1;
+        if (current < Closed) {
+            next = static_cast<Level>(current + 1);
+            if (pressure == fillPressure) {
+                reason = QString("ingress queue %1% full").arg(qRound(m_queueFill * 100));
+            } else if (pressure == lagPressure) {
+                reason = QString("lag %1 ms").arg(m_lagMs, 0, 'f', 1);
+            } else {
+                reason = QString("%1 line(s) waiting to be sent").arg(m_backlog);
+            }
+        }
+    } else if (pressure < 0.5 && current > Normal) {
+        if (m_calmSinceNs < 0) {
+            m_calmSinceNs = sample.nowNs;
+        } else if (sample.nowNs - m_calmSinceNs >= kCoolDownMs * 1000000) {
+            next = static_cast<Level>(current - 1);
+            m_calmSinceNs = sample.nowNs;
+            reason = QString("load under half the limits for %1 ms").arg(kCoolDownMs);
+        }
+    } else {
+        m_calmSinceNs = -1;
+    }
+
+    if (next == current) {
+        return false;
+    }
+    m_level.storeRelaxed(next);
+    ++m_transitions;
+    *transition = Transition{current, next, reason};
+    return true;
+}
+
+void OverloadController::reset()
+{
+    m_level.storeRelaxed(Normal);
+    m_primed = false;
+    m_calmSinceNs = -1;
+}
+
+OverloadController::Stats OverloadController::stats() const
+{
+    Stats s;
+    s.enabled = m_lagLimitMs > 0;
+    s.level = level();
+    s.transitions = m_transitions;
+    s.queueFill = m_queueFill;
+    s.lagMs = m_lagMs;
+    s.backlog = m_backlog;
+    s.senderCap = senderCap();
+    for (int m = 0; m < MeasureCount; ++m) {
+        s.measures[m] = m_measures[m].loadRelaxed();
+    }
+    return s;
+}
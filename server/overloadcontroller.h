@@ -0,0 +1,120 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QString>
+#include <QtGlobal>
+
+// Degrades the server step by step while it cannot keep up.
+//
+// ChatServer samples the load a few times a second: the fullest router
+// ingress queue, how long events waited in those queues since the last sample
+// (or, if worse, how long the oldest event still queued has been waiting, which
+// catches a router stuck in one long event, or how late the sample itself is,
+// the GUI thread's lag) and the lines waiting in the workers' outbound queues. While any of them is
+// over its limit the level goes up one step per sample; once all are under
+// half their limit for kCoolDownMs it comes down one step at a time. Each
+// level keeps the measures of the ones below it:
+//
+//   Quiet     no per-message log lines
+//   Coalesce  no join/leave notices, at most one user list per second
+//   Shed      search and new file transfers are refused as "busy"
+//   Throttle  a connection sending far more than the average is not read
+//             for the rest of the current window
+//   Closed    new logins are refused as "busy" (resumes still work)
+class OverloadController
+{
+public:
+    enum Level : int {
+        Normal,
+        Quiet,
+        Coalesce,
+        Shed,
+        Throttle,
+        Closed,
+        LevelCount,
+    };
+
+    // What the measures did, counted by whoever applied them.
+    enum Measure : quint8 {
+        LogsSuppressed,
+        NoticesDropped,
+        RequestsShed,
+        ReadsPaused,
+        LoginsRejected,
+        MeasureCount,
+    };
+
+    struct Sample {
+        qint64 nowNs = 0;
+        // Fullest router ingress queue, 0..1.
+        double queueFill = 0.0;
+        // Totals over all routers since they started.
+        quint64 dequeued = 0;
+        qint64 totalWaitNs = 0;
+        // Longest any router's oldest queued event has waited so far.
+        qint64 oldestQueuedNs = 0;
+        // How much later than planned this sample was taken.
+        qint64 lateNs = 0;
+        qint64 backlog = 0;
+        int connections = 0;
+    };
+
+    struct Transition {
+        Level from = Normal;
+        Level to = Normal;
+        QString reason;
+    };
+
+    struct Stats {
+        bool enabled = false;
+        Level level = Normal;
+        quint64 transitions = 0;
+        double queueFill = 0.0;
+        double lagMs = 0.0;
+        qint64 backlog = 0;
+        int senderCap = 0;
+        quint64 measures[MeasureCount] = {};
+    };
+
+    // Throttle counts each connection's lines in windows of this length.
+    static constexpr int kThrottleWindowMs = 250;
+
+    static const char *levelName(Level level);
+    static const char *measureName(Measure measure);
+
+    // Limit on the queue wait / GUI lag; 0 disables the controller (the level
+    // stays Normal).
+    void setLagLimitMs(int ms);
+
+    // GUI thread. True, with *transition, when the level changed.
+    bool update(const Sample &sample, Transition *transition);
+    // GUI thread, once the server stopped: back to Normal with no baseline.
+    void reset();
+
+    // Any thread.
+    Level level() const { return static_cast<Level>(m_level.loadRelaxed()); }
+    bool atLeast(Level level) const { return m_level.loadRelaxed() >= level; }
+    // Lines a connection may send per kThrottleWindowMs under Throttle.
+    int senderCap() const { return m_senderCap.loadRelaxed(); }
+    void count(Measure measure) { m_measures[measure].fetchAndAddRelaxed(1); }
+
+    // GUI thread.
+    Stats stats() const;
+
+private:
+    int m_lagLimitMs = 0;
+    QAtomicInteger<int> m_level;
+    QAtomicInteger<int> m_senderCap;
+    QAtomicInteger<quint64> m_measures[MeasureCount];
+
+    // Previous sample and the derived load; GUI thread only.
+    bool m_primed = false;
+    qint64 m_lastNs = 0;
+    quint64 m_lastDequeued = 0;
+    qint64 m_lastWaitNs = 0;
+    qint64 m_calmSinceNs = -1;
+    quint64 m_transitions = 0;
+    double m_queueFill = 0.0;
+    double m_lagMs = 0.0;
+    qint64 m_backlog = 0;
+};
@@ -0,0 +1,230 @@
+#include "routerthread.h"
+
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+#include <QEvent>
+
+#include <chrono>
+#include <utility>
+
+RouterThread::RouterThread(const RouterPolicy &policy, QObject *parent)
+    : QThread(parent)
+    , m_policy(policy)
+    , m_queue(static_cast<std::size_t>(qMax(2, policy.queueCapacity)))
+{
+    m_batch.reserve(qMax(1, m_policy.batchSize));
+}
+
+RouterThread::~RouterThread()
+{
+    shutdown();
+}
+
+void RouterThread::setHandler(Handler handler)
+{
+    m_handler = std::move(handler);
+}
+
+void RouterThread::setBatchDoneHandler(BatchDoneHandler handler)
+{
+    m_batchDone = std::move(handler);
+}
+
+void RouterThread::post(IngressEvent event)
+{
+    const qint64 enqueuedNs = event.enqueuedNs = nowNs();
+    if (!m_queue.tryPush(event)) {
+        m_fullWaits.fetch_add(1, std::memory_order_relaxed);
+        do {
+            wake();
+            QThread::yieldCurrentThread();
+        } while (!m_queue.tryPush(event));
+    }
+    noteQueued(enqueuedNs);
+    wakeIfParked();
+}
+
+void RouterThread::forward(IngressEvent event)
+{
+    const qint64 enqueuedNs = event.enqueuedNs = nowNs();
+    m_forwarded.push(event);
+    noteQueued(enqueuedNs);
+    wakeIfParked();
+}
+
+int RouterThread::drainPending()
+{
+    int total = 0;
+    int n = 0;
+    while ((n = drainBatch(qMax(1, m_policy.batchSize))) > 0) {
+        total += n;
+    }
+    return total;
+}
+
+void RouterThread::shutdown()
+{
+    if (!isRunning()) {
+        return;
+    }
+    requestInterruption();
+    wake();
+    wait();
+}
+
+RouterThread::Stats RouterThread::stats() const
+{
+    Stats s;
+    s.depth = static_cast<qint64>(m_queue.sizeApprox());
+    s.maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+    s.capacity = static_cast<qint64>(m_queue.capacity());
+    s.dequeued = m_dequeued.load(std::memory_order_relaxed);
+    s.forwarded = m_forwardedCount.load(std::memory_order_relaxed);
+    s.batches = m_batches.load(std::memory_order_relaxed);
+    s.parks = m_parks.load(std::memory_order_relaxed);
+    s.wakeups = m_wakeups.load(std::memory_order_relaxed);
+    s.fullWaits = m_fullWaits.load(std::memory_order_relaxed);
+    s.totalWaitNs = m_totalWaitNs.load(std::memory_order_relaxed);
+    s.maxWaitNs = m_maxWaitNs.load(std::memory_order_relaxed);
+    s.oldestQueuedNs = m_oldestQueuedNs.load(std::memory_order_relaxed);
+    return s;
+}
+
+qint64 RouterThread::nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RouterThread::run()
+{
+    QAbstractEventDispatcher *dispatcher = eventDispatcher();
+    int idleRounds = 0;
+
+    while (!isInterruptionRequested()) {
+        if (drainBatch(qMax(1, m_policy.batchSize)) > 0) {
+            idleRounds = 0;
+            dispatcher->processEvents(QEventLoop::AllEvents);
+            continue;
+        }
+
+        if (idleRounds < m_policy.spinRounds) {
+            ++idleRounds;
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        idleRounds = 0;
+
+        // There is no QEventLoop on this thread, so deleteLater() is only
+        // honoured when asked for explicitly.
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+
+        m_parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (isIdle() && !isInterruptionRequested()) {
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+            dispatcher->processEvents(QEventLoop::AllEvents | QEventLoop::WaitForMoreEvents);
+        }
+        m_parked.store(false, std::memory_order_relaxed);
+    }
+
+    // Let pending cross-thread calls (e.g. a blocking shutdown) complete.
+    dispatcher->processEvents(QEventLoop::AllEvents);
+    drainPending();
+}
+
+int RouterThread::drainBatch(int maxEvents)
+{
+    // Up to half the batch comes from other routers, the rest from client
+    // input, and any room left goes back to router events; neither side can
+    // starve the other.
+    IngressEvent event;
+    qsizetype forwarded = 0;
+    const qsizetype forwardShare = qMax(1, maxEvents / 2);
+    while (m_batch.size() < forwardShare && m_forwarded.tryPop(event)) {
+        m_batch.push_back(std::move(event));
+        ++forwarded;
+    }
+    while (m_batch.size() < maxEvents && m_queue.tryPop(event)) {
+        m_batch.push_back(std::move(event));
+    }
+    while (m_batch.size() < maxEvents && m_forwarded.tryPop(event)) {
+        m_batch.push_back(std::move(event));
+        ++forwarded;
+    }
+    // Whatever is left behind this batch waits at least until it is done.
+    const IngressEvent *input = m_queue.peek();
+    const IngressEvent *other = m_forwarded.peek();
+    qint64 oldest = input ? input->enqueuedNs : 0;
+    if (other && (oldest == 0 || other->enqueuedNs < oldest)) {
+        oldest = other->enqueuedNs;
+    }
+    m_oldestQueuedNs.store(oldest, std::memory_order_relaxed);
+    if (m_batch.isEmpty()) {
+        return 0;
+    }
+
+    const qint64 now = nowNs();
+    const qint64 depth = static_cast<qint64>(m_batch.size() - forwarded + m_queue.sizeApprox());
+    if (depth > m_maxDepth.load(std::memory_order_relaxed)) {
+        m_maxDepth.store(depth, std::memory_order_relaxed);
+    }
+
+    qint64 waitSum = 0;
+    qint64 waitMax = m_maxWaitNs.load(std::memory_order_relaxed);
+    for (const auto &e : std::as_const(m_batch)) {
+        const qint64 wait = qMax<qint64>(0, now - e.enqueuedNs);
+        waitSum += wait;
+        waitMax = qMax(waitMax, wait);
+    }
+    m_totalWaitNs.fetch_add(waitSum, std::memory_order_relaxed);
+    m_maxWaitNs.store(waitMax, std::memory_order_relaxed);
+    m_dequeued.fetch_add(static_cast<quint64>(m_batch.size()), std::memory_order_relaxed);
+    m_forwardedCount.fetch_add(static_cast<quint64>(forwarded), std::memory_order_relaxed);
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+
+    const int n = static_cast<int>(m_batch.size());
+    if (m_handler) {
+        for (auto &e : m_batch) {
+            m_handler(e);
+        }
+    }
+    m_batch.clear();
+    if (m_batchDone) {
+        m_batchDone();
+    }
+    return n;
+}
+
+void RouterThread::noteQueued(qint64 enqueuedNs)
+{
+    // Only the first event behind a queue the router last saw empty sets the
+    // mark; one pushed while the router clears it is picked up by its next
+    // batch, which is not stuck.
+    if (m_oldestQueuedNs.load(std::memory_order_relaxed) == 0) {
+        qint64 expected = 0;
+        m_oldestQueuedNs.compare_exchange_strong(expected, enqueuedNs, std::memory_order_relaxed);
+    }
+}
+
+bool RouterThread::isIdle() const
+{
+    return m_forwarded.isEmpty() && m_queue.isEmptyApprox();
+}
+
+void RouterThread::wakeIfParked()
+{
+    // Pairs with the fence in run(): either the router sees the event before
+    // parking, or this thread sees it parked and wakes it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_parked.load(std::memory_order_relaxed) && m_parked.exchange(false)) {
+        m_wakeups.fetch_add(1, std::memory_order_relaxed);
+        wake();
+    }
+}
+
+void RouterThread::wake()
+{
+    if (QAbstractEventDispatcher *dispatcher = eventDispatcher()) {
+        dispatcher->wakeUp();
+    }
+}
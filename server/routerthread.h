@@ -0,0 +1,160 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+#include <atomic>
+#include <functional>
+
+#include "mpscqueue.h"
+
+class ClientWorker;
+
+// One unit of work for a router. Workers push client input straight into the
+// router's queue from their own threads instead of emitting queued signals;
+// routers use the same events to talk to each other.
+struct IngressEvent {
+    enum class Kind : quint8 {
+        // From the accept loop and client workers.
+        Attach,       // new connection (or one taken over, logged in as `name` if set); worker and thread are handed to the router
+        Line,         // one protocol line, without the trailing '\n'
+        Disconnected, // socket closed or never came up
+        Handoff,      // login/resume in `line` belongs on `shard`; move the connection there
+        FileUploaded, // last byte of file `line` is on disk
+
+        // Between routers.
+        Adopt,              // connection moved here, with the line that triggered the move
+        Publish,            // to the coordinator: broadcast `line` to every session
+        Broadcast,          // from the coordinator: deliver `line` to local sessions
+        Join,               // to the coordinator: `name` logged in
+        Leave,              // to the coordinator: `name` is gone
+        UserList,           // from the coordinator: presence snapshot in `line`
+        Private,            // to the recipient's router: `line` from `name` to `peer`
+        PrivateResult,      // back to the sender's router; `code` is the outcome
+        PrivateGroup,       // to a recipients' router: `line` from `name` to its `names`, request `code`
+        PrivateGroupResult, // back to the sender's router: one outcome byte per `names` in `line`
+
+        // With the search thread.
+        Index,        // to search: broadcast text `line` from `name`
+        IndexPrivate, // to search: private message `line`, as sent, from `name`, stored for `names`
+        Search,       // to search: request `line` by `name`, answer to router `shard`
+        SearchResult, // back to the router: reply `line` for `clientId`, if still `name`
+    };
+
+    Kind kind = Kind::Line;
+    quint64 clientId = 0;
+    QByteArray line;
+    QString name;
+    QString peer;
+    QStringList names;
+    ClientWorker *worker = nullptr;
+    QThread *thread = nullptr;
+    // Line/Disconnected: router the connection is moving to, -1 if none.
+    // Handoff: destination router.
+    int shard = -1;
+    int code = 0;
+    qint64 enqueuedNs = 0;
+};
+
+struct RouterPolicy {
+    int queueCapacity = 16384;
+    // Events handled per drain before the thread looks at its own Qt events
+    // (timers, cross-thread calls).
+    int batchSize = 64;
+    // Empty polls (each a yield) before the thread parks in the event
+    // dispatcher; 0 parks as soon as the queue is empty.
+    int spinRounds = 2000;
+};
+
+// Runs one router: drains a bounded lock-free MPSC queue of client input and an
+// unbounded one of router-to-router events in batches, spinning briefly when
+// both run dry and then parking until a producer wakes it. Objects moved to
+// this thread still get timers and queued/blocking calls; they are dispatched
+// between batches and while parked.
+class RouterThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    using Handler = std::function<void(IngressEvent &event)>;
+    using BatchDoneHandler = std::function<void()>;
+
+    struct Stats {
+        qint64 depth = 0;
+        qint64 maxDepth = 0;
+        qint64 capacity = 0;
+        quint64 dequeued = 0;
+        quint64 forwarded = 0;
+        quint64 batches = 0;
+        quint64 parks = 0;
+        quint64 wakeups = 0;
+        quint64 fullWaits = 0;
+        qint64 totalWaitNs = 0;
+        qint64 maxWaitNs = 0;
+        // nowNs() when the oldest event still queued was queued; 0 if none.
+        // Grows old while the router is stuck in one long event, when nothing
+        // is dequeued and totalWaitNs stands still.
+        qint64 oldestQueuedNs = 0;
+    };
+
+    explicit RouterThread(const RouterPolicy &policy = RouterPolicy(), QObject *parent = nullptr);
+    ~RouterThread() override;
+
+    // Must be set before start(). The batch-done handler runs after every
+    // non-empty batch, e.g. to coalesce work across the events in it.
+    void setHandler(Handler handler);
+    void setBatchDoneHandler(BatchDoneHandler handler);
+
+    // Any thread. Never drops: when the queue is full the producer yields until
+    // the router catches up, which pushes back on that connection's socket.
+    void post(IngressEvent event);
+
+    // From other routers. Unbounded, never blocks.
+    void forward(IngressEvent event);
+
+    // Router thread only: handles everything queued so far, regardless of the
+    // batch size. Used on shutdown so no Attach event is left behind.
+    int drainPending();
+
+    // Stops the loop after the current batch and joins the thread.
+    void shutdown();
+
+    Stats stats() const;
+
+    static qint64 nowNs();
+
+protected:
+    void run() override;
+
+private:
+    int drainBatch(int maxEvents);
+    bool isIdle() const;
+    void noteQueued(qint64 enqueuedNs);
+    void wakeIfParked();
+    void wake();
+
+    const RouterPolicy m_policy;
+    Handler m_handler;
+    BatchDoneHandler m_batchDone;
+    MpscQueue<IngressEvent> m_queue;
+    MpscList<IngressEvent> m_forwarded;
+    QList<IngressEvent> m_batch;
+    std::atomic<bool> m_parked{false};
+
+    // Written by the router thread only, except wakeups/fullWaits.
+    std::atomic<quint64> m_dequeued{0};
+    std::atomic<quint64> m_forwardedCount{0};
+    std::atomic<quint64> m_batches{0};
+    std::atomic<quint64> m_parks{0};
+    std::atomic<quint64> m_wakeups{0};
+    std::atomic<quint64> m_fullWaits{0};
+    std::atomic<qint64> m_maxDepth{0};
+    std::atomic<qint64> m_totalWaitNs{0};
+    std::atomic<qint64> m_maxWaitNs{0};
+    // Set by a producer when it is 0, moved on by the router after each batch
+    // to the older of its two queue heads.
+    std::atomic<qint64> m_oldestQueuedNs{0};
+};
@@ -0,0 +1,443 @@
+#include "searchindex.h"
+
+#include <QSet>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Longer "words" (hashes, base64, URLs) are indexed by their first part.
+constexpr int kMaxWordLength = 32;
+
+bool isCjk(char32_t c)
+{
+    return (c >= 0x3040 && c <= 0x30ff)     // Hiragana, Katakana
+        || (c >= 0x3400 && c <= 0x4dbf)     // CJK Extension A
+        || (c >= 0x4e00 && c <= 0x9fff)     // CJK Unified Ideographs
+        || (c >= 0xac00 && c <= 0xd7af)     // Hangul syllables
+        || (c >= 0xf900 && c <= 0xfaff)     // CJK Compatibility Ideographs
+        || (c >= 0x20000 && c <= 0x2ffff);  // CJK Extensions B and later
+}
+
+struct Run {
+    QList<char32_t> chars; // lowercased
+    bool cjk = false;
+};
+
+// Splits text into runs of word characters, separating CJK from the rest.
+QList<Run> splitRuns(const QString &text)
+{
+    QList<Run> runs;
+    Run current;
+    const auto flush = [&]() {
+        if (!current.chars.isEmpty()) {
+            runs.push_back(std::move(current));
+        }
+        current = Run();
+    };
+
+    for (const char32_t c : text.toUcs4()) {
+        const bool cjk = isCjk(c);
+        if (!cjk && !QChar::isLetterOrNumber(c)) {
+            flush();
+            continue;
+        }
+        if (!current.chars.isEmpty() && cjk != current.cjk) {
+            flush();
+        }
+        current.cjk = cjk;
+        if (cjk || current.chars.size() < kMaxWordLength) {
+            current.chars.push_back(QChar::toLower(c));
+        }
+    }
+    flush();
+    return runs;
+}
+
+QString fromChars(const Run &run, qsizetype from, qsizetype count)
+{
+    return QString::fromUcs4(run.chars.constData() + from, count);
+}
+
+// Terms to look up for a query, and the CJK runs a candidate must contain
+// literally (pairs alone do not prove the run is contiguous).
+void queryTerms(const QString &text, QStringList *terms, QStringList *verify)
+{
+    QSet<QString> seen;
+    const auto add = [&](const QString &term) {
+        if (!seen.contains(term)) {
+            seen.insert(term);
+            terms->push_back(term);
+        }
+    };
+
+    for (const Run &run : splitRuns(text)) {
+        if (!run.cjk) {
+            add(fromChars(run, 0, run.chars.size()));
+            continue;
+        }
+        if (run.chars.size() == 1) {
+            add(fromChars(run, 0, 1));
+            continue;
+        }
+        for (qsizetype i = 0; i + 1 < run.chars.size(); ++i) {
+            add(fromChars(run, i, 2));
+        }
+        if (run.chars.size() > 2) {
+            verify->push_back(fromChars(run, 0, run.chars.size()));
+        }
+    }
+}
+
+} // namespace
+
+void SearchIndex::PostingList::append(quint32 doc)
+{
+    if (count % kBlockSize == 0) {
+        skips.push_back(Skip{doc, static_cast<quint32>(data.size())});
+    } else {
+        quint32 delta = doc - lastDoc;
+        while (delta >= 0x80) {
+            data.append(static_cast<char>((delta & 0x7f) | 0x80));
+            delta >>= 7;
+        }
+        data.append(static_cast<char>(delta));
+    }
+    lastDoc = doc;
+    ++count;
+}
+
+int SearchIndex::PostingList::decodeBlock(int b, quint32 *out) const
+{
+    const qsizetype end = b + 1 < skips.size() ? skips.at(b + 1).offset : data.size();
+    const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+    qsizetype pos = skips.at(b).offset;
+    quint32 doc = skips.at(b).firstDoc;
+
+    int n = 0;
+    out[n++] = doc;
+    while (pos < end) {
+        quint32 delta = 0;
+        int shift = 0;
+        uchar byte = 0;
+        do {
+            byte = bytes[pos++];
+            delta |= static_cast<quint32>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        doc += delta;
+        out[n++] = doc;
+    }
+    return n;
+}
+
+SearchIndex::SearchIndex(qint64 maxMessages)
+    : m_maxMessages(qMax<qint64>(1, maxMessages))
+{
+    m_names.push_back(QString()); // id 0: nobody (the "to" of a broadcast)
+}
+
+void SearchIndex::add(qint64 timeMs, const QString &from, const QStringList &to, const QString &text, bool group)
+{
+    const QByteArray utf8 = text.toUtf8();
+    if (static_cast<quint64>(m_text.size()) + static_cast<quint64>(utf8.size()) > std::numeric_limits<quint32>::max()) {
+        m_firstLive += static_cast<quint32>((m_docs.size() - m_firstLive) / 2);
+        compact();
+    }
+
+    const auto doc = static_cast<quint32>(m_docs.size());
+    Doc entry;
+    // Kept non-decreasing so a time range is a range of ids.
+    entry.timeMs = m_docs.isEmpty() ? timeMs : qMax(timeMs, m_docs.constLast().timeMs);
+    entry.from = nameId(from);
+    entry.toOffset = static_cast<quint32>(m_recipients.size());
+    entry.toCount = static_cast<quint16>(qMin<qsizetype>(to.size(), std::numeric_limits<quint16>::max()));
+    entry.group = group;
+    for (qsizetype i = 0; i < entry.toCount; ++i) {
+        m_recipients.push_back(nameId(to.at(i)));
+    }
+    entry.textOffset = static_cast<quint32>(m_text.size());
+    entry.textLength = static_cast<quint32>(utf8.size());
+    m_docs.push_back(entry);
+    m_text.append(utf8);
+
+    for (const auto &term : indexTerms(text)) {
+        PostingList &list = m_terms[term];
+        const qint64 before = list.data.size() + list.skips.size() * static_cast<qint64>(sizeof(Skip));
+        list.append(doc);
+        m_postingBytes += list.data.size() + list.skips.size() * static_cast<qint64>(sizeof(Skip)) - before;
+    }
+
+    if (m_docs.size() - m_firstLive > m_maxMessages) {
+        ++m_firstLive;
+        if (m_firstLive >= qMax<qint64>(1, m_maxMessages / 2)) {
+            compact();
+        }
+    }
+}
+
+SearchIndex::Result SearchIndex::search(const Query &query) const
+{
+    Result result;
+    QStringList terms;
+    QStringList verify;
+    queryTerms(query.text, &terms, &verify);
+    if (terms.isEmpty() || query.limit <= 0) {
+        result.valid = false;
+        return result;
+    }
+
+    quint32 fromId = 0;
+    if (!query.from.isEmpty()) {
+        const auto it = m_nameIds.constFind(query.from);
+        if (it == m_nameIds.constEnd()) {
+            return result;
+        }
+        fromId = it.value();
+    }
+    const quint32 viewerId = m_nameIds.value(query.viewer, 0);
+
+    QList<const PostingList *> lists;
+    for (const auto &term : std::as_const(terms)) {
+        const auto it = m_terms.constFind(term);
+        if (it == m_terms.constEnd()) {
+            return result;
+        }
+        lists.push_back(&it.value());
+    }
+    std::sort(lists.begin(), lists.end(), [](const PostingList *a, const PostingList *b) { return a->count < b->count; });
+
+    const quint32 lo = qMax(m_firstLive, query.sinceMs > 0 ? lowerBound(query.sinceMs) : 0u);
+    const quint32 hi = query.untilMs > 0 ? lowerBound(query.untilMs) : static_cast<quint32>(m_docs.size());
+    if (lo >= hi) {
+        return result;
+    }
+
+    // The other terms are probed in decreasing id order too, so each keeps
+    // its last decoded block.
+    struct Probe {
+        const PostingList *list = nullptr;
+        int block = -1;
+        int size = 0;
+        quint32 ids[kBlockSize];
+    };
+    std::vector<Probe> probes(lists.size() - 1);
+    for (qsizetype i = 1; i < lists.size(); ++i) {
+        probes[i - 1].list = lists.at(i);
+    }
+    const auto contains = [](Probe &probe, quint32 doc) {
+        const auto &skips = probe.list->skips;
+        const auto it = std::upper_bound(skips.cbegin(), skips.cend(), doc, [](quint32 d, const Skip &s) { return d < s.firstDoc; });
+        if (it == skips.cbegin()) {
+            return false;
+        }
+        const int block = static_cast<int>(it - skips.cbegin()) - 1;
+        if (block != probe.block) {
+            probe.size = probe.list->decodeBlock(block, probe.ids);
+            probe.block = block;
+        }
+        return std::binary_search(probe.ids, probe.ids + probe.size, doc);
+    };
+
+    const PostingList &driver = *lists.constFirst();
+    quint32 ids[kBlockSize];
+    int examined = 0;
+    for (auto b = driver.skips.size() - 1; b >= 0; --b) {
+        if (driver.skips.at(b).firstDoc >= hi) {
+            continue;
+        }
+        const int n = driver.decodeBlock(static_cast<int>(b), ids);
+        for (int i = n - 1; i >= 0; --i) {
+            const quint32 doc = ids[i];
+            if (doc >= hi) {
+                continue;
+            }
+            if (doc < lo) {
+                return result;
+            }
+            if (++examined > kMaxCandidates) {
+                result.truncated = true;
+                return result;
+            }
+
+            const Doc &entry = m_docs.at(doc);
+            if ((fromId != 0 && entry.from != fromId) || !isVisible(entry, viewerId)) {
+                continue;
+            }
+            if (!std::all_of(probes.begin(), probes.end(), [&](Probe &probe) { return contains(probe, doc); })) {
+                continue;
+            }
+
+            QString text = docText(entry);
+            if (!verify.isEmpty()) {
+                const QString lower = text.toLower();
+                if (!std::all_of(verify.cbegin(), verify.cend(), [&](const QString &run) { return lower.contains(run); })) {
+                    continue;
+                }
+            }
+
+            result.hits.push_back(hit(entry, std::move(text)));
+            if (result.hits.size() >= query.limit) {
+                return result;
+            }
+        }
+    }
+    return result;
+}
+
+SearchIndex::Result SearchIndex::history(const QString &viewer, qint64 sinceMs, quint64 after, int limit) const
+{
+    Result result;
+    if (limit <= 0) {
+        result.valid = false;
+        return result;
+    }
+    const quint32 viewerId = m_nameIds.value(viewer, 0);
+    const auto end = static_cast<quint32>(m_docs.size());
+    // A cursor into messages already dropped resumes at the oldest left.
+    quint32 first = lowerBound(sinceMs);
+    if (after > 0) {
+        first = after > m_dropped ? static_cast<quint32>(qMin<quint64>(after - m_dropped, end)) : 0;
+    }
+    for (quint32 doc = qMax(m_firstLive, first); doc < end; ++doc) {
+        const Doc &entry = m_docs.at(doc);
+        if (!isVisible(entry, viewerId)) {
+            continue;
+        }
+        if (result.hits.size() >= limit) {
+            result.truncated = true;
+            result.next = m_dropped + doc;
+            break;
+        }
+        result.hits.push_back(hit(entry, docText(entry)));
+    }
+    return result;
+}
+
+SearchIndex::Stats SearchIndex::stats() const
+{
+    Stats s;
+    s.messages = m_docs.size() - m_firstLive;
+    s.terms = m_terms.size();
+    s.postingBytes = m_postingBytes;
+    s.textBytes = m_text.size();
+    return s;
+}
+
+QStringList SearchIndex::indexTerms(const QString &text)
+{
+    QSet<QString> terms;
+    for (const Run &run : splitRuns(text)) {
+        if (!run.cjk) {
+            terms.insert(fromChars(run, 0, run.chars.size()));
+            continue;
+        }
+        for (qsizetype i = 0; i < run.chars.size(); ++i) {
+            terms.insert(fromChars(run, i, 1));
+            if (i + 1 < run.chars.size()) {
+                terms.insert(fromChars(run, i, 2));
+            }
+        }
+    }
+    return terms.values();
+}
+
+quint32 SearchIndex::nameId(const QString &name)
+{
+    const auto it = m_nameIds.constFind(name);
+    if (it != m_nameIds.constEnd()) {
+        return it.value();
+    }
+    const auto id = static_cast<quint32>(m_names.size());
+    m_names.push_back(name);
+    m_nameIds.insert(name, id);
+    return id;
+}
+
+QString SearchIndex::docText(const Doc &doc) const
+{
+    return QString::fromUtf8(m_text.constData() + doc.textOffset, doc.textLength);
+}
+
+bool SearchIndex::isVisible(const Doc &doc, quint32 viewerId) const
+{
+    if (doc.toCount == 0 || doc.from == viewerId) {
+        return true;
+    }
+    const quint32 *const to = m_recipients.constData() + doc.toOffset;
+    return std::find(to, to + doc.toCount, viewerId) != to + doc.toCount;
+}
+
+SearchIndex::Hit SearchIndex::hit(const Doc &doc, QString text) const
+{
+    Hit result{doc.timeMs, m_names.at(doc.from), QStringList(), std::move(text), doc.group};
+    result.to.reserve(doc.toCount);
+    for (quint32 i = 0; i < doc.toCount; ++i) {
+        result.to.push_back(m_names.at(m_recipients.at(doc.toOffset + i)));
+    }
+    return result;
+}
+
+quint32 SearchIndex::lowerBound(qint64 timeMs) const
+{
+    const auto it = std::lower_bound(m_docs.cbegin(), m_docs.cend(), timeMs, [](const Doc &doc, qint64 t) { return doc.timeMs < t; });
+    return static_cast<quint32>(it - m_docs.cbegin());
+}
+
+void SearchIndex::compact()
+{
+    // Drops everything before m_firstLive and renumbers the rest from 0.
+    const quint32 shift = m_firstLive;
+    if (shift == 0) {
+        return;
+    }
+
+    QHash<QString, PostingList> terms;
+    qint64 postingBytes = 0;
+    quint32 ids[kBlockSize];
+    for (auto it = m_terms.cbegin(); it != m_terms.cend(); ++it) {
+        const PostingList &old = it.value();
+        if (old.lastDoc < shift) {
+            continue;
+        }
+        PostingList fresh;
+        for (qsizetype b = 0; b < old.skips.size(); ++b) {
+            if (b + 1 < old.skips.size() && old.skips.at(b + 1).firstDoc <= shift) {
+                continue; // the whole block is older
+            }
+            const int n = old.decodeBlock(static_cast<int>(b), ids);
+            for (int i = 0; i < n; ++i) {
+                if (ids[i] >= shift) {
+                    fresh.append(ids[i] - shift);
+                }
+            }
+        }
+        postingBytes += fresh.data.size() + fresh.skips.size() * static_cast<qint64>(sizeof(Skip));
+        terms.insert(it.key(), std::move(fresh));
+    }
+    m_terms = std::move(terms);
+    m_postingBytes = postingBytes;
+
+    QList<Doc> docs;
+    docs.reserve(m_docs.size() - shift);
+    QByteArray text;
+    QList<quint32> recipients;
+    for (auto i = static_cast<qsizetype>(shift); i < m_docs.size(); ++i) {
+        Doc doc = m_docs.at(i);
+        const auto offset = static_cast<quint32>(text.size());
+        text.append(m_text.constData() + doc.textOffset, doc.textLength);
+        doc.textOffset = offset;
+        const auto toOffset = static_cast<quint32>(recipients.size());
+        recipients.append(m_recipients.mid(doc.toOffset, doc.toCount));
+        doc.toOffset = toOffset;
+        docs.push_back(doc);
+    }
+    m_docs = std::move(docs);
+    m_text = std::move(text);
+    m_recipients = std::move(recipients);
+    m_dropped += shift;
+    m_firstLive = 0;
+}
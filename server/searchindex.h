@@ -0,0 +1,126 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// In-memory inverted index over chat messages in arrival order. Latin words
+// and numbers are indexed lowercased; Chinese, Japanese and Korean text has no
+// spaces to split on, so every character and every pair of adjacent characters
+// is a term, and a query for a longer run probes its pairs and then checks the
+// candidate's text.
+//
+// A posting list is the ids of the messages containing a term, varint-encoded
+// as deltas in blocks of kBlockSize with one skip entry (first id, byte offset)
+// per block. A query walks its rarest term newest-first and probes the other
+// lists through their skip entries, so it touches a few blocks per candidate
+// rather than whole lists.
+//
+// Keeps the newest `maxMessages`; older ones are dropped in bulk once half as
+// many again have piled up. Not thread-safe: lives on the search thread.
+class SearchIndex
+{
+public:
+    struct Query {
+        QString text;
+        QString from;       // empty: anyone
+        QString viewer;     // private messages are only visible to their sender and recipients
+        qint64 sinceMs = 0; // inclusive, 0 for no bound
+        qint64 untilMs = 0; // exclusive, 0 for no bound
+        int limit = 20;
+    };
+
+    struct Hit {
+        qint64 timeMs = 0;
+        QString from;
+        QStringList to; // empty for a broadcast
+        QString text;
+        bool group = false; // sent to a list of recipients, as `to` is
+    };
+
+    struct Result {
+        QList<Hit> hits;
+        bool valid = true;      // false if the query has nothing to look up
+        bool truncated = false; // stopped after kMaxCandidates, older matches may exist
+        quint64 next = 0;       // history: cursor of the first message not returned
+    };
+
+    struct Stats {
+        qint64 messages = 0;
+        qint64 terms = 0;
+        qint64 postingBytes = 0;
+        qint64 textBytes = 0;
+    };
+
+    static constexpr int kBlockSize = 128;
+    static constexpr int kMaxCandidates = 200000;
+
+    explicit SearchIndex(qint64 maxMessages = 1000000);
+
+    // `to` is empty for a broadcast; `group` for a message sent to a list of
+    // recipients (of which `to` holds those who got it).
+    void add(qint64 timeMs, const QString &from, const QStringList &to, const QString &text, bool group = false);
+    Result search(const Query &query) const;
+    // Every message the viewer can see from `sinceMs` (inclusive) on, oldest
+    // first; truncated if more follow the first `limit`, and then `next` is
+    // where the following page starts. A non-zero `after` (a previous `next`)
+    // takes the place of `sinceMs`. For clients catching up on what arrived
+    // while they were away.
+    Result history(const QString &viewer, qint64 sinceMs, quint64 after, int limit) const;
+    Stats stats() const;
+
+    // Terms a message is indexed under (unique, in no particular order).
+    static QStringList indexTerms(const QString &text);
+
+private:
+    struct Skip {
+        quint32 firstDoc = 0;
+        quint32 offset = 0;
+    };
+
+    struct PostingList {
+        QByteArray data;
+        QList<Skip> skips;
+        quint32 count = 0;
+        quint32 lastDoc = 0;
+
+        void append(quint32 doc);
+        // Ids of block `b`, ascending; returns how many.
+        int decodeBlock(int b, quint32 *out) const;
+    };
+
+    struct Doc {
+        qint64 timeMs = 0;
+        quint32 from = 0;
+        quint32 toOffset = 0; // into m_recipients
+        quint16 toCount = 0;  // 0 for a broadcast
+        bool group = false;
+        quint32 textOffset = 0;
+        quint32 textLength = 0;
+    };
+
+    quint32 nameId(const QString &name);
+    QString docText(const Doc &doc) const;
+    bool isVisible(const Doc &doc, quint32 viewerId) const;
+    Hit hit(const Doc &doc, QString text) const;
+    quint32 lowerBound(qint64 timeMs) const;
+    void compact();
+
+    const qint64 m_maxMessages;
+    QList<Doc> m_docs;
+    // Index of the oldest message still searchable; everything before it is
+    // dropped at the next compaction.
+    quint32 m_firstLive = 0;
+    // Messages compacted away so far; a history cursor is a message's index
+    // plus this, so it stays put across compactions.
+    quint64 m_dropped = 0;
+    QByteArray m_text;
+    // Recipient name ids of private messages, a run per message.
+    QList<quint32> m_recipients;
+    QHash<QString, PostingList> m_terms;
+    qint64 m_postingBytes = 0;
+    QHash<QString, quint32> m_nameIds;
+    QStringList m_names;
+};
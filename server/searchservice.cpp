@@ -0,0 +1,183 @@
+#include "searchservice.h"
+
+#include "protocol.h"
+#include "routerthread.h"
+#include "shardmap.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QTimer>
+
+#include <utility>
+
+static qint64 parseTime(const QJsonValue &value)
+{
+    // Same format as the "time" of chat messages.
+    const QDateTime time = QDateTime::fromString(value.toString(), Qt::ISODate);
+    return time.isValid() ? time.toMSecsSinceEpoch() : 0;
+}
+
+static QJsonArray hitsToJson(const QList<SearchIndex::Hit> &hits)
+{
+    QJsonArray messages;
+    for (const auto &hit : hits) {
+        QJsonObject msg{
+            {"type", "chat"},
+            {"scope", hit.to.isEmpty() ? "broadcast" : "private"},
+            {"from", hit.from},
+            {"text", hit.text},
+            {"time", QDateTime::fromMSecsSinceEpoch(hit.timeMs).toString(Qt::ISODate)},
+        };
+        // A message to several recipients lists them, as it did when sent.
+        if (hit.group) {
+            msg.insert("to", QJsonArray::fromStringList(hit.to));
+        } else if (!hit.to.isEmpty()) {
+            msg.insert("to", hit.to.constFirst());
+        }
+        messages.append(msg);
+    }
+    return messages;
+}
+
+SearchService::SearchService(qint64 maxMessages, const ShardMap *shards, QObject *parent)
+    : QObject(parent)
+    , m_index(maxMessages)
+    , m_shards(shards)
+    , m_statsTimer(new QTimer(this))
+{
+    m_statsTimer->setInterval(500);
+    connect(m_statsTimer, &QTimer::timeout, this, &SearchService::publishStats);
+    publishStats();
+}
+
+void SearchService::handleEvent(IngressEvent &event)
+{
+    switch (event.kind) {
+    case IngressEvent::Kind::Index:
+        m_index.add(QDateTime::currentMSecsSinceEpoch(), event.name, QStringList(), QString::fromUtf8(event.line));
+        ++m_indexed;
+        break;
+    case IngressEvent::Kind::IndexPrivate: {
+        const QJsonObject msg = QJsonDocument::fromJson(event.line).object();
+        m_index.add(QDateTime::currentMSecsSinceEpoch(), event.name, event.names, msg.value("text").toString(), msg.value("to").isArray());
+        ++m_indexed;
+        break;
+    }
+    case IngressEvent::Kind::Search:
+        answer(event);
+        break;
+    default:
+        break;
+    }
+}
+
+QJsonObject SearchService::stats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_statsSnapshot;
+}
+
+void SearchService::start()
+{
+    m_statsTimer->start();
+}
+
+void SearchService::publishStats()
+{
+    const SearchIndex::Stats index = m_index.stats();
+    QJsonObject snapshot{
+        {"enabled", true},
+        {"messages", index.messages},
+        {"terms", index.terms},
+        {"posting_bytes", index.postingBytes},
+        {"text_bytes", index.textBytes},
+        {"indexed", static_cast<qint64>(m_indexed)},
+        {"queries", static_cast<qint64>(m_queries)},
+        {"avg_query_us", m_queries ? static_cast<double>(m_totalQueryNs) / static_cast<double>(m_queries) / 1e3 : 0.0},
+        {"max_query_us", static_cast<double>(m_maxQueryNs) / 1e3},
+        {"history_queries", static_cast<qint64>(m_historyQueries)},
+        {"history_messages", static_cast<qint64>(m_historyMessages)},
+    };
+
+    QMutexLocker locker(&m_statsMutex);
+    m_statsSnapshot = std::move(snapshot);
+}
+
+void SearchService::answer(IngressEvent &event)
+{
+    const QJsonObject request = QJsonDocument::fromJson(event.line).object();
+    if (request.value("type").toString() == "history") {
+        reply(event, answerHistory(event.name, request));
+        return;
+    }
+
+    SearchIndex::Query query;
+    query.text = Protocol::normalizeText(request.value("term").toString());
+    query.from = Protocol::normalizeName(request.value("from").toString());
+    query.viewer = event.name;
+    query.sinceMs = parseTime(request.value("since"));
+    query.untilMs = parseTime(request.value("until"));
+    query.limit = qBound(1, request.value("limit").toInt(20), kMaxResults);
+
+    QElapsedTimer timer;
+    timer.start();
+    const SearchIndex::Result result = m_index.search(query);
+    const qint64 ns = timer.nsecsElapsed();
+    ++m_queries;
+    m_totalQueryNs += ns;
+    m_maxQueryNs = qMax(m_maxQueryNs, ns);
+
+    QJsonObject answer{
+        {"type", "search_result"},
+        {"id", request.value("id")},
+        {"term", query.text},
+    };
+    if (!result.valid) {
+        answer.insert("error", "invalid_query");
+    } else {
+        answer.insert("messages", hitsToJson(result.hits));
+        answer.insert("truncated", result.truncated);
+        answer.insert("took_us", static_cast<double>(ns) / 1e3);
+    }
+    reply(event, answer);
+}
+
+QJsonObject SearchService::answerHistory(const QString &viewer, const QJsonObject &request)
+{
+    QJsonObject answer{
+        {"type", "history_result"},
+        {"id", request.value("id")},
+    };
+    // Without a starting point (a time, or the cursor a previous page handed
+    // out) there is nothing to catch up on.
+    const qint64 sinceMs = parseTime(request.value("since"));
+    const auto after = static_cast<quint64>(qMax(0.0, request.value("after").toDouble()));
+    if (sinceMs <= 0 && after == 0) {
+        answer.insert("error", "invalid_query");
+        return answer;
+    }
+
+    const SearchIndex::Result result = m_index.history(viewer, sinceMs, after, qBound(1, request.value("limit").toInt(kMaxHistory), kMaxHistory));
+    const QJsonArray messages = hitsToJson(result.hits);
+    ++m_historyQueries;
+    m_historyMessages += static_cast<quint64>(messages.size());
+    answer.insert("messages", messages);
+    answer.insert("more", result.truncated);
+    if (result.truncated) {
+        answer.insert("next", static_cast<double>(result.next));
+    }
+    return answer;
+}
+
+void SearchService::reply(const IngressEvent &event, const QJsonObject &answer)
+{
+    IngressEvent back;
+    back.kind = IngressEvent::Kind::SearchResult;
+    back.clientId = event.clientId;
+    back.name = event.name;
+    back.line = Protocol::toLine(answer);
+    m_shards->forward(event.shard, std::move(back));
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QMutex>
+#include <QObject>
+
+#include "searchindex.h"
+
+class QTimer;
+class ShardMap;
+struct IngressEvent;
+
+// Owns the SearchIndex on its own thread (a RouterThread fed by the routers),
+// so building the index and answering queries never hold up routing: routers
+// forward chat and private messages as they handle them and get each answer
+// back as a SearchResult event for the asking connection. "history" requests
+// (catching up from a point in time) are answered the same way.
+class SearchService : public QObject
+{
+    Q_OBJECT
+
+public:
+    SearchService(qint64 maxMessages, const ShardMap *shards, QObject *parent = nullptr);
+
+    // Search thread: handler installed on its RouterThread.
+    void handleEvent(IngressEvent &event);
+
+    // Any thread: state as of the last publish (every 500 ms).
+    QJsonObject stats() const;
+
+    static constexpr int kMaxResults = 100;
+    // Messages in one "history_result"; a client wanting more asks again
+    // "after" the `next` cursor it was given.
+    static constexpr int kMaxHistory = 500;
+
+public slots:
+    void start();
+
+private slots:
+    void publishStats();
+
+private:
+    void answer(IngressEvent &event);
+    QJsonObject answerHistory(const QString &viewer, const QJsonObject &request);
+    void reply(const IngressEvent &event, const QJsonObject &answer);
+
+    SearchIndex m_index;
+    const ShardMap *const m_shards;
+    QTimer *m_statsTimer = nullptr;
+
+    quint64 m_indexed = 0;
+    quint64 m_queries = 0;
+    qint64 m_totalQueryNs = 0;
+    qint64 m_maxQueryNs = 0;
+    quint64 m_historyQueries = 0;
+    quint64 m_historyMessages = 0;
+
+    mutable QMutex m_statsMutex;
+    QJsonObject m_statsSnapshot;
+};
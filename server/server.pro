@@ -3,15 +3,55 @@ QT += core gui widgets network
 CONFIG += c++17
 
 SOURCES += \
+    capturewriter.cpp \
+    chatrouter.cpp \
     chatserver.cpp \
+    clientregistry.cpp \
+    clienttransport.cpp \
     clientworker.cpp \
+    contentfilter.cpp \
+    envelope.cpp \
+    filespool.cpp \
+    handover.cpp \
     main.cpp \
-    serverwindow.cpp
+    memorybudget.cpp \
+    offlinemailbox.cpp \
+    outboundqueue.cpp \
+    overloadcontroller.cpp \
+    routerthread.cpp \
+    searchindex.cpp \
+    searchservice.cpp \
+    serverwindow.cpp \
+    spanrecorder.cpp \
+    tlscontext.cpp \
+    tracestats.cpp
 
 HEADERS += \
+    capturewriter.h \
+    chatrouter.h \
     chatserver.h \
+    clientregistry.h \
+    clienttransport.h \
     clientworker.h \
-    serverwindow.h
+    contentfilter.h \
+    envelope.h \
+    filespool.h \
+    handover.h \
+    memorybudget.h \
+    mpscqueue.h \
+    offlinemailbox.h \
+    outboundqueue.h \
+    overloadcontroller.h \
+    routerthread.h \
+    searchindex.h \
+    searchservice.h \
+    serverconfig.h \
+    servercontext.h \
+    serverwindow.h \
+    shardmap.h \
+    spanrecorder.h \
+    tlscontext.h \
+    tracestats.h
 
 FORMS += \
     serverwindow.ui
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QString>
+
+// Startup options shared by the window and the server core; filled from the
+// command line in main.cpp.
+struct ServerConfig {
+    // Directory for spilled offline mail; empty keeps the mailbox in memory.
+    QString mailboxDir;
+
+    // PEM certificate chain and private key; setting both switches every client
+    // connection to TLS.
+    QString tlsCertFile;
+    QString tlsKeyFile;
+
+    // Connections served at once; more are closed right after accept.
+    int maxClients = 100;
+
+    // Unix domain socket for clients on the same host (bots, collectors), in
+    // addition to TCP; never TLS. Empty disables it.
+    QString localSocketPath;
+
+    // Router shards (threads); 0 picks one per two cores, at most 16.
+    int routerShards = 0;
+
+    // Per-shard ingress queue: capacity (rounded up to a power of two), events
+    // per drain, and empty polls before the router thread parks.
+    int routerQueueCapacity = 16384;
+    int routerBatch = 64;
+    int routerSpin = 2000;
+
+    // File transfers: spool directory (empty disables them), the largest file
+    // accepted, and the per-transfer rate in bytes per second (0 = unlimited).
+    QString spoolDir;
+    qint64 maxFileSize = 64LL * 1024 * 1024;
+    qint64 transferRate = 0;
+
+    // Chat and private messages kept in the search index; 0 disables search.
+    qint64 searchHistory = 1000000;
+
+    // Record every received line into this file for chatreplay; empty disables
+    // capturing. The file is rewritten on each start.
+    QString captureFile;
+
+    // Record a timeline of the server threads (see SpanRecorder) and save the
+    // last profileWindowSeconds of it to this Chrome trace-event file, on
+    // demand and, if profileEverySeconds > 0, that often; empty disables it.
+    QString profileFile;
+    int profileWindowSeconds = 10;
+    int profileEverySeconds = 0;
+
+    // Banned terms for chat and private text (see ContentFilter), reloaded
+    // whenever the file changes; empty disables filtering. Terms outside an
+    // action section get filterAction: "mask", "reject" or "log".
+    QString filterFile;
+    QString filterAction = QStringLiteral("mask");
+
+    // Limit on the memory all connections hold together (see MemoryBudget), in
+    // bytes; 0 = no limit. Over it, the largest connections are dropped.
+    qint64 memoryBudget = 0;
+
+    // Overload control (see OverloadController): the router queue wait, in
+    // ms, above which the server starts degrading step by step; 0 disables it.
+    int overloadLagMs = 100;
+
+    // Client socket backend: "qt" or "epoll" (Linux, plain TCP only; see
+    // TransportContext).
+    QString transport = QStringLiteral("qt");
+
+    // Unix socket for upgrades: on startup the server takes over from one
+    // listening there, and while running it listens there for a successor.
+    // Empty disables handovers.
+    QString handoverPath;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+class CaptureWriter;
+class ContentFilter;
+class FileSpool;
+class MemoryBudget;
+class OutboundStats;
+class OverloadController;
+class QSemaphore;
+class ShardMap;
+class SpanRecorder;
+class TlsContext;
+class TraceStats;
+class TransportContext;
+
+// The server-wide objects the routers and workers work with. ChatServer owns
+// them and hands each ChatRouter and ClientWorker this struct once; a null
+// member is a feature not in use (chatsim leaves most of them null). Only
+// `shards` is always needed, and `connectionLimit` by the routers.
+struct ServerContext {
+    const ShardMap *shards = nullptr;
+    QSemaphore *connectionLimit = nullptr;
+    TlsContext *tls = nullptr;
+    FileSpool *spool = nullptr;
+    OutboundStats *outbound = nullptr;
+    CaptureWriter *capture = nullptr;
+    TraceStats *trace = nullptr;
+    TransportContext *transports = nullptr;
+    MemoryBudget *memory = nullptr;
+    OverloadController *overload = nullptr;
+    SpanRecorder *spans = nullptr;
+    ContentFilter *filter = nullptr;
+};
@@ -3,22 +3,45 @@
 
 #include "chatserver.h"
 
+#include <QCoreApplication>
 #include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QMessageBox>
+#include <QStatusBar>
+#include <QTimer>
 
-ServerWindow::ServerWindow(QWidget *parent)
+ServerWindow::ServerWindow(const ServerConfig &config, QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::ServerWindow)
-    , m_server(new ChatServer(this))
+    , m_server(new ChatServer(config, this))
+    , m_statsTimer(new QTimer(this))
 {
     ui->setupUi(this);
 
     connect(ui->pushButtonStartStop, &QPushButton::clicked, this, &ServerWindow::onStartStopClicked);
+    connect(ui->pushButtonProfile, &QPushButton::clicked, this, &ServerWindow::onSaveProfileClicked);
+    ui->pushButtonProfile->setVisible(!config.profileFile.isEmpty());
     connect(m_server, &ChatServer::log, this, &ServerWindow::onServerLog);
     connect(m_server, &ChatServer::usersChanged, this, &ServerWindow::onUsersChanged);
     connect(m_server, &ChatServer::runningChanged, this, &ServerWindow::onRunningChanged);
+    // The successor serves everyone now.
+    connect(m_server, &ChatServer::handedOver, qApp, &QCoreApplication::quit, Qt::QueuedConnection);
+
+    m_statsTimer->setInterval(1000);
+    connect(m_statsTimer, &QTimer::timeout, this, &ServerWindow::refreshStats);
+    m_statsTimer->start();
 
     setRunningUi(false);
+    refreshStats();
+
+    if (!config.handoverPath.isEmpty()) {
+        QTimer::singleShot(0, this, [this]() {
+            if (m_server->takeOver()) {
+                ui->spinBoxPort->setValue(m_server->serverPort());
+            }
+        });
+    }
 }
 
 ServerWindow::~ServerWindow()
@@ -39,6 +62,16 @@ void ServerWindow::onStartStopClicked()
     }
 }
 
+void ServerWindow::onSaveProfileClicked()
+{
+    QString error;
+    if (!m_server->saveProfile(&error)) {
+        QMessageBox::warning(this, tr("保存失败"), tr("无法保存时间线：%1").arg(error));
+        return;
+    }
+    statusBar()->showMessage(tr("时间线已保存"), 3000);
+}
+
 void ServerWindow::onServerLog(const QString &message)
 {
     ui->plainTextEditLog->appendPlainText(message);
@@ -54,6 +87,175 @@ void ServerWindow::onRunningChanged(bool running)
     setRunningUi(running);
 }
 
+void ServerWindow::refreshStats()
+{
+    const QJsonObject stats = m_server->stats();
+    const QJsonObject mail = stats.value("mailbox").toObject();
+
+    QStringList lines;
+    lines << tr("连接：%1    会话：%2")
+                 .arg(stats.value("connections").toInt())
+                 .arg(stats.value("sessions").toInt());
+    lines << tr("离线消息：待投递 %1（%2 人）  已投递 %3（%4 批）  落盘 %5（%6 MiB）  丢弃（满/过期）%7/%8  无此用户 %9")
+                 .arg(mail.value("pending").toInt())
+                 .arg(mail.value("recipients").toInt())
+                 .arg(mail.value("delivered").toInteger())
+                 .arg(mail.value("bursts").toInteger())
+                 .arg(mail.value("spilled").toInteger())
+                 .arg(static_cast<double>(mail.value("spill_bytes").toInteger()) / (1024 * 1024), 0, 'f', 1)
+                 .arg(mail.value("dropped_full").toInteger())
+                 .arg(mail.value("dropped_expired").toInteger())
+                 .arg(mail.value("unknown").toInteger());
+    const QJsonArray shards = stats.value("shards").toArray();
+    QStringList perShard;
+    for (const auto &shard : shards) {
+        perShard << QString::number(shard.toObject().value("sessions").toInt());
+    }
+    lines << tr("路由分片：%1  各分片会话 %2  分片间转发 %3")
+                 .arg(shards.size())
+                 .arg(perShard.join('/'))
+                 .arg(stats.value("ingress").toObject().value("forwarded").toInteger());
+    const QJsonObject ingress = stats.value("ingress").toObject();
+    lines << tr("接入队列：深度 %1（峰值 %2 / 容量 %3）  等待 平均 %4 µs 最大 %5 µs  批次 %6（平均 %7 条）  休眠/唤醒 %8/%9  队满等待 %10")
+                 .arg(ingress.value("depth").toInteger())
+                 .arg(ingress.value("max_depth").toInteger())
+                 .arg(ingress.value("capacity").toInteger())
+                 .arg(ingress.value("avg_wait_us").toDouble(), 0, 'f', 1)
+                 .arg(ingress.value("max_wait_us").toDouble(), 0, 'f', 1)
+                 .arg(ingress.value("batches").toInteger())
+                 .arg(ingress.value("avg_batch").toDouble(), 0, 'f', 1)
+                 .arg(ingress.value("parks").toInteger())
+                 .arg(ingress.value("wakeups").toInteger())
+                 .arg(ingress.value("full_waits").toInteger());
+    QStringList outQueued;
+    QStringList outAvg;
+    QStringList outMax;
+    qint64 superseded = 0;
+    for (const auto &value : stats.value("outbound").toArray()) {
+        const QJsonObject cls = value.toObject();
+        outQueued << QString::number(cls.value("queued").toInteger());
+        outAvg << QString::number(cls.value("avg_wait_us").toDouble(), 'f', 0);
+        outMax << QString::number(cls.value("max_wait_us").toDouble(), 'f', 0);
+        superseded += cls.value("superseded").toInteger();
+    }
+    lines << tr("发送队列（控制/私聊/广播/批量）：排队 %1  等待 平均 %2 µs 最大 %3 µs  合并快照 %4")
+                 .arg(outQueued.join('/'), outAvg.join('/'), outMax.join('/'))
+                 .arg(superseded);
+    const QJsonObject files = stats.value("files").toObject();
+    if (files.value("enabled").toBool()) {
+        lines << tr("文件：%1 个（%2 个未传完，%3 MiB）  上传 %4  下载 %5  发送 零拷贝 %6 MiB / 复制 %7 MiB")
+                     .arg(files.value("files").toInt())
+                     .arg(files.value("partial").toInt())
+                     .arg(static_cast<double>(files.value("bytes").toInteger()) / (1024 * 1024), 0, 'f', 1)
+                     .arg(files.value("uploads").toInteger())
+                     .arg(files.value("downloads").toInteger())
+                     .arg(static_cast<double>(files.value("zero_copy_bytes").toInteger()) / (1024 * 1024), 0, 'f', 1)
+                     .arg(static_cast<double>(files.value("copied_bytes").toInteger()) / (1024 * 1024), 0, 'f', 1);
+    }
+    const QJsonObject memory = stats.value("memory").toObject();
+    const auto kib = [](const QJsonValue &bytes) { return static_cast<double>(bytes.toInteger()) / 1024; };
+    lines << tr("连接内存：%1 KiB%2  输入 %3  输出 %4  待发 %5  重放 %6  驱逐 %7")
+                 .arg(kib(memory.value("total")), 0, 'f', 0)
+                 .arg(memory.value("budget").toInteger() > 0 ? tr(" / 预算 %1 KiB").arg(kib(memory.value("budget")), 0, 'f', 0) : QString())
+                 .arg(kib(memory.value("input")), 0, 'f', 0)
+                 .arg(kib(memory.value("output")), 0, 'f', 0)
+                 .arg(kib(memory.value("pending")), 0, 'f', 0)
+                 .arg(kib(memory.value("replay")), 0, 'f', 0)
+                 .arg(memory.value("evictions").toInteger());
+    for (const auto &value : memory.value("top").toArray()) {
+        const QJsonObject top = value.toObject();
+        lines << tr("  #%1 %2：%3 KiB（输入 %4 / 输出 %5 / 待发 %6 / 重放 %7）")
+                     .arg(top.value("id").toInteger())
+                     .arg(top.value("name").toString().isEmpty() ? tr("（未登录）") : top.value("name").toString())
+                     .arg(kib(top.value("total")), 0, 'f', 1)
+                     .arg(kib(top.value("input")), 0, 'f', 1)
+                     .arg(kib(top.value("output")), 0, 'f', 1)
+                     .arg(kib(top.value("pending")), 0, 'f', 1)
+                     .arg(kib(top.value("replay")), 0, 'f', 1);
+    }
+    const QJsonObject filter = stats.value("filter").toObject();
+    if (filter.value("enabled").toBool()) {
+        lines << tr("内容过滤：%1 个词（重载 %2 次）  检查 %3 条  记录 %4  屏蔽 %5  拒绝 %6")
+                     .arg(filter.value("terms").toInt())
+                     .arg(filter.value("reloads").toInteger())
+                     .arg(filter.value("scanned").toInteger())
+                     .arg(filter.value("logged").toInteger())
+                     .arg(filter.value("masked").toInteger())
+                     .arg(filter.value("rejected").toInteger());
+    }
+    const QJsonObject overload = stats.value("overload").toObject();
+    if (overload.value("enabled").toBool()) {
+        lines << tr("过载控制：%1（切换 %2 次）  队列 %3%  延迟 %4 ms  待发 %5 行  省略日志 %6  丢弃通知 %7  拒绝请求 %8  暂停读取 %9  拒绝登录 %10")
+                     .arg(overload.value("level").toString())
+                     .arg(overload.value("transitions").toInteger())
+                     .arg(overload.value("queue_fill").toDouble() * 100, 0, 'f', 0)
+                     .arg(overload.value("lag_ms").toDouble(), 0, 'f', 1)
+                     .arg(overload.value("backlog").toInteger())
+                     .arg(overload.value("logs_suppressed").toInteger())
+                     .arg(overload.value("notices_dropped").toInteger())
+                     .arg(overload.value("requests_shed").toInteger())
+                     .arg(overload.value("reads_paused").toInteger())
+                     .arg(overload.value("logins_rejected").toInteger());
+    }
+    const QJsonObject ingressTrace = stats.value("trace").toObject().value("ingress").toObject();
+    const QJsonObject deliveryTrace = stats.value("trace").toObject().value("delivery").toObject();
+    if (ingressTrace.value("count").toInteger() > 0) {
+        lines << tr("消息追踪：%1 条  入队→路由 平均 %2 µs p99 %3 µs  路由→写出 平均 %4 µs p99 %5 µs")
+                     .arg(ingressTrace.value("count").toInteger())
+                     .arg(ingressTrace.value("avg_us").toDouble(), 0, 'f', 0)
+                     .arg(ingressTrace.value("p99_us").toDouble(), 0, 'f', 0)
+                     .arg(deliveryTrace.value("avg_us").toDouble(), 0, 'f', 0)
+                     .arg(deliveryTrace.value("p99_us").toDouble(), 0, 'f', 0);
+    }
+    const QJsonObject search = stats.value("search").toObject();
+    if (search.value("enabled").toBool()) {
+        lines << tr("搜索索引：%1 条消息  %2 个词  倒排 %3 MiB  查询 %4 次  平均 %5 µs  最大 %6 µs")
+                     .arg(search.value("messages").toInteger())
+                     .arg(search.value("terms").toInteger())
+                     .arg(static_cast<double>(search.value("posting_bytes").toInteger()) / (1024 * 1024), 0, 'f', 1)
+                     .arg(search.value("queries").toInteger())
+                     .arg(search.value("avg_query_us").toDouble(), 0, 'f', 0)
+                     .arg(search.value("max_query_us").toDouble(), 0, 'f', 0);
+        lines << tr("历史补取：%1 次  共 %2 条消息")
+                     .arg(search.value("history_queries").toInteger())
+                     .arg(search.value("history_messages").toInteger());
+    }
+    const QJsonObject capture = stats.value("capture").toObject();
+    if (capture.value("enabled").toBool()) {
+        lines << tr("流量录制：%1 条记录  %2 MiB  写入失败 %3")
+                     .arg(capture.value("records").toInteger())
+                     .arg(static_cast<double>(capture.value("bytes").toInteger()) / (1024 * 1024), 0, 'f', 1)
+                     .arg(capture.value("failed_writes").toInteger());
+    }
+    const QJsonObject profile = stats.value("profile").toObject();
+    if (profile.value("enabled").toBool()) {
+        lines << tr("时间线：%1 个线程  已记录 %2 段  窗口内 %3 段  丢弃 %4  保存 %5 次")
+                     .arg(profile.value("threads").toInt())
+                     .arg(profile.value("spans").toInteger())
+                     .arg(profile.value("window_spans").toInteger())
+                     .arg(profile.value("dropped").toInteger())
+                     .arg(profile.value("writes").toInteger());
+    }
+    const QJsonObject transport = stats.value("transport").toObject();
+    if (transport.value("backend").toString() == QLatin1String("epoll")) {
+        lines << tr("网络后端：epoll  读 %1 次 %2 MiB  写 %3 次（平均 %4 段）%5 MiB")
+                     .arg(transport.value("reads").toInteger())
+                     .arg(static_cast<double>(transport.value("read_bytes").toInteger()) / (1024 * 1024), 0, 'f', 1)
+                     .arg(transport.value("writes").toInteger())
+                     .arg(transport.value("writes").toInteger() ? transport.value("write_buffers").toDouble() / transport.value("writes").toDouble() : 0.0, 0, 'f', 1)
+                     .arg(static_cast<double>(transport.value("written_bytes").toInteger()) / (1024 * 1024), 0, 'f', 1);
+    }
+    const QJsonObject tls = stats.value("tls").toObject();
+    if (tls.value("enabled").toBool()) {
+        lines << tr("TLS 握手：%1 次  失败 %2  平均 %3 ms  最大 %4 ms")
+                     .arg(tls.value("handshakes").toInteger())
+                     .arg(tls.value("failures").toInteger())
+                     .arg(tls.value("avg_ms").toDouble(), 0, 'f', 2)
+                     .arg(tls.value("max_ms").toDouble(), 0, 'f', 2);
+    }
+    ui->plainTextEditStats->setPlainText(lines.join('\n'));
+}
+
 void ServerWindow::setRunningUi(bool running)
 {
     ui->pushButtonStartStop->setText(running ? tr("停止服务器") : tr("启动服务器"));
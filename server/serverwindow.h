@@ -3,6 +3,8 @@
 #include <QMainWindow>
 #include <QStringList>
 
+#include "serverconfig.h"
+
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class ServerWindow;
@@ -10,24 +12,28 @@ class ServerWindow;
 QT_END_NAMESPACE
 
 class ChatServer;
+class QTimer;
 
 class ServerWindow : public QMainWindow
 {
     Q_OBJECT
 
 public:
-    explicit ServerWindow(QWidget *parent = nullptr);
+    explicit ServerWindow(const ServerConfig &config = ServerConfig(), QWidget *parent = nullptr);
     ~ServerWindow() override;
 
 private slots:
     void onStartStopClicked();
+    void onSaveProfileClicked();
     void onServerLog(const QString &message);
     void onUsersChanged(const QStringList &users);
     void onRunningChanged(bool running);
+    void refreshStats();
 
 private:
     void setRunningUi(bool running);
 
     Ui::ServerWindow *ui = nullptr;
     ChatServer *m_server = nullptr;
+    QTimer *m_statsTimer = nullptr;
 };
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include <utility>
+
+#include "routerthread.h"
+
+// Which router owns what. A user's session, resume token, offline mail and
+// name registration live on router qHash(name) % count(), so claiming a name is
+// a single-threaded check on one router. Connections start on a home router
+// picked by client id and move to the name's router when they log in. Router 0
+// also coordinates broadcasts and presence, so every router sees them in the
+// same order. The search index, if enabled, has a thread of its own.
+class ShardMap
+{
+public:
+    static constexpr int kCoordinator = 0;
+
+    explicit ShardMap(const QList<RouterThread *> &threads = {}, RouterThread *search = nullptr)
+        : m_threads(threads)
+        , m_search(search)
+    {
+    }
+
+    int count() const { return static_cast<int>(m_threads.size()); }
+    RouterThread *thread(int shard) const { return m_threads.at(shard); }
+
+    int homeShard(quint64 clientId) const { return static_cast<int>(clientId % static_cast<quint64>(count())); }
+    int shardForName(const QString &name) const { return static_cast<int>(qHash(name, 0) % static_cast<size_t>(count())); }
+
+    // Resume tokens are "<shard>.<random hex>" so a resume can be routed without
+    // asking anyone; -1 if the token is malformed.
+    QByteArray makeToken(int shard, const QByteArray &random) const { return QByteArray::number(shard) + '.' + random; }
+    int shardForToken(const QByteArray &token) const
+    {
+        const auto dot = token.indexOf('.');
+        bool ok = false;
+        const int shard = dot > 0 ? token.left(dot).toInt(&ok) : -1;
+        return (ok && shard >= 0 && shard < count()) ? shard : -1;
+    }
+
+    // Client input (bounded, may block the caller) and router-to-router
+    // traffic (unbounded).
+    void post(int shard, IngressEvent event) const { m_threads.at(shard)->post(std::move(event)); }
+    void forward(int shard, IngressEvent event) const { m_threads.at(shard)->forward(std::move(event)); }
+
+    bool hasSearch() const { return m_search != nullptr; }
+    void toSearch(IngressEvent event) const { m_search->forward(std::move(event)); }
+
+private:
+    QList<RouterThread *> m_threads;
+    RouterThread *m_search = nullptr;
+};
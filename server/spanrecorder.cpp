@@ -0,0 +1,288 @@
+#include "spanrecorder.h"
+
+#include "routerthread.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+
+#include <atomic>
+
+namespace {
+
+// Spans per thread between two collects. There is a worker thread per
+// connection, most of them recording a few spans a second, so rings start
+// small; a worker reading flat out records a few per read and grows its ring
+// to the maximum, which covers far more than the collect interval.
+constexpr quint64 kMinRingSpans = 32;
+constexpr quint64 kMaxRingSpans = 1024;
+
+// The window stops growing here however long it is; the oldest batches go.
+constexpr qint64 kMaxWindowSpans = 2000000;
+
+// Flushed to the file in pieces of about this size.
+constexpr int kWriteChunk = 1 << 20;
+
+QAtomicInteger<quint64> nextRecorderId{1};
+
+QByteArray jsonString(const QString &text)
+{
+    QByteArray escaped = text.toUtf8();
+    escaped.replace('\\', "\\\\").replace('"', "\\\"");
+    return '"' + escaped + '"';
+}
+
+} // namespace
+
+// One thread's spans. Only that thread moves `head`, only the collector moves
+// `tail`; the thread's own reference (see localRing()) keeps it alive while
+// the thread records into it.
+struct SpanRecorder::Ring {
+    explicit Ring(quint64 size)
+        : capacity(size)
+        , spans(new Span[size])
+    {
+    }
+
+    int thread = 0;
+    QString name;
+    const quint64 capacity;
+    std::atomic<quint64> head{0};
+    std::atomic<quint64> tail{0};
+    std::atomic<quint64> dropped{0};
+    std::unique_ptr<Span[]> spans;
+};
+
+SpanRecorder::Scope::Scope(SpanRecorder *recorder, Kind kind, qint64 arg)
+    : m_recorder(recorder && recorder->isEnabled() ? recorder : nullptr)
+    , m_kind(kind)
+    , m_arg(arg)
+{
+    if (m_recorder) {
+        m_startNs = RouterThread::nowNs();
+    }
+}
+
+SpanRecorder::Scope::~Scope()
+{
+    if (m_recorder) {
+        m_recorder->record(m_kind, m_startNs, RouterThread::nowNs(), m_arg);
+    }
+}
+
+SpanRecorder::SpanRecorder()
+    : m_id(nextRecorderId.fetchAndAddRelaxed(1))
+{
+}
+
+SpanRecorder::~SpanRecorder() = default;
+
+const char *SpanRecorder::kindName(Kind kind)
+{
+    switch (kind) {
+    case Accept:
+        return "accept";
+    case Read:
+        return "read";
+    case Frame:
+        return "frame";
+    case Route:
+        return "route";
+    case Parse:
+        return "parse";
+    case FanOut:
+        return "fan_out";
+    case Encode:
+        return "encode";
+    case Write:
+        return "write";
+    case KindCount:
+        break;
+    }
+    return "";
+}
+
+void SpanRecorder::open(const QString &path, int windowSeconds)
+{
+    m_path = path;
+    m_windowNs = qMax(1, windowSeconds) * 1000000000LL;
+    m_originNs = RouterThread::nowNs();
+    m_window.clear();
+    m_windowSpans = 0;
+    m_threadNames.clear();
+    m_spans = 0;
+    m_dropped = 0;
+    m_writes = 0;
+    m_enabled.storeRelease(true);
+}
+
+void SpanRecorder::close()
+{
+    m_enabled.storeRelease(false);
+}
+
+void SpanRecorder::record(Kind kind, qint64 startNs, qint64 endNs, qint64 arg)
+{
+    Ring *ring = localRing();
+    quint64 head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= ring->capacity) {
+        if (ring->capacity >= kMaxRingSpans) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ring = growRing(ring);
+        head = 0;
+    }
+    Span &span = ring->spans[head % ring->capacity];
+    span.startNs = startNs;
+    span.durationNs = endNs - startNs;
+    span.arg = arg;
+    span.kind = kind;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+SpanRecorder::Local &SpanRecorder::local()
+{
+    // When the thread finishes this reference goes and m_rings holds the last.
+    static thread_local Local local;
+    return local;
+}
+
+SpanRecorder::Ring *SpanRecorder::localRing()
+{
+    Local &current = local();
+    if (current.recorder == m_id) {
+        return current.ring.get();
+    }
+
+    auto ring = std::make_shared<Ring>(kMinRingSpans);
+    QThread *thread = QThread::currentThread();
+    ring->name = thread->objectName();
+    {
+        QMutexLocker locker(&m_ringsMutex);
+        ring->thread = m_nextThread++;
+        m_rings.push_back(ring);
+    }
+    if (ring->name.isEmpty()) {
+        ring->name = (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+            ? QStringLiteral("main")
+            : QStringLiteral("thread-%1").arg(ring->thread);
+    }
+    current.recorder = m_id;
+    current.ring = std::move(ring);
+    return current.ring.get();
+}
+
+SpanRecorder::Ring *SpanRecorder::growRing(Ring *full)
+{
+    // The full ring keeps its spans until the next collect and is dropped
+    // then, like the ring of a finished thread.
+    auto ring = std::make_shared<Ring>(full->capacity * 2);
+    ring->thread = full->thread;
+    ring->name = full->name;
+    {
+        QMutexLocker locker(&m_ringsMutex);
+        m_rings.push_back(ring);
+    }
+    local().ring = std::move(ring);
+    return local().ring.get();
+}
+
+void SpanRecorder::collect()
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    Batch batch;
+    batch.collectedNs = RouterThread::nowNs();
+    {
+        QMutexLocker locker(&m_ringsMutex);
+        for (const auto &ring : std::as_const(m_rings)) {
+            m_threadNames.insert(ring->thread, ring->name);
+            const quint64 head = ring->head.load(std::memory_order_acquire);
+            quint64 tail = ring->tail.load(std::memory_order_relaxed);
+            for (; tail < head; ++tail) {
+                batch.entries.push_back(Entry{ring->thread, ring->spans[tail % ring->capacity]});
+            }
+            ring->tail.store(tail, std::memory_order_release);
+            m_dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+        }
+        // A finished thread cannot record any more; whatever it left is in
+        // this batch unless it wrote after the loop above.
+        m_rings.removeIf([](const std::shared_ptr<Ring> &ring) {
+            return ring.use_count() == 1 && ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+        });
+    }
+
+    m_spans += static_cast<quint64>(batch.entries.size());
+    m_windowSpans += batch.entries.size();
+    m_window.push_back(std::move(batch));
+    const qint64 oldestNs = m_window.constLast().collectedNs - m_windowNs;
+    while (m_window.size() > 1 && (m_window.constFirst().collectedNs < oldestNs || m_windowSpans > kMaxWindowSpans)) {
+        m_windowSpans -= m_window.constFirst().entries.size();
+        m_window.removeFirst();
+    }
+}
+
+bool SpanRecorder::write(QString *error)
+{
+    if (m_path.isEmpty()) {
+        *error = QStringLiteral("profiling is off");
+        return false;
+    }
+    // Written aside and renamed, so a viewer never opens half a file.
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *error = file.errorString();
+        return false;
+    }
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":0,\"args\":{\"name\":\"chat server\"}}";
+    for (auto it = m_threadNames.cbegin(); it != m_threadNames.cend(); ++it) {
+        out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(it.key())
+            + ",\"args\":{\"name\":" + jsonString(it.value()) + "}}";
+    }
+    for (const auto &batch : std::as_const(m_window)) {
+        for (const auto &entry : batch.entries) {
+            const Span &span = entry.span;
+            out += ",\n{\"name\":\"";
+            out += kindName(span.kind);
+            out += "\",\"cat\":\"server\",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(entry.thread);
+            out += ",\"ts\":" + QByteArray::number(static_cast<double>(span.startNs - m_originNs) / 1000.0, 'f', 3);
+            out += ",\"dur\":" + QByteArray::number(static_cast<double>(span.durationNs) / 1000.0, 'f', 3);
+            out += ",\"args\":{\"n\":" + QByteArray::number(span.arg) + "}}";
+            if (out.size() >= kWriteChunk) {
+                file.write(out);
+                out.clear();
+            }
+        }
+    }
+    out += "\n]}\n";
+    file.write(out);
+    if (!file.commit()) {
+        *error = file.errorString();
+        return false;
+    }
+    ++m_writes;
+    return true;
+}
+
+SpanRecorder::Stats SpanRecorder::stats() const
+{
+    Stats s;
+    s.enabled = isEnabled();
+    s.path = m_path;
+    s.spans = m_spans;
+    s.dropped = m_dropped;
+    {
+        QMutexLocker locker(&m_ringsMutex);
+        s.threads = static_cast<int>(m_rings.size());
+    }
+    s.windowSpans = m_windowSpans;
+    s.writes = m_writes;
+    return s;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QtGlobal>
+
+#include <memory>
+
+// Timeline of what the server threads spend their time on (server --profile).
+//
+// Code under a Scope records one span: its kind, start, duration and one
+// number (bytes, lines or recipients). Every thread writes its spans into a
+// ring of its own, so recording takes two clock reads and a store. A ring
+// starts at kMinRingSpans (1 KiB), which is all an idle connection's worker
+// thread ever costs; a thread that fills its ring between two collects
+// replaces it with one twice the size, up to kMaxRingSpans (32 KiB), and past
+// that a full ring drops the span and counts it. The GUI thread collects the rings every
+// few hundred milliseconds into a window holding the last windowSeconds, and
+// write() saves that window as Chrome trace-event JSON, which
+// chrome://tracing and ui.perfetto.dev open as one track per thread.
+class SpanRecorder
+{
+public:
+    enum Kind : quint8 {
+        Accept, // new connection taken by the server
+        Read,   // socket read into the worker's buffer (arg: bytes)
+        Frame,  // input split into lines and data frames (arg: lines)
+        Route,  // one line handed to its router
+        Parse,  // JSON of one line parsed by the router (arg: bytes)
+        FanOut, // broadcast to every session of a shard (arg: recipients)
+        Encode, // message serialised to a line (arg: bytes)
+        Write,  // queued lines handed to the socket (arg: lines)
+        KindCount,
+    };
+
+    struct Stats {
+        bool enabled = false;
+        QString path;
+        quint64 spans = 0;
+        quint64 dropped = 0;
+        int threads = 0;
+        qint64 windowSpans = 0;
+        quint64 writes = 0;
+    };
+
+    class Scope
+    {
+    public:
+        // Nothing is recorded without a recorder or while it is disabled.
+        Scope(SpanRecorder *recorder, Kind kind, qint64 arg = 0);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        void setArg(qint64 arg) { m_arg = arg; }
+
+    private:
+        SpanRecorder *m_recorder;
+        Kind m_kind;
+        qint64 m_arg;
+        qint64 m_startNs = 0;
+    };
+
+    SpanRecorder();
+    ~SpanRecorder();
+
+    static const char *kindName(Kind kind);
+
+    // GUI thread. open() empties the window; write() replaces the file with
+    // the window as it was at the last collect().
+    void open(const QString &path, int windowSeconds);
+    void close();
+    void collect();
+    bool write(QString *error);
+
+    // Any thread.
+    bool isEnabled() const { return m_enabled.loadAcquire(); }
+
+    // GUI thread.
+    Stats stats() const;
+
+private:
+    struct Span {
+        qint64 startNs = 0;
+        qint64 durationNs = 0;
+        qint64 arg = 0;
+        Kind kind = Accept;
+    };
+    struct Ring;
+    // The calling thread's ring, if it was made for this recorder.
+    struct Local {
+        quint64 recorder = 0;
+        std::shared_ptr<Ring> ring;
+    };
+    struct Entry {
+        int thread = 0;
+        Span span;
+    };
+    // What one collect() took from all rings.
+    struct Batch {
+        qint64 collectedNs = 0;
+        QList<Entry> entries;
+    };
+
+    void record(Kind kind, qint64 startNs, qint64 endNs, qint64 arg);
+    static Local &local();
+    Ring *localRing();
+    // The calling thread's ring replaced by a larger one on the same track.
+    Ring *growRing(Ring *full);
+
+    const quint64 m_id;
+    QAtomicInteger<bool> m_enabled;
+
+    // Rings of the threads that recorded anything; a ring whose thread has
+    // finished, or has grown out of it, is dropped once it has been collected.
+    mutable QMutex m_ringsMutex;
+    QList<std::shared_ptr<Ring>> m_rings;
+    int m_nextThread = 1;
+
+    // GUI thread only.
+    QString m_path;
+    qint64 m_windowNs = 0;
+    qint64 m_originNs = 0;
+    QList<Batch> m_window;
+    qint64 m_windowSpans = 0;
+    QHash<int, QString> m_threadNames;
+    quint64 m_spans = 0;
+    quint64 m_dropped = 0;
+    quint64 m_writes = 0;
+};
@@ -0,0 +1,105 @@
+#include "tlscontext.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslSocket>
+
+bool TlsContext::load(const QString &certFile, const QString &keyFile, QString *error)
+{
+    const auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    if (!QSslSocket::supportsSsl()) {
+        return fail("TLS is not supported by this Qt build");
+    }
+
+    const QList<QSslCertificate> chain = QSslCertificate::fromPath(certFile, QSsl::Pem);
+    if (chain.isEmpty()) {
+        return fail(QString("cannot read certificate %1").arg(certFile));
+    }
+
+    QFile file(keyFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail(QString("cannot open key %1").arg(keyFile));
+    }
+    const QByteArray pem = file.readAll();
+
+    QSslKey key;
+    for (const auto algorithm : {QSsl::Ec, QSsl::Rsa, QSsl::Dsa}) {
+        key = QSslKey(pem, algorithm, QSsl::Pem, QSsl::PrivateKey);
+        if (!key.isNull()) {
+            break;
+        }
+    }
+    if (key.isNull()) {
+        return fail(QString("cannot read private key %1").arg(keyFile));
+    }
+
+    QSslConfiguration config = QSslConfiguration::defaultConfiguration();
+    config.setLocalCertificateChain(chain);
+    config.setPrivateKey(key);
+    config.setProtocol(QSsl::TlsV1_2OrLater);
+    config.setPeerVerifyMode(QSslSocket::VerifyNone);
+    // Qt gives every server-side QSslSocket an OpenSSL context of its own, and
+    // with it its own ticket keys, so no ticket issued here could be redeemed
+    // on a later connection: every handshake is a full one. Issue none rather
+    // than encrypt and send tickets that are never any use (NumTickets is an
+    // OpenSSL setting for TLS 1.3; other backends ignore it).
+    config.setSslOption(QSsl::SslOptionDisableSessionTickets, true);
+    config.setBackendConfigurationOption(QByteArrayLiteral("NumTickets"), QStringLiteral("0"));
+
+    QMutexLocker locker(&m_mutex);
+    m_config = config;
+    m_enabled = true;
+    return true;
+}
+
+void TlsContext::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_config = QSslConfiguration();
+    m_enabled = false;
+}
+
+bool TlsContext::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_enabled;
+}
+
+QSslConfiguration TlsContext::configuration() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_config;
+}
+
+void TlsContext::recordHandshake(qint64 ns)
+{
+    m_handshakes.fetchAndAddRelaxed(1);
+    m_totalNs.fetchAndAddRelaxed(ns);
+
+    qint64 seen = m_maxNs.loadRelaxed();
+    while (ns > seen && !m_maxNs.testAndSetRelaxed(seen, ns, seen)) {
+    }
+}
+
+void TlsContext::recordFailure()
+{
+    m_failures.fetchAndAddRelaxed(1);
+}
+
+TlsContext::Stats TlsContext::stats() const
+{
+    Stats s;
+    s.handshakes = m_handshakes.loadRelaxed();
+    s.failures = m_failures.loadRelaxed();
+    s.totalNs = m_totalNs.loadRelaxed();
+    s.maxNs = m_maxNs.loadRelaxed();
+    return s;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QSslConfiguration>
+#include <QString>
+
+// Server-side TLS settings shared by every ClientWorker. Only the configuration
+// and the counters are shared; each handshake runs on its worker's own thread
+// and is a full handshake (the server issues no session tickets, see load()).
+class TlsContext
+{
+public:
+    struct Stats {
+        quint64 handshakes = 0;
+        quint64 failures = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+    };
+
+    bool load(const QString &certFile, const QString &keyFile, QString *error);
+    void clear();
+    bool isEnabled() const;
+
+    QSslConfiguration configuration() const;
+
+    void recordHandshake(qint64 ns);
+    void recordFailure();
+    Stats stats() const;
+
+private:
+    mutable QMutex m_mutex;
+    QSslConfiguration m_config;
+    bool m_enabled = false;
+
+    QAtomicInteger<quint64> m_handshakes;
+    QAtomicInteger<quint64> m_failures;
+    QAtomicInteger<qint64> m_totalNs;
+    QAtomicInteger<qint64> m_maxNs;
+};
@@ -0,0 +1,76 @@
+#include "tracestats.h"
+
+namespace {
+
+// Bucket b holds durations below 2^b µs.
+int bucketOf(qint64 ns)
+{
+    quint64 us = static_cast<quint64>(ns / 1000);
+    int bucket = 0;
+    while (us > 0) {
+        us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+} // namespace
+
+const char *TraceStats::hopName(Hop hop)
+{
+    switch (hop) {
+    case Ingress:
+        return "ingress";
+    case Delivery:
+        return "delivery";
+    case HopCount:
+        break;
+    }
+    return "";
+}
+
+void TraceStats::record(Hop hop, qint64 ns)
+{
+    // Clocks of another process (a spilled mailbox from an earlier run) can
+    // make a hop look negative.
+    ns = qMax<qint64>(0, ns);
+    Histogram &h = m_hops[hop];
+    h.buckets[qMin(bucketOf(ns), kBuckets - 1)].fetchAndAddRelaxed(1);
+    h.count.fetchAndAddRelaxed(1);
+    h.totalNs.fetchAndAddRelaxed(ns);
+    qint64 seen = h.maxNs.loadRelaxed();
+    while (ns > seen && !h.maxNs.testAndSetRelaxed(seen, ns, seen)) {
+    }
+}
+
+TraceStats::HopStats TraceStats::stats(Hop hop) const
+{
+    const Histogram &h = m_hops[hop];
+    HopStats s;
+    s.count = h.count.loadRelaxed();
+    s.maxUs = static_cast<double>(h.maxNs.loadRelaxed()) / 1e3;
+    if (s.count == 0) {
+        return s;
+    }
+    s.avgUs = static_cast<double>(h.totalNs.loadRelaxed()) / static_cast<double>(s.count) / 1e3;
+
+    // Buckets are read one at a time while workers add to them; what is
+    // missed falls back to the maximum.
+    s.p50Us = s.maxUs;
+    s.p99Us = s.maxUs;
+    quint64 seen = 0;
+    bool haveP50 = false;
+    for (int b = 0; b < kBuckets; ++b) {
+        seen += h.buckets[b].loadRelaxed();
+        const double upperUs = qMin(static_cast<double>(1ULL << b), s.maxUs);
+        if (!haveP50 && seen * 2 >= s.count) {
+            s.p50Us = upperUs;
+            haveP50 = true;
+        }
+        if (seen * 100 >= s.count * 99) {
+            s.p99Us = upperUs;
+            break;
+        }
+    }
+    return s;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QtGlobal>
+
+// Server side of message tracing (see Protocol::withTrace): how long traced
+// messages spent in each hop, as log2 histograms of microseconds. Routers
+// record the ingress hop, workers the delivery hop when they write a traced
+// line. Untraced traffic never touches it.
+class TraceStats
+{
+public:
+    enum Hop : quint8 {
+        Ingress,  // received by the worker -> handled by the router
+        Delivery, // handled by the router -> written to a recipient's socket
+        HopCount,
+    };
+
+    struct HopStats {
+        quint64 count = 0;
+        double avgUs = 0;
+        // Upper bounds of the histogram buckets holding the percentile.
+        double p50Us = 0;
+        double p99Us = 0;
+        double maxUs = 0;
+    };
+
+    static const char *hopName(Hop hop);
+
+    // Any thread.
+    void record(Hop hop, qint64 ns);
+    HopStats stats(Hop hop) const;
+
+private:
+    static constexpr int kBuckets = 32;
+
+    struct Histogram {
+        QAtomicInteger<quint64> buckets[kBuckets];
+        QAtomicInteger<quint64> count;
+        QAtomicInteger<qint64> totalNs;
+        QAtomicInteger<qint64> maxNs;
+    };
+
+    Histogram m_hops[HopCount];
+};
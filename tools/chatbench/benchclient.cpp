@@ -0,0 +1,193 @@
+#include "benchclient.h"
+
+#include "localsocket.h"
+#include "protocol.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMetaObject>
+#include <QSslSocket>
+
+BenchClient::BenchClient(const QString &name, const Options &options, const QElapsedTimer *clock, QObject *parent)
+    : QObject(parent)
+    , m_name(name)
+    , m_options(options)
+    , m_clock(clock)
+    , m_socket(new QSslSocket(this))
+{
+    if (m_options.tls) {
+        connect(m_socket, &QSslSocket::encrypted, this, &BenchClient::onReady);
+    } else {
+        connect(m_socket, &QSslSocket::connected, this, &BenchClient::onReady);
+    }
+    connect(m_socket, &QSslSocket::readyRead, this, &BenchClient::onReadyRead);
+    connect(m_socket, &QSslSocket::errorOccurred, this, &BenchClient::onError);
+}
+
+void BenchClient::start()
+{
+    m_startNs = m_clock->nsecsElapsed();
+    if (!m_options.localPath.isEmpty()) {
+        // Connected at once; connected() is not emitted for an adopted socket.
+        QString error;
+        const qintptr fd = LocalSocket::connectTo(m_options.localPath, &error);
+        if (fd < 0 || !m_socket->setSocketDescriptor(fd)) {
+            // Reported from the event loop, like a failed TCP connect.
+            const QString reason = fd < 0 ? error : m_socket->errorString();
+            QMetaObject::invokeMethod(this, [this, reason]() { fail(reason); }, Qt::QueuedConnection);
+            return;
+        }
+        QMetaObject::invokeMethod(this, &BenchClient::onReady, Qt::QueuedConnection);
+    } else if (m_options.tls) {
+        m_socket->setSslConfiguration(m_options.ssl);
+        m_socket->connectToHostEncrypted(m_options.host, m_options.port);
+    } else {
+        m_socket->connectToHost(m_options.host, m_options.port);
+    }
+}
+
+void BenchClient::startSending()
+{
+    if (m_loginNs < 0 || m_sending) {
+        return;
+    }
+    m_sending = true;
+    if (m_options.messages <= 0) {
+        m_done = true;
+        emit finished();
+        return;
+    }
+    while (m_sent < m_options.messages && m_sent - m_acked < m_options.window) {
+        sendNext();
+    }
+}
+
+void BenchClient::stop()
+{
+    if (m_socket->state() == QAbstractSocket::ConnectedState) {
+        m_socket->write(Protocol::toLine(QJsonObject{{"type", "logout"}}));
+        m_socket->flush();
+    }
+    m_socket->abort();
+}
+
+QString BenchClient::name() const
+{
+    return m_name;
+}
+
+qint64 BenchClient::loginNs() const
+{
+    return m_loginNs;
+}
+
+const LatencyStats &BenchClient::roundTrip() const
+{
+    return m_roundTrip;
+}
+
+quint64 BenchClient::chatReceived() const
+{
+    return m_chatReceived;
+}
+
+bool BenchClient::isDone() const
+{
+    return m_done;
+}
+
+void BenchClient::onReady()
+{
+    m_socket->write(Protocol::toLine(QJsonObject{{"type", "login"}, {"name", m_name}}));
+}
+
+void BenchClient::onReadyRead()
+{
+    m_buffer.append(m_socket->readAll());
+
+    while (true) {
+        const int newlineIndex = m_buffer.indexOf('\n');
+        if (newlineIndex < 0) {
+            break;
+        }
+
+        const QByteArray line = m_buffer.left(newlineIndex).trimmed();
+        m_buffer.remove(0, newlineIndex + 1);
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        const QJsonDocument doc = QJsonDocument::fromJson(line);
+        if (doc.isObject()) {
+            handleJson(doc.object());
+        }
+    }
+}
+
+void BenchClient::onError()
+{
+    if (!m_done) {
+        fail(m_socket->errorString());
+    }
+}
+
+void BenchClient::sendNext()
+{
+    ++m_sent;
+    const QString text = QString("bench %1 %2").arg(m_sent).arg(m_clock->nsecsElapsed());
+    m_socket->write(Protocol::toLine(QJsonObject{{"type", "chat"}, {"text", text}}));
+}
+
+void BenchClient::handleJson(const QJsonObject &obj)
+{
+    const QString type = obj.value("type").toString();
+    if (type == "login_ok") {
+        m_loginNs = m_clock->nsecsElapsed() - m_startNs;
+        emit loggedIn();
+        return;
+    }
+
+    if (type == "login_error") {
+        fail(QString("login error: %1").arg(obj.value("reason").toString()));
+        return;
+    }
+
+    if (type != "chat") {
+        return;
+    }
+
+    ++m_chatReceived;
+    if (obj.value("from").toString() != m_name) {
+        return;
+    }
+
+    const QString text = obj.value("text").toString();
+    bool ok = false;
+    const qint64 sentNs = text.section(' ', -1).toLongLong(&ok);
+    if (!ok || !text.startsWith("bench ")) {
+        return;
+    }
+
+    m_roundTrip.add(m_clock->nsecsElapsed() - sentNs);
+    ++m_acked;
+
+    if (m_acked >= m_options.messages) {
+        if (!m_done) {
+            m_done = true;
+            emit finished();
+        }
+        return;
+    }
+    if (m_sent < m_options.messages) {
+        sendNext();
+    }
+}
+
+void BenchClient::fail(const QString &reason)
+{
+    if (m_done) {
+        return;
+    }
+    m_done = true;
+    emit failed(QString("%1: %2").arg(m_name, reason));
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "latencystats.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSslConfiguration>
+#include <QString>
+
+class QJsonObject;
+class QSslSocket;
+
+// One scripted chat connection: logs in, then sends `messages` chat lines with
+// at most `window` of its own messages in flight, timing each one until the
+// server's broadcast of it comes back.
+class BenchClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        QString host;
+        quint16 port = 0;
+        // Unix socket of a same-host server instead of host and port.
+        QString localPath;
+        bool tls = false;
+        QSslConfiguration ssl;
+        int messages = 100;
+        int window = 1;
+    };
+
+    BenchClient(const QString &name, const Options &options, const QElapsedTimer *clock, QObject *parent = nullptr);
+
+    void start();
+    void startSending();
+    void stop();
+
+    QString name() const;
+    qint64 loginNs() const;
+    const LatencyStats &roundTrip() const;
+    quint64 chatReceived() const;
+    bool isDone() const;
+
+signals:
+    void loggedIn();
+    void finished();
+    void failed(QString reason);
+
+private slots:
+    void onReady();
+    void onReadyRead();
+    void onError();
+
+private:
+    void sendNext();
+    void handleJson(const QJsonObject &obj);
+    void fail(const QString &reason);
+
+    const QString m_name;
+    const Options m_options;
+    const QElapsedTimer *const m_clock;
+    QSslSocket *m_socket = nullptr;
+    QByteArray m_buffer;
+
+    qint64 m_startNs = 0;
+    qint64 m_loginNs = -1;
+    int m_sent = 0;
+    int m_acked = 0;
+    quint64 m_chatReceived = 0;
+    bool m_sending = false;
+    bool m_done = false;
+    LatencyStats m_roundTrip;
+};
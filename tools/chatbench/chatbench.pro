@@ -0,0 +1,14 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+SOURCES += \
+    benchclient.cpp \
+    main.cpp
+
+HEADERS += \
+    benchclient.h
+
+INCLUDEPATH += $$PWD/../../common
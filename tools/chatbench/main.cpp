@@ -0,0 +1,208 @@
+#include "benchclient.h"
+#include "latencystats.h"
+#include "protocol.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSslCertificate>
+#include <QSslSocket>
+#include <QTextStream>
+#include <QTimer>
+
+#include <utility>
+
+namespace {
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+// Connect + TLS handshake latency. The server does not resume sessions, so
+// every handshake is a full one.
+LatencyStats measureHandshakes(const BenchClient::Options &options, int count, int *failures)
+{
+    LatencyStats stats;
+    for (int i = 0; i < count; ++i) {
+        QSslSocket socket;
+        socket.setSslConfiguration(options.ssl);
+
+        QElapsedTimer timer;
+        timer.start();
+        socket.connectToHostEncrypted(options.host, options.port);
+        if (!socket.waitForEncrypted(5000)) {
+            ++*failures;
+            socket.abort();
+            continue;
+        }
+        stats.add(timer.nsecsElapsed());
+        socket.abort();
+    }
+    return stats;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Load generator for the chat server.");
+    parser.addHelpOption();
+    const QCommandLineOption hostOption("host", "Server host.", "host", "127.0.0.1");
+    const QCommandLineOption portOption("port", "Server port.", "port", QString::number(Protocol::kDefaultPort));
+    const QCommandLineOption localOption("local", "Connect to the server's Unix socket <path> instead (no TLS).", "path");
+    const QCommandLineOption clientsOption("clients", "Concurrent logged-in clients.", "n", "20");
+    const QCommandLineOption messagesOption("messages", "Chat messages sent by each client.", "n", "100");
+    const QCommandLineOption windowOption("window", "Own messages in flight per client.", "n", "1");
+    const QCommandLineOption prefixOption("prefix", "User name prefix.", "name", "bench");
+    const QCommandLineOption timeoutOption("timeout", "Give up after <sec> seconds.", "sec", "60");
+    const QCommandLineOption tlsOption("tls", "Connect with TLS.");
+    const QCommandLineOption caCertOption("ca-cert", "Trust the PEM CA certificate in <file>.", "file");
+    const QCommandLineOption handshakesOption("handshakes", "TLS handshakes to time.", "n", "50");
+    parser.addOptions({hostOption, portOption, localOption, clientsOption, messagesOption, windowOption, prefixOption, timeoutOption, tlsOption, caCertOption, handshakesOption});
+    parser.process(app);
+
+    BenchClient::Options options;
+    options.host = parser.value(hostOption);
+    options.port = static_cast<quint16>(parser.value(portOption).toUInt());
+    options.localPath = parser.value(localOption);
+    options.tls = options.localPath.isEmpty() && (parser.isSet(tlsOption) || parser.isSet(caCertOption));
+    options.messages = parser.value(messagesOption).toInt();
+    options.window = qMax(1, parser.value(windowOption).toInt());
+    const int clientCount = qMax(1, parser.value(clientsOption).toInt());
+    const int handshakes = parser.value(handshakesOption).toInt();
+    const QString prefix = parser.value(prefixOption);
+
+#ifndef Q_OS_LINUX
+    if (!options.localPath.isEmpty()) {
+        out() << "error: --local needs Linux\n";
+        return 1;
+    }
+#endif
+
+    if (options.tls) {
+        if (!QSslSocket::supportsSsl()) {
+            out() << "error: TLS is not supported by this Qt build\n";
+            return 1;
+        }
+        options.ssl = QSslConfiguration::defaultConfiguration();
+        options.ssl.setProtocol(QSsl::TlsV1_2OrLater);
+        if (parser.isSet(caCertOption)) {
+            const auto certs = QSslCertificate::fromPath(parser.value(caCertOption), QSsl::Pem);
+            if (certs.isEmpty()) {
+                out() << "error: cannot read " << parser.value(caCertOption) << "\n";
+                return 1;
+            }
+            options.ssl.addCaCertificates(certs);
+        }
+    }
+
+    out() << QString("chatbench: %1 clients x %2 messages, window %3, %4\n")
+                 .arg(clientCount)
+                 .arg(options.messages)
+                 .arg(options.window)
+                 .arg(!options.localPath.isEmpty() ? QString("local %1").arg(options.localPath)
+                                                   : QString("%1 %2:%3").arg(options.tls ? QStringLiteral("tls") : QStringLiteral("tcp"), options.host).arg(options.port));
+
+    if (options.tls && handshakes > 0) {
+        int failures = 0;
+        const LatencyStats full = measureHandshakes(options, handshakes, &failures);
+        out() << full.report("tls handshake full") << "\n";
+        if (failures > 0) {
+            out() << QString("  handshake failures: %1\n").arg(failures);
+        }
+        out().flush();
+    }
+
+    QElapsedTimer clock;
+    clock.start();
+
+    QList<BenchClient *> clients;
+    int loggedIn = 0;
+    int finished = 0;
+    int failed = 0;
+    qint64 sendStartNs = 0;
+
+    bool reported = false;
+    const auto report = [&]() {
+        if (reported) {
+            return;
+        }
+        reported = true;
+        const double sendSec = static_cast<double>(clock.nsecsElapsed() - sendStartNs) / 1e9;
+
+        LatencyStats login;
+        LatencyStats roundTrip;
+        quint64 delivered = 0;
+        for (auto *c : std::as_const(clients)) {
+            if (c->loginNs() >= 0) {
+                login.add(c->loginNs());
+            }
+            roundTrip.merge(c->roundTrip());
+            delivered += c->chatReceived();
+            c->stop();
+        }
+
+        out() << login.report("login") << "\n";
+        out() << roundTrip.report("round trip", sendSec) << "\n";
+        out() << QString("[fan-out] n=%1 rate=%2/s\n").arg(delivered).arg(sendSec > 0 ? static_cast<double>(delivered) / sendSec : 0.0, 0, 'f', 1);
+        if (failed > 0) {
+            out() << QString("failed clients: %1\n").arg(failed);
+        }
+        out().flush();
+        app.exit(failed > 0 ? 2 : 0);
+    };
+
+    const auto checkDone = [&]() {
+        if (finished + failed >= clientCount) {
+            report();
+        }
+    };
+
+    const auto startSending = [&]() {
+        sendStartNs = clock.nsecsElapsed();
+        for (auto *c : std::as_const(clients)) {
+            c->startSending();
+        }
+    };
+
+    for (int i = 0; i < clientCount; ++i) {
+        auto *client = new BenchClient(QString("%1%2").arg(prefix).arg(i), options, &clock, &app);
+        clients.push_back(client);
+
+        QObject::connect(client, &BenchClient::loggedIn, &app, [&]() {
+            if (++loggedIn + failed == clientCount) {
+                startSending();
+            }
+        });
+        QObject::connect(client, &BenchClient::finished, &app, [&]() {
+            ++finished;
+            checkDone();
+        });
+        QObject::connect(client, &BenchClient::failed, &app, [&](const QString &reason) {
+            ++failed;
+            out() << "client failed: " << reason << "\n";
+            if (loggedIn + failed == clientCount && sendStartNs == 0) {
+                startSending();
+            }
+            checkDone();
+        });
+    }
+
+    QTimer::singleShot(parser.value(timeoutOption).toInt() * 1000, &app, [&]() {
+        out() << "timeout\n";
+        failed = qMax(failed, 1);
+        report();
+    });
+
+    for (auto *c : std::as_const(clients)) {
+        c->start();
+    }
+
+    return app.exec();
+}
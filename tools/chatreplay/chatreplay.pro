@@ -0,0 +1,14 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+SOURCES += \
+    main.cpp \
+    replayconnection.cpp
+
+HEADERS += \
+    replayconnection.h
+
+INCLUDEPATH += $$PWD/../../common
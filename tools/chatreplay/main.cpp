@@ -0,0 +1,310 @@
+#include "capturefile.h"
+#include "latencystats.h"
+#include "protocol.h"
+#include "replayconnection.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QSslCertificate>
+#include <QSslSocket>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// Events handed out per pass of the event loop, so sockets keep being served
+// while a fast replay catches up.
+constexpr int kDispatchBatch = 1024;
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+bool loadCapture(const QString &path, qint64 *startMs, QList<Capture::Record> *records, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = file.errorString();
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    if (!Capture::parseHeader(data, startMs)) {
+        *error = QStringLiteral("not a capture file");
+        return false;
+    }
+
+    const char *p = data.constData() + Capture::kHeaderSize;
+    const char *end = data.constData() + data.size();
+    Capture::Record record;
+    while (Capture::readRecord(&p, end, &record)) {
+        records->push_back(record);
+    }
+    if (p < end) {
+        out() << QString("warning: ignoring %1 truncated bytes at the end of the capture\n").arg(end - p);
+    }
+
+    // Workers wrote their records in blocks; a stable sort restores the time
+    // order across connections and keeps each connection's own order.
+    std::stable_sort(records->begin(), records->end(), [](const Capture::Record &a, const Capture::Record &b) { return a.timeNs < b.timeNs; });
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays traffic captured by the chat server (server --capture <file>).");
+    parser.addHelpOption();
+    parser.addPositionalArgument("capture", "Capture file.");
+    const QCommandLineOption hostOption("host", "Server host.", "host", "127.0.0.1");
+    const QCommandLineOption portOption("port", "Server port.", "port", QString::number(Protocol::kDefaultPort));
+    const QCommandLineOption speedOption("speed", "Playback speed: 1 is real time, N is N times faster, max sends as fast as possible.", "x", "1");
+    const QCommandLineOption drainOption("drain", "Seconds to wait for outstanding replies after the last event.", "sec", "5");
+    const QCommandLineOption timeoutOption("timeout", "Give up after <sec> seconds (0 = never).", "sec", "0");
+    const QCommandLineOption tlsOption("tls", "Connect with TLS.");
+    const QCommandLineOption caCertOption("ca-cert", "Trust the PEM CA certificate in <file>.", "file");
+    parser.addOptions({hostOption, portOption, speedOption, drainOption, timeoutOption, tlsOption, caCertOption});
+    parser.process(app);
+
+    const QStringList positional = parser.positionalArguments();
+    if (positional.size() != 1) {
+        parser.showHelp(1);
+    }
+
+    // 0 stands for "max".
+    double speed = 0.0;
+    if (parser.value(speedOption) != "max") {
+        bool ok = false;
+        speed = parser.value(speedOption).toDouble(&ok);
+        if (!ok || speed <= 0.0) {
+            out() << "error: --speed takes a positive number or max\n";
+            return 1;
+        }
+    }
+
+    ReplayConnection::Options options;
+    options.host = parser.value(hostOption);
+    options.port = static_cast<quint16>(parser.value(portOption).toUInt());
+    options.tls = parser.isSet(tlsOption) || parser.isSet(caCertOption);
+    if (options.tls) {
+        if (!QSslSocket::supportsSsl()) {
+            out() << "error: TLS is not supported by this Qt build\n";
+            return 1;
+        }
+        options.ssl = QSslConfiguration::defaultConfiguration();
+        options.ssl.setProtocol(QSsl::TlsV1_2OrLater);
+        if (parser.isSet(caCertOption)) {
+            const auto certs = QSslCertificate::fromPath(parser.value(caCertOption), QSsl::Pem);
+            if (certs.isEmpty()) {
+                out() << "error: cannot read " << parser.value(caCertOption) << "\n";
+                return 1;
+            }
+            options.ssl.addCaCertificates(certs);
+        }
+    }
+
+    qint64 captureStartMs = 0;
+    QList<Capture::Record> records;
+    QString error;
+    if (!loadCapture(positional.first(), &captureStartMs, &records, &error)) {
+        out() << "error: " << positional.first() << ": " << error << "\n";
+        return 1;
+    }
+
+    // Session records only tell which name a connection ended up with, for
+    // turning its resume into a login; they are not replayed themselves.
+    QHash<quint64, QString> sessionNames;
+    QList<Capture::Record> events;
+    events.reserve(records.size());
+    int connectionCount = 0;
+    qint64 lineCount = 0;
+    for (auto &record : records) {
+        switch (record.kind) {
+        case Capture::Kind::Session:
+            if (!sessionNames.contains(record.clientId)) {
+                sessionNames.insert(record.clientId, QString::fromUtf8(record.data));
+            }
+            continue;
+        case Capture::Kind::Open:
+            ++connectionCount;
+            break;
+        case Capture::Kind::Line:
+            ++lineCount;
+            break;
+        case Capture::Kind::Close:
+            break;
+        }
+        events.push_back(std::move(record));
+    }
+    records.clear();
+
+    if (events.isEmpty()) {
+        out() << "error: the capture holds no traffic\n";
+        return 1;
+    }
+    const qint64 firstNs = events.constFirst().timeNs;
+    const qint64 spanNs = events.constLast().timeNs - firstNs;
+
+    out() << QString("chatreplay: %1 connections, %2 lines over %3 s captured %4, speed %5, %6 %7:%8\n")
+                 .arg(connectionCount)
+                 .arg(lineCount)
+                 .arg(static_cast<double>(spanNs) / 1e9, 0, 'f', 1)
+                 .arg(QDateTime::fromMSecsSinceEpoch(captureStartMs).toString(Qt::ISODate),
+                     speed > 0.0 ? QString("%1x").arg(speed) : QStringLiteral("max"),
+                     options.tls ? QStringLiteral("tls") : QStringLiteral("tcp"),
+                     options.host)
+                 .arg(options.port);
+    out().flush();
+
+    QElapsedTimer clock;
+    clock.start();
+
+    QHash<quint64, ReplayConnection *> live;
+    QList<ReplayConnection *> connections;
+    qsizetype next = 0;
+    int failed = 0;
+    qint64 startNs = 0;
+    qint64 lastEventNs = 0;
+    QTimer dispatchTimer;
+    dispatchTimer.setSingleShot(true);
+    dispatchTimer.setTimerType(Qt::PreciseTimer);
+    QTimer drainTimer;
+    drainTimer.setInterval(50);
+    const qint64 drainNs = parser.value(drainOption).toLongLong() * 1000000000LL;
+
+    bool reported = false;
+    const auto report = [&]() {
+        if (reported) {
+            return;
+        }
+        reported = true;
+        dispatchTimer.stop();
+        drainTimer.stop();
+        const double replaySec = static_cast<double>(qMax<qint64>(1, lastEventNs - startNs)) / 1e9;
+
+        LatencyStats login;
+        LatencyStats roundTrip;
+        LatencyStats lag;
+        quint64 sent = 0;
+        quint64 skipped = 0;
+        quint64 delivered = 0;
+        for (auto *c : std::as_const(connections)) {
+            login.merge(c->login());
+            roundTrip.merge(c->roundTrip());
+            lag.merge(c->lag());
+            sent += c->sent();
+            skipped += c->skipped();
+            delivered += c->chatReceived();
+            c->close();
+        }
+
+        out() << login.report("login") << "\n";
+        out() << roundTrip.report("round trip", replaySec) << "\n";
+        out() << QString("[fan-out] n=%1 rate=%2/s\n").arg(delivered).arg(static_cast<double>(delivered) / replaySec, 0, 'f', 1);
+        out() << lag.report("schedule lag", replaySec) << "\n";
+        out() << QString("[replay] sent=%1 skipped=%2 elapsed=%3 s (captured %4 s)\n")
+                     .arg(sent)
+                     .arg(skipped)
+                     .arg(replaySec, 0, 'f', 1)
+                     .arg(static_cast<double>(spanNs) / 1e9, 0, 'f', 1);
+        if (failed > 0) {
+            out() << QString("failed connections: %1\n").arg(failed);
+        }
+        out().flush();
+        app.exit(failed > 0 ? 2 : 0);
+    };
+
+    const auto openConnection = [&](quint64 clientId) {
+        auto *c = new ReplayConnection(clientId, sessionNames.value(clientId), options, &clock, &app);
+        QObject::connect(c, &ReplayConnection::failed, &app, [&](const QString &reason) {
+            ++failed;
+            out() << "connection failed: " << reason << "\n";
+        });
+        connections.push_back(c);
+        live.insert(clientId, c);
+        c->open();
+        return c;
+    };
+
+    const auto dispatch = [&]() {
+        const qint64 now = clock.nsecsElapsed();
+        int handled = 0;
+        while (next < events.size() && handled < kDispatchBatch) {
+            const Capture::Record &event = events.at(next);
+            const qint64 dueNs = speed > 0.0 ? startNs + static_cast<qint64>(static_cast<double>(event.timeNs - firstNs) / speed) : now;
+            if (dueNs > now) {
+                break;
+            }
+            ++next;
+            ++handled;
+
+            switch (event.kind) {
+            case Capture::Kind::Open:
+                openConnection(event.clientId);
+                break;
+            case Capture::Kind::Line:
+                // Connections already open when the capture started have no
+                // Open record; they are opened on their first line.
+                (live.contains(event.clientId) ? live.value(event.clientId) : openConnection(event.clientId))->send(event.data, dueNs);
+                break;
+            case Capture::Kind::Close:
+                if (auto *c = live.take(event.clientId)) {
+                    c->close();
+                }
+                break;
+            case Capture::Kind::Session:
+                break;
+            }
+        }
+
+        if (next < events.size()) {
+            const qint64 waitNs = speed > 0.0
+                ? startNs + static_cast<qint64>(static_cast<double>(events.at(next).timeNs - firstNs) / speed) - clock.nsecsElapsed()
+                : 0;
+            dispatchTimer.start(static_cast<int>(qMax<qint64>(0, waitNs / 1000000)));
+            return;
+        }
+
+        // Connections still open at the end of the capture stay open until
+        // their replies are in.
+        lastEventNs = clock.nsecsElapsed();
+        drainTimer.start();
+    };
+
+    QObject::connect(&dispatchTimer, &QTimer::timeout, &app, dispatch);
+    QObject::connect(&drainTimer, &QTimer::timeout, &app, [&]() {
+        const bool idle = std::all_of(connections.cbegin(), connections.cend(), [](const ReplayConnection *c) { return c->isIdle(); });
+        if (idle || clock.nsecsElapsed() - lastEventNs >= drainNs) {
+            report();
+        }
+    });
+
+    const int timeoutSec = parser.value(timeoutOption).toInt();
+    if (timeoutSec > 0) {
+        QTimer::singleShot(timeoutSec * 1000, &app, [&]() {
+            out() << "timeout\n";
+            failed = qMax(failed, 1);
+            if (lastEventNs == 0) {
+                lastEventNs = clock.nsecsElapsed();
+            }
+            report();
+        });
+    }
+
+    startNs = clock.nsecsElapsed();
+    dispatchTimer.start(0);
+    return app.exec();
+}
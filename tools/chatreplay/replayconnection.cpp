@@ -0,0 +1,225 @@
+#include "replayconnection.h"
+
+#include "protocol.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSslSocket>
+
+ReplayConnection::ReplayConnection(quint64 clientId, const QString &sessionName, const Options &options, const QElapsedTimer *clock, QObject *parent)
+    : QObject(parent)
+    , m_clientId(clientId)
+    , m_sessionName(sessionName)
+    , m_options(options)
+    , m_clock(clock)
+    , m_socket(new QSslSocket(this))
+{
+    if (m_options.tls) {
+        connect(m_socket, &QSslSocket::encrypted, this, &ReplayConnection::onReady);
+    } else {
+        connect(m_socket, &QSslSocket::connected, this, &ReplayConnection::onReady);
+    }
+    connect(m_socket, &QSslSocket::readyRead, this, &ReplayConnection::onReadyRead);
+    connect(m_socket, &QSslSocket::errorOccurred, this, &ReplayConnection::onError);
+}
+
+void ReplayConnection::open()
+{
+    if (m_options.tls) {
+        m_socket->setSslConfiguration(m_options.ssl);
+        m_socket->connectToHostEncrypted(m_options.host, m_options.port);
+    } else {
+        m_socket->connectToHost(m_options.host, m_options.port);
+    }
+}
+
+void ReplayConnection::send(const QByteArray &line, qint64 dueNs)
+{
+    if (m_closed) {
+        return;
+    }
+
+    Pending pending;
+    pending.line = line;
+    pending.dueNs = dueNs;
+
+    const QJsonObject obj = QJsonDocument::fromJson(line).object();
+    pending.type = obj.value("type").toString();
+    if (pending.type == "resume") {
+        if (m_sessionName.isEmpty()) {
+            ++m_skipped;
+            return;
+        }
+        pending.type = QStringLiteral("login");
+        pending.line = QJsonDocument(QJsonObject{{"type", "login"}, {"name", m_sessionName}}).toJson(QJsonDocument::Compact);
+    } else if (pending.type.startsWith("file_")) {
+        ++m_skipped;
+        return;
+    } else if (pending.type == "chat" || pending.type == "private") {
+        pending.text = Protocol::normalizeText(obj.value("text").toString());
+    }
+
+    m_pending.push_back(std::move(pending));
+    flush();
+}
+
+void ReplayConnection::close()
+{
+    m_closeRequested = true;
+    flush();
+}
+
+quint64 ReplayConnection::clientId() const
+{
+    return m_clientId;
+}
+
+bool ReplayConnection::isIdle() const
+{
+    return m_closed || m_failed || (m_pending.isEmpty() && m_loginSentNs < 0 && m_inFlight.isEmpty());
+}
+
+bool ReplayConnection::hasFailed() const
+{
+    return m_failed;
+}
+
+const LatencyStats &ReplayConnection::login() const
+{
+    return m_login;
+}
+
+const LatencyStats &ReplayConnection::roundTrip() const
+{
+    return m_roundTrip;
+}
+
+const LatencyStats &ReplayConnection::lag() const
+{
+    return m_lag;
+}
+
+quint64 ReplayConnection::sent() const
+{
+    return m_sent;
+}
+
+quint64 ReplayConnection::skipped() const
+{
+    return m_skipped;
+}
+
+quint64 ReplayConnection::chatReceived() const
+{
+    return m_chatReceived;
+}
+
+void ReplayConnection::onReady()
+{
+    m_ready = true;
+    flush();
+}
+
+void ReplayConnection::onReadyRead()
+{
+    m_buffer.append(m_socket->readAll());
+
+    while (true) {
+        const int newlineIndex = m_buffer.indexOf('\n');
+        if (newlineIndex < 0) {
+            break;
+        }
+
+        const QByteArray line = m_buffer.left(newlineIndex).trimmed();
+        m_buffer.remove(0, newlineIndex + 1);
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        const QJsonDocument doc = QJsonDocument::fromJson(line);
+        if (doc.isObject()) {
+            handleJson(doc.object());
+        }
+    }
+}
+
+void ReplayConnection::onError()
+{
+    if (m_closed || m_failed) {
+        return;
+    }
+    // The server closes the connection itself after a logout.
+    if (m_loggedOut && m_socket->error() == QAbstractSocket::RemoteHostClosedError) {
+        m_closed = true;
+        return;
+    }
+    m_failed = true;
+    emit failed(QString("#%1: %2").arg(m_clientId).arg(m_socket->errorString()));
+}
+
+void ReplayConnection::flush()
+{
+    if (m_closed || m_failed || !m_ready) {
+        return;
+    }
+
+    // A login is answered before anything else goes out, like a real client.
+    while (!m_pending.isEmpty() && m_loginSentNs < 0) {
+        Pending pending = m_pending.takeFirst();
+        const qint64 now = m_clock->nsecsElapsed();
+        m_socket->write(pending.line + '\n');
+        m_lag.add(qMax<qint64>(0, now - pending.dueNs));
+        ++m_sent;
+
+        if (pending.type == "login") {
+            m_loginSentNs = now;
+        } else if (pending.type == "logout") {
+            m_loggedOut = true;
+        } else if (!pending.text.isEmpty()) {
+            m_inFlight.push_back(qMakePair(pending.text, now));
+        }
+    }
+
+    if (m_closeRequested && m_pending.isEmpty() && m_loginSentNs < 0) {
+        m_closed = true;
+        m_inFlight.clear();
+        m_socket->disconnectFromHost();
+    }
+}
+
+void ReplayConnection::handleJson(const QJsonObject &obj)
+{
+    const QString type = obj.value("type").toString();
+    if (type == "login_ok" || type == "login_error") {
+        if (m_loginSentNs >= 0) {
+            m_login.add(m_clock->nsecsElapsed() - m_loginSentNs);
+            m_loginSentNs = -1;
+        }
+        if (type == "login_ok") {
+            m_name = obj.value("name").toString();
+        }
+        flush();
+        return;
+    }
+
+    if (type != "chat") {
+        return;
+    }
+
+    ++m_chatReceived;
+    if (m_name.isEmpty() || obj.value("from").toString() != m_name) {
+        return;
+    }
+
+    // Own messages come back in the order they were sent; one that never does
+    // (rejected, or a private message to a full mailbox or an unknown name)
+    // is passed over.
+    const QString text = obj.value("text").toString();
+    for (int i = 0; i < m_inFlight.size(); ++i) {
+        if (m_inFlight.at(i).first == text) {
+            m_roundTrip.add(m_clock->nsecsElapsed() - m_inFlight.at(i).second);
+            m_inFlight.remove(0, i + 1);
+            break;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "latencystats.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QSslConfiguration>
+#include <QString>
+
+class QJsonObject;
+class QSslSocket;
+
+// One captured connection played back: opens when the original did, sends its
+// lines when they are due and closes when it closed. Lines after a login wait
+// for the answer, as they did for the original client, and a resume becomes a
+// login under the name the original session had (its token belonged to the
+// captured server). File transfer requests are skipped: their data frames are
+// not captured.
+class ReplayConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        QString host;
+        quint16 port = 0;
+        bool tls = false;
+        QSslConfiguration ssl;
+    };
+
+    ReplayConnection(quint64 clientId, const QString &sessionName, const Options &options, const QElapsedTimer *clock, QObject *parent = nullptr);
+
+    // `dueNs` is when the line should go out on `clock`; the delay it actually
+    // had is recorded as schedule lag.
+    void open();
+    void send(const QByteArray &line, qint64 dueNs);
+    void close();
+
+    quint64 clientId() const;
+    // Nothing left to send and no own message waiting for its echo.
+    bool isIdle() const;
+    bool hasFailed() const;
+
+    const LatencyStats &login() const;
+    const LatencyStats &roundTrip() const;
+    const LatencyStats &lag() const;
+    quint64 sent() const;
+    quint64 skipped() const;
+    quint64 chatReceived() const;
+
+signals:
+    void failed(QString reason);
+
+private slots:
+    void onReady();
+    void onReadyRead();
+    void onError();
+
+private:
+    struct Pending {
+        QByteArray line;
+        QString type;
+        QString text;
+        qint64 dueNs = 0;
+    };
+
+    void flush();
+    void handleJson(const QJsonObject &obj);
+
+    const quint64 m_clientId;
+    const QString m_sessionName;
+    const Options m_options;
+    const QElapsedTimer *const m_clock;
+    QSslSocket *m_socket = nullptr;
+    QByteArray m_buffer;
+
+    QList<Pending> m_pending;
+    bool m_ready = false;
+    bool m_closeRequested = false;
+    bool m_closed = false;
+    bool m_failed = false;
+    bool m_loggedOut = false;
+    QString m_name;
+    qint64 m_loginSentNs = -1;
+    // Own chat and private messages sent, oldest first, until the server's
+    // copy comes back.
+    QList<QPair<QString, qint64>> m_inFlight;
+
+    quint64 m_sent = 0;
+    quint64 m_skipped = 0;
+    quint64 m_chatReceived = 0;
+    LatencyStats m_login;
+    LatencyStats m_roundTrip;
+    LatencyStats m_lag;
+};
@@ -0,0 +1,67 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# The server core and the client are built in, without their windows; every
+# connection is a socket pair inside this process.
+SERVER = $$PWD/../../server
+CLIENT = $$PWD/../../client
+
+SOURCES += \
+    main.cpp \
+    simulation.cpp \
+    $$SERVER/capturewriter.cpp \
+    $$SERVER/chatrouter.cpp \
+    $$SERVER/chatserver.cpp \
+    $$SERVER/clientregistry.cpp \
+    $$SERVER/clienttransport.cpp \
+    $$SERVER/clientworker.cpp \
+    $$SERVER/contentfilter.cpp \
+    $$SERVER/envelope.cpp \
+    $$SERVER/filespool.cpp \
+    $$SERVER/handover.cpp \
+    $$SERVER/memorybudget.cpp \
+    $$SERVER/offlinemailbox.cpp \
+    $$SERVER/outboundqueue.cpp \
+    $$SERVER/overloadcontroller.cpp \
+    $$SERVER/routerthread.cpp \
+    $$SERVER/searchindex.cpp \
+    $$SERVER/searchservice.cpp \
+    $$SERVER/spanrecorder.cpp \
+    $$SERVER/tlscontext.cpp \
+    $$SERVER/tracestats.cpp \
+    $$CLIENT/chatclient.cpp \
+    $$CLIENT/historycache.cpp
+
+HEADERS += \
+    simulation.h \
+    $$SERVER/capturewriter.h \
+    $$SERVER/chatrouter.h \
+    $$SERVER/chatserver.h \
+    $$SERVER/clientregistry.h \
+    $$SERVER/clienttransport.h \
+    $$SERVER/clientworker.h \
+    $$SERVER/contentfilter.h \
+    $$SERVER/envelope.h \
+    $$SERVER/filespool.h \
+    $$SERVER/handover.h \
+    $$SERVER/memorybudget.h \
+    $$SERVER/mpscqueue.h \
+    $$SERVER/offlinemailbox.h \
+    $$SERVER/outboundqueue.h \
+    $$SERVER/overloadcontroller.h \
+    $$SERVER/routerthread.h \
+    $$SERVER/searchindex.h \
+    $$SERVER/searchservice.h \
+    $$SERVER/serverconfig.h \
+    $$SERVER/servercontext.h \
+    $$SERVER/shardmap.h \
+    $$SERVER/spanrecorder.h \
+    $$SERVER/tlscontext.h \
+    $$SERVER/tracestats.h \
+    $$CLIENT/chatclient.h \
+    $$CLIENT/historycache.h
+
+INCLUDEPATH += $$PWD/../../common $$SERVER $$CLIENT
@@ -0,0 +1,183 @@
+#include "chatserver.h"
+#include "clienttransport.h"
+#include "serverconfig.h"
+#include "simulation.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+
+namespace {
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+struct Limits {
+    double maxLoginP99Ms = 0.0;
+    double maxDeliveryP99Ms = 0.0;
+    double minDeliveryRate = 0.0;
+};
+
+// Prints the result; false if it missed a limit (0 = no limit) or did not
+// complete.
+bool check(const Simulation::Result &result, const Limits &limits)
+{
+    out() << QString("== %1 ==\n").arg(result.scenario);
+    if (!result.login.isEmpty()) {
+        out() << result.login.report("login", result.delivery.isEmpty() ? result.elapsedSec : 0.0) << "\n";
+    }
+    if (!result.delivery.isEmpty()) {
+        out() << result.delivery.report("delivery", result.elapsedSec) << "\n";
+        out() << QString("  delivered %1 of %2\n").arg(result.delivered).arg(result.expected);
+    }
+    for (const auto &note : result.notes) {
+        out() << note << "\n";
+    }
+    if (!result.server.isEmpty()) {
+        const QJsonObject memory = result.server.value("memory").toObject();
+        out() << QString("  server memory: total=%1 KiB output=%2 KiB pending=%3 KiB evictions=%4\n")
+                     .arg(memory.value("total").toInteger() / 1024)
+                     .arg(memory.value("output").toInteger() / 1024)
+                     .arg(memory.value("pending").toInteger() / 1024)
+                     .arg(memory.value("evictions").toInteger());
+    }
+
+    QStringList failures;
+    if (!result.completed) {
+        failures << result.failure;
+    }
+    const auto p99Ms = [](const LatencyStats &stats) { return static_cast<double>(stats.percentile(99)) / 1e6; };
+    if (limits.maxLoginP99Ms > 0 && !result.login.isEmpty() && p99Ms(result.login) > limits.maxLoginP99Ms) {
+        failures << QString("login p99 %1 ms over %2 ms").arg(p99Ms(result.login), 0, 'f', 3).arg(limits.maxLoginP99Ms);
+    }
+    if (limits.maxDeliveryP99Ms > 0 && !result.delivery.isEmpty() && p99Ms(result.delivery) > limits.maxDeliveryP99Ms) {
+        failures << QString("delivery p99 %1 ms over %2 ms").arg(p99Ms(result.delivery), 0, 'f', 3).arg(limits.maxDeliveryP99Ms);
+    }
+    if (limits.minDeliveryRate > 0 && !result.delivery.isEmpty() && result.elapsedSec > 0) {
+        const double rate = static_cast<double>(result.delivered) / result.elapsedSec;
+        if (rate < limits.minDeliveryRate) {
+            failures << QString("delivery rate %1/s under %2/s").arg(rate, 0, 'f', 1).arg(limits.minDeliveryRate);
+        }
+    }
+    for (const auto &failure : std::as_const(failures)) {
+        out() << "  FAIL: " << failure << "\n";
+    }
+    out().flush();
+    return failures.isEmpty();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs the chat server and many clients in one process and checks scripted scenarios.");
+    parser.addHelpOption();
+    const QCommandLineOption scenarioOption("scenario", "login-storm, fan-out, slow-consumer, router-scan, envelope or all.", "name", "all");
+    const QCommandLineOption clientsOption("clients", "Clients per scenario.", "n", "1000");
+    const QCommandLineOption sendersOption("senders", "Clients sending in a burst.", "n", "10");
+    const QCommandLineOption messagesOption("messages", "Chat messages per sender in a burst.", "n", "20");
+    const QCommandLineOption payloadOption("payload", "Chat text length in characters.", "n", "100");
+    const QCommandLineOption slowOption("slow", "Connections that never read (slow-consumer).", "n", "10");
+    const QCommandLineOption seedOption("seed", "Seed for picking senders.", "n", "1");
+    const QCommandLineOption timeoutOption("timeout", "Give up on a scenario after <sec> seconds.", "sec", "60");
+    const QCommandLineOption shardsOption("router-shards", "Server router threads (0 = auto).", "n", "0");
+    const QCommandLineOption transportOption("transport", "Server socket backend: qt or epoll.", "backend", "qt");
+    const QCommandLineOption memoryOption("memory-budget", "Server memory budget in MiB (0 = no limit).", "mib", "0");
+    const QCommandLineOption loginP99Option("max-login-p99", "Fail if the login p99 exceeds <ms>.", "ms", "0");
+    const QCommandLineOption deliveryP99Option("max-p99", "Fail if the delivery p99 exceeds <ms>.", "ms", "0");
+    const QCommandLineOption rateOption("min-rate", "Fail if fewer than <n> deliveries per second.", "n", "0");
+    const QCommandLineOption verboseOption("verbose", "Print the server log.");
+    parser.addOptions({scenarioOption, clientsOption, sendersOption, messagesOption, payloadOption, slowOption, seedOption, timeoutOption, shardsOption,
+        transportOption, memoryOption, loginP99Option, deliveryP99Option, rateOption, verboseOption});
+    parser.process(app);
+
+    const QString scenario = parser.value(scenarioOption);
+    const QStringList known{"login-storm", "fan-out", "slow-consumer", "router-scan", "envelope", "all"};
+    if (!known.contains(scenario)) {
+        out() << "error: unknown --scenario " << scenario << "\n";
+        return 1;
+    }
+    TransportContext::Backend backend;
+    if (!TransportContext::parseBackend(parser.value(transportOption), &backend)) {
+        out() << "error: unknown --transport " << parser.value(transportOption) << "\n";
+        return 1;
+    }
+
+    Simulation::Options options;
+    options.clients = qMax(1, parser.value(clientsOption).toInt());
+    options.senders = qMax(1, parser.value(sendersOption).toInt());
+    options.messages = qMax(0, parser.value(messagesOption).toInt());
+    options.payload = qMax(1, parser.value(payloadOption).toInt());
+    options.slowConsumers = qMax(0, parser.value(slowOption).toInt());
+    options.seed = parser.value(seedOption).toUInt();
+    options.timeoutMs = qMax(1, parser.value(timeoutOption).toInt()) * 1000;
+
+    Limits limits;
+    limits.maxLoginP99Ms = parser.value(loginP99Option).toDouble();
+    limits.maxDeliveryP99Ms = parser.value(deliveryP99Option).toDouble();
+    limits.minDeliveryRate = parser.value(rateOption).toDouble();
+
+    ServerConfig config;
+    config.maxClients = options.clients + options.slowConsumers;
+    config.routerShards = qMax(0, parser.value(shardsOption).toInt());
+    config.transport = parser.value(transportOption);
+    config.memoryBudget = qMax<qint64>(0, parser.value(memoryOption).toLongLong()) * 1024 * 1024;
+    // Search indexing is not what is measured here.
+    config.searchHistory = 0;
+
+    ChatServer server(config);
+    if (parser.isSet(verboseOption)) {
+        QObject::connect(&server, &ChatServer::log, [](const QString &message) { out() << message << "\n"; });
+    }
+    if (!server.start(QHostAddress::LocalHost, 0)) {
+        out() << "error: the server did not start\n";
+        return 1;
+    }
+
+    out() << QString("chatsim: %1 clients, %2 senders x %3 messages of %4 chars, seed %5, %6 backend\n")
+                 .arg(options.clients)
+                 .arg(options.senders)
+                 .arg(options.messages)
+                 .arg(options.payload)
+                 .arg(options.seed)
+                 .arg(config.transport);
+    out().flush();
+
+    int exitCode = 0;
+    QTimer::singleShot(0, &app, [&]() {
+        {
+            Simulation simulation(&server, options);
+            bool ok = true;
+            if (scenario == "login-storm" || scenario == "all") {
+                ok = check(simulation.loginStorm(), limits) && ok;
+            }
+            if (scenario == "fan-out" || scenario == "all") {
+                ok = check(simulation.fanOut(), limits) && ok;
+            }
+            if (scenario == "slow-consumer" || scenario == "all") {
+                ok = check(simulation.slowConsumers(), limits) && ok;
+            }
+            if (scenario == "router-scan") {
+                ok = check(simulation.routerScan(), limits) && ok;
+            }
+            if (scenario == "envelope" || scenario == "all") {
+                ok = check(simulation.envelopeCheck(), limits) && ok;
+            }
+            exitCode = ok ? 0 : 2;
+        }
+        server.stop();
+        app.quit();
+    });
+    app.exec();
+    return exitCode;
+}
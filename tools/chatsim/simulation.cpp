@@ -0,0 +1,632 @@
+#include "simulation.h"
+
+#include "chatclient.h"
+#include "chatrouter.h"
+#include "chatserver.h"
+#include "clientworker.h"
+#include "envelope.h"
+#include "memorybudget.h"
+#include "overloadcontroller.h"
+#include "protocol.h"
+#include "routerthread.h"
+#include "serverconfig.h"
+#include "servercontext.h"
+#include "shardmap.h"
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QSemaphore>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
+
+#include <numeric>
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+namespace {
+
+// How often waitUntil() looks at its condition; latencies are taken in the
+// signal handlers, not here.
+constexpr int kPollMs = 5;
+
+// Time for the server to notice the clients of a scenario have gone.
+constexpr int kSettleMs = 10000;
+
+// router-scan: connections at the least, and timed passes of each path.
+constexpr int kMinScanClients = 10000;
+constexpr int kScanRounds = 200;
+
+QString scanLine(const QString &what, qsizetype recipients, const LatencyStats &before, const LatencyStats &after)
+{
+    const auto us = [](const LatencyStats &stats) { return static_cast<double>(stats.percentile(50)) / 1e3; };
+    const auto perRecipient = [recipients](const LatencyStats &stats) {
+        return recipients > 0 ? static_cast<double>(stats.percentile(50)) / static_cast<double>(recipients) : 0.0;
+    };
+    return QString("  %1: hash %2 us (%3 ns/recipient)  router %4 us (%5 ns/recipient)  %6x")
+        .arg(what)
+        .arg(us(before), 0, 'f', 1)
+        .arg(perRecipient(before), 0, 'f', 2)
+        .arg(us(after), 0, 'f', 1)
+        .arg(perRecipient(after), 0, 'f', 2)
+        .arg(us(after) > 0 ? us(before) / us(after) : 0.0, 0, 'f', 2);
+}
+
+// Walks `overload` to `level` with made-up samples: a full ingress queue
+// raises it a step per sample, an idle one lowers it a step per cool-down.
+void pinLevel(OverloadController *overload, OverloadController::Level level, qint64 *clockNs)
+{
+    // Longer than any cool-down.
+    constexpr qint64 kStepNs = Q_INT64_C(3600) * 1000 * 1000 * 1000;
+    overload->setLagLimitMs(1000);
+    OverloadController::Sample sample;
+    OverloadController::Transition transition;
+    while (overload->level() != level) {
+        *clockNs += kStepNs;
+        sample.nowNs = *clockNs;
+        sample.queueFill = overload->level() < level ? 1.0 : 0.0;
+        overload->update(sample, &transition);
+    }
+}
+
+// A router's connections and sessions as they were kept before
+// ClientRegistry: hashed by client id and by name, with a lookup by id for
+// every recipient of a broadcast. The fan-out and the user list do what
+// ChatRouter's did then, minus the per-recipient log lines, which the router
+// under test leaves out too.
+class HashedRouter
+{
+public:
+    void attach(quint64 clientId, ClientWorker *worker) { m_clients.insert(clientId, ClientEntry{QString(), worker, false}); }
+    void remove(quint64 clientId) { m_clients.remove(clientId); }
+
+    void logIn(quint64 clientId, const QString &name)
+    {
+        ClientEntry &client = m_clients[clientId];
+        client.name = name;
+        client.loggedIn = true;
+        Session session;
+        session.name = name;
+        session.clientId = clientId;
+        m_sessions.insert(name, session);
+        m_presence.insert(name);
+    }
+
+    void deliverToAll(const QByteArray &line)
+    {
+        for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+            deliver(it.value(), line);
+        }
+    }
+
+    void flushPresence()
+    {
+        QStringList users = m_presence.values();
+        users.sort(Qt::CaseInsensitive);
+        sendUserList(Envelope::userList(users));
+    }
+
+    void sendUserList(const QByteArray &line)
+    {
+        for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
+            if (it.value().loggedIn) {
+                sendLine(it.value(), line);
+            }
+        }
+    }
+
+private:
+    struct ClientEntry {
+        QString name;
+        ClientWorker *worker = nullptr;
+        bool loggedIn = false;
+    };
+
+    struct Session {
+        QString name;
+        quint64 clientId = 0;
+        quint64 lastSeq = 0;
+        QList<QPair<quint64, QByteArray>> replay;
+        qint64 replayBytes = 0;
+    };
+
+    static void sendLine(const ClientEntry &client, const QByteArray &line)
+    {
+        if (!client.worker) {
+            return;
+        }
+        if (auto *account = client.worker->memoryAccount()) {
+            account->add(MemoryBudget::Pending, line.size());
+        }
+        QMetaObject::invokeMethod(client.worker, "sendLine", Qt::QueuedConnection, Q_ARG(QByteArray, line));
+    }
+
+    void deliver(Session &session, const QByteArray &line)
+    {
+        const quint64 seq = ++session.lastSeq;
+        const QByteArray stamped = Protocol::withSeq(line, seq);
+        session.replay.append(qMakePair(seq, stamped));
+        session.replayBytes += stamped.size();
+        while (session.replay.size() > Protocol::kResumeBufferSize) {
+            session.replayBytes -= session.replay.constFirst().second.size();
+            session.replay.removeFirst();
+        }
+        const auto it = m_clients.constFind(session.clientId);
+        if (it != m_clients.constEnd()) {
+            if (auto *account = it.value().worker ? it.value().worker->memoryAccount() : nullptr) {
+                account->set(MemoryBudget::Replay, session.replayBytes);
+            }
+            sendLine(it.value(), stamped);
+        }
+    }
+
+    QHash<quint64, ClientEntry> m_clients;
+    QHash<QString, Session> m_sessions;
+    QSet<QString> m_presence;
+};
+
+} // namespace
+
+Simulation::Simulation(ChatServer *server, const Options &options, QObject *parent)
+    : QObject(parent)
+    , m_server(server)
+    , m_options(options)
+    , m_random(options.seed)
+{
+    m_clock.start();
+}
+
+Simulation::~Simulation()
+{
+    disconnectAll();
+}
+
+Simulation::Result Simulation::loginStorm()
+{
+    Result result;
+    result.scenario = QStringLiteral("login-storm");
+    ++m_run;
+    m_scenarioClock.start();
+
+    result.completed = connectClients(m_options.clients, &result);
+    result.elapsedSec = static_cast<double>(m_scenarioClock.nsecsElapsed()) / 1e9;
+    result.server = m_server->stats();
+    disconnectAll();
+    return result;
+}
+
+Simulation::Result Simulation::fanOut()
+{
+    Result result;
+    result.scenario = QStringLiteral("fan-out");
+    ++m_run;
+    m_scenarioClock.start();
+
+    result.completed = connectClients(m_options.clients, &result) && burst(&result);
+    result.server = m_server->stats();
+    disconnectAll();
+    return result;
+}
+
+Simulation::Result Simulation::slowConsumers()
+{
+    Result result;
+    result.scenario = QStringLiteral("slow-consumer");
+    ++m_run;
+    m_scenarioClock.start();
+
+    result.completed = openSlowConsumers(m_options.slowConsumers, &result) && connectClients(m_options.clients, &result) && burst(&result);
+    result.server = m_server->stats();
+    disconnectAll();
+    return result;
+}
+
+Simulation::Result Simulation::routerScan()
+{
+    Result result;
+    result.scenario = QStringLiteral("router-scan");
+    m_scenarioClock.start();
+
+    // A router of its own, shard 0 of one, fed on this thread the events its
+    // RouterThread would hand it, next to a HashedRouter holding the same
+    // connections. The workers are real but never started: they live on one
+    // thread that takes the queued sendLine() calls and, without a socket,
+    // drops them.
+    ServerConfig config;
+    RouterThread routerThread;
+    const ShardMap shards(QList<RouterThread *>{&routerThread});
+    const int clients = qMax(kMinScanClients, m_options.clients);
+    QSemaphore connectionLimit(clients * 2);
+    OverloadController overload;
+    qint64 overloadClockNs = 0;
+    // While connecting: no join notice to every session per login.
+    pinLevel(&overload, OverloadController::Coalesce, &overloadClockNs);
+    ServerContext context;
+    context.shards = &shards;
+    context.connectionLimit = &connectionLimit;
+    context.overload = &overload;
+    ChatRouter router(config, ShardMap::kCoordinator, context);
+    HashedRouter hashed;
+
+    QThread sink;
+    QObject sinkMarker;
+    sinkMarker.moveToThread(&sink);
+    sink.start();
+    // Everything queued for the workers so far has been handled.
+    const auto drain = [&] { QMetaObject::invokeMethod(&sinkMarker, [] {}, Qt::BlockingQueuedConnection); };
+
+    // The router deletes the worker of a connection it drops, so churn
+    // happens before the workers move to the sink thread.
+    QHash<quint64, ClientWorker *> workers;
+    QList<quint64> live;
+    quint64 nextId = 1;
+    const auto attach = [&]() {
+        const quint64 id = nextId++;
+        auto *worker = new ClientWorker(id, -1, context);
+        workers.insert(id, worker);
+        hashed.attach(id, worker);
+        IngressEvent event;
+        event.kind = IngressEvent::Kind::Attach;
+        event.clientId = id;
+        event.worker = worker;
+        router.handleIngress(event);
+        live.push_back(id);
+    };
+
+    // Churned so that registry slots and hash nodes are reused out of order
+    // as on a long-running server; nine in ten connections log in.
+    for (int i = 0; i < clients; ++i) {
+        attach();
+    }
+    for (int i = 0; i < clients / 4; ++i) {
+        const auto index = static_cast<qsizetype>(m_random.bounded(static_cast<quint32>(live.size())));
+        const quint64 id = live.at(index);
+        live[index] = live.constLast();
+        live.removeLast();
+        workers.remove(id);
+        hashed.remove(id);
+        IngressEvent event;
+        event.kind = IngressEvent::Kind::Disconnected;
+        event.clientId = id;
+        router.handleIngress(event);
+        attach();
+    }
+    for (auto *worker : std::as_const(workers)) {
+        worker->moveToThread(&sink);
+    }
+    int sessions = 0;
+    for (const quint64 id : std::as_const(live)) {
+        if (m_random.bounded(10) == 0) {
+            continue;
+        }
+        const QString name = QString("u%1").arg(id);
+        IngressEvent event;
+        event.kind = IngressEvent::Kind::Line;
+        event.clientId = id;
+        event.line = Protocol::toLine(QJsonObject{{"type", "login"}, {"name", name}}).trimmed();
+        router.handleIngress(event);
+        hashed.logIn(id, name);
+        ++sessions;
+    }
+    router.onBatchDone();
+    drain();
+
+    // Timed at Quiet: log lines are not what is measured, and every user list
+    // goes out at once.
+    pinLevel(&overload, OverloadController::Quiet, &overloadClockNs);
+
+    const QByteArray chat = Envelope::chat(QStringLiteral("bench"), QString(m_options.payload, QLatin1Char('x')));
+    const QByteArray relayed = Envelope::userList(QStringList{QStringLiteral("bench")});
+    LatencyStats broadcastBefore;
+    LatencyStats broadcastAfter;
+    LatencyStats userListBefore;
+    LatencyStats userListAfter;
+    LatencyStats relayBefore;
+    LatencyStats relayAfter;
+    QElapsedTimer timer;
+    const auto time = [&](LatencyStats *stats, const std::function<void()> &run) {
+        timer.start();
+        run();
+        stats->add(timer.nsecsElapsed());
+        drain();
+    };
+    const auto feed = [&](IngressEvent::Kind kind, const QByteArray &line, const QString &name) {
+        IngressEvent event;
+        event.kind = kind;
+        event.line = line;
+        event.name = name;
+        router.handleIngress(event);
+    };
+    for (int round = 0; round < kScanRounds; ++round) {
+        // Broadcast: the coordinator delivers to every session.
+        time(&broadcastBefore, [&] { hashed.deliverToAll(chat); });
+        time(&broadcastAfter, [&] { feed(IngressEvent::Kind::Publish, chat, QString()); });
+
+        // Presence: the user list to every logged-in connection at the end of
+        // a batch with a login in it. The login's own join notice is not timed.
+        feed(IngressEvent::Kind::Join, QByteArray(), QStringLiteral("bench"));
+        drain();
+        time(&userListBefore, [&] { hashed.flushPresence(); });
+        time(&userListAfter, [&] { router.onBatchDone(); });
+        feed(IngressEvent::Kind::Leave, QByteArray(), QStringLiteral("bench"));
+        router.onBatchDone();
+        drain();
+
+        // The same list as the other shards get it from the coordinator.
+        time(&relayBefore, [&] { hashed.sendUserList(relayed); });
+        time(&relayAfter, [&] { feed(IngressEvent::Kind::UserList, relayed, QString()); });
+    }
+
+    result.notes << QString("  %1 connections, %2 logged in, median of %3 passes")
+                        .arg(clients)
+                        .arg(sessions)
+                        .arg(kScanRounds);
+    result.notes << scanLine(QStringLiteral("broadcast"), sessions, broadcastBefore, broadcastAfter);
+    result.notes << scanLine(QStringLiteral("user list"), sessions, userListBefore, userListAfter);
+    result.notes << scanLine(QStringLiteral("user list relay"), sessions, relayBefore, relayAfter);
+
+    sink.quit();
+    sink.wait();
+    qDeleteAll(workers);
+    result.elapsedSec = static_cast<double>(m_scenarioClock.nsecsElapsed()) / 1e9;
+    result.completed = true;
+    return result;
+}
+
+Simulation::Result Simulation::envelopeCheck()
+{
+    Result result;
+    result.scenario = QStringLiteral("envelope");
+    m_scenarioClock.start();
+
+    const QChar high(0xd83d);
+    const QChar low(0xde00);
+    const QList<QString> samples{
+        QString(),
+        QStringLiteral("alice"),
+        QStringLiteral("say \"hi\" \\ C:\\tmp / </script>"),
+        QStringLiteral("\b\f\n\r\t") + QChar(0x01) + QChar(0x1f) + QChar(0x7f),
+        QString::fromUtf8("\u4e2d\u6587 \u00e9 \u2028 \U0001F600"),
+        QString(high) + QStringLiteral("x") + QString(low),
+        QStringLiteral("end ") + QString(high),
+        QString(low) + QString(high),
+        QString(QChar(0xfffd)) + QChar(0xffff),
+    };
+    const QList<std::pair<Envelope::Notice, QString>> notices{
+        {Envelope::Notice::Joined, QStringLiteral("%1 joined")},
+        {Envelope::Notice::Left, QStringLiteral("%1 left")},
+        {Envelope::Notice::Queued, QStringLiteral("%1 is offline, message queued")},
+        {Envelope::Notice::MailboxFull, QStringLiteral("mailbox of %1 is full, message dropped")},
+        {Envelope::Notice::NotFound, QStringLiteral("user not found: %1")},
+    };
+
+    int checked = 0;
+    const auto compare = [&](const QString &what, const std::function<QByteArray()> &envelope, const std::function<QJsonObject()> &object) {
+        // The "time" field can change between the two; a second try is in the
+        // same second.
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            const QByteArray line = envelope();
+            const QByteArray expected = Protocol::toLine(object());
+            if (line == expected) {
+                ++checked;
+                return;
+            }
+            if (attempt == 1) {
+                result.notes << QString("  %1: %2").arg(what, QString::fromUtf8(line.toPercentEncoding(" \"{}[]:,")));
+                result.notes << QString("  %1  expected %2").arg(QString(what.size(), ' '), QString::fromUtf8(expected.toPercentEncoding(" \"{}[]:,")));
+            }
+        }
+    };
+    const auto now = [] { return QString::fromLatin1(Envelope::isoNow()); };
+
+    for (qsizetype i = 0; i < samples.size(); ++i) {
+        const QString &text = samples.at(i);
+        const QStringList to{QStringLiteral("bob"), text};
+        compare(QString("chat #%1").arg(i), [&] { return Envelope::chat(text, text); }, [&] {
+            return QJsonObject{{"type", "chat"}, {"scope", "broadcast"}, {"from", text}, {"text", text}, {"time", now()}};
+        });
+        compare(QString("private #%1").arg(i), [&] { return Envelope::privateChat(text, text, text); }, [&] {
+            return QJsonObject{{"type", "chat"}, {"scope", "private"}, {"from", text}, {"to", text}, {"text", text}, {"time", now()}};
+        });
+        compare(QString("group #%1").arg(i), [&] { return Envelope::privateChat(text, to, text); }, [&] {
+            return QJsonObject{{"type", "chat"}, {"scope", "private"}, {"from", text}, {"to", QJsonArray::fromStringList(to)}, {"text", text}, {"time", now()}};
+        });
+        for (const auto &notice : notices) {
+            compare(QString("notice #%1").arg(i), [&] { return Envelope::notice(notice.first, text); }, [&] {
+                return QJsonObject{{"type", "system"}, {"text", notice.second.arg(text)}, {"time", now()}};
+            });
+        }
+        compare(QString("user list #%1").arg(i), [&] { return Envelope::userList(to); }, [&] {
+            return QJsonObject{{"type", "user_list"}, {"users", QJsonArray::fromStringList(to)}};
+        });
+    }
+
+    result.notes.prepend(QString("  %1 lines identical to Protocol::toLine()").arg(checked));
+    result.elapsedSec = static_cast<double>(m_scenarioClock.nsecsElapsed()) / 1e9;
+    result.completed = result.notes.size() == 1;
+    if (!result.completed) {
+        result.failure = QStringLiteral("envelope lines differ from Protocol::toLine()");
+    }
+    return result;
+}
+
+bool Simulation::connectClients(int count, Result *result)
+{
+#ifndef Q_OS_LINUX
+    // openLocalConnection() has no socket pairs here; every client would only
+    // keep reconnecting until the timeout.
+    Q_UNUSED(count);
+    result->failure = QStringLiteral("in-process clients need local connections (Linux)");
+    return false;
+#endif
+    int loggedIn = 0;
+    int failed = 0;
+    LatencyStats *login = &result->login;
+
+    m_clients.reserve(m_clients.size() + count);
+    for (int i = 0; i < count; ++i) {
+        auto *client = new ChatClient(this);
+        // Thousands of bots would each keep a history file.
+        client->setHistoryEnabled(false);
+        client->setConnector([server = m_server] { return server->openLocalConnection(); });
+
+        // Only the first login counts; a resumed one is not part of the storm.
+        const qint64 startNs = m_clock.nsecsElapsed();
+        const auto onLogin = connect(client, &ChatClient::loginOk, this, [this, login, startNs, &loggedIn] {
+            login->add(m_clock.nsecsElapsed() - startNs);
+            ++loggedIn;
+        });
+        const auto onError = connect(client, &ChatClient::loginError, this, [result, &failed](const QString &reason) {
+            result->failure = QString("login refused: %1").arg(reason);
+            ++failed;
+        });
+        connect(client, &ChatClient::loginOk, this, [onLogin, onError] {
+            QObject::disconnect(onLogin);
+            QObject::disconnect(onError);
+        });
+        connect(client, &ChatClient::chatReceived, this, [this](const QString &, const QString &text, bool isPrivate) {
+            if (isPrivate || !m_delivery) {
+                return;
+            }
+            const auto it = m_sentAt.constFind(text);
+            if (it != m_sentAt.constEnd()) {
+                m_delivery->add(m_clock.nsecsElapsed() - it.value());
+                ++m_delivered;
+            }
+        });
+
+        m_clients.push_back(client);
+        client->connectToServer(QStringLiteral("local"), 0, QString("s%1c%2").arg(m_run).arg(i));
+    }
+
+    const bool done = waitUntil([&] { return loggedIn + failed >= count; }, static_cast<int>(remainingMs()));
+    // The handlers above refer to this frame.
+    for (auto *client : std::as_const(m_clients)) {
+        disconnect(client, &ChatClient::loginOk, this, nullptr);
+        disconnect(client, &ChatClient::loginError, this, nullptr);
+    }
+    if (!done && result->failure.isEmpty()) {
+        result->failure = QString("%1 of %2 clients logged in before the timeout").arg(loggedIn).arg(count);
+    }
+    return done && failed == 0;
+}
+
+bool Simulation::openSlowConsumers(int count, Result *result)
+{
+#ifdef Q_OS_LINUX
+    const int sessionsBefore = m_server->stats().value("sessions").toInt();
+    for (int i = 0; i < count; ++i) {
+        const qintptr fd = m_server->openLocalConnection();
+        if (fd < 0) {
+            result->failure = QStringLiteral("no local connection for a slow consumer");
+            return false;
+        }
+        m_slow.push_back(fd);
+
+        // The login fits in the empty socket buffer; nothing is read after it.
+        const QByteArray line = Protocol::toLine(QJsonObject{{"type", "login"}, {"name", QString("s%1slow%2").arg(m_run).arg(i)}});
+        if (::write(static_cast<int>(fd), line.constData(), static_cast<size_t>(line.size())) != line.size()) {
+            result->failure = QStringLiteral("cannot log in a slow consumer");
+            return false;
+        }
+    }
+
+    const bool done = waitUntil([&] { return m_server->stats().value("sessions").toInt() >= sessionsBefore + count; }, static_cast<int>(remainingMs()));
+    if (!done) {
+        result->failure = QStringLiteral("slow consumers did not log in before the timeout");
+    }
+    return done;
+#else
+    Q_UNUSED(count);
+    result->failure = QStringLiteral("slow consumers need local connections (Linux)");
+    return false;
+#endif
+}
+
+bool Simulation::burst(Result *result)
+{
+    // A seeded partial shuffle picks distinct senders.
+    QList<int> order(m_clients.size());
+    std::iota(order.begin(), order.end(), 0);
+    const int senders = qBound(1, m_options.senders, static_cast<int>(order.size()));
+    for (int i = 0; i < senders; ++i) {
+        std::swap(order[i], order[m_random.bounded(i, static_cast<int>(order.size()))]);
+    }
+
+    const int length = qBound(1, m_options.payload, Protocol::kMaxMessageLength);
+    m_sentAt.clear();
+    m_sentAt.reserve(senders * m_options.messages);
+    m_delivered = 0;
+    m_delivery = &result->delivery;
+    result->expected = static_cast<qint64>(senders) * m_options.messages * m_clients.size();
+
+    const qint64 startNs = m_clock.nsecsElapsed();
+    for (int n = 0; n < m_options.messages; ++n) {
+        for (int s = 0; s < senders; ++s) {
+            ChatClient *client = m_clients.at(order.at(s));
+            QString text = QString("%1#%2:").arg(client->userName()).arg(n);
+            if (text.size() < length) {
+                text.append(QString(length - text.size(), QLatin1Char('x')));
+            }
+            m_sentAt.insert(text, m_clock.nsecsElapsed());
+            client->sendChat(text);
+        }
+    }
+
+    const bool done = waitUntil([&] { return m_delivered >= result->expected; }, static_cast<int>(remainingMs()));
+    result->elapsedSec = static_cast<double>(m_clock.nsecsElapsed() - startNs) / 1e9;
+    result->delivered = m_delivered;
+    m_delivery = nullptr;
+    if (!done) {
+        result->failure = QString("%1 of %2 deliveries before the timeout").arg(result->delivered).arg(result->expected);
+    }
+    return done;
+}
+
+void Simulation::disconnectAll()
+{
+    m_delivery = nullptr;
+    for (auto *client : std::as_const(m_clients)) {
+        client->disconnectFromServer();
+        delete client;
+    }
+    m_clients.clear();
+#ifdef Q_OS_LINUX
+    for (const qintptr fd : std::as_const(m_slow)) {
+        ::close(static_cast<int>(fd));
+    }
+#endif
+    m_slow.clear();
+
+    // Every worker holds a memory account until it is gone.
+    waitUntil([this] { return m_server->stats().value("memory").toObject().value("connections").toInt() == 0; }, kSettleMs);
+}
+
+bool Simulation::waitUntil(const std::function<bool()> &done, int timeoutMs)
+{
+    if (done()) {
+        return true;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    QEventLoop loop;
+    QTimer poll;
+    poll.setInterval(kPollMs);
+    connect(&poll, &QTimer::timeout, &loop, [&] {
+        if (done() || timer.hasExpired(timeoutMs)) {
+            loop.quit();
+        }
+    });
+    poll.start();
+    loop.exec();
+    return done();
+}
+
+qint64 Simulation::remainingMs() const
+{
+    return qMax<qint64>(0, m_options.timeoutMs - m_scenarioClock.elapsed());
+}
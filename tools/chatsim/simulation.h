@@ -0,0 +1,104 @@
+#pragma once
+
+#include "latencystats.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QRandomGenerator>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+class ChatClient;
+class ChatServer;
+
+// Scripted load against a ChatServer in this process: every client is a
+// ChatClient on one end of a socket pair from ChatServer::openLocalConnection,
+// so thousands of them need no ports and no network.
+//
+// Each scenario connects its own clients, runs, and disconnects them all
+// before it returns, so scenarios can run in any order and again. Senders are
+// picked with the seeded generator, so a run with the same options sends the
+// same messages from the same clients.
+class Simulation : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        int clients = 1000;
+        int senders = 10;
+        int messages = 20;
+        // Chat text length in characters (up to Protocol::kMaxMessageLength).
+        int payload = 100;
+        // Extra connections that log in and never read (slow-consumer only).
+        int slowConsumers = 10;
+        quint32 seed = 1;
+        int timeoutMs = 60000;
+    };
+
+    struct Result {
+        QString scenario;
+        // Every login and every expected delivery arrived before the timeout.
+        bool completed = false;
+        QString failure;
+        double elapsedSec = 0.0;
+        LatencyStats login;
+        // Send to arrival at each recipient.
+        LatencyStats delivery;
+        qint64 expected = 0;
+        qint64 delivered = 0;
+        // ChatServer::stats() before the clients left.
+        QJsonObject server;
+        // Scenario-specific report lines.
+        QStringList notes;
+    };
+
+    Simulation(ChatServer *server, const Options &options, QObject *parent = nullptr);
+    ~Simulation() override;
+
+    // All clients connect at once.
+    Result loginStorm();
+    // Every sender sends all its messages at once; each goes to every client.
+    Result fanOut();
+    // A fan-out burst while some connections never read what they are sent.
+    Result slowConsumers();
+    // No clients: times a ChatRouter of its own delivering a broadcast to
+    // every session and a user list to every logged-in connection, at
+    // kMinScanClients connections or more with workers that are never
+    // started, against the same work over the QHash layout routers kept
+    // before ClientRegistry.
+    Result routerScan();
+    // No clients: every Envelope line over edge-case strings (controls,
+    // quotes, surrogate pairs, lone surrogates) against Protocol::toLine() of
+    // the same object, byte for byte.
+    Result envelopeCheck();
+
+private:
+    bool connectClients(int count, Result *result);
+    bool openSlowConsumers(int count, Result *result);
+    bool burst(Result *result);
+    void disconnectAll();
+    // Runs the event loop until `done` or the timeout; done() then.
+    bool waitUntil(const std::function<bool()> &done, int timeoutMs);
+    qint64 remainingMs() const;
+
+    ChatServer *m_server;
+    Options m_options;
+    QRandomGenerator m_random;
+    int m_run = 0;
+
+    QList<ChatClient *> m_clients;
+    QList<qintptr> m_slow;
+    QElapsedTimer m_clock;
+    QElapsedTimer m_scenarioClock;
+
+    // Chat text -> send time; the text names its sender and number.
+    QHash<QString, qint64> m_sentAt;
+    LatencyStats *m_delivery = nullptr;
+    qint64 m_delivered = 0;
+};